@@ -21,9 +21,14 @@
 // Qt includes
 #include <QCoreApplication>
 #include <QDir>
+#include <QFileInfo>
+#include <QSqlDatabase>
+#include <QSqlQuery>
 
 // ctkDICOMCore includes
 #include "ctkDICOMDatabase.h"
+#include "ctkDICOMIndexer.h"
+#include "ctkDICOMItem.h"
 
 // STD includes
 #include <iostream>
@@ -142,6 +147,294 @@ int ctkDICOMDatabaseTest4( int argc, char * argv [] )
     return EXIT_FAILURE;
     }
 
+  //
+  // Test batch lookup of values
+  //
+  QString patientNameTag("0010,0010");
+  QStringList batchTags;
+  batchTags << tag << badTag << patientNameTag;
+  QList<QStringList> batchValues = database.instanceValues(QStringList() << instanceUID, batchTags);
+  if (batchValues.size() != 1 || batchValues[0].size() != 3
+    || batchValues[0][0] != knownSeriesDescription || !batchValues[0][1].isEmpty()
+    || batchValues[0][2] != database.instanceValue(instanceUID, patientNameTag))
+    {
+    std::cerr << "ctkDICOMDatabase: instanceValues should return the same values as instanceValue" << std::endl;
+    return EXIT_FAILURE;
+    }
+  batchValues = database.fileValues(QStringList() << filePath << filePath, batchTags);
+  if (batchValues.size() != 2 || batchValues[1].size() != 3
+    || batchValues[1][0] != knownSeriesDescription || !batchValues[1][1].isEmpty())
+    {
+    std::cerr << "ctkDICOMDatabase: fileValues should return a row for each file" << std::endl;
+    return EXIT_FAILURE;
+    }
+  QStringList seriesInstanceUIDs;
+  batchValues = database.seriesValues(database.seriesForFile(filePath), batchTags, seriesInstanceUIDs);
+  if (batchValues.size() != 1 || seriesInstanceUIDs != (QStringList() << instanceUID)
+    || batchValues[0][0] != knownSeriesDescription)
+    {
+    std::cerr << "ctkDICOMDatabase: seriesValues should return a row for each instance of the series" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  //
+  // Test lookup cache
+  //
+  database.clearLookupCache();
+  database.resetLookupCacheCounters();
+  QString seriesInstanceUID = database.seriesForFile(filePath);
+  if (database.fileForInstance(instanceUID) != filePath
+    || database.fileForInstance(instanceUID) != filePath
+    || database.seriesForFile(filePath) != seriesInstanceUID)
+    {
+    std::cerr << "ctkDICOMDatabase: cached lookup should return the same value as the database" << std::endl;
+    return EXIT_FAILURE;
+    }
+  if (database.lookupCacheHitCount() != 2 || database.lookupCacheMissCount() != 2)
+    {
+    std::cerr << "ctkDICOMDatabase: unexpected lookup cache hit/miss count: "
+      << database.lookupCacheHitCount() << "/" << database.lookupCacheMissCount() << std::endl;
+    return EXIT_FAILURE;
+    }
+  database.removeSeries(seriesInstanceUID);
+  if (!database.fileForInstance(instanceUID).isEmpty() || !database.seriesForFile(filePath).isEmpty())
+    {
+    std::cerr << "ctkDICOMDatabase: lookup cache should be cleared when series is removed" << std::endl;
+    return EXIT_FAILURE;
+    }
+  database.insert(dicomFilePath, false, false);
+  if (database.fileForInstance(instanceUID) != filePath)
+    {
+    std::cerr << "ctkDICOMDatabase: lookup should find instance after it is inserted again" << std::endl;
+    return EXIT_FAILURE;
+    }
+  database.setLookupCacheSize(0);
+  database.resetLookupCacheCounters();
+  database.fileForInstance(instanceUID);
+  if (database.lookupCacheSize() != 0 || database.lookupCacheHitCount() != 0)
+    {
+    std::cerr << "ctkDICOMDatabase: lookup cache should be disabled if its size is 0" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  //
+  // Test directory fingerprints
+  //
+  QString fileDirectory = QFileInfo(filePath).path();
+  ctkDICOMDatabase::DirectoryFingerprint fingerprint;
+  fingerprint.modifiedTime = Q_INT64_C(1500000000000);
+  fingerprint.inode = Q_UINT64_C(123456789);
+  QHash<QString, ctkDICOMDatabase::DirectoryFingerprint> fingerprints;
+  fingerprints[fileDirectory] = fingerprint;
+  fingerprints["/some/other/directory"] = fingerprint;
+  QHash<QString, ctkDICOMDatabase::DirectoryFingerprint> storedFingerprints;
+  if (!database.setDirectoryFingerprints(fingerprints)
+    || !database.directoryFingerprints(storedFingerprints)
+    || storedFingerprints.size() != 2
+    || storedFingerprints[fileDirectory].modifiedTime != fingerprint.modifiedTime
+    || storedFingerprints[fileDirectory].inode != fingerprint.inode)
+    {
+    std::cerr << "ctkDICOMDatabase: directory fingerprints are not stored correctly" << std::endl;
+    return EXIT_FAILURE;
+    }
+  // Modified times are only returned for files of the requested directory
+  QMap<QString, QDateTime> modifiedTimeForFilepath;
+  if (!database.filesModifiedTimesInDirectory(fileDirectory, modifiedTimeForFilepath)
+    || !modifiedTimeForFilepath.contains(filePath))
+    {
+    std::cerr << "ctkDICOMDatabase: filesModifiedTimesInDirectory failed to find inserted file" << std::endl;
+    return EXIT_FAILURE;
+    }
+  modifiedTimeForFilepath.clear();
+  if (!database.filesModifiedTimesInDirectory(fileDirectory + "_other", modifiedTimeForFilepath)
+    || !modifiedTimeForFilepath.isEmpty())
+    {
+    std::cerr << "ctkDICOMDatabase: filesModifiedTimesInDirectory returned files of another directory" << std::endl;
+    return EXIT_FAILURE;
+    }
+  // Fingerprint must be removed when a file of the directory is removed
+  database.removeSeries(database.seriesForFile(filePath));
+  storedFingerprints.clear();
+  database.directoryFingerprints(storedFingerprints);
+  if (storedFingerprints.size() != 1 || storedFingerprints.contains(fileDirectory))
+    {
+    std::cerr << "ctkDICOMDatabase: directory fingerprint should be removed when its files are removed" << std::endl;
+    return EXIT_FAILURE;
+    }
+  database.removeAllDirectoryFingerprints();
+  storedFingerprints.clear();
+  database.directoryFingerprints(storedFingerprints);
+  if (!storedFingerprints.isEmpty())
+    {
+    std::cerr << "ctkDICOMDatabase: removeAllDirectoryFingerprints failed" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  //
+  // Test copying files into the database folder in batch insert
+  //
+  database.setNumberOfStorageCopyThreads(2);
+  if (database.numberOfStorageCopyThreads() != 2)
+    {
+    std::cerr << "ctkDICOMDatabase::setNumberOfStorageCopyThreads() failed" << std::endl;
+    return EXIT_FAILURE;
+    }
+  {
+    ctkDICOMDatabase::IndexingResult indexingResult;
+    indexingResult.filePath = dicomFilePath;
+    indexingResult.dataset = QSharedPointer<ctkDICOMItem>(new ctkDICOMItem);
+    indexingResult.dataset->InitializeFromFile(dicomFilePath);
+    indexingResult.copyFile = true;
+    database.insert(QList<ctkDICOMDatabase::IndexingResult>() << indexingResult);
+  }
+  QString storedFilePath = database.fileForInstance(instanceUID);
+  if (!storedFilePath.startsWith(database.databaseDirectory() + "/dicom/")
+    || QFileInfo(storedFilePath).size() != QFileInfo(dicomFilePath).size())
+    {
+    std::cerr << "ctkDICOMDatabase: file should be copied into the database folder, stored file: "
+      << qPrintable(storedFilePath) << std::endl;
+    return EXIT_FAILURE;
+    }
+  // A failed copy over the stored file must keep the previously stored file and its record
+  {
+    ctkDICOMDatabase::IndexingResult indexingResult;
+    indexingResult.filePath = QFileInfo(dicomFilePath).absolutePath() + "/nonexistent.dcm";
+    indexingResult.dataset = QSharedPointer<ctkDICOMItem>(new ctkDICOMItem);
+    indexingResult.dataset->InitializeFromFile(dicomFilePath);
+    indexingResult.copyFile = true;
+    database.insert(QList<ctkDICOMDatabase::IndexingResult>() << indexingResult);
+  }
+  if (database.fileForInstance(instanceUID) != storedFilePath
+    || QFileInfo(storedFilePath).size() != QFileInfo(dicomFilePath).size())
+    {
+    std::cerr << "ctkDICOMDatabase: stored file should be kept when copying a new version fails" << std::endl;
+    return EXIT_FAILURE;
+    }
+  if (!QDir(QFileInfo(storedFilePath).absolutePath()).entryList(QStringList() << "*.tmp", QDir::Files).isEmpty())
+    {
+    std::cerr << "ctkDICOMDatabase: temporary file should be removed when copying fails" << std::endl;
+    return EXIT_FAILURE;
+    }
+  database.removeSeries(database.seriesForFile(storedFilePath));
+  if (QFileInfo(storedFilePath).exists())
+    {
+    std::cerr << "ctkDICOMDatabase: stored file should be removed with the series" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  //
+  // Test batch removal, files are deleted in the background
+  //
+  {
+    ctkDICOMDatabase::IndexingResult indexingResult;
+    indexingResult.filePath = dicomFilePath;
+    indexingResult.dataset = QSharedPointer<ctkDICOMItem>(new ctkDICOMItem);
+    indexingResult.dataset->InitializeFromFile(dicomFilePath);
+    indexingResult.copyFile = true;
+    database.insert(QList<ctkDICOMDatabase::IndexingResult>() << indexingResult);
+  }
+  storedFilePath = database.fileForInstance(instanceUID);
+  QString studyInstanceUID = database.studyForSeries(database.seriesForFile(storedFilePath));
+  if (!QFileInfo(storedFilePath).exists() || studyInstanceUID.isEmpty()
+    || database.cachedTag(instanceUID, tag) != knownSeriesDescription)
+    {
+    std::cerr << "ctkDICOMDatabase: file should be stored again after it is removed" << std::endl;
+    return EXIT_FAILURE;
+    }
+  if (!database.removeItems(QStringList(), QStringList() << studyInstanceUID << "1.2.3.4.5", QStringList(), true))
+    {
+    std::cerr << "ctkDICOMDatabase::removeItems() failed" << std::endl;
+    return EXIT_FAILURE;
+    }
+  if (!database.fileForInstance(instanceUID).isEmpty() || !database.seriesForStudy(studyInstanceUID).isEmpty()
+    || !database.cachedTag(instanceUID, tag).isEmpty())
+    {
+    std::cerr << "ctkDICOMDatabase: records and cached tags should be removed by removeItems" << std::endl;
+    return EXIT_FAILURE;
+    }
+  database.waitForFileRemoval();
+  if (QFileInfo(storedFilePath).exists() || database.isFileRemovalInProgress())
+    {
+    std::cerr << "ctkDICOMDatabase: stored file should be removed by removeItems" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  //
+  // Test removal followed by import of the same file through the indexer, which stores
+  // the file using its own database instance while the removal may still be pending
+  //
+  {
+    ctkDICOMIndexer indexer;
+    indexer.addFile(&database, dicomFilePath, true);
+    indexer.waitForImportFinished();
+    database.clearLookupCache();
+    storedFilePath = database.fileForInstance(instanceUID);
+    studyInstanceUID = database.studyForSeries(database.seriesForFile(storedFilePath));
+    database.removeItems(QStringList(), QStringList() << studyInstanceUID, QStringList());
+    indexer.addFile(&database, dicomFilePath, true);
+    indexer.waitForImportFinished();
+    database.waitForFileRemoval();
+    database.clearLookupCache();
+    if (database.fileForInstance(instanceUID) != storedFilePath || !QFileInfo(storedFilePath).exists())
+      {
+      std::cerr << "ctkDICOMDatabase: file imported by the indexer should not be deleted by a pending removal" << std::endl;
+      return EXIT_FAILURE;
+      }
+    indexer.setDatabase(nullptr);
+  }
+  database.insert(dicomFilePath, false, false);
+
+  database.closeDatabase();
+
+  //
+  // Test conversion of a tag cache that uses the legacy (SOPInstanceUID, Tag, Value) table layout
+  //
+  {
+    QSqlDatabase legacyTagCache = QSqlDatabase::addDatabase("QSQLITE", "ctkDICOMDatabaseTest4LegacyTagCache");
+    legacyTagCache.setDatabaseName(databaseDirectory.absoluteFilePath("ctkDICOMTagCache.sql"));
+    if (!legacyTagCache.open())
+      {
+      std::cerr << "ctkDICOMDatabase: failed to open tag cache database" << std::endl;
+      return EXIT_FAILURE;
+      }
+    QSqlQuery legacyQuery(legacyTagCache);
+    legacyQuery.exec("DROP VIEW IF EXISTS TagCache");
+    legacyQuery.exec("DROP TABLE IF EXISTS TagCacheValues");
+    legacyQuery.exec("DROP TABLE IF EXISTS TagCacheInstances");
+    legacyQuery.exec("CREATE TABLE TagCache (SOPInstanceUID, Tag, Value, PRIMARY KEY (SOPInstanceUID, Tag))");
+    legacyQuery.prepare("INSERT INTO TagCache VALUES(?,?,?)");
+    legacyQuery.addBindValue(instanceUID);
+    legacyQuery.addBindValue(tag);
+    legacyQuery.addBindValue(knownSeriesDescription);
+    if (!legacyQuery.exec())
+      {
+      std::cerr << "ctkDICOMDatabase: failed to create legacy tag cache" << std::endl;
+      return EXIT_FAILURE;
+      }
+    legacyQuery.finish();
+    legacyTagCache.close();
+  }
+  QSqlDatabase::removeDatabase("ctkDICOMDatabaseTest4LegacyTagCache");
+
+  database.openDatabase(databaseFile.absoluteFilePath());
+  if (database.cachedTag(instanceUID, tag) != knownSeriesDescription)
+    {
+    std::cerr << "ctkDICOMDatabase: tag cache value should be preserved when legacy tag cache is converted" << std::endl;
+    return EXIT_FAILURE;
+    }
+  QMap<QString, QString> cachedTags;
+  database.getCachedTags(instanceUID, cachedTags);
+  if (cachedTags.size() != 1 || cachedTags[tag] != knownSeriesDescription)
+    {
+    std::cerr << "ctkDICOMDatabase: getCachedTags should return the converted tag cache value" << std::endl;
+    return EXIT_FAILURE;
+    }
+  // tags are matched regardless of the case of hexadecimal digits
+  if (database.cachedTag(instanceUID, tag.toUpper()) != knownSeriesDescription)
+    {
+    std::cerr << "ctkDICOMDatabase: tag cache lookup should not depend on tag letter case" << std::endl;
+    return EXIT_FAILURE;
+    }
   database.closeDatabase();
 
   std::cerr << "Database is in " << databaseDirectory.path().toStdString() << std::endl;
@@ -21,6 +21,7 @@
 // Qt includes
 #include <QCoreApplication>
 #include <QDir>
+#include <QSqlQuery>
 
 // ctkDICOMCore includes
 #include "ctkDICOMDatabase.h"
@@ -29,6 +30,22 @@
 #include <iostream>
 #include <cstdlib>
 
+namespace
+{
+//------------------------------------------------------------------------------
+int fullTextSearchMatchCount(ctkDICOMDatabase& database, const QString& tableName, const QString& match)
+{
+  QString indexTableName = database.fullTextSearchIndexTableName(tableName);
+  QSqlQuery matchQuery(database.database());
+  matchQuery.prepare(QString("SELECT COUNT(*) FROM %1 WHERE %1 MATCH ?").arg(indexTableName));
+  matchQuery.addBindValue(match);
+  if (indexTableName.isEmpty() || !matchQuery.exec() || !matchQuery.next())
+    {
+    return -1;
+    }
+  return matchQuery.value(0).toInt();
+}
+}
 
 int ctkDICOMDatabaseTest6( int argc, char * argv [] )
 {
@@ -147,6 +164,31 @@ int ctkDICOMDatabaseTest6( int argc, char * argv [] )
     return EXIT_FAILURE;
     }
 
+  //
+  // Test the full-text search index:
+  // - inserted patients and series are indexed
+  // - entries of removed rows are removed from the index
+  //
+  if (fullTextSearchMatchCount(database, "Patients", "\"facial\"*") != 1
+    || fullTextSearchMatchCount(database, "Series", "\"prepp\"*") != 1)
+    {
+    std::cerr << "ctkDICOMDatabase: inserted rows are not found in the full-text search index" << std::endl;
+    return EXIT_FAILURE;
+    }
+  database.updateDisplayedFields();
+  if (fullTextSearchMatchCount(database, "Patients", "DisplayedPatientsName : \"facial\"*") != 1)
+    {
+    std::cerr << "ctkDICOMDatabase: displayed fields are not updated in the full-text search index" << std::endl;
+    return EXIT_FAILURE;
+    }
+  database.removeSeries(seriesUID);
+  if (fullTextSearchMatchCount(database, "Patients", "\"facial\"*") != 0
+    || fullTextSearchMatchCount(database, "Series", "\"prepp\"*") != 0)
+    {
+    std::cerr << "ctkDICOMDatabase: removed rows are still in the full-text search index" << std::endl;
+    return EXIT_FAILURE;
+    }
+
   database.closeDatabase();
 
   std::cerr << "Database is in " << databaseDirectory.path().toStdString() << std::endl;
@@ -0,0 +1,185 @@
+/*=========================================================================
+
+  Library:   CTK
+
+  Copyright (c) Kitware Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0.txt
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+=========================================================================*/
+
+// Qt includes
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QSqlQuery>
+
+// ctkDICOMCore includes
+#include "ctkDICOMDatabase.h"
+#include "ctkDICOMIndexer.h"
+
+// STD includes
+#include <iostream>
+#include <cstdlib>
+
+namespace
+{
+
+//------------------------------------------------------------------------------
+// Import the directory in the background and measure latency of reading
+// the database in the meantime. Returns false if the database could not be created.
+bool measureReadLatencyDuringImport(const QString& databaseDirectoryPath, const QString& dicomDirectoryPath,
+  const QMap<QString, QString>& pragmas, int& numberOfReads, int& numberOfFailedReads, qint64& maximumLatencyMsec)
+{
+  QDir databaseDirectory(databaseDirectoryPath);
+  databaseDirectory.removeRecursively();
+  QDir().mkpath(databaseDirectoryPath);
+
+  ctkDICOMDatabase database;
+  database.setDatabasePragmas(pragmas);
+  database.openDatabase(databaseDirectory.absoluteFilePath("ctkDICOM.sql"));
+  if (!database.isOpen())
+  {
+    std::cerr << "ctkDICOMDatabase::openDatabase() failed: " << qPrintable(database.lastError()) << std::endl;
+    return false;
+  }
+
+  ctkDICOMIndexer indexer;
+  indexer.setBackgroundImportEnabled(true);
+  indexer.addDirectory(&database, dicomDirectoryPath);
+
+  numberOfReads = 0;
+  numberOfFailedReads = 0;
+  maximumLatencyMsec = 0;
+  QElapsedTimer timer;
+  while (indexer.isImporting())
+  {
+    timer.start();
+    QSqlQuery readQuery(database.database());
+    if (!readQuery.exec("SELECT COUNT(*) FROM Images") || !readQuery.next())
+    {
+      ++numberOfFailedReads;
+    }
+    qint64 latencyMsec = timer.elapsed();
+    maximumLatencyMsec = qMax(maximumLatencyMsec, latencyMsec);
+    readQuery.finish();
+    ++numberOfReads;
+    QCoreApplication::processEvents();
+  }
+  indexer.waitForImportFinished();
+
+  database.closeDatabase();
+  return true;
+}
+
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMDatabaseTest8( int argc, char * argv [] )
+{
+  QCoreApplication app(argc, argv);
+
+  if (argc < 2)
+  {
+    std::cerr << "ctkDICOMDatabaseTest8: missing DICOM directory argument" << std::endl;
+    std::cerr << "Usage: ctkDICOMDatabaseTest8 /path/to/dicom/directory" << std::endl;
+    return EXIT_FAILURE;
+  }
+  QString dicomDirectoryPath = argv[1];
+
+  //
+  // Test pragma settings
+  //
+  ctkDICOMDatabase database;
+  if (database.databasePragma("synchronous") != "OFF")
+  {
+    std::cerr << "ctkDICOMDatabase::databasePragma() failed: synchronous should be OFF by default" << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (database.setDatabasePragma("foreign_keys", "ON"))
+  {
+    std::cerr << "ctkDICOMDatabase::setDatabasePragma() failed: unsupported pragma was accepted" << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (database.setDatabasePragma("journal_mode", "WAL; DROP TABLE Images"))
+  {
+    std::cerr << "ctkDICOMDatabase::setDatabasePragma() failed: invalid value was accepted" << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (!database.setDatabasePragma("JOURNAL_MODE", "WAL")
+    || database.databasePragma("journal_mode") != "WAL")
+  {
+    std::cerr << "ctkDICOMDatabase::setDatabasePragma() failed" << std::endl;
+    return EXIT_FAILURE;
+  }
+  if (!database.setDatabasePragma("journal_mode", "")
+    || database.databasePragmas().contains("journal_mode"))
+  {
+    std::cerr << "ctkDICOMDatabase::setDatabasePragma() failed to remove pragma" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  //
+  // Read latency during import, with default settings and with write-ahead logging
+  //
+  QMap<QString, QString> defaultPragmas = database.databasePragmas();
+  QMap<QString, QString> walPragmas = defaultPragmas;
+  walPragmas["journal_mode"] = "WAL";
+  walPragmas["cache_size"] = "-16384";
+  walPragmas["temp_store"] = "MEMORY";
+
+  QString databaseDirectoryPath = QDir::temp().absoluteFilePath("ctkDICOMDatabaseTest8");
+
+  int numberOfReads = 0;
+  int numberOfFailedReads = 0;
+  qint64 maximumLatencyMsec = 0;
+  if (!measureReadLatencyDuringImport(databaseDirectoryPath, dicomDirectoryPath, defaultPragmas,
+    numberOfReads, numberOfFailedReads, maximumLatencyMsec))
+  {
+    return EXIT_FAILURE;
+  }
+  std::cout << "Default journal mode: " << numberOfReads << " reads during import, "
+    << numberOfFailedReads << " failed, maximum latency " << maximumLatencyMsec << " ms" << std::endl;
+
+  if (!measureReadLatencyDuringImport(databaseDirectoryPath, dicomDirectoryPath, walPragmas,
+    numberOfReads, numberOfFailedReads, maximumLatencyMsec))
+  {
+    return EXIT_FAILURE;
+  }
+  std::cout << "WAL journal mode: " << numberOfReads << " reads during import, "
+    << numberOfFailedReads << " failed, maximum latency " << maximumLatencyMsec << " ms" << std::endl;
+
+  // Readers are never blocked by the writer in WAL mode
+  if (numberOfFailedReads > 0)
+  {
+    std::cerr << "Reading the database failed during import in WAL journal mode" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  // Check that the journal mode is persistent in the database file
+  ctkDICOMDatabase walDatabase;
+  walDatabase.openDatabase(QDir(databaseDirectoryPath).absoluteFilePath("ctkDICOM.sql"));
+  QSqlQuery journalModeQuery(walDatabase.database());
+  if (!journalModeQuery.exec("PRAGMA journal_mode") || !journalModeQuery.next()
+    || journalModeQuery.value(0).toString().toUpper() != "WAL")
+  {
+    std::cerr << "ctkDICOMDatabase::setDatabasePragma() failed: journal mode is not WAL" << std::endl;
+    return EXIT_FAILURE;
+  }
+  journalModeQuery.finish();
+  walDatabase.closeDatabase();
+
+  QDir(databaseDirectoryPath).removeRecursively();
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,207 @@
+/*=========================================================================
+
+  Library:   CTK
+
+  Copyright (c) Kitware Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0.txt
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+=========================================================================*/
+
+// Qt includes
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+// ctkDICOMCore includes
+#include "ctkDICOMExporter.h"
+
+// DCMTK includes
+#include <dcmtk/dcmdata/dcdeftag.h>
+#include <dcmtk/dcmdata/dcdicdir.h>
+#include <dcmtk/dcmdata/dcstack.h>
+
+// STD includes
+#include <cstdlib>
+#include <iostream>
+
+namespace
+{
+//-----------------------------------------------------------------------------
+QByteArray fileContent(const QString& filePath)
+{
+  QFile file(filePath);
+  if (!file.open(QIODevice::ReadOnly))
+    {
+    return QByteArray();
+    }
+  return file.readAll();
+}
+
+//-----------------------------------------------------------------------------
+/// Returns true if the DICOMDIR file contains a record that references the file ID
+bool dicomDirReferencesFile(const QString& dicomDirPath, const OFString& fileID)
+{
+  DcmDicomDir dicomDir(QFile::encodeName(QDir::toNativeSeparators(dicomDirPath)).constData());
+  DcmDataset* dataset = dicomDir.getDirFileFormat().getDataset();
+  if (dicomDir.error().bad() || !dataset)
+    {
+    return false;
+    }
+  DcmStack stack;
+  while (dataset->search(DCM_ReferencedFileID, stack, ESM_afterStackTop, OFTrue).good())
+    {
+    OFString referencedFileID;
+    if (static_cast<DcmElement*>(stack.top())->getOFStringArray(referencedFileID).good()
+      && referencedFileID == fileID)
+      {
+      return true;
+      }
+    }
+  return false;
+}
+
+} // end of anonymous namespace
+
+//-----------------------------------------------------------------------------
+int ctkDICOMExporterTest1( int argc, char * argv [] )
+{
+  QCoreApplication app(argc, argv);
+
+  if (argc < 2)
+    {
+    std::cerr << "Usage: ctkDICOMExporterTest1 <dicomFile>" << std::endl;
+    return EXIT_FAILURE;
+    }
+  QString dicomFilePath(argv[1]);
+  QByteArray dicomFileContent = fileContent(dicomFilePath);
+
+  ctkDICOMExporter exporter;
+
+  // check default values
+  if (exporter.numberOfThreads() != 4 || exporter.linkFiles() || exporter.writeDicomDir()
+    || exporter.isExporting() || !exporter.errors().isEmpty())
+    {
+    std::cerr << "ctkDICOMExporter: unexpected default values" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  QDir exportDirectory(QDir::temp().absoluteFilePath("ctkDICOMExporterTest1"));
+  exportDirectory.removeRecursively();
+
+  if (exporter.startExport(QStringList() << dicomFilePath, QStringList()))
+    {
+    std::cerr << "ctkDICOMExporter: export should fail if the file lists do not match" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  //
+  // Export the same file many times in parallel
+  //
+  const int numberOfFiles = 100;
+  QStringList sourceFilePaths;
+  QStringList destinationFilePaths;
+  for (int fileIndex = 0; fileIndex < numberOfFiles; ++fileIndex)
+    {
+    sourceFilePaths << dicomFilePath;
+    destinationFilePaths << exportDirectory.absoluteFilePath(QString("copy/%1/%2.dcm").arg(fileIndex % 7).arg(fileIndex));
+    }
+  // file that does not exist
+  sourceFilePaths << exportDirectory.absoluteFilePath("nonexistent.dcm");
+  destinationFilePaths << exportDirectory.absoluteFilePath("copy/nonexistent.dcm");
+
+  exporter.setNumberOfThreads(3);
+  if (!exporter.startExport(sourceFilePaths, destinationFilePaths) || !exporter.isExporting())
+    {
+    std::cerr << "ctkDICOMExporter: failed to start export" << std::endl;
+    return EXIT_FAILURE;
+    }
+  exporter.waitForExportFinished();
+  if (exporter.isExporting()
+    || exporter.numberOfProcessedFiles() != numberOfFiles + 1
+    || exporter.numberOfExportedFiles() != numberOfFiles
+    || exporter.numberOfExportedBytes() != qint64(numberOfFiles) * dicomFileContent.size()
+    || exporter.errors().size() != 1)
+    {
+    std::cerr << "ctkDICOMExporter: unexpected export results: " << exporter.numberOfExportedFiles()
+      << " files, " << exporter.errors().size() << " errors" << std::endl;
+    return EXIT_FAILURE;
+    }
+  foreach (const QString& destinationFilePath, destinationFilePaths.mid(0, numberOfFiles))
+    {
+    if (fileContent(destinationFilePath) != dicomFileContent)
+      {
+      std::cerr << "ctkDICOMExporter: exported file differs: " << qPrintable(destinationFilePath) << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+
+  // Existing files are not overwritten
+  exporter.startExport(sourceFilePaths.mid(0, 1), destinationFilePaths.mid(0, 1));
+  exporter.waitForExportFinished();
+  if (exporter.numberOfExportedFiles() != 0 || exporter.errors().size() != 1)
+    {
+    std::cerr << "ctkDICOMExporter: existing file should not be overwritten" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  //
+  // Hard links and DICOMDIR
+  //
+  exporter.setLinkFiles(true);
+  exporter.setWriteDicomDir(true);
+  QString dicomDirFolder = exportDirectory.absoluteFilePath("dicomdir");
+  QString linkedFilePath = dicomDirFolder + "/DICOM/S0000001/I0000001";
+  exporter.startExport(QStringList() << dicomFilePath, QStringList() << linkedFilePath, dicomDirFolder);
+  exporter.waitForExportFinished();
+  if (exporter.numberOfExportedFiles() != 1 || fileContent(linkedFilePath) != dicomFileContent)
+    {
+    std::cerr << "ctkDICOMExporter: linked file is not exported" << std::endl;
+    return EXIT_FAILURE;
+    }
+  if (!dicomDirReferencesFile(dicomDirFolder + "/DICOMDIR", "DICOM\\S0000001\\I0000001"))
+    {
+    std::cerr << "ctkDICOMExporter: DICOMDIR file does not reference the exported file" << std::endl;
+    if (!exporter.errors().isEmpty())
+      {
+      std::cerr << qPrintable(exporter.errors().join("\n")) << std::endl;
+      }
+    return EXIT_FAILURE;
+    }
+
+  //
+  // Cancel export
+  //
+  exporter.setLinkFiles(false);
+  exporter.setWriteDicomDir(false);
+  for (int fileIndex = 0; fileIndex < destinationFilePaths.size(); ++fileIndex)
+    {
+    destinationFilePaths[fileIndex] = exportDirectory.absoluteFilePath(QString("cancel/%1.dcm").arg(fileIndex));
+    }
+  // cancelled before any worker starts, so that no file is exported
+  QObject::connect(&exporter, SIGNAL(exportStarted(int)), &exporter, SLOT(cancel()));
+  exporter.startExport(sourceFilePaths, destinationFilePaths);
+  exporter.waitForExportFinished();
+  QString cancelMessage = QString("Export cancelled, %1 files were not exported").arg(sourceFilePaths.size());
+  if (exporter.isExporting() || exporter.numberOfProcessedFiles() != sourceFilePaths.size()
+    || exporter.numberOfExportedFiles() != 0
+    || exporter.errors() != QStringList(cancelMessage))
+    {
+    std::cerr << "ctkDICOMExporter: cancelled export should be finished and reported" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  exportDirectory.removeRecursively();
+  return EXIT_SUCCESS;
+}
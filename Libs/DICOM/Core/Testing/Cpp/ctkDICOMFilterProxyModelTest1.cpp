@@ -0,0 +1,128 @@
+/*=========================================================================
+
+  Library:   CTK
+
+  Copyright (c) Kitware Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0.txt
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+=========================================================================*/
+
+// Qt includes
+#include <QCoreApplication>
+#include <QStringList>
+
+// ctkDICOMCore includes
+#include "ctkDICOMDatabase.h"
+#include "ctkDICOMFilterProxyModel.h"
+#include "ctkDICOMModel.h"
+
+// STD includes
+#include <iostream>
+
+namespace
+{
+//-----------------------------------------------------------------------------
+QStringList acceptedRows(ctkDICOMFilterProxyModel& proxy, const QModelIndex& parent = QModelIndex())
+{
+  QStringList rows;
+  for (int row = 0; row < proxy.rowCount(parent); ++row)
+    {
+    QModelIndex index = proxy.index(row, 0, parent);
+    rows << proxy.data(index, ctkDICOMModel::UIDRole).toString();
+    rows << acceptedRows(proxy, index);
+    }
+  return rows;
+}
+
+//-----------------------------------------------------------------------------
+void fetchAll(ctkDICOMModel& model, const QModelIndex& parent = QModelIndex())
+{
+  model.fetchMore(parent);
+  for (int row = 0; row < model.rowCount(parent); ++row)
+    {
+    QModelIndex index = model.index(row, 0, parent);
+    if (model.data(index, ctkDICOMModel::TypeRole).toInt() < ctkDICOMModel::SeriesType)
+      {
+      fetchAll(model, index);
+      }
+    }
+}
+
+} // end of anonymous namespace
+
+//-----------------------------------------------------------------------------
+int ctkDICOMFilterProxyModelTest1( int argc, char * argv [] )
+{
+  QCoreApplication app(argc, argv);
+
+  if (argc <= 2)
+    {
+    std::cerr << "Usage: ctkDICOMFilterProxyModelTest1 <scratch.db> <dumpfile.sql>" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  ctkDICOMDatabase database(argv[1]);
+  if (!database.initializeDatabase(argv[2]))
+    {
+    std::cerr << "Error when initializing the data base: " << argv[2]
+              << " error: " << database.lastError().toStdString() << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  ctkDICOMModel model;
+  model.setDatabase(database.database());
+  fetchAll(model);
+  if (model.rowCount() == 0)
+    {
+    std::cerr << "No patient in the sample database" << std::endl;
+    return EXIT_FAILURE;
+    }
+  QString patientName = model.data(model.index(0, 0)).toString();
+
+  ctkDICOMFilterProxyModel proxy;
+  proxy.setSourceModel(&model);
+  QStringList allRows = acceptedRows(proxy);
+
+  // plain text, regular expression, no match and empty text
+  QStringList searchTexts;
+  searchTexts << patientName.left(3) << QString("^") + patientName.left(1)
+              << "#no match#" << QString();
+  foreach(const QString& searchText, searchTexts)
+    {
+    proxy.setNameSearchText(searchText);
+    QStringList rows = acceptedRows(proxy);
+    if (searchText.isEmpty() && rows != allRows)
+      {
+      std::cerr << "Empty search text filtered rows" << std::endl;
+      return EXIT_FAILURE;
+      }
+    if (!searchText.isEmpty() && (rows.isEmpty() == (searchText != "#no match#")))
+      {
+      std::cerr << "Filter failed for: " << qPrintable(searchText) << ": "
+                << rows.count() << " rows" << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+
+  // a study filter only hides studies
+  proxy.setStudySearchText("#no match#");
+  if (proxy.rowCount() != model.rowCount() ||
+      proxy.rowCount(proxy.index(0, 0)) != 0)
+    {
+    std::cerr << "Study filter failed" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -21,10 +21,19 @@
 // Qt includes
 #include <QCoreApplication>
 #include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
 
 // ctkDICOMCore includes
 #include "ctkDICOMDatabase.h"
+#include "ctkDICOMExporter.h"
 #include "ctkDICOMIndexer.h"
+#include "ctkDICOMItem.h"
+
+// DCMTK includes
+#include <dcmtk/dcmdata/dcdeftag.h>
 
 // STD includes
 #include <iostream>
@@ -33,9 +42,257 @@ int ctkDICOMIndexerTest1( int argc, char * argv [] )
 {
   QCoreApplication app(argc, argv);
 
+  if (argc < 2)
+  {
+    std::cerr << "ctkDICOMIndexerTest1: missing DICOM file argument" << std::endl;
+    std::cerr << "Usage: ctkDICOMIndexerTest1 /path/to/dicom/file" << std::endl;
+    return EXIT_FAILURE;
+  }
+  QString dicomFilePath = argv[1];
+
   ctkDICOMDatabase database;
   ctkDICOMIndexer indexer;
 
+  if (indexer.indexingResultsMemorySize() != 0)
+  {
+    std::cerr << "ctkDICOMIndexer::indexingResultsMemorySize() failed: no memory should be used before indexing" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  QString testDirectoryPath = QDir::temp().absoluteFilePath("ctkDICOMIndexerTest1");
+  QDir(testDirectoryPath).removeRecursively();
+  QDir testDirectory(testDirectoryPath);
+
+  // Instances of the same series in a folder and its subfolder
+  ctkDICOMItem sourceItem;
+  sourceItem.InitializeFromFile(dicomFilePath);
+  QString patientName = sourceItem.GetElementAsString(DCM_PatientName);
+  QString filesDirectoryPath = testDirectory.absoluteFilePath("files");
+  QDir().mkpath(filesDirectoryPath + "/sub");
+  const int numberOfFiles = 8;
+  QStringList filePaths;
+  for (int fileIndex = 0; fileIndex < numberOfFiles + 1; ++fileIndex)
+  {
+    ctkDICOMItem item;
+    item.InitializeFromFile(dicomFilePath);
+    item.SetElementAsString(DCM_SOPInstanceUID, QString("1.2.826.0.1.3680043.2.1125.3.%1").arg(fileIndex + 1));
+    filePaths << QDir(filesDirectoryPath).absoluteFilePath(QString("%1image%2.dcm")
+      .arg(fileIndex % 2 ? "sub/" : "").arg(fileIndex));
+    // the last file is added later
+    if (fileIndex < numberOfFiles && !item.SaveToFile(filePaths.last()))
+    {
+      std::cerr << "Failed to write test file " << qPrintable(filePaths.last()) << std::endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  // Test ctkDICOMIndexer::setNumberOfParserThreads() and setHeaderOnlyParsingEnabled():
+  // files are parsed by several threads, the indexed fields do not depend on the parsing mode.
+  indexer.setNumberOfParserThreads(3);
+  for (int headerOnly = 1; headerOnly >= 0; --headerOnly)
+  {
+    indexer.setHeaderOnlyParsingEnabled(headerOnly);
+    ctkDICOMDatabase parsingDatabase;
+    parsingDatabase.openDatabase(testDirectory.absoluteFilePath(QString("parsing%1.sql").arg(headerOnly)));
+    indexer.addDirectory(&parsingDatabase, filesDirectoryPath);
+    indexer.waitForImportFinished();
+    if (parsingDatabase.imagesCount() != numberOfFiles
+      || parsingDatabase.fileValue(filePaths[numberOfFiles - 1], "0010,0010") != patientName)
+    {
+      std::cerr << "ctkDICOMIndexer::addDirectory() failed with " << (headerOnly ? "header-only" : "full")
+        << " parsing: " << parsingDatabase.imagesCount() << " images indexed" << std::endl;
+      return EXIT_FAILURE;
+    }
+    parsingDatabase.closeDatabase();
+  }
+  indexer.setHeaderOnlyParsingEnabled(true);
+
+  // Test ctkDICOMIndexer::setFastRescanEnabled(): fingerprints of the indexed folders are
+  // stored, and a folder where a file is added is scanned again.
+  {
+    ctkDICOMDatabase rescanDatabase;
+    rescanDatabase.openDatabase(testDirectory.absoluteFilePath("rescan.sql"));
+    indexer.setFastRescanEnabled(true);
+    indexer.addDirectory(&rescanDatabase, filesDirectoryPath);
+    indexer.waitForImportFinished();
+    QHash<QString, ctkDICOMDatabase::DirectoryFingerprint> fingerprints;
+    rescanDatabase.directoryFingerprints(fingerprints);
+    if (rescanDatabase.imagesCount() != numberOfFiles || fingerprints.isEmpty())
+    {
+      std::cerr << "ctkDICOMIndexer::addDirectory() failed with fast rescan: " << rescanDatabase.imagesCount()
+        << " images, " << fingerprints.size() << " folder fingerprints" << std::endl;
+      return EXIT_FAILURE;
+    }
+    // make sure that the modification time of the folder changes
+    QThread::msleep(1100);
+    ctkDICOMItem item;
+    item.InitializeFromFile(dicomFilePath);
+    item.SetElementAsString(DCM_SOPInstanceUID, QString("1.2.826.0.1.3680043.2.1125.3.%1").arg(numberOfFiles + 1));
+    item.SaveToFile(filePaths[numberOfFiles]);
+    indexer.addDirectory(&rescanDatabase, filesDirectoryPath);
+    indexer.waitForImportFinished();
+    if (rescanDatabase.imagesCount() != numberOfFiles + 1)
+    {
+      std::cerr << "ctkDICOMIndexer::addDirectory() failed with fast rescan: file added to an indexed folder was not found" << std::endl;
+      return EXIT_FAILURE;
+    }
+    indexer.setFastRescanEnabled(false);
+    rescanDatabase.closeDatabase();
+  }
+
+  // Test ctkDICOMIndexer::setFastDicomdirImportEnabled(): images are inserted from the
+  // DICOMDIR records, other tags are read from the file when requested.
+  {
+    QString dicomdirDirectoryPath = testDirectory.absoluteFilePath("dicomdir");
+    QString exportedFilePath = dicomdirDirectoryPath + "/DICOM/S0000001/I0000001";
+    ctkDICOMExporter exporter;
+    exporter.setWriteDicomDir(true);
+    exporter.startExport(QStringList() << dicomFilePath, QStringList() << exportedFilePath, dicomdirDirectoryPath);
+    exporter.waitForExportFinished();
+
+    ctkDICOMDatabase dicomdirDatabase;
+    dicomdirDatabase.openDatabase(testDirectory.absoluteFilePath("dicomdir.sql"));
+    indexer.setFastDicomdirImportEnabled(true);
+    if (!indexer.addDicomdir(&dicomdirDatabase, dicomdirDirectoryPath))
+    {
+      std::cerr << "ctkDICOMIndexer::addDicomdir() failed with fast DICOMDIR import" << std::endl;
+      return EXIT_FAILURE;
+    }
+    indexer.waitForImportFinished();
+    QStringList dicomdirFiles = dicomdirDatabase.allFiles();
+    if (dicomdirDatabase.imagesCount() != 1 || dicomdirFiles.size() != 1
+      || QFileInfo(dicomdirFiles[0]).canonicalFilePath() != QFileInfo(exportedFilePath).canonicalFilePath()
+      || dicomdirDatabase.fileValue(dicomdirFiles[0], "0010,0010") != patientName)
+    {
+      std::cerr << "ctkDICOMIndexer::addDicomdir() failed with fast DICOMDIR import: "
+        << dicomdirDatabase.imagesCount() << " images" << std::endl;
+      return EXIT_FAILURE;
+    }
+    indexer.setFastDicomdirImportEnabled(false);
+    dicomdirDatabase.closeDatabase();
+  }
+
+  // Test ctkDICOMIndexer::setIndexingResultsMemoryBudget() with a budget that only fits two parsed files:
+  // parsers must wait while the worker writes queued results to the database, so that the memory
+  // used by the results never exceeds the budget, and all files are still indexed.
+  {
+    ctkDICOMDatabase budgetDatabase;
+    budgetDatabase.openDatabase(testDirectory.absoluteFilePath("budget.sql"));
+    ctkDICOMIndexer budgetIndexer;
+    budgetIndexer.setBackgroundImportEnabled(true);
+    budgetIndexer.setNumberOfParserThreads(3);
+    // pixel data is read, too
+    budgetIndexer.setHeaderOnlyParsingEnabled(false);
+    qint64 resultMemorySize = sizeof(ctkDICOMItem) + sourceItem.GetEstimatedMemorySize();
+    qint64 budget = 2 * resultMemorySize;
+    budgetIndexer.setIndexingResultsMemoryBudget(budget);
+    // all files (including the one added to the rescanned folder) do not fit in the budget at once
+    if ((numberOfFiles + 1) * resultMemorySize <= budget)
+    {
+      std::cerr << "ctkDICOMIndexer::setIndexingResultsMemoryBudget() test failed: budget is too large" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    budgetIndexer.addDirectory(&budgetDatabase, filesDirectoryPath);
+    qint64 maximumMemorySize = budgetIndexer.indexingResultsMemorySize();
+    QElapsedTimer timer;
+    timer.start();
+    while (budgetIndexer.isImporting() && timer.elapsed() < 30000)
+    {
+      maximumMemorySize = qMax(maximumMemorySize, budgetIndexer.indexingResultsMemorySize());
+      QThread::msleep(1);
+    }
+    budgetIndexer.waitForImportFinished(30000);
+    if (budgetIndexer.isImporting())
+    {
+      std::cerr << "ctkDICOMIndexer::setIndexingResultsMemoryBudget() failed: indexing did not finish with a small memory budget" << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (maximumMemorySize > budget)
+    {
+      std::cerr << "ctkDICOMIndexer::setIndexingResultsMemoryBudget() failed: indexing results used "
+        << maximumMemorySize << " bytes, budget is " << budget << " bytes" << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (budgetDatabase.imagesCount() != numberOfFiles + 1)
+    {
+      std::cerr << "ctkDICOMIndexer::setIndexingResultsMemoryBudget() failed: expected " << numberOfFiles + 1
+        << " images, found " << budgetDatabase.imagesCount() << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (budgetIndexer.indexingResultsMemorySize() != 0)
+    {
+      std::cerr << "ctkDICOMIndexer::indexingResultsMemorySize() failed: memory is not released after indexing" << std::endl;
+      return EXIT_FAILURE;
+    }
+    budgetIndexer.setDatabase(nullptr);
+    budgetDatabase.closeDatabase();
+  }
+  QDir(testDirectoryPath).removeRecursively();
+
+  // Test ctkDICOMIndexer::addIndexingResults() with a result that does not fit in the memory budget
+  // next to the already queued results. Results are queued by the worker thread, which must not
+  // wait for memory that only it can release.
+  {
+    QString databaseDirectoryPath = QDir::temp().absoluteFilePath("ctkDICOMIndexerTest1");
+    QDir(databaseDirectoryPath).removeRecursively();
+    QDir().mkpath(databaseDirectoryPath);
+    QDir databaseDirectory(databaseDirectoryPath);
+    QString smallFilePath = databaseDirectory.absoluteFilePath("small.dcm");
+    QString largeFilePath = databaseDirectory.absoluteFilePath("large.dcm");
+    QFile::copy(dicomFilePath, smallFilePath);
+    QFile::copy(dicomFilePath, largeFilePath);
+
+    ctkDICOMDatabase budgetDatabase;
+    budgetDatabase.openDatabase(databaseDirectory.absoluteFilePath("ctkDICOM.sql"));
+    if (!budgetDatabase.isOpen())
+    {
+      std::cerr << "ctkDICOMDatabase::openDatabase() failed: " << qPrintable(budgetDatabase.lastError()) << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    // Header of the file (a small result) and the complete file (a large result)
+    ctkDICOMDatabase::IndexingResult smallResult;
+    smallResult.filePath = smallFilePath;
+    smallResult.dataset = QSharedPointer<ctkDICOMItem>(new ctkDICOMItem);
+    smallResult.dataset->InitializeFromFileUntilTag(smallFilePath, DCM_PixelData);
+    smallResult.dataset->SetElementAsString(DCM_SOPInstanceUID, "1.2.826.0.1.3680043.2.1125.1.99");
+    smallResult.incompleteDataset = true;
+    ctkDICOMDatabase::IndexingResult largeResult;
+    largeResult.filePath = largeFilePath;
+    largeResult.dataset = QSharedPointer<ctkDICOMItem>(new ctkDICOMItem);
+    largeResult.dataset->InitializeFromFile(largeFilePath);
+
+    ctkDICOMIndexer budgetIndexer;
+    budgetIndexer.setBackgroundImportEnabled(true);
+    budgetIndexer.setDatabase(&budgetDatabase);
+    // The large result alone fits in the budget, but not together with the queued small result
+    budgetIndexer.setIndexingResultsMemoryBudget(largeResult.dataset->GetEstimatedMemorySize());
+    QList<ctkDICOMDatabase::IndexingResult> indexingResults;
+    indexingResults << smallResult << largeResult;
+    budgetIndexer.addIndexingResults(indexingResults);
+    budgetIndexer.waitForImportFinished(30000);
+    if (budgetIndexer.isImporting())
+    {
+      std::cerr << "ctkDICOMIndexer::addIndexingResults() failed: indexing did not finish with a small memory budget" << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (budgetDatabase.imagesCount() != 2)
+    {
+      std::cerr << "ctkDICOMIndexer::addIndexingResults() failed: expected 2 images, found "
+        << budgetDatabase.imagesCount() << std::endl;
+      return EXIT_FAILURE;
+    }
+    if (budgetIndexer.indexingResultsMemorySize() != 0)
+    {
+      std::cerr << "ctkDICOMIndexer::indexingResultsMemorySize() failed: memory is not released after indexing" << std::endl;
+      return EXIT_FAILURE;
+    }
+    budgetIndexer.setDatabase(nullptr);
+    budgetDatabase.closeDatabase();
+    QDir(databaseDirectoryPath).removeRecursively();
+  }
+
   // Test ctkDICOMIndexer::addDirectory()
   // just check if it doesn't crash
   // Create block to test batch indexing using indexingBatch helper class.
@@ -50,5 +307,11 @@ int ctkDICOMIndexerTest1( int argc, char * argv [] )
   // ensure all concurrent inserts are complete
   indexer.waitForImportFinished();
 
+  if (indexer.indexingResultsMemorySize() != 0)
+  {
+    std::cerr << "ctkDICOMIndexer::indexingResultsMemorySize() failed: memory is not released after indexing" << std::endl;
+    return EXIT_FAILURE;
+  }
+
   return EXIT_SUCCESS;
 }
@@ -88,6 +88,66 @@ int ctkDICOMModelTest1( int argc, char * argv [] )
     qDebug() << model.rowCount() << model.columnCount();
     qDebug() << model.index(0,0);
 
+    // The hierarchy index must show the same items as the queries
+    ctkDICOMModel indexedModel;
+    if (indexedModel.isHierarchyIndexEnabled())
+      {
+      std::cerr << "ctkDICOMModel: hierarchy index is enabled by default" << std::endl;
+      return EXIT_FAILURE;
+      }
+    indexedModel.setHierarchyIndexEnabled(true);
+    ctkModelTester indexedTester;
+    indexedTester.setNestedInserts(true);
+    indexedTester.setThrowOnError(false);
+    indexedTester.setModel(&indexedModel);
+    indexedModel.setDatabase(myCTK.database());
+    if (indexedModel.rowCount() != model.rowCount())
+      {
+      std::cerr << "ctkDICOMModel hierarchy index failed: " << indexedModel.rowCount()
+                << " patients instead of " << model.rowCount() << std::endl;
+      return EXIT_FAILURE;
+      }
+    for (int patient = 0; patient < model.rowCount(); ++patient)
+      {
+      QModelIndex patientIndex = model.index(patient, 0);
+      QModelIndex indexedPatientIndex = indexedModel.index(patient, 0);
+      model.fetchMore(patientIndex);
+      indexedModel.fetchMore(indexedPatientIndex);
+      if (indexedModel.data(indexedPatientIndex, ctkDICOMModel::UIDRole) != model.data(patientIndex, ctkDICOMModel::UIDRole) ||
+          indexedModel.data(indexedPatientIndex).toString() != model.data(patientIndex).toString() ||
+          indexedModel.hasChildren(indexedPatientIndex) != model.hasChildren(patientIndex) ||
+          indexedModel.rowCount(indexedPatientIndex) != model.rowCount(patientIndex))
+        {
+        std::cerr << "ctkDICOMModel hierarchy index failed: patient " << patient << " differs" << std::endl;
+        return EXIT_FAILURE;
+        }
+      for (int study = 0; study < model.rowCount(patientIndex); ++study)
+        {
+        QModelIndex studyIndex = model.index(study, 0, patientIndex);
+        QModelIndex indexedStudyIndex = indexedModel.index(study, 0, indexedPatientIndex);
+        model.fetchMore(studyIndex);
+        indexedModel.fetchMore(indexedStudyIndex);
+        if (indexedModel.data(indexedStudyIndex, ctkDICOMModel::UIDRole) != model.data(studyIndex, ctkDICOMModel::UIDRole) ||
+            indexedModel.data(indexedStudyIndex.sibling(study, 2)).toString() != model.data(studyIndex.sibling(study, 2)).toString() ||
+            indexedModel.rowCount(indexedStudyIndex) != model.rowCount(studyIndex))
+          {
+          std::cerr << "ctkDICOMModel hierarchy index failed: study " << study
+                    << " of patient " << patient << " differs" << std::endl;
+          return EXIT_FAILURE;
+          }
+        }
+      }
+
+    // unknown instances are ignored, a rebuild gives the same items
+    int patientCount = indexedModel.rowCount();
+    indexedModel.onInstanceAdded("1.2.3.4.5.6.7.8.9");
+    indexedModel.onItemsRemoved();
+    if (indexedModel.rowCount() != patientCount)
+      {
+      std::cerr << "ctkDICOMModel hierarchy index update failed" << std::endl;
+      return EXIT_FAILURE;
+      }
+
     return EXIT_SUCCESS;
   }
   catch (std::exception e)
@@ -21,14 +21,19 @@
 // Qt includes
 #include <QCoreApplication>
 #include <QDebug>
+#include <QDir>
 #include <QStringList>
 #include <QVariant>
 
 // ctkDICOMCore includes
 #include "ctkDICOMDatabase.h"
+#include "ctkDICOMItem.h"
 #include "ctkDICOMQuery.h"
 #include "ctkDICOMTester.h"
 
+// DCMTK includes
+#include <dcmtk/dcmdata/dcdeftag.h>
+
 // STD includes
 #include <iostream>
 
@@ -75,5 +80,51 @@ int ctkDICOMQueryTest2( int argc, char * argv [] )
               << "No study instance retrieved" << std::endl;
     return EXIT_FAILURE;
     }
+
+  // Store more studies, so that series are queried on several associations in parallel
+  QString studiesDirectoryPath = QDir::temp().absoluteFilePath("ctkDICOMQueryTest2");
+  QDir(studiesDirectoryPath).removeRecursively();
+  QDir().mkpath(studiesDirectoryPath);
+  QStringList studyInstanceUIDs;
+  QStringList studyFilePaths;
+  for (int studyIndex = 0; studyIndex < 6; ++studyIndex)
+    {
+    QString uidSuffix = QString(".%1").arg(studyIndex + 1);
+    ctkDICOMItem item;
+    item.InitializeFromFile(arguments[0]);
+    item.SetElementAsString(DCM_StudyInstanceUID, "1.2.826.0.1.3680043.2.1125.2.1" + uidSuffix);
+    item.SetElementAsString(DCM_SeriesInstanceUID, "1.2.826.0.1.3680043.2.1125.2.2" + uidSuffix);
+    item.SetElementAsString(DCM_SOPInstanceUID, "1.2.826.0.1.3680043.2.1125.2.3" + uidSuffix);
+    QString studyFilePath = QDir(studiesDirectoryPath).absoluteFilePath(QString("study%1.dcm").arg(studyIndex));
+    if (!item.SaveToFile(studyFilePath))
+      {
+      std::cout << "Failed to write test file " << qPrintable(studyFilePath) << std::endl;
+      return EXIT_FAILURE;
+      }
+    studyInstanceUIDs << item.GetElementAsString(DCM_StudyInstanceUID);
+    studyFilePaths << studyFilePath;
+    }
+  tester.storeData(studyFilePaths);
+
+  ctkDICOMDatabase associationsDatabase;
+  associationsDatabase.openDatabase(":memory:");
+  query.setNumberOfSeriesQueryAssociations(3);
+  if (!query.query(associationsDatabase))
+    {
+    std::cout << "ctkDICOMQuery::query() failed with several series query associations" << std::endl;
+    return EXIT_FAILURE;
+    }
+  foreach (const QString& studyInstanceUID, studyInstanceUIDs)
+    {
+    if (!query.studyInstanceUIDQueried().contains(studyInstanceUID)
+      || associationsDatabase.seriesForStudy(studyInstanceUID).count() != 1)
+      {
+      std::cout << "ctkDICOMQuery::query() failed: series of study " << qPrintable(studyInstanceUID)
+                << " not found with several series query associations" << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+  QDir(studiesDirectoryPath).removeRecursively();
+
   return EXIT_SUCCESS;
 }
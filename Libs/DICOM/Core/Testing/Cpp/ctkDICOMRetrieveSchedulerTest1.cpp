@@ -0,0 +1,87 @@
+/*=========================================================================
+
+  Library:   CTK
+
+  Copyright (c) Kitware Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0.txt
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+=========================================================================*/
+
+// Qt includes
+#include <QCoreApplication>
+
+// ctkDICOMCore includes
+#include "ctkDICOMRetrieveScheduler.h"
+
+// STD includes
+#include <cstdlib>
+#include <iostream>
+
+// Check that failed retrieves are retried and reported
+int ctkDICOMRetrieveSchedulerTest1( int argc, char * argv [] )
+{
+  QCoreApplication app(argc, argv);
+
+  ctkDICOMRetrieveScheduler scheduler;
+
+  scheduler.setCallingAETitle("CallingAETitle");
+  scheduler.setMaximumNumberOfRetrieves(3);
+  scheduler.setMaximumNumberOfRetrievesPerPeer(3);
+  scheduler.setMaximumNumberOfRetries(1);
+  scheduler.setRetryDelay(10);
+
+  // requests without UIDs are not queued
+  scheduler.addSeriesRetrieve(QString(), QString(), "CalledAETitle", "localhost", 1);
+  scheduler.addStudyRetrieve(QString(), "CalledAETitle", "localhost", 1);
+  if (scheduler.numberOfPendingRetrieves() != 0)
+    {
+    std::cerr << "ctkDICOMRetrieveScheduler::addSeriesRetrieve() failed: invalid request was queued" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // there is no server listening, all retrieves fail after retrying
+  scheduler.addSeriesRetrieve("1.2.3", "1.2.3.1", "CalledAETitle", "localhost", 1);
+  scheduler.addSeriesRetrieve("1.2.3", "1.2.3.2", "CalledAETitle", "localhost", 1);
+  scheduler.addStudyRetrieve("1.2.4", "CalledAETitle", "localhost", 1);
+  if (!scheduler.isRetrieving() || scheduler.numberOfPendingRetrieves() != 3)
+    {
+    std::cerr << "ctkDICOMRetrieveScheduler::addSeriesRetrieve() failed: requests are not queued" << std::endl;
+    return EXIT_FAILURE;
+    }
+  scheduler.waitForRetrievesFinished(60000);
+  if (scheduler.isRetrieving() || scheduler.numberOfPendingRetrieves() != 0)
+    {
+    std::cerr << "ctkDICOMRetrieveScheduler::waitForRetrievesFinished() failed" << std::endl;
+    return EXIT_FAILURE;
+    }
+  if (scheduler.receivedDatasetCount() != 0 || scheduler.indexedDatasetCount() != 0)
+    {
+    std::cerr << "ctkDICOMRetrieveScheduler::receivedDatasetCount() failed: no datasets should be received" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // canceling removes queued requests
+  scheduler.setMaximumNumberOfRetrieves(1);
+  scheduler.addSeriesRetrieve("1.2.3", "1.2.3.1", "CalledAETitle", "localhost", 1);
+  scheduler.addSeriesRetrieve("1.2.3", "1.2.3.2", "CalledAETitle", "localhost", 1);
+  scheduler.cancel();
+  scheduler.waitForRetrievesFinished(60000);
+  if (scheduler.isRetrieving() || scheduler.numberOfPendingRetrieves() != 0)
+    {
+    std::cerr << "ctkDICOMRetrieveScheduler::cancel() failed" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,98 @@
+/*=========================================================================
+
+  Library:   CTK
+
+  Copyright (c) Kitware Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0.txt
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+=========================================================================*/
+
+// Qt includes
+#include <QCoreApplication>
+#include <QStringList>
+
+// ctkDICOMCore includes
+#include "ctkDICOMDatabase.h"
+#include "ctkDICOMItem.h"
+#include "ctkDICOMRetrieveScheduler.h"
+#include "ctkDICOMTester.h"
+
+// DCMTK includes
+#include <dcmtk/dcmdata/dcdeftag.h>
+
+// STD includes
+#include <cstdlib>
+#include <iostream>
+
+void ctkDICOMRetrieveSchedulerTest2PrintUsage()
+{
+  std::cout << " ctkDICOMRetrieveSchedulerTest2 images" << std::endl;
+}
+
+// Retrieve a study from a real local server into an in-memory database
+int ctkDICOMRetrieveSchedulerTest2( int argc, char * argv [] )
+{
+  QCoreApplication app(argc, argv);
+
+  ctkDICOMTester tester;
+  tester.startDCMQRSCP();
+
+  QStringList arguments = app.arguments();
+  arguments.pop_front(); // remove application name
+  arguments.pop_front(); // remove test name
+  if (!arguments.count())
+    {
+    ctkDICOMRetrieveSchedulerTest2PrintUsage();
+    return EXIT_FAILURE;
+    }
+  tester.storeData(arguments);
+
+  ctkDICOMItem item;
+  item.InitializeFromFile(arguments[0]);
+  QString studyInstanceUID = item.GetElementAsString(DCM_StudyInstanceUID);
+
+  // The indexer thread cannot open another connection to an in-memory database,
+  // retrieved datasets must still end up in this database.
+  ctkDICOMDatabase database;
+  database.openDatabase(":memory:");
+
+  ctkDICOMRetrieveScheduler scheduler;
+  scheduler.setDatabase(&database);
+  scheduler.setCallingAETitle("CTK_AE");
+  scheduler.setStoreBatchSize(1);
+  scheduler.setMaximumNumberOfRetries(0);
+  scheduler.addStudyRetrieve(studyInstanceUID, "CTK_AE", "localhost", tester.dcmqrscpPort());
+  scheduler.waitForRetrievesFinished(60000);
+  if (scheduler.isRetrieving())
+    {
+    std::cerr << "ctkDICOMRetrieveScheduler::waitForRetrievesFinished() failed: retrieve did not finish" << std::endl;
+    return EXIT_FAILURE;
+    }
+  if (scheduler.receivedDatasetCount() != arguments.count()
+    || scheduler.indexedDatasetCount() != arguments.count())
+    {
+    std::cerr << "ctkDICOMRetrieveScheduler failed: expected " << arguments.count() << " datasets, received "
+              << scheduler.receivedDatasetCount() << ", indexed " << scheduler.indexedDatasetCount() << std::endl;
+    return EXIT_FAILURE;
+    }
+  if (database.imagesCount() != arguments.count()
+    || database.seriesForStudy(studyInstanceUID).isEmpty())
+    {
+    std::cerr << "ctkDICOMRetrieveScheduler failed: retrieved datasets are not in the database, found "
+              << database.imagesCount() << " images" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  return EXIT_SUCCESS;
+}
@@ -24,6 +24,7 @@
 #include <QVariant>
 
 // ctkDICOMCore includes
+#include "ctkDICOMIndexer.h"
 #include "ctkDICOMRetrieve.h"
 
 // STD includes
@@ -98,6 +99,30 @@ int ctkDICOMRetrieveTest1( int argc, char * argv [] )
     return EXIT_FAILURE;
     }
 
+  std::cerr << "Set Indexer\n";
+  ctkDICOMIndexer indexer;
+  if (retrieve.indexer() != 0)
+    {
+    std::cerr << __LINE__ << ": ctkDICOMRetrieve::indexer() failed: no indexer should be set by default."
+              << std::endl;
+    return EXIT_FAILURE;
+    }
+  retrieve.setIndexer(&indexer);
+  if (retrieve.indexer() != &indexer)
+    {
+    std::cerr << __LINE__ << ": ctkDICOMRetrieve::setIndexer() failed."
+              << std::endl;
+    return EXIT_FAILURE;
+    }
+  retrieve.setIndexer(0);
+  if (retrieve.receivedDatasetCount() != 0 || retrieve.receivedDatasetsPerSecond() != 0.0 ||
+      retrieve.indexedDatasetCount() != 0 || retrieve.indexedDatasetsPerSecond() != 0.0)
+    {
+    std::cerr << __LINE__ << ": ctkDICOMRetrieve transfer statistics are invalid before retrieve."
+              << std::endl;
+    return EXIT_FAILURE;
+    }
+
   std::cerr << "Move Series\n";
   bool res = retrieve.moveSeries(QString(), QString());
   if (res)
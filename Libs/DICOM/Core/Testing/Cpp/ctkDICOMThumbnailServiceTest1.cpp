@@ -0,0 +1,196 @@
+/*=========================================================================
+
+  Library:   CTK
+
+  Copyright (c) Kitware Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0.txt
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+=========================================================================*/
+
+// Qt includes
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QThread>
+
+// ctkDICOMCore includes
+#include "ctkDICOMAbstractThumbnailGenerator.h"
+#include "ctkDICOMDatabase.h"
+#include "ctkDICOMThumbnailService.h"
+
+// DCMTK includes
+#include <dcmtk/dcmimgle/dcmimage.h>
+
+// STD includes
+#include <cstdlib>
+#include <iostream>
+
+//------------------------------------------------------------------------------
+// Renders the image into a PGM file, the PNG generator of the Widgets library
+// cannot be used from the Core tests.
+class ctkDICOMThumbnailServiceTestGenerator : public ctkDICOMAbstractThumbnailGenerator
+{
+public:
+  virtual bool generateThumbnail(DicomImage* dcmImage, const QString& path)
+  {
+    this->GeneratedCount.ref();
+    if (dcmImage == 0 || dcmImage->getStatus() != EIS_Normal)
+    {
+      return false;
+    }
+    return dcmImage->writeImageToFile(QDir::toNativeSeparators(path).toUtf8()) != 0;
+  }
+
+  QAtomicInt GeneratedCount;
+};
+
+//------------------------------------------------------------------------------
+int ctkDICOMThumbnailServiceTest1( int argc, char * argv [] )
+{
+  QCoreApplication app(argc, argv);
+
+  if (argc < 2)
+  {
+    std::cerr << "Usage: ctkDICOMThumbnailServiceTest1 <dicom file>" << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  ctkDICOMThumbnailService service;
+
+  // requests cannot be queued without a database
+  if (!service.requestThumbnail("1.2.3", "1.2.3.4", "1.2.3.4.5").isEmpty() ||
+      service.isThumbnailPending("1.2.3.4.5") || service.isGenerating())
+    {
+    std::cerr << "ctkDICOMThumbnailService::requestThumbnail() failed: request without database was queued" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  ctkDICOMDatabase database;
+  QDir databaseDirectory = QDir::temp();
+  QFileInfo databaseFile(databaseDirectory, QString("ctkDICOMThumbnailServiceTest1.sql"));
+  database.openDatabase(databaseFile.absoluteFilePath());
+  database.initializeDatabase();
+  service.setDatabase(&database);
+  if (service.database() != &database)
+    {
+    std::cerr << "ctkDICOMThumbnailService::setDatabase() failed" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  QString expectedPath = database.databaseDirectory() + "/thumbs/1.2.3/1.2.3.4/1.2.3.4.5.png";
+  if (service.thumbnailPath("1.2.3", "1.2.3.4", "1.2.3.4.5") != expectedPath)
+    {
+    std::cerr << "ctkDICOMThumbnailService::thumbnailPath() failed: "
+              << qPrintable(service.thumbnailPath("1.2.3", "1.2.3.4", "1.2.3.4.5")) << std::endl;
+    return EXIT_FAILURE;
+    }
+  if (!service.thumbnailPath(QString(), "1.2.3.4", "1.2.3.4.5").isEmpty())
+    {
+    std::cerr << "ctkDICOMThumbnailService::thumbnailPath() failed: path of invalid instance" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // instance is not in the database
+  if (!service.requestThumbnail("1.2.3", "1.2.3.4", "1.2.3.4.5").isEmpty() ||
+      service.isThumbnailPending("1.2.3.4.5"))
+    {
+    std::cerr << "ctkDICOMThumbnailService::requestThumbnail() failed: request of missing instance was queued" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // nothing to wait for, must return immediately
+  service.waitForThumbnailsFinished();
+  service.cancel();
+  if (service.isGenerating())
+    {
+    std::cerr << "ctkDICOMThumbnailService::cancel() failed" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // render the thumbnail of a real file
+  ctkDICOMThumbnailServiceTestGenerator generator;
+  service.setThumbnailGenerator(&generator);
+
+  QString dicomFilePath = databaseDirectory.absoluteFilePath("ctkDICOMThumbnailServiceTest1.dcm");
+  QFile::remove(dicomFilePath);
+  if (!QFile::copy(argv[1], dicomFilePath))
+    {
+    std::cerr << "Failed to copy " << argv[1] << std::endl;
+    return EXIT_FAILURE;
+    }
+  database.insert(dicomFilePath, false, false);
+  QString sopInstanceUID = database.instanceForFile(dicomFilePath);
+  QString seriesInstanceUID = database.seriesForFile(dicomFilePath);
+  QString studyInstanceUID = database.studyForSeries(seriesInstanceUID);
+  QString thumbnailPath = service.thumbnailPath(studyInstanceUID, seriesInstanceUID, sopInstanceUID);
+  QFile::remove(thumbnailPath);
+
+  if (!service.requestThumbnail(studyInstanceUID, seriesInstanceUID, sopInstanceUID).isEmpty() ||
+      !service.isThumbnailPending(sopInstanceUID))
+    {
+    std::cerr << "ctkDICOMThumbnailService::requestThumbnail() failed: missing thumbnail was not queued" << std::endl;
+    return EXIT_FAILURE;
+    }
+  service.waitForThumbnailsFinished(30000);
+  QFileInfo thumbnailInfo(thumbnailPath);
+  if (service.isGenerating() || generator.GeneratedCount.load() != 1 ||
+      !thumbnailInfo.exists() || thumbnailInfo.size() == 0)
+    {
+    std::cerr << "ctkDICOMThumbnailService::waitForThumbnailsFinished() failed: thumbnail was not generated in "
+              << qPrintable(thumbnailPath) << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // an up-to-date thumbnail is returned without being regenerated
+  if (service.requestThumbnail(studyInstanceUID, seriesInstanceUID, sopInstanceUID) != thumbnailPath ||
+      service.isGenerating())
+    {
+    std::cerr << "ctkDICOMThumbnailService::requestThumbnail() failed: up-to-date thumbnail was not returned" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  // the thumbnail is stale once the file is modified
+  QDateTime thumbnailTime = thumbnailInfo.lastModified();
+  QThread::msleep(1100);
+  QFile::remove(dicomFilePath);
+  if (!QFile::copy(argv[1], dicomFilePath))
+    {
+    std::cerr << "Failed to copy " << argv[1] << std::endl;
+    return EXIT_FAILURE;
+    }
+  if (!service.requestThumbnail(studyInstanceUID, seriesInstanceUID, sopInstanceUID).isEmpty() ||
+      !service.isThumbnailPending(sopInstanceUID))
+    {
+    std::cerr << "ctkDICOMThumbnailService::requestThumbnail() failed: stale thumbnail was returned" << std::endl;
+    return EXIT_FAILURE;
+    }
+  service.waitForThumbnailsFinished(30000);
+  thumbnailInfo.refresh();
+  if (generator.GeneratedCount.load() != 2 || thumbnailInfo.lastModified() <= thumbnailTime)
+    {
+    std::cerr << "ctkDICOMThumbnailService::waitForThumbnailsFinished() failed: stale thumbnail was not regenerated" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  service.setThumbnailGenerator(0);
+  database.closeDatabase();
+  QFile::remove(thumbnailPath);
+  QFile::remove(dicomFilePath);
+  databaseDirectory.remove("ctkDICOMThumbnailServiceTest1.sql");
+
+  return EXIT_SUCCESS;
+}
@@ -18,21 +18,39 @@
 
 =========================================================================*/
 
+#include <cstdio>
 #include <stdexcept>
 
 // Qt includes
+#include <QAtomicInt>
+#include <QCache>
 #include <QDate>
 #include <QDebug>
+#include <QDir>
 #include <QFile>
 #include <QFileInfo>
 #include <QFileSystemWatcher>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
 #include <QSet>
 #include <QSqlError>
 #include <QSqlQuery>
 #include <QSqlRecord>
+#include <QRunnable>
 #include <QStringList>
+#include <QThreadPool>
 #include <QUuid>
+#include <QVector>
 #include <QVariant>
+#include <QWaitCondition>
+
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <linux/fs.h>   /* for FICLONE */
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
 
 // ctkDICOM includes
 #include "ctkDICOMDatabase.h"
@@ -69,8 +87,372 @@ static QString TagNotInInstance("__TAG_NOT_IN_INSTANCE__");
 static QString ValueIsEmptyString("__VALUE_IS_EMPTY_STRING__");
 /// Tag exists in the instance and non-empty but its value is not stored (e.g., because it is too long)
 static QString ValueIsNotStored("__VALUE_IS_NOT_STORED__");
+
+//------------------------------------------------------------------------------
+/// Tags are stored in the tag cache as a single integer ((group << 16) | element)
+static bool tagCacheKeyForTag(const QString& tag, qint64& tagCacheKey)
+{
+  QStringList groupElement = tag.split(",");
+  if (groupElement.length() != 2)
+  {
+    return false;
+  }
+  bool groupOK = false;
+  bool elementOK = false;
+  unsigned int group = groupElement[0].toUInt(&groupOK, 16);
+  unsigned int element = groupElement[1].toUInt(&elementOK, 16);
+  if (!groupOK || !elementOK || group > 0xffff || element > 0xffff)
+  {
+    return false;
+  }
+  tagCacheKey = (static_cast<qint64>(group) << 16) | element;
+  return true;
+}
+
+//------------------------------------------------------------------------------
+static QString tagForTagCacheKey(qint64 tagCacheKey)
+{
+  return QString("%1,%2")
+    .arg(static_cast<unsigned int>((tagCacheKey >> 16) & 0xffff), 4, 16, QLatin1Char('0'))
+    .arg(static_cast<unsigned int>(tagCacheKey & 0xffff), 4, 16, QLatin1Char('0'));
+}
 /// Separator character for table and field names to be used in display rules manager
 static QString TableFieldSeparator(":");
+/// Pragmas that can be set in ctkDICOMDatabase::setDatabasePragma, in the order they are applied.
+/// page_size must precede journal_mode, as page size cannot be changed in WAL mode.
+static const char* SUPPORTED_DATABASE_PRAGMAS[] = { "page_size", "journal_mode", "synchronous", "cache_size", "mmap_size", "temp_store", 0 };
+/// Number of rows that are copied at once when tag cache is migrated from the legacy layout
+static int TAG_CACHE_MIGRATION_BATCH_SIZE = 10000;
+/// Maximum number of values bound to a single statement (SQLite default limit is 999)
+static int MAXIMUM_NUMBER_OF_BOUND_VALUES = 500;
+/// Default maximum number of entries in the lookup cache
+static int DEFAULT_LOOKUP_CACHE_SIZE = 10000;
+/// Default number of threads that copy files into the database folder.
+/// Copying is I/O bound, therefore it does not depend on the number of processor cores.
+static int DEFAULT_STORAGE_COPY_THREAD_COUNT = 4;
+/// Number of threads that delete files of removed items from the database folder
+static int FILE_REMOVAL_THREAD_COUNT = 4;
+/// Number of files deleted by a single task of the file removal thread pool
+static int FILE_REMOVAL_BATCH_SIZE = 200;
+
+//------------------------------------------------------------------------------
+/// Copy file contents without decoding the DICOM dataset. If the file system supports it
+/// (e.g., Btrfs, XFS) then the copy is made by cloning the file extents (reflink), which
+/// does not require reading and writing the data.
+static bool copyFileContents(const QString& sourceFilePath, const QString& destinationFilePath)
+{
+#if defined(Q_OS_LINUX) && defined(FICLONE)
+  int sourceFile = ::open(QFile::encodeName(sourceFilePath).constData(), O_RDONLY);
+  if (sourceFile >= 0)
+  {
+    int destinationFile = ::open(QFile::encodeName(destinationFilePath).constData(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool cloned = false;
+    if (destinationFile >= 0)
+    {
+      cloned = (::ioctl(destinationFile, FICLONE, sourceFile) == 0);
+      ::close(destinationFile);
+    }
+    ::close(sourceFile);
+    if (cloned)
+    {
+      return true;
+    }
+    // cloning is not supported (e.g., different file systems), make a regular copy
+    QFile::remove(destinationFilePath);
+  }
+#endif
+  return QFile::copy(sourceFilePath, destinationFilePath);
+}
+
+//------------------------------------------------------------------------------
+/// Return a unique temporary file path in the folder of the destination file
+static QString temporaryFilePathForFile(const QString& destinationFilePath)
+{
+  return QString("%1.%2.tmp").arg(destinationFilePath).arg(QUuid::createUuid().toString().mid(1, 8));
+}
+
+//------------------------------------------------------------------------------
+/// Replace the destination file with the temporary file. The temporary file is removed if it cannot be renamed.
+static bool replaceFileWithTemporaryFile(const QString& temporaryFilePath, const QString& destinationFilePath)
+{
+#ifdef Q_OS_UNIX
+  // rename replaces the previously stored version of the file atomically
+  bool replaced = (::rename(QFile::encodeName(temporaryFilePath).constData(),
+    QFile::encodeName(destinationFilePath).constData()) == 0);
+#else
+  // QFile::rename does not overwrite existing files
+  QFile::remove(destinationFilePath);
+  bool replaced = QFile::rename(temporaryFilePath, destinationFilePath);
+#endif
+  if (!replaced)
+  {
+    QFile::remove(temporaryFilePath);
+  }
+  return replaced;
+}
+
+//------------------------------------------------------------------------------
+/// Copy a file into the database folder. The file is copied to a temporary file in the
+/// destination folder first, which then replaces the destination file. This way a previously
+/// stored version of the file is kept if copying fails.
+static bool copyDatasetFile(const QString& sourceFilePath, const QString& destinationFilePath)
+{
+  if (QFileInfo(sourceFilePath) == QFileInfo(destinationFilePath))
+  {
+    // file is already in the database folder
+    return true;
+  }
+  QString temporaryFilePath = temporaryFilePathForFile(destinationFilePath);
+  if (!copyFileContents(sourceFilePath, temporaryFilePath))
+  {
+    QFile::remove(temporaryFilePath);
+    return false;
+  }
+  return replaceFileWithTemporaryFile(temporaryFilePath, destinationFilePath);
+}
+
+//------------------------------------------------------------------------------
+/// Save a dataset into the database folder, through a temporary file (same as copyDatasetFile).
+static bool saveDatasetFile(DcmDataset* dataset, const QString& destinationFilePath)
+{
+  QString temporaryFilePath = temporaryFilePathForFile(destinationFilePath);
+#if OFFIS_DCMTK_VERSION_NUMBER < 362
+  DcmFileFormat fileformat(dataset);
+#else
+  // the dataset is written without making a copy of it
+  DcmFileFormat fileformat(dataset, OFFalse /* deepCopy */);
+#endif
+  OFCondition status = fileformat.saveFile(QDir::toNativeSeparators(temporaryFilePath).toUtf8().data());
+#if OFFIS_DCMTK_VERSION_NUMBER >= 362
+  // the dataset is owned by the caller
+  fileformat.getAndRemoveDataset();
+#endif
+  if (status.bad())
+  {
+    QFile::remove(temporaryFilePath);
+    return false;
+  }
+  return replaceFileWithTemporaryFile(temporaryFilePath, destinationFilePath);
+}
+
+//------------------------------------------------------------------------------
+/// Copies a file into the database folder in a thread pool.
+class ctkDICOMDatabaseFileCopier : public QRunnable
+{
+public:
+  ctkDICOMDatabaseFileCopier(const QString& sourceFilePath, const QString& destinationFilePath, bool* success)
+    : SourceFilePath(sourceFilePath)
+    , DestinationFilePath(destinationFilePath)
+    , Success(success)
+  {
+  }
+
+  virtual void run()
+  {
+    *this->Success = copyDatasetFile(this->SourceFilePath, this->DestinationFilePath);
+  }
+
+protected:
+  QString SourceFilePath;
+  QString DestinationFilePath;
+  bool* Success;
+};
+
+//------------------------------------------------------------------------------
+/// Reads values of tags from a file. Used for reading values that are not in the tag cache
+/// in a thread pool.
+class ctkDICOMDatabaseFileValuesReader : public QRunnable
+{
+public:
+  ctkDICOMDatabaseFileValuesReader(const QString& fileName, const QList<DcmTagKey>& tagKeys,
+    const QList<bool>& tagsExcludedFromStorage, const DcmTagKey& stopParsingAtElement, QStringList* values, bool* success)
+    : FileName(fileName)
+    , TagKeys(tagKeys)
+    , TagsExcludedFromStorage(tagsExcludedFromStorage)
+    , StopParsingAtElement(stopParsingAtElement)
+    , Values(values)
+    , Success(success)
+  {
+  }
+
+  virtual void run()
+  {
+    ctkDICOMItem dataset;
+    dataset.InitializeFromFileUntilTag(this->FileName, this->StopParsingAtElement);
+    if (!dataset.IsInitialized())
+    {
+      logger.error("File " + this->FileName + " could not be initialized.");
+      return;
+    }
+    *this->Success = true;
+    for (int tagIndex = 0; tagIndex < this->TagKeys.size(); ++tagIndex)
+    {
+      if (this->TagsExcludedFromStorage[tagIndex])
+      {
+        (*this->Values)[tagIndex] = dataset.TagExists(this->TagKeys[tagIndex]) ? ValueIsNotStored : TagNotInInstance;
+      }
+      else
+      {
+        (*this->Values)[tagIndex] = dataset.GetAllElementValuesAsString(this->TagKeys[tagIndex]);
+      }
+    }
+  }
+
+protected:
+  QString FileName;
+  QList<DcmTagKey> TagKeys;
+  QList<bool> TagsExcludedFromStorage;
+  DcmTagKey StopParsingAtElement;
+  QStringList* Values;
+  bool* Success;
+};
+
+//------------------------------------------------------------------------------
+/// Files that are queued for removal by any database instance of the process.
+/// The indexer stores files through its own database instance, therefore a file
+/// that is stored again must be taken off this set (instead of waiting for the removal
+/// tasks of the instance), so that a pending removal task does not delete the new file.
+static QMutex PendingFileRemovalMutex;
+static QSet<QString> PendingFileRemovalPaths;
+/// Files that are not pending anymore, but are being deleted (without holding the mutex)
+static QSet<QString> RemovingFilePaths;
+/// Signaled when a file is taken off RemovingFilePaths
+static QWaitCondition FileRemovedCondition;
+
+//------------------------------------------------------------------------------
+/// Cancel pending removal of a file that is about to be stored again. When this returns
+/// then the file is either already removed or it will not be removed.
+static void cancelPendingFileRemoval(const QString& filePath)
+{
+  QMutexLocker locker(&PendingFileRemovalMutex);
+  PendingFileRemovalPaths.remove(filePath);
+  // the file is being deleted right now, wait until it is gone
+  while (RemovingFilePaths.contains(filePath))
+  {
+    FileRemovedCondition.wait(&PendingFileRemovalMutex);
+  }
+}
+
+//------------------------------------------------------------------------------
+/// Deletes files (and their thumbnails) of removed items from the database folder in a thread pool.
+/// Files that are not in PendingFileRemovalPaths anymore are kept.
+class ctkDICOMDatabaseFileRemover : public QRunnable
+{
+public:
+  ctkDICOMDatabaseFileRemover(QObject* database, const QStringList& filePaths, const QStringList& thumbnailPaths,
+    QAtomicInt* processedCount, QAtomicInt* totalCount, QAtomicInt* cancelled)
+    : Database(database)
+    , FilePaths(filePaths)
+    , ThumbnailPaths(thumbnailPaths)
+    , ProcessedCount(processedCount)
+    , TotalCount(totalCount)
+    , Cancelled(cancelled)
+  {
+  }
+
+  virtual void run()
+  {
+    QStringList foldersToRemove;
+    int fileIndex = 0;
+    for (; fileIndex < this->FilePaths.size() && !this->Cancelled->loadAcquire(); ++fileIndex)
+    {
+      const QString& filePath = this->FilePaths[fileIndex];
+      RemovalResult fileResult = this->removePendingFile(filePath);
+      if (fileResult == Removed)
+      {
+        QString fileFolder = QFileInfo(filePath).absolutePath();
+        if (foldersToRemove.isEmpty() || foldersToRemove.last() != fileFolder)
+        {
+          foldersToRemove << fileFolder;
+        }
+      }
+      else if (fileResult == NotRemoved)
+      {
+        logger.warn("Failed to remove file " + filePath);
+      }
+      const QString& thumbnailPath = this->ThumbnailPaths[fileIndex];
+      RemovalResult thumbnailResult = this->removePendingFile(thumbnailPath);
+      if (thumbnailResult == Removed)
+      {
+        QString thumbnailFolder = QFileInfo(thumbnailPath).absolutePath();
+        if (foldersToRemove.isEmpty() || foldersToRemove.last() != thumbnailFolder)
+        {
+          foldersToRemove << thumbnailFolder;
+        }
+      }
+      else if (thumbnailResult == NotRemoved && QFile::exists(thumbnailPath))
+      {
+        logger.warn("Failed to remove thumbnail " + thumbnailPath);
+      }
+    }
+    // Files that are skipped because of cancellation are not pending anymore
+    if (fileIndex < this->FilePaths.size())
+    {
+      QMutexLocker locker(&PendingFileRemovalMutex);
+      for (; fileIndex < this->FilePaths.size(); ++fileIndex)
+      {
+        PendingFileRemovalPaths.remove(this->FilePaths[fileIndex]);
+        PendingFileRemovalPaths.remove(this->ThumbnailPaths[fileIndex]);
+      }
+    }
+    // Delete all empty folders that are left after removing the files.
+    // Folders that still contain files of other tasks are removed by the last one.
+    foreach (const QString& folderToRemove, foldersToRemove)
+    {
+      QDir().rmpath(folderToRemove);
+    }
+
+    // Files that are skipped because of cancellation are counted as processed
+    int processedCount = this->ProcessedCount->fetchAndAddOrdered(this->FilePaths.size()) + this->FilePaths.size();
+    QMetaObject::invokeMethod(this->Database, "fileRemovalProgress", Qt::QueuedConnection, Q_ARG(int, processedCount));
+    if (processedCount == this->TotalCount->loadAcquire())
+    {
+      QMetaObject::invokeMethod(this->Database, "fileRemovalFinished", Qt::QueuedConnection);
+    }
+  }
+
+protected:
+  enum RemovalResult
+  {
+    NotPending,
+    Removed,
+    NotRemoved
+  };
+
+  /// Remove the file if it is still pending for removal. The file is deleted after releasing
+  /// the lock of pending files, storing the same file again waits until it is deleted
+  /// (see cancelPendingFileRemoval).
+  RemovalResult removePendingFile(const QString& filePath)
+  {
+    if (filePath.isEmpty())
+    {
+      return NotPending;
+    }
+    {
+      QMutexLocker locker(&PendingFileRemovalMutex);
+      if (!PendingFileRemovalPaths.remove(filePath))
+      {
+        // the file has been stored again since its removal was requested
+        return NotPending;
+      }
+      RemovingFilePaths.insert(filePath);
+    }
+    bool removed = QFile::remove(filePath);
+    {
+      QMutexLocker locker(&PendingFileRemovalMutex);
+      RemovingFilePaths.remove(filePath);
+    }
+    FileRemovedCondition.wakeAll();
+    return removed ? Removed : NotRemoved;
+  }
+
+  QObject* Database;
+  QStringList FilePaths;
+  QStringList ThumbnailPaths;
+  QAtomicInt* ProcessedCount;
+  QAtomicInt* TotalCount;
+  QAtomicInt* Cancelled;
+};
 
 //------------------------------------------------------------------------------
 class ctkDICOMDatabasePrivate
@@ -96,12 +478,66 @@ public:
 
   /// Store copy of the dataset in database folder.
   /// If the original file is available then that will be inserted. If not then a file is created from the dataset object.
+  /// If asyncCopySuccess is specified then the original file is copied in StorageCopyThreadPool and
+  /// asyncCopySuccess is set to the result when the copy is completed (StorageCopyThreadPool.waitForDone()).
   bool storeDatasetFile(const ctkDICOMItem& dataset, const QString& originalFilePath,
-    const QString& studyInstanceUID, const QString& seriesInstanceUID, const QString& sopInstanceUID, QString& storedFilePath);
+    const QString& studyInstanceUID, const QString& seriesInstanceUID, const QString& sopInstanceUID, QString& storedFilePath,
+    bool* asyncCopySuccess = nullptr);
+  /// Threads that copy files into the database folder during batch insert
+  QThreadPool StorageCopyThreadPool;
+
+  /// Delete files and thumbnails of removed items in FileRemovalThreadPool.
+  /// Paths of files that are not stored in the database folder are empty, only their thumbnail is deleted.
+  void startFileRemoval(const QStringList& filePaths, const QStringList& thumbnailPaths);
+  /// Threads that delete files of removed items from the database folder
+  QThreadPool FileRemovalThreadPool;
+  /// Number of files queued for removal and number of files processed since file removal was last idle
+  QAtomicInt FileRemovalTotalCount;
+  QAtomicInt FileRemovalProcessedCount;
+  /// Set while file removal is being cancelled
+  QAtomicInt FileRemovalCancelled;
 
   /// Returns false in case of an error
   bool indexingStatusForFile(const QString& filePath, const QString& sopInstanceUID, bool& datasetInDatabase, bool& datasetUpToDate, QString& databaseFilename);
 
+  /// Returns true if filePath is the same file as databaseFilename and it has not been modified since insertTimestamp
+  bool isDatabaseFileUpToDate(const QString& filePath, const QString& databaseFilename, const QString& insertTimestamp);
+
+  /// Run a query that contains a "%1" placeholder for a list of values (such as "... WHERE UID IN (%1)").
+  /// The query is executed for chunks of the values to not exceed the maximum number of bound values
+  /// in a statement. Records of all result rows are appended to records.
+  bool selectForValues(QSqlDatabase& database, const QString& queryTemplate, const QStringList& values, QList<QSqlRecord>& records);
+
+  /// Run a statement that contains a "%1" placeholder for a list of values (such as "DELETE ... WHERE UID IN (%1)")
+  /// for chunks of the values, same as selectForValues.
+  bool execForValues(QSqlDatabase& database, const QString& queryTemplate, const QStringList& values);
+
+  /// Create (or replace) a temporary table with a single SOPInstanceUID column that contains the specified values.
+  /// Temporary tables are only visible in the database connection that created them and can be used in joins
+  /// to process many instances in one statement.
+  bool createTemporaryInstanceTable(QSqlDatabase& database, const QString& tableName, const QVariantList& sopInstanceUIDs);
+
+  /// Get insert timestamp and file name for all SOP instances that are already in the database
+  bool insertTimestampsAndFilenamesForInstances(const QStringList& sopInstanceUIDs,
+    QHash<QString, QPair<QString, QString> >& insertTimestampAndFilenameForInstance);
+
+  /// Basic UIDs of a dataset, as returned by uidsForDataSet
+  struct InstanceUIDs
+  {
+    QString sopInstanceUID;
+    QString patientsName;
+    QString patientID;
+    QString studyInstanceUID;
+    QString seriesInstanceUID;
+    bool valid;
+  };
+
+  /// Add patients, studies, and series of the datasets that are already in the database to the
+  /// inserted item caches (InsertedPatientsCompositeIDCache, InsertedStudyUIDsCache, InsertedSeriesUIDsCache)
+  /// so that they do not have to be looked up one by one during insert.
+  void cacheExistingPatientsStudiesSeries(const QList<ctkDICOMDatabase::IndexingResult>& indexingResults,
+    const QVector<InstanceUIDs>& instanceUIDsForResults);
+
   /// Retrieve thumbnail from file and store in database folder.
   bool storeThumbnailFile(const QString& originalFilePath,
     const QString& studyInstanceUID, const QString& seriesInstanceUID, const QString& sopInstanceUID);
@@ -145,15 +581,42 @@ public:
 
   QVector<QMap<QString /*DisplayField*/, QString /*Value*/> > displayedFieldsVectorPatient; // The index in the vector is the internal patient UID
   /// Calculate count (number of objects in interest) for each series in the displayed fields container
+  /// that does not have a count yet. Counts are written directly to the database and they are removed
+  /// from the container, so that applyDisplayedFieldsChanges does not overwrite counts that are updated
+  /// by triggers meanwhile.
   /// \param displayedFieldsMapSeries (SeriesInstanceUID -> (DisplayField -> Value) )
   void setCountToSeriesDisplayedFields(QMap<QString, QMap<QString, QString> > &displayedFieldsMapSeries);
-  /// Calculate number of series for each study in the displayed fields container
+  /// Calculate number of series for each study in the displayed fields container, same as setCountToSeriesDisplayedFields
   /// \param displayedFieldsMapStudy (StudyInstanceUID -> (DisplayField -> Value) )
   void setNumberOfSeriesToStudyDisplayedFields(QMap<QString, QMap<QString, QString> > &displayedFieldsMapStudy);
-  /// Calculate number of studies for each patient in the displayed fields container
+  /// Calculate number of studies for each patient in the displayed fields container, same as setCountToSeriesDisplayedFields
   /// \param displayedFieldsVectorPatient (Internal_ID -> (DisplayField -> Value) )
   void setNumberOfStudiesToPatientDisplayedFields(QMap<QString, QMap<QString, QString> >& displayedFieldsMapPatient);
 
+  /// Create triggers that keep the displayed number of images, series, and studies up-to-date
+  /// when rows are inserted to or removed from the Images, Series, and Studies tables.
+  /// Counts that are NULL (not computed yet) are left unchanged by the triggers and they are
+  /// computed from scratch when displayed fields are updated.
+  /// Triggers are only created if the database has displayed fields.
+  /// Existing triggers are only replaced if recreate is true (when the schema is initialized), otherwise
+  /// only missing triggers are created, so that opening the database does not need to write it.
+  bool updateDisplayedFieldsCountTriggers(bool recreate);
+
+  /// Create the table that stores fingerprints of indexed directories, if it does not exist yet.
+  /// The table is not part of the schema file, so that it can be added to existing databases
+  /// without requiring a schema update (which would re-index all the files).
+  bool createDirectoryFingerprintsTable();
+
+  /// Create the full-text search index (an FTS5 table named after the table with "FTS" suffix) of the
+  /// Patients, Studies, and Series tables that do not have one yet, and fill it from the current rows.
+  /// Existing indices are replaced if recreate is true (e.g., when the schema is initialized).
+  /// Rowids of the index are the rowids of the indexed rows.
+  /// Returns false if the FTS5 module is not available in the SQLite library.
+  bool createFullTextSearchIndex(bool recreate);
+  /// Replace the index entries of the rows of the table that have the specified key field values.
+  /// Entries of rows that no longer exist are only removed if rows are specified by rowid.
+  bool updateFullTextSearchIndex(const QString& tableName, const QString& keyFieldName, const QStringList& keys);
+
   int rowCount(const QString& tableName);
 
   /// Name of the database file (i.e. for SQLITE the sqlite file)
@@ -162,6 +625,11 @@ public:
   QSqlDatabase Database;
   QMap<QString, QString> LoadedHeader;
   bool DisplayedFieldsTableAvailable;
+  /// Indexed fields of the tables that have a full-text search index (table name -> field names)
+  QMap<QString, QStringList> FullTextSearchIndexFieldNames;
+
+  /// SQLite pragmas set for each database connection (pragma name -> value)
+  QMap<QString, QString> DatabasePragmas;
 
   ctkDICOMAbstractThumbnailGenerator* ThumbnailGenerator;
 
@@ -184,6 +652,22 @@ public:
   /// resets the variables to new inserts won't be fooled by leftover values
   void resetLastInsertedValues();
 
+  /// Cache of recent lookups (instance -> file, file -> series, series -> study, ...).
+  /// Keys are made of the lookup type and the argument (see lookupCacheKey).
+  /// Only found values are cached, as a missing record may be inserted
+  /// by another database connection (e.g., background indexing) at any time.
+  /// The cache is cleared whenever records are inserted or removed.
+  QCache<QString, QString> LookupCache;
+  int LookupCacheHitCount;
+  int LookupCacheMissCount;
+  /// Lookups may be called from multiple threads (e.g., thumbnail generation)
+  mutable QMutex LookupCacheMutex;
+  static QString lookupCacheKey(const QString& lookupType, const QString& argument);
+  /// Returns true and sets result if the value is found in the lookup cache.
+  bool cachedLookup(const QString& lookupType, const QString& argument, QString& result);
+  void cacheLookup(const QString& lookupType, const QString& argument, const QString& result);
+  void clearLookupCache();
+
   /// tagCache table has been checked to exist
   bool TagCacheVerified;
   /// tag cache has independent database to avoid locking issue
@@ -194,6 +678,23 @@ public:
   QStringList TagsToPrecache;
   QStringList TagsToExcludeFromStorage;
   bool openTagCacheDatabase();
+
+  /// Create the tag cache tables in the tag cache database
+  bool createTagCacheTables();
+  /// Convert tag cache from the legacy layout (SOPInstanceUID, Tag, Value text columns) to the compact layout
+  bool migrateLegacyTagCache();
+  /// Insert values into the tag cache. Tags are specified as "gggg,eeee" strings.
+  /// Empty values are replaced by TagNotInInstance.
+  bool insertCachedTags(const QVariantList& sopInstanceUIDs, const QVariantList& tags, const QVariantList& values);
+
+  /// Get values of tags for instances, reading tag cache and files as needed.
+  /// If file name of an instance is not specified then it is looked up in the database (if needed).
+  /// If SOP instance UID is not specified then the values are read from the file and are not cached.
+  QList<QStringList> valuesForInstances(const QStringList& sopInstanceUIDs, QStringList fileNames, const QStringList& tags);
+
+  /// Set pragmas in DatabasePragmas for the database connection.
+  /// If pragmaName is specified then only that pragma is set.
+  bool applyDatabasePragmas(QSqlDatabase& database, const QString& pragmaName = QString());
   void precacheTags(const ctkDICOMItem& dataset, const QString sopInstanceUID);
 
   // Return true if a new item is inserted
@@ -213,6 +714,12 @@ ctkDICOMDatabasePrivate::ctkDICOMDatabasePrivate(ctkDICOMDatabase& o): q_ptr(&o)
   this->LoggedExecVerbose = false;
   this->TagCacheVerified = false;
   this->DisplayedFieldsTableAvailable = false;
+  this->DatabasePragmas["synchronous"] = "OFF";
+  this->LookupCache.setMaxCost(DEFAULT_LOOKUP_CACHE_SIZE);
+  this->StorageCopyThreadPool.setMaxThreadCount(DEFAULT_STORAGE_COPY_THREAD_COUNT);
+  this->FileRemovalThreadPool.setMaxThreadCount(FILE_REMOVAL_THREAD_COUNT);
+  this->LookupCacheHitCount = 0;
+  this->LookupCacheMissCount = 0;
   this->resetLastInsertedValues();
 }
 
@@ -224,6 +731,53 @@ void ctkDICOMDatabasePrivate::resetLastInsertedValues()
   this->InsertedSeriesUIDsCache.clear();
 }
 
+//------------------------------------------------------------------------------
+QString ctkDICOMDatabasePrivate::lookupCacheKey(const QString& lookupType, const QString& argument)
+{
+  return lookupType + QLatin1Char('\n') + argument;
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabasePrivate::cachedLookup(const QString& lookupType, const QString& argument, QString& result)
+{
+  QMutexLocker locker(&this->LookupCacheMutex);
+  if (this->LookupCache.maxCost() <= 0)
+  {
+    return false;
+  }
+  QString* cachedResult = this->LookupCache.object(lookupCacheKey(lookupType, argument));
+  if (!cachedResult)
+  {
+    this->LookupCacheMissCount++;
+    return false;
+  }
+  this->LookupCacheHitCount++;
+  result = *cachedResult;
+  return true;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMDatabasePrivate::cacheLookup(const QString& lookupType, const QString& argument, const QString& result)
+{
+  if (result.isEmpty())
+  {
+    return;
+  }
+  QMutexLocker locker(&this->LookupCacheMutex);
+  if (this->LookupCache.maxCost() <= 0)
+  {
+    return;
+  }
+  this->LookupCache.insert(lookupCacheKey(lookupType, argument), new QString(result));
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMDatabasePrivate::clearLookupCache()
+{
+  QMutexLocker locker(&this->LookupCacheMutex);
+  this->LookupCache.clear();
+}
+
 //------------------------------------------------------------------------------
 void ctkDICOMDatabasePrivate::init(QString databaseFilename)
 {
@@ -451,7 +1005,7 @@ bool ctkDICOMDatabasePrivate::insertPatient(const ctkDICOMItem& dataset, int& db
     insertPatientStatement.prepare("INSERT INTO Patients "
       "( 'UID', 'PatientsName', 'PatientID', 'PatientsBirthDate', 'PatientsBirthTime', 'PatientsSex', 'PatientsAge', 'PatientsComments', "
       "'InsertTimestamp', 'DisplayedPatientsName', 'DisplayedNumberOfStudies', 'DisplayedFieldsUpdatedTimestamp' ) "
-      "VALUES ( NULL, ?, ?, ?, ?, ?, ?, ?, ?, NULL, NULL, NULL )");
+      "VALUES ( NULL, ?, ?, ?, ?, ?, ?, ?, ?, NULL, 0, NULL )");
     insertPatientStatement.bindValue(0, patientsName);
     insertPatientStatement.bindValue(1, patientID);
     insertPatientStatement.bindValue(2, QDate::fromString(patientsBirthDate, "yyyyMMdd"));
@@ -465,6 +1019,7 @@ bool ctkDICOMDatabasePrivate::insertPatient(const ctkDICOMItem& dataset, int& db
     loggedExec(insertPatientStatement);
     dbPatientID = insertPatientStatement.lastInsertId().toInt();
     this->InsertedPatientsCompositeIDCache[compositeID] = dbPatientID;
+    this->updateFullTextSearchIndex("Patients", "rowid", QStringList() << QString::number(dbPatientID));
     if (this->LoggedExecVerbose)
     {
       logger.debug("New patient inserted: database item ID = " + QString().setNum(dbPatientID));
@@ -502,7 +1057,7 @@ bool ctkDICOMDatabasePrivate::insertStudy(const ctkDICOMItem& dataset, int dbPat
     insertStudyStatement.prepare( "INSERT INTO Studies "
       "( 'StudyInstanceUID', 'PatientsUID', 'StudyID', 'StudyDate', 'StudyTime', 'AccessionNumber', 'ModalitiesInStudy', 'InstitutionName', 'ReferringPhysician', 'PerformingPhysiciansName', "
         "'StudyDescription', 'InsertTimestamp', 'DisplayedNumberOfSeries', 'DisplayedFieldsUpdatedTimestamp' ) "
-      "VALUES ( ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, NULL, NULL )" );
+      "VALUES ( ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, 0, NULL )" );
     insertStudyStatement.addBindValue( studyInstanceUID );
     insertStudyStatement.addBindValue( dbPatientID );
     insertStudyStatement.addBindValue( studyID );
@@ -522,6 +1077,7 @@ bool ctkDICOMDatabasePrivate::insertStudy(const ctkDICOMItem& dataset, int dbPat
     else
     {
       this->InsertedStudyUIDsCache.insert(studyInstanceUID);
+      this->updateFullTextSearchIndex("Studies", "rowid", QStringList() << insertStudyStatement.lastInsertId().toString());
     }
 
     return true;
@@ -572,8 +1128,9 @@ bool ctkDICOMDatabasePrivate::insertSeries(const ctkDICOMItem& dataset, QString
     QSqlQuery insertSeriesStatement(this->Database);
     insertSeriesStatement.prepare( "INSERT INTO Series "
       "( 'SeriesInstanceUID', 'StudyInstanceUID', 'SeriesNumber', 'SeriesDate', 'SeriesTime', 'SeriesDescription', 'Modality', 'BodyPartExamined', "
-        "'FrameOfReferenceUID', 'AcquisitionNumber', 'ContrastAgent', 'ScanningSequence', 'EchoNumber', 'TemporalPosition', 'InsertTimestamp' ) "
-      "VALUES ( ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ? )" );
+        "'FrameOfReferenceUID', 'AcquisitionNumber', 'ContrastAgent', 'ScanningSequence', 'EchoNumber', 'TemporalPosition', 'InsertTimestamp', "
+        "'DisplayedCount' ) "
+      "VALUES ( ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, 0 )" );
     insertSeriesStatement.addBindValue( seriesInstanceUID );
     insertSeriesStatement.addBindValue( studyInstanceUID );
     insertSeriesStatement.addBindValue( static_cast<int>(seriesNumber) );
@@ -598,6 +1155,7 @@ bool ctkDICOMDatabasePrivate::insertSeries(const ctkDICOMItem& dataset, QString
     else
     {
       this->InsertedSeriesUIDsCache.insert(seriesInstanceUID);
+      this->updateFullTextSearchIndex("Series", "rowid", QStringList() << insertSeriesStatement.lastInsertId().toString());
     }
 
     return true;
@@ -631,87 +1189,445 @@ bool ctkDICOMDatabasePrivate::openTagCacheDatabase()
     return false;
   }
 
-  // Disable synchronous writing to make modifications faster
-  QSqlQuery pragmaSyncQuery(this->TagCacheDatabase);
-  pragmaSyncQuery.exec("PRAGMA synchronous = OFF");
-  pragmaSyncQuery.finish();
+  this->applyDatabasePragmas(this->TagCacheDatabase);
 
   return true;
 }
 
 //------------------------------------------------------------------------------
-void ctkDICOMDatabasePrivate::precacheTags(const ctkDICOMItem& dataset, const QString sopInstanceUID)
+bool ctkDICOMDatabasePrivate::createTagCacheTables()
 {
-  Q_Q(ctkDICOMDatabase);
-
-  QStringList sopInstanceUIDs, tags, values;
-  foreach (const QString &tag, this->TagsToPrecache)
-    {
-    unsigned short group, element;
-    q->tagToGroupElement(tag, group, element);
-    DcmTagKey tagKey(group, element);
-    QString value;
-    if (this->TagsToExcludeFromStorage.contains(tag))
+  // SOP instance UIDs are stored only once, in TagCacheInstances. Cached values refer to the instance
+  // by its integer ID and the tag is stored as a 32-bit integer, which makes the tag cache several
+  // times smaller than storing the text of the SOP instance UID and tag in each row.
+  // TagCache view provides the legacy (SOPInstanceUID, Tag, Value) layout for reading.
+  QStringList statements;
+  statements << "CREATE TABLE TagCacheInstances (InstanceID INTEGER PRIMARY KEY, SOPInstanceUID TEXT NOT NULL UNIQUE)";
+  statements << "CREATE TABLE TagCacheValues (InstanceID INTEGER NOT NULL, Tag INTEGER NOT NULL, Value, "
+    "PRIMARY KEY (InstanceID, Tag)) WITHOUT ROWID";
+  statements << "CREATE VIEW TagCache AS SELECT TagCacheInstances.SOPInstanceUID AS SOPInstanceUID, "
+    "printf('%04x,%04x', TagCacheValues.Tag >> 16, TagCacheValues.Tag & 65535) AS Tag, TagCacheValues.Value AS Value "
+    "FROM TagCacheValues INNER JOIN TagCacheInstances ON TagCacheValues.InstanceID = TagCacheInstances.InstanceID";
+  foreach(const QString& statement, statements)
+  {
+    QSqlQuery createQuery(this->TagCacheDatabase);
+    if (!this->loggedExec(createQuery, statement))
     {
-      if (dataset.TagExists(tagKey))
-      {
-        value = ValueIsNotStored;
-      }
-      else
-      {
-        value = TagNotInInstance;
-      }
+      return false;
     }
-    else
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabasePrivate::migrateLegacyTagCache()
+{
+  logger.info("Converting tag cache to compact layout: " + this->TagCacheDatabaseFilename);
+
+  this->TagCacheDatabase.transaction();
+  QSqlQuery renameQuery(this->TagCacheDatabase);
+  if (!this->loggedExec(renameQuery, QString("ALTER TABLE TagCache RENAME TO LegacyTagCache")) || !this->createTagCacheTables())
+  {
+    this->TagCacheDatabase.rollback();
+    return false;
+  }
+
+  QSqlQuery insertInstancesQuery(this->TagCacheDatabase);
+  if (!this->loggedExec(insertInstancesQuery,
+    QString("INSERT OR IGNORE INTO TagCacheInstances (SOPInstanceUID) SELECT DISTINCT SOPInstanceUID FROM LegacyTagCache")))
+  {
+    this->TagCacheDatabase.rollback();
+    return false;
+  }
+
+  // Tags are converted to integers while copying (SQLite cannot parse hexadecimal strings)
+  QSqlQuery legacyValuesQuery(this->TagCacheDatabase);
+  legacyValuesQuery.setForwardOnly(true);
+  if (!this->loggedExec(legacyValuesQuery, QString("SELECT SOPInstanceUID, Tag, Value FROM LegacyTagCache")))
+  {
+    this->TagCacheDatabase.rollback();
+    return false;
+  }
+  QVariantList sopInstanceUIDs;
+  QVariantList tags;
+  QVariantList values;
+  bool moreValues = legacyValuesQuery.next();
+  while (moreValues)
+  {
+    sopInstanceUIDs << legacyValuesQuery.value(0);
+    tags << legacyValuesQuery.value(1);
+    values << legacyValuesQuery.value(2);
+    moreValues = legacyValuesQuery.next();
+    if (sopInstanceUIDs.size() >= TAG_CACHE_MIGRATION_BATCH_SIZE || !moreValues)
     {
-      value = dataset.GetAllElementValuesAsString(tagKey);
-    }
-    sopInstanceUIDs << sopInstanceUID;
-    tags << tag;
-    values << value;
+      // values with invalid tags are skipped (and logged), they do not make the migration fail
+      this->insertCachedTags(sopInstanceUIDs, tags, values);
+      sopInstanceUIDs.clear();
+      tags.clear();
+      values.clear();
     }
+  }
+  legacyValuesQuery.finish();
 
-  this->TagCacheDatabase.transaction();
-  q->cacheTags(sopInstanceUIDs, tags, values);
+  QSqlQuery dropQuery(this->TagCacheDatabase);
+  bool success = this->loggedExec(dropQuery, QString("DROP TABLE LegacyTagCache"));
   this->TagCacheDatabase.commit();
+
+  // Reclaim the disk space used by the legacy table
+  QSqlQuery vacuumQuery(this->TagCacheDatabase);
+  this->loggedExec(vacuumQuery, QString("VACUUM"));
+
+  return success;
 }
 
 //------------------------------------------------------------------------------
-bool ctkDICOMDatabasePrivate::removeImage(const QString& sopInstanceUID)
+bool ctkDICOMDatabasePrivate::insertCachedTags(const QVariantList& sopInstanceUIDs, const QVariantList& tags,
+  const QVariantList& values)
 {
-  Q_Q(ctkDICOMDatabase);
-  QSqlQuery deleteFile(Database);
-  deleteFile.prepare("DELETE FROM Images WHERE SOPInstanceUID == :sopInstanceUID");
-  deleteFile.bindValue(":sopInstanceUID", sopInstanceUID);
-  bool success = deleteFile.exec();
-  if (!success)
+  QVariantList validSOPInstanceUIDs;
+  QVariantList tagCacheKeys;
+  QVariantList validValues;
+  bool success = true;
+  for (int valueIndex = 0; valueIndex < sopInstanceUIDs.size(); ++valueIndex)
   {
-    logger.error("SQLITE ERROR deleting old image row: " + deleteFile.lastError().driverText());
+    qint64 tagCacheKey = 0;
+    if (!tagCacheKeyForTag(tags[valueIndex].toString(), tagCacheKey))
+    {
+      logger.error("Failed to cache tag: invalid tag " + tags[valueIndex].toString());
+      success = false;
+      continue;
+    }
+    validSOPInstanceUIDs << sopInstanceUIDs[valueIndex];
+    tagCacheKeys << tagCacheKey;
+    QString value = values[valueIndex].toString();
+    // replace empty strings with special flag string
+    validValues << (value.isEmpty() ? TagNotInInstance : value);
+  }
+  if (validSOPInstanceUIDs.isEmpty())
+  {
+    return success;
   }
+
+  QSqlQuery insertInstances(this->TagCacheDatabase);
+  insertInstances.prepare("INSERT OR IGNORE INTO TagCacheInstances (SOPInstanceUID) VALUES (?)");
+  insertInstances.addBindValue(validSOPInstanceUIDs);
+  success = this->loggedExecBatch(insertInstances) && success;
+
+  QSqlQuery insertValues(this->TagCacheDatabase);
+  insertValues.prepare("INSERT OR REPLACE INTO TagCacheValues (InstanceID, Tag, Value) VALUES "
+    "((SELECT InstanceID FROM TagCacheInstances WHERE SOPInstanceUID = ?), ?, ?)");
+  insertValues.addBindValue(validSOPInstanceUIDs);
+  insertValues.addBindValue(tagCacheKeys);
+  insertValues.addBindValue(validValues);
+  success = this->loggedExecBatch(insertValues) && success;
   return success;
 }
 
 //------------------------------------------------------------------------------
-bool ctkDICOMDatabasePrivate::storeDatasetFile(const ctkDICOMItem& dataset, const QString& originalFilePath,
-  const QString& studyInstanceUID, const QString& seriesInstanceUID, const QString& sopInstanceUID,
-  QString& storedFilePath)
+QList<QStringList> ctkDICOMDatabasePrivate::valuesForInstances(const QStringList& sopInstanceUIDs,
+  QStringList fileNames, const QStringList& tags)
 {
   Q_Q(ctkDICOMDatabase);
+  const int numberOfInstances = sopInstanceUIDs.size();
+  const int numberOfTags = tags.size();
 
-  if (sopInstanceUID.isEmpty())
+  QStringList emptyRow;
+  for (int tagIndex = 0; tagIndex < numberOfTags; ++tagIndex)
   {
-    return false;
+    emptyRow << QString();
+  }
+  QVector<QStringList> values(numberOfInstances, emptyRow);
+  // Indicates for each instance and tag if the value is found in the tag cache
+  QVector<QVector<bool> > valueFound(numberOfInstances, QVector<bool>(numberOfTags, false));
+  if (numberOfInstances == 0 || numberOfTags == 0)
+  {
+    return values.toList();
   }
 
-  QString destinationDirectoryName = q->databaseDirectory() + "/dicom/";
-  QDir destinationDir(destinationDirectoryName);
-  storedFilePath = destinationDirectoryName +
-    studyInstanceUID + "/" +
-    seriesInstanceUID + "/" +
-    sopInstanceUID;
+  QHash<qint64, QList<int> > tagIndicesForTagCacheKey;
+  QStringList tagCacheKeyStrings;
+  for (int tagIndex = 0; tagIndex < numberOfTags; ++tagIndex)
+  {
+    qint64 tagCacheKey = 0;
+    if (!tagCacheKeyForTag(tags[tagIndex], tagCacheKey))
+    {
+      logger.error("Invalid tag: " + tags[tagIndex]);
+      // invalid tags are reported as found with empty value, they are not read from the files
+      for (int instanceIndex = 0; instanceIndex < numberOfInstances; ++instanceIndex)
+      {
+        valueFound[instanceIndex][tagIndex] = true;
+      }
+      continue;
+    }
+    tagIndicesForTagCacheKey[tagCacheKey] << tagIndex;
+    tagCacheKeyStrings << QString::number(tagCacheKey);
+  }
+
+  QHash<QString, QList<int> > instanceIndicesForSOPInstanceUID;
+  QVariantList lookupSOPInstanceUIDs;
+  for (int instanceIndex = 0; instanceIndex < numberOfInstances; ++instanceIndex)
+  {
+    if (sopInstanceUIDs[instanceIndex].isEmpty())
+    {
+      continue;
+    }
+    instanceIndicesForSOPInstanceUID[sopInstanceUIDs[instanceIndex]] << instanceIndex;
+    lookupSOPInstanceUIDs << sopInstanceUIDs[instanceIndex];
+  }
+
+  // Get all cached values in one query
+  if (!lookupSOPInstanceUIDs.isEmpty() && !tagCacheKeyStrings.isEmpty()
+    && (q->tagCacheExists() || q->initializeTagCache())
+    && this->createTemporaryInstanceTable(this->TagCacheDatabase, "InstanceValuesLookup", lookupSOPInstanceUIDs))
+  {
+    QSqlQuery cachedValuesQuery(this->TagCacheDatabase);
+    cachedValuesQuery.setForwardOnly(true);
+    // tag cache keys are integers computed above, therefore they can be safely included in the query string
+    if (this->loggedExec(cachedValuesQuery, QString(
+      "SELECT TagCacheInstances.SOPInstanceUID, TagCacheValues.Tag, TagCacheValues.Value "
+      "FROM temp.InstanceValuesLookup "
+      "INNER JOIN TagCacheInstances ON TagCacheInstances.SOPInstanceUID = InstanceValuesLookup.SOPInstanceUID "
+      "INNER JOIN TagCacheValues ON TagCacheValues.InstanceID = TagCacheInstances.InstanceID "
+      "WHERE TagCacheValues.Tag IN (%1)").arg(tagCacheKeyStrings.join(","))))
+    {
+      while (cachedValuesQuery.next())
+      {
+        QString value = cachedValuesQuery.value(2).toString();
+        if (value == TagNotInInstance || value == ValueIsEmptyString || value == ValueIsNotStored)
+        {
+          value = QString("");
+        }
+        const QList<int>& instanceIndices = instanceIndicesForSOPInstanceUID[cachedValuesQuery.value(0).toString()];
+        const QList<int>& tagIndices = tagIndicesForTagCacheKey[cachedValuesQuery.value(1).toLongLong()];
+        foreach(int instanceIndex, instanceIndices)
+        {
+          foreach(int tagIndex, tagIndices)
+          {
+            values[instanceIndex][tagIndex] = value;
+            valueFound[instanceIndex][tagIndex] = true;
+          }
+        }
+      }
+    }
+    cachedValuesQuery.finish();
+    QSqlQuery dropTableQuery(this->TagCacheDatabase);
+    this->loggedExec(dropTableQuery, QString("DROP TABLE IF EXISTS temp.InstanceValuesLookup ;"));
+  }
 
-  destinationDir.mkpath(studyInstanceUID + "/" +
-    seriesInstanceUID);
+  // Find instances that have values missing from the tag cache
+  QList<int> instanceIndicesToRead;
+  QStringList sopInstanceUIDsWithoutFileName;
+  for (int instanceIndex = 0; instanceIndex < numberOfInstances; ++instanceIndex)
+  {
+    if (!valueFound[instanceIndex].contains(false))
+    {
+      continue;
+    }
+    instanceIndicesToRead << instanceIndex;
+    if (fileNames[instanceIndex].isEmpty() && !sopInstanceUIDs[instanceIndex].isEmpty())
+    {
+      sopInstanceUIDsWithoutFileName << sopInstanceUIDs[instanceIndex];
+    }
+  }
+  if (instanceIndicesToRead.isEmpty())
+  {
+    return values.toList();
+  }
+  if (!sopInstanceUIDsWithoutFileName.isEmpty())
+  {
+    QList<QSqlRecord> records;
+    this->selectForValues(this->Database, "SELECT SOPInstanceUID, Filename FROM Images WHERE SOPInstanceUID IN (%1)",
+      sopInstanceUIDsWithoutFileName, records);
+    foreach(const QSqlRecord& record, records)
+    {
+      foreach(int instanceIndex, instanceIndicesForSOPInstanceUID[record.value(0).toString()])
+      {
+        fileNames[instanceIndex] = record.value(1).toString();
+      }
+    }
+  }
+
+  // Read missing values from the files in parallel. Only the header is read (up to the last requested tag).
+  QList<DcmTagKey> tagKeys;
+  QList<bool> tagsExcludedFromStorage;
+  DcmTagKey lastRequestedElement(0x0000, 0x0000);
+  for (int tagIndex = 0; tagIndex < numberOfTags; ++tagIndex)
+  {
+    unsigned short group = 0;
+    unsigned short element = 0;
+    q->tagToGroupElement(tags[tagIndex], group, element);
+    DcmTagKey tagKey(group, element);
+    tagKeys << tagKey;
+    bool excludedFromStorage = this->TagsToExcludeFromStorage.contains(q->groupElementToTag(group, element));
+    tagsExcludedFromStorage << excludedFromStorage;
+    if (lastRequestedElement < tagKey)
+    {
+      lastRequestedElement = tagKey;
+    }
+  }
+  DcmTagKey stopParsingAtElement = DCM_UndefinedTagKey;
+  if (lastRequestedElement.getElement() < 0xffff)
+  {
+    stopParsingAtElement = DcmTagKey(lastRequestedElement.getGroup(), lastRequestedElement.getElement() + 1);
+  }
+  else if (lastRequestedElement.getGroup() < 0xffff)
+  {
+    stopParsingAtElement = DcmTagKey(lastRequestedElement.getGroup() + 1, 0x0000);
+  }
+
+  QVector<QStringList> fileValues(instanceIndicesToRead.size(), emptyRow);
+  QVector<bool> fileReadSuccess(instanceIndicesToRead.size(), false);
+  QThreadPool fileReaderThreadPool;
+  for (int readIndex = 0; readIndex < instanceIndicesToRead.size(); ++readIndex)
+  {
+    const QString& fileName = fileNames[instanceIndicesToRead[readIndex]];
+    if (fileName.isEmpty())
+    {
+      continue;
+    }
+    fileReaderThreadPool.start(new ctkDICOMDatabaseFileValuesReader(fileName, tagKeys, tagsExcludedFromStorage,
+      stopParsingAtElement, &fileValues[readIndex], &fileReadSuccess[readIndex]));
+  }
+  fileReaderThreadPool.waitForDone();
+
+  // Store values in the output and the tag cache
+  QVariantList cacheSOPInstanceUIDs;
+  QVariantList cacheTags;
+  QVariantList cacheValues;
+  QSet<QString> cachedSOPInstanceUIDs;
+  for (int readIndex = 0; readIndex < instanceIndicesToRead.size(); ++readIndex)
+  {
+    if (!fileReadSuccess[readIndex])
+    {
+      // values that could not be read are left empty
+      continue;
+    }
+    int instanceIndex = instanceIndicesToRead[readIndex];
+    const QString& sopInstanceUID = sopInstanceUIDs[instanceIndex];
+    bool addToCache = !sopInstanceUID.isEmpty() && !cachedSOPInstanceUIDs.contains(sopInstanceUID);
+    cachedSOPInstanceUIDs.insert(sopInstanceUID);
+    for (int tagIndex = 0; tagIndex < numberOfTags; ++tagIndex)
+    {
+      if (valueFound[instanceIndex][tagIndex])
+      {
+        continue;
+      }
+      QString value = fileValues[readIndex][tagIndex];
+      if (addToCache)
+      {
+        cacheSOPInstanceUIDs << sopInstanceUID;
+        cacheTags << q->groupElementToTag(tagKeys[tagIndex].getGroup(), tagKeys[tagIndex].getElement());
+        cacheValues << value;
+      }
+      if (value == TagNotInInstance || value == ValueIsNotStored)
+      {
+        value = QString("");
+      }
+      values[instanceIndex][tagIndex] = value;
+    }
+  }
+  if (!cacheSOPInstanceUIDs.isEmpty())
+  {
+    this->TagCacheDatabase.transaction();
+    this->insertCachedTags(cacheSOPInstanceUIDs, cacheTags, cacheValues);
+    this->TagCacheDatabase.commit();
+  }
+
+  return values.toList();
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabasePrivate::applyDatabasePragmas(QSqlDatabase& database, const QString& pragmaName)
+{
+  bool success = true;
+  for (int pragmaIndex = 0; SUPPORTED_DATABASE_PRAGMAS[pragmaIndex]; ++pragmaIndex)
+  {
+    QString name = SUPPORTED_DATABASE_PRAGMAS[pragmaIndex];
+    if (!this->DatabasePragmas.contains(name) || (!pragmaName.isEmpty() && name != pragmaName))
+    {
+      continue;
+    }
+    QSqlQuery pragmaQuery(database);
+    if (!this->loggedExec(pragmaQuery, QString("PRAGMA %1 = %2").arg(name).arg(this->DatabasePragmas[name])))
+    {
+      success = false;
+    }
+    pragmaQuery.finish();
+  }
+  return success;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMDatabasePrivate::precacheTags(const ctkDICOMItem& dataset, const QString sopInstanceUID)
+{
+  Q_Q(ctkDICOMDatabase);
+
+  QStringList sopInstanceUIDs, tags, values;
+  foreach (const QString &tag, this->TagsToPrecache)
+    {
+    unsigned short group, element;
+    q->tagToGroupElement(tag, group, element);
+    DcmTagKey tagKey(group, element);
+    QString value;
+    if (this->TagsToExcludeFromStorage.contains(tag))
+    {
+      if (dataset.TagExists(tagKey))
+      {
+        value = ValueIsNotStored;
+      }
+      else
+      {
+        value = TagNotInInstance;
+      }
+    }
+    else
+    {
+      value = dataset.GetAllElementValuesAsString(tagKey);
+    }
+    sopInstanceUIDs << sopInstanceUID;
+    tags << tag;
+    values << value;
+    }
+
+  this->TagCacheDatabase.transaction();
+  q->cacheTags(sopInstanceUIDs, tags, values);
+  this->TagCacheDatabase.commit();
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabasePrivate::removeImage(const QString& sopInstanceUID)
+{
+  Q_Q(ctkDICOMDatabase);
+  this->clearLookupCache();
+  QSqlQuery deleteFile(Database);
+  deleteFile.prepare("DELETE FROM Images WHERE SOPInstanceUID == :sopInstanceUID");
+  deleteFile.bindValue(":sopInstanceUID", sopInstanceUID);
+  bool success = deleteFile.exec();
+  if (!success)
+  {
+    logger.error("SQLITE ERROR deleting old image row: " + deleteFile.lastError().driverText());
+  }
+  return success;
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabasePrivate::storeDatasetFile(const ctkDICOMItem& dataset, const QString& originalFilePath,
+  const QString& studyInstanceUID, const QString& seriesInstanceUID, const QString& sopInstanceUID,
+  QString& storedFilePath, bool* asyncCopySuccess/*=nullptr*/)
+{
+  Q_Q(ctkDICOMDatabase);
+
+  if (sopInstanceUID.isEmpty())
+  {
+    return false;
+  }
+
+  storedFilePath = q->storagePathForInstance(studyInstanceUID, seriesInstanceUID, sopInstanceUID);
+  // A removed instance that is imported again is stored at the same path, make sure
+  // that the file is not deleted after it is stored again (removal may be pending in
+  // another database instance, e.g., the one the indexer uses).
+  cancelPendingFileRemoval(storedFilePath);
+  QDir().mkpath(QFileInfo(storedFilePath).absolutePath());
 
   if (originalFilePath.isEmpty())
   {
@@ -719,7 +1635,14 @@ bool ctkDICOMDatabasePrivate::storeDatasetFile(const ctkDICOMItem& dataset, cons
     {
       logger.debug("Saving file: " + storedFilePath);
     }
-    if (!dataset.SaveToFile(storedFilePath))
+    QString temporaryFilePath = temporaryFilePathForFile(storedFilePath);
+    if (!dataset.SaveToFile(temporaryFilePath))
+    {
+      QFile::remove(temporaryFilePath);
+      logger.error("Error saving file: " + storedFilePath);
+      return false;
+    }
+    if (!replaceFileWithTemporaryFile(temporaryFilePath, storedFilePath))
     {
       logger.error("Error saving file: " + storedFilePath);
       return false;
@@ -728,12 +1651,20 @@ bool ctkDICOMDatabasePrivate::storeDatasetFile(const ctkDICOMItem& dataset, cons
   else
   {
     // we're inserting an existing file
-    QFile currentFile(originalFilePath);
-    currentFile.copy(storedFilePath);
     if (this->LoggedExecVerbose)
     {
       logger.debug("Copy file from: " + originalFilePath + " to: " + storedFilePath);
     }
+    if (asyncCopySuccess)
+    {
+      *asyncCopySuccess = false;
+      this->StorageCopyThreadPool.start(new ctkDICOMDatabaseFileCopier(originalFilePath, storedFilePath, asyncCopySuccess));
+    }
+    else if (!copyDatasetFile(originalFilePath, storedFilePath))
+    {
+      logger.error("Error copying file from: " + originalFilePath + " to: " + storedFilePath);
+      return false;
+    }
   }
 
   return true;
@@ -768,17 +1699,231 @@ bool ctkDICOMDatabasePrivate::indexingStatusForFile(const QString& filePath, con
   // The SOP instance UID exists in the database. In theory, new SOP instance UID must be generated if
   // a file is modified, but some software may not respect this, so check if the file was modified.
   databaseFilename = fileExistsQuery.value(1).toString();
-  QDateTime fileLastModified(QFileInfo(databaseFilename).lastModified());
-  QDateTime databaseInsertTimestamp(QDateTime::fromString(fileExistsQuery.value(0).toString(), Qt::ISODate));
+  datasetUpToDate = this->isDatabaseFileUpToDate(filePath, databaseFilename, fileExistsQuery.value(0).toString());
+
+  return true;
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabasePrivate::isDatabaseFileUpToDate(const QString& filePath, const QString& databaseFilename,
+  const QString& insertTimestamp)
+{
+  QFileInfo databaseFileInfo(databaseFilename);
   // Compare QFileInfo objects instead of path strings to ensure equivalent file names
   // (such as same file name in uppercase/lowercase on Windows) are considered as equal.
-  if (QFileInfo(databaseFilename) == QFileInfo(filePath) && fileLastModified < databaseInsertTimestamp)
+  if (databaseFileInfo != QFileInfo(filePath))
   {
-    // this file is already added and database is up-to-date
-    datasetUpToDate = true;
+    return false;
   }
+  QDateTime databaseInsertTimestamp(QDateTime::fromString(insertTimestamp, Qt::ISODate));
+  return (databaseFileInfo.lastModified() < databaseInsertTimestamp);
+}
 
-  return true;
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabasePrivate::selectForValues(QSqlDatabase& database, const QString& queryTemplate,
+  const QStringList& values, QList<QSqlRecord>& records)
+{
+  bool success = true;
+  for (int chunkStart = 0; chunkStart < values.size(); chunkStart += MAXIMUM_NUMBER_OF_BOUND_VALUES)
+  {
+    QStringList chunkValues = values.mid(chunkStart, MAXIMUM_NUMBER_OF_BOUND_VALUES);
+    QStringList placeholders;
+    for (int valueIndex = 0; valueIndex < chunkValues.size(); ++valueIndex)
+    {
+      placeholders << "?";
+    }
+    QSqlQuery query(database);
+    query.prepare(queryTemplate.arg(placeholders.join(",")));
+    foreach(const QString& value, chunkValues)
+    {
+      query.addBindValue(value);
+    }
+    if (!this->loggedExec(query))
+    {
+      success = false;
+      continue;
+    }
+    while (query.next())
+    {
+      records << query.record();
+    }
+  }
+  return success;
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabasePrivate::execForValues(QSqlDatabase& database, const QString& queryTemplate,
+  const QStringList& values)
+{
+  bool success = true;
+  for (int chunkStart = 0; chunkStart < values.size(); chunkStart += MAXIMUM_NUMBER_OF_BOUND_VALUES)
+  {
+    QStringList chunkValues = values.mid(chunkStart, MAXIMUM_NUMBER_OF_BOUND_VALUES);
+    QStringList placeholders;
+    for (int valueIndex = 0; valueIndex < chunkValues.size(); ++valueIndex)
+    {
+      placeholders << "?";
+    }
+    QSqlQuery query(database);
+    query.prepare(queryTemplate.arg(placeholders.join(",")));
+    foreach(const QString& value, chunkValues)
+    {
+      query.addBindValue(value);
+    }
+    if (!this->loggedExec(query))
+    {
+      success = false;
+    }
+  }
+  return success;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMDatabasePrivate::startFileRemoval(const QStringList& filePaths, const QStringList& thumbnailPaths)
+{
+  Q_Q(ctkDICOMDatabase);
+  if (filePaths.isEmpty())
+  {
+    return;
+  }
+  if (this->FileRemovalProcessedCount.loadAcquire() == this->FileRemovalTotalCount.loadAcquire())
+  {
+    // previous removals are completed, restart counting
+    this->FileRemovalProcessedCount.storeRelease(0);
+    this->FileRemovalTotalCount.storeRelease(0);
+  }
+  {
+    QMutexLocker locker(&PendingFileRemovalMutex);
+    foreach (const QString& filePath, filePaths + thumbnailPaths)
+    {
+      if (!filePath.isEmpty())
+      {
+        PendingFileRemovalPaths.insert(filePath);
+      }
+    }
+  }
+  int totalCount = this->FileRemovalTotalCount.fetchAndAddOrdered(filePaths.size()) + filePaths.size();
+  emit q->fileRemovalStarted(totalCount);
+  for (int batchStart = 0; batchStart < filePaths.size(); batchStart += FILE_REMOVAL_BATCH_SIZE)
+  {
+    this->FileRemovalThreadPool.start(new ctkDICOMDatabaseFileRemover(q,
+      filePaths.mid(batchStart, FILE_REMOVAL_BATCH_SIZE), thumbnailPaths.mid(batchStart, FILE_REMOVAL_BATCH_SIZE),
+      &this->FileRemovalProcessedCount, &this->FileRemovalTotalCount, &this->FileRemovalCancelled));
+  }
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabasePrivate::createTemporaryInstanceTable(QSqlDatabase& database, const QString& tableName,
+  const QVariantList& sopInstanceUIDs)
+{
+  QSqlQuery dropTableQuery(database);
+  if (!this->loggedExec(dropTableQuery, QString("DROP TABLE IF EXISTS temp.%1 ;").arg(tableName)))
+  {
+    return false;
+  }
+  QSqlQuery createTableQuery(database);
+  if (!this->loggedExec(createTableQuery, QString("CREATE TEMP TABLE %1 ( SOPInstanceUID VARCHAR(64) PRIMARY KEY ) ;").arg(tableName)))
+  {
+    return false;
+  }
+  if (sopInstanceUIDs.isEmpty())
+  {
+    return true;
+  }
+  QSqlQuery insertQuery(database);
+  insertQuery.prepare(QString("INSERT OR IGNORE INTO temp.%1 ( SOPInstanceUID ) VALUES ( ? ) ;").arg(tableName));
+  insertQuery.addBindValue(sopInstanceUIDs);
+  return this->loggedExecBatch(insertQuery);
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabasePrivate::insertTimestampsAndFilenamesForInstances(const QStringList& sopInstanceUIDs,
+  QHash<QString, QPair<QString, QString> >& insertTimestampAndFilenameForInstance)
+{
+  // the same instance may be in the list multiple times
+  QSet<QString> uniqueSOPInstanceUIDs;
+  foreach(const QString& sopInstanceUID, sopInstanceUIDs)
+  {
+    uniqueSOPInstanceUIDs.insert(sopInstanceUID);
+  }
+  QList<QSqlRecord> records;
+  bool success = this->selectForValues(this->Database,
+    "SELECT SOPInstanceUID, InsertTimestamp, Filename FROM Images WHERE SOPInstanceUID IN (%1)",
+    uniqueSOPInstanceUIDs.values(), records);
+  foreach(const QSqlRecord& record, records)
+  {
+    insertTimestampAndFilenameForInstance[record.value(0).toString()] =
+      qMakePair(record.value(1).toString(), record.value(2).toString());
+  }
+  return success;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMDatabasePrivate::cacheExistingPatientsStudiesSeries(const QList<ctkDICOMDatabase::IndexingResult>& indexingResults,
+  const QVector<InstanceUIDs>& instanceUIDsForResults)
+{
+  QSet<QString> patientIDs;
+  QSet<QString> studyInstanceUIDs;
+  QSet<QString> seriesInstanceUIDs;
+  foreach(const InstanceUIDs& instanceUIDs, instanceUIDsForResults)
+  {
+    if (!instanceUIDs.valid)
+    {
+      continue;
+    }
+    patientIDs.insert(instanceUIDs.patientID);
+    if (!this->InsertedStudyUIDsCache.contains(instanceUIDs.studyInstanceUID))
+    {
+      studyInstanceUIDs.insert(instanceUIDs.studyInstanceUID);
+    }
+    if (!instanceUIDs.seriesInstanceUID.isEmpty() && !this->InsertedSeriesUIDsCache.contains(instanceUIDs.seriesInstanceUID))
+    {
+      seriesInstanceUIDs.insert(instanceUIDs.seriesInstanceUID);
+    }
+  }
+
+  // Patients are identified by patient ID and name (same as in insertPatient)
+  QList<QSqlRecord> records;
+  this->selectForValues(this->Database, "SELECT UID, PatientID, PatientsName FROM Patients WHERE PatientID IN (%1)",
+    patientIDs.values(), records);
+  QHash<QString, int> databasePatientIDForPatientIDAndName;
+  foreach(const QSqlRecord& record, records)
+  {
+    databasePatientIDForPatientIDAndName[record.value(1).toString() + "~" + record.value(2).toString()] = record.value(0).toInt();
+  }
+  for (int resultIndex = 0; resultIndex < indexingResults.size(); ++resultIndex)
+  {
+    const InstanceUIDs& instanceUIDs = instanceUIDsForResults[resultIndex];
+    if (!instanceUIDs.valid)
+    {
+      continue;
+    }
+    QHash<QString, int>::const_iterator databasePatientIDIt =
+      databasePatientIDForPatientIDAndName.constFind(instanceUIDs.patientID + "~" + instanceUIDs.patientsName);
+    if (databasePatientIDIt == databasePatientIDForPatientIDAndName.constEnd())
+    {
+      continue;
+    }
+    QString patientsBirthDate(indexingResults[resultIndex].dataset->GetElementAsString(DCM_PatientBirthDate));
+    QString compositeID = this->compositePatientID(instanceUIDs.patientID, instanceUIDs.patientsName, patientsBirthDate);
+    this->InsertedPatientsCompositeIDCache[compositeID] = databasePatientIDIt.value();
+  }
+
+  records.clear();
+  this->selectForValues(this->Database, "SELECT StudyInstanceUID FROM Studies WHERE StudyInstanceUID IN (%1)",
+    studyInstanceUIDs.values(), records);
+  foreach(const QSqlRecord& record, records)
+  {
+    this->InsertedStudyUIDsCache.insert(record.value(0).toString());
+  }
+
+  records.clear();
+  this->selectForValues(this->Database, "SELECT SeriesInstanceUID FROM Series WHERE SeriesInstanceUID IN (%1)",
+    seriesInstanceUIDs.values(), records);
+  foreach(const QSqlRecord& record, records)
+  {
+    this->InsertedSeriesUIDsCache.insert(record.value(0).toString());
+  }
 }
 
 //------------------------------------------------------------------------------
@@ -865,6 +2010,7 @@ bool ctkDICOMDatabasePrivate::storeThumbnailFile(const QString& originalFilePath
   QString thumbnailPath = q->databaseDirectory() +
     "/thumbs/" + studyInstanceUID + "/" + seriesInstanceUID
     + "/" + sopInstanceUID + ".png";
+  cancelPendingFileRemoval(thumbnailPath);
   QFileInfo thumbnailInfo(thumbnailPath);
   if (thumbnailInfo.exists() && (thumbnailInfo.lastModified() > QFileInfo(originalFilePath).lastModified()))
   {
@@ -925,6 +2071,9 @@ void ctkDICOMDatabasePrivate::insert(const ctkDICOMItem& dataset, const QString&
   // this is the method that all other insert signatures end up calling
   // after they have pre-parsed their arguments
 
+  // Inserted file may replace an existing file or change descriptions
+  this->clearLookupCache();
+
   QString sopInstanceUID(dataset.GetElementAsString(DCM_SOPInstanceUID));
 
   // Check to see if the file has already been loaded
@@ -949,12 +2098,7 @@ void ctkDICOMDatabasePrivate::insert(const ctkDICOMItem& dataset, const QString&
       logger.debug("File " + databaseFilename + " already added");
       return;
     }
-    // File is updated, delete record and re-index
-    if (!this->removeImage(sopInstanceUID))
-    {
-      logger.debug("File " + filePath + " cannot be added, failed to update existing values in the database");
-      return;
-    }
+    // File is updated, record is deleted and re-indexed when the new file is stored
   }
 
   // Verify that minimum required fields are present
@@ -976,6 +2120,14 @@ void ctkDICOMDatabasePrivate::insert(const ctkDICOMItem& dataset, const QString&
     }
   }
 
+  // Existing record is only deleted when the new file is stored, so that the record
+  // of the previously stored file is kept if storing fails
+  if (datasetInDatabase && !this->removeImage(sopInstanceUID))
+  {
+    logger.debug("File " + filePath + " cannot be added, failed to update existing values in the database");
+    return;
+  }
+
   bool databaseWasChanged = this->insertPatientStudySeries(dataset, patientID, patientsName);
 
   if (!storedFilePath.isEmpty() && !seriesInstanceUID.isEmpty())
@@ -1026,21 +2178,69 @@ void ctkDICOMDatabase::insert(const QList<ctkDICOMDatabase::IndexingResult>& ind
   Q_D(ctkDICOMDatabase);
   bool databaseWasChanged = false;
 
+  // Inserted files may replace existing files or change descriptions
+  d->clearLookupCache();
+
   d->TagCacheDatabase.transaction();
   d->Database.transaction();
 
-  foreach(const ctkDICOMDatabase::IndexingResult & indexingResult, indexingResults)
-  {
+  // Get UIDs of all datasets
+  QVector<ctkDICOMDatabasePrivate::InstanceUIDs> instanceUIDsForResults(indexingResults.size());
+  QStringList sopInstanceUIDs;
+  for (int resultIndex = 0; resultIndex < indexingResults.size(); ++resultIndex)
+  {
+    const ctkDICOMItem& dataset = *indexingResults[resultIndex].dataset.data();
+    ctkDICOMDatabasePrivate::InstanceUIDs& instanceUIDs = instanceUIDsForResults[resultIndex];
+    instanceUIDs.sopInstanceUID = dataset.GetElementAsString(DCM_SOPInstanceUID);
+    instanceUIDs.valid = d->uidsForDataSet(dataset, instanceUIDs.patientsName, instanceUIDs.patientID,
+      instanceUIDs.studyInstanceUID, instanceUIDs.seriesInstanceUID);
+    sopInstanceUIDs << instanceUIDs.sopInstanceUID;
+  }
+
+  // Look up instances, patients, studies, and series that are already in the database
+  // using a few queries instead of querying them for each dataset
+  QHash<QString, QPair<QString, QString> > insertTimestampAndFilenameForInstance;
+  d->insertTimestampsAndFilenamesForInstances(sopInstanceUIDs, insertTimestampAndFilenameForInstance);
+  d->cacheExistingPatientsStudiesSeries(indexingResults, instanceUIDsForResults);
+
+  // Values of batch statements
+  QVariantList removedSOPInstanceUIDs;
+  QVariantList imageSOPInstanceUIDs;
+  QVariantList imageFilenames;
+  QVariantList imageSeriesInstanceUIDs;
+  QVariantList imageInsertTimestamps;
+  QVariantList tagSOPInstanceUIDs;
+  QVariantList tagTags;
+  QVariantList tagValues;
+  // Index of the SOP instance in image lists, for handling multiple files with the same SOP instance UID in the batch
+  QHash<QString, int> imageIndexForSOPInstanceUID;
+  // Files are copied into the database folder in parallel with processing of the other results.
+  // Image rows are only inserted for files that have been copied successfully.
+  // Vector is allocated in advance, as copier threads store the results in its elements.
+  QVector<bool> copySuccessForResult(indexingResults.size(), true);
+  QHash<QString, int> copyResultIndexForSOPInstanceUID;
+
+  for (int resultIndex = 0; resultIndex < indexingResults.size(); ++resultIndex)
+  {
+    const ctkDICOMDatabase::IndexingResult& indexingResult = indexingResults[resultIndex];
+    const ctkDICOMDatabasePrivate::InstanceUIDs& instanceUIDs = instanceUIDsForResults[resultIndex];
     const ctkDICOMItem& dataset = *indexingResult.dataset.data();
     QString filePath = indexingResult.filePath;
     bool generateThumbnail = false; // thumbnail will be generated when needed, don't slow down import with that
     bool storeFile = indexingResult.copyFile;
+    const QString& sopInstanceUID = instanceUIDs.sopInstanceUID;
 
     // Check to see if the file has already been loaded
-    QString sopInstanceUID(dataset.GetElementAsString(DCM_SOPInstanceUID));
     bool datasetInDatabase = false;
     bool datasetUpToDate = false;
-    if (indexingResult.overwriteExistingDataset)
+    QHash<QString, int>::const_iterator imageIndexIt = imageIndexForSOPInstanceUID.constFind(sopInstanceUID);
+    if (imageIndexIt != imageIndexForSOPInstanceUID.constEnd())
+    {
+      // another file with the same SOP instance UID has been already added in this batch
+      datasetInDatabase = true;
+      datasetUpToDate = (QFileInfo(imageFilenames[imageIndexIt.value()].toString()) == QFileInfo(filePath));
+    }
+    else if (indexingResult.overwriteExistingDataset)
     {
       // overwrite was requested based on exact file match
       datasetInDatabase = true;
@@ -1050,11 +2250,13 @@ void ctkDICOMDatabase::insert(const QList<ctkDICOMDatabase::IndexingResult>& ind
     {
       // there is no exact file match, but there may be still a different file in the database
       // for the same SOP instance UID
-      QString databaseFilename;
-      if (!d->indexingStatusForFile(filePath, sopInstanceUID, datasetInDatabase, datasetUpToDate, databaseFilename))
+      QHash<QString, QPair<QString, QString> >::const_iterator existingInstanceIt =
+        insertTimestampAndFilenameForInstance.constFind(sopInstanceUID);
+      if (existingInstanceIt != insertTimestampAndFilenameForInstance.constEnd())
       {
-        // error occurred, message is already logged
-        continue;
+        datasetInDatabase = true;
+        datasetUpToDate = d->isDatabaseFileUpToDate(filePath,
+          existingInstanceIt.value().second, existingInstanceIt.value().first);
       }
     }
 
@@ -1065,32 +2267,43 @@ void ctkDICOMDatabase::insert(const QList<ctkDICOMDatabase::IndexingResult>& ind
         continue;
       }
       // File is updated, delete record and re-index
-      if (!d->removeImage(sopInstanceUID))
+      if (imageIndexIt == imageIndexForSOPInstanceUID.constEnd())
       {
-        logger.error("Failed to insert file into database (cannot update pre-existing item): " + filePath);
-        continue;
+        removedSOPInstanceUIDs << sopInstanceUID;
       }
     }
 
     // Verify that minimum required fields are present
-    QString patientsName, patientID, studyInstanceUID, seriesInstanceUID;
-    if (!d->uidsForDataSet(dataset, patientsName, patientID, studyInstanceUID, seriesInstanceUID))
+    if (!instanceUIDs.valid)
     {
       logger.error("Failed to insert file into database (required fields missing): " + filePath);
       continue;
     }
+    const QString& studyInstanceUID = instanceUIDs.studyInstanceUID;
+    const QString& seriesInstanceUID = instanceUIDs.seriesInstanceUID;
 
     // Store a copy of the dataset
     QString storedFilePath = filePath;
     if (storeFile && !seriesInstanceUID.isEmpty() && !this->isInMemory())
     {
-      if (!d->storeDatasetFile(dataset, filePath, studyInstanceUID, seriesInstanceUID, sopInstanceUID, storedFilePath))
+      if (copyResultIndexForSOPInstanceUID.contains(sopInstanceUID))
+      {
+        // another file with the same SOP instance UID is being copied to the same location
+        d->StorageCopyThreadPool.waitForDone();
+      }
+      if (!d->storeDatasetFile(dataset, filePath, studyInstanceUID, seriesInstanceUID, sopInstanceUID, storedFilePath,
+        &copySuccessForResult[resultIndex]))
       {
         continue;
       }
+      copyResultIndexForSOPInstanceUID[sopInstanceUID] = resultIndex;
+    }
+    else
+    {
+      copyResultIndexForSOPInstanceUID.remove(sopInstanceUID);
     }
 
-    if (d->insertPatientStudySeries(dataset, patientID, patientsName))
+    if (d->insertPatientStudySeries(dataset, instanceUIDs.patientID, instanceUIDs.patientsName))
     {
       databaseWasChanged = true;
     }
@@ -1098,14 +2311,16 @@ void ctkDICOMDatabase::insert(const QList<ctkDICOMDatabase::IndexingResult>& ind
     if (!storedFilePath.isEmpty() && !seriesInstanceUID.isEmpty())
     {
       // Insert all pre-cached fields into tag cache
-      QSqlQuery insertTags(d->TagCacheDatabase);
-      insertTags.prepare("INSERT OR REPLACE INTO TagCache VALUES(?,?,?)");
-      insertTags.bindValue(0, sopInstanceUID);
       foreach(const QString & tag, d->TagsToPrecache)
       {
         unsigned short group, element;
         this->tagToGroupElement(tag, group, element);
         DcmTagKey tagKey(group, element);
+        if (indexingResult.incompleteDataset && !dataset.TagExists(tagKey))
+        {
+          // the tag may be in the file, it will be read from there when needed
+          continue;
+        }
         QString value;
         if (d->TagsToExcludeFromStorage.contains(tag))
         {
@@ -1122,32 +2337,26 @@ void ctkDICOMDatabase::insert(const QList<ctkDICOMDatabase::IndexingResult>& ind
         {
           value = dataset.GetAllElementValuesAsString(tagKey);
         }
-        insertTags.bindValue(1, tag);
-        if (value.isEmpty())
-        {
-          insertTags.bindValue(2, TagNotInInstance);
-        }
-        else
-        {
-          insertTags.bindValue(2, value);
-        }
-        insertTags.exec();
+        tagSOPInstanceUIDs << sopInstanceUID;
+        tagTags << tag;
+        tagValues << (value.isEmpty() ? TagNotInInstance : value);
       }
 
       // Insert image files
-      QSqlQuery insertImageStatement(d->Database);
-      insertImageStatement.prepare("INSERT INTO Images ( 'SOPInstanceUID', 'Filename', 'SeriesInstanceUID', 'InsertTimestamp' ) VALUES ( ?, ?, ?, ? )");
-      insertImageStatement.addBindValue(sopInstanceUID);
-      insertImageStatement.addBindValue(storedFilePath);
-      insertImageStatement.addBindValue(seriesInstanceUID);
-      insertImageStatement.addBindValue(QDateTime::currentDateTime());
-      insertImageStatement.exec();
-      emit instanceAdded(sopInstanceUID);
-      if (d->LoggedExecVerbose)
+      if (imageIndexIt != imageIndexForSOPInstanceUID.constEnd())
       {
-        qDebug() << "Instance Added";
+        imageFilenames[imageIndexIt.value()] = storedFilePath;
+        imageSeriesInstanceUIDs[imageIndexIt.value()] = seriesInstanceUID;
+        imageInsertTimestamps[imageIndexIt.value()] = QDateTime::currentDateTime();
+      }
+      else
+      {
+        imageIndexForSOPInstanceUID[sopInstanceUID] = imageSOPInstanceUIDs.size();
+        imageSOPInstanceUIDs << sopInstanceUID;
+        imageFilenames << storedFilePath;
+        imageSeriesInstanceUIDs << seriesInstanceUID;
+        imageInsertTimestamps << QDateTime::currentDateTime();
       }
-      databaseWasChanged = true;
 
       if (generateThumbnail)
       {
@@ -1156,9 +2365,109 @@ void ctkDICOMDatabase::insert(const QList<ctkDICOMDatabase::IndexingResult>& ind
     }
   }
 
+  // Wait for file copies and skip files that could not be copied
+  d->StorageCopyThreadPool.waitForDone();
+  QSet<QString> failedCopySOPInstanceUIDs;
+  QHash<QString, int>::const_iterator copyResultIt;
+  for (copyResultIt = copyResultIndexForSOPInstanceUID.constBegin(); copyResultIt != copyResultIndexForSOPInstanceUID.constEnd(); ++copyResultIt)
+  {
+    if (!copySuccessForResult[copyResultIt.value()])
+    {
+      logger.error("Failed to copy file into the database folder: " + indexingResults[copyResultIt.value()].filePath);
+      failedCopySOPInstanceUIDs.insert(copyResultIt.key());
+    }
+  }
+  if (!failedCopySOPInstanceUIDs.isEmpty())
+  {
+    // Previously stored file is kept if the copy failed, keep its record, too
+    for (int removedIndex = removedSOPInstanceUIDs.size() - 1; removedIndex >= 0; --removedIndex)
+    {
+      if (failedCopySOPInstanceUIDs.contains(removedSOPInstanceUIDs[removedIndex].toString()))
+      {
+        removedSOPInstanceUIDs.removeAt(removedIndex);
+      }
+    }
+    for (int imageIndex = imageSOPInstanceUIDs.size() - 1; imageIndex >= 0; --imageIndex)
+    {
+      if (failedCopySOPInstanceUIDs.contains(imageSOPInstanceUIDs[imageIndex].toString()))
+      {
+        imageSOPInstanceUIDs.removeAt(imageIndex);
+        imageFilenames.removeAt(imageIndex);
+        imageSeriesInstanceUIDs.removeAt(imageIndex);
+        imageInsertTimestamps.removeAt(imageIndex);
+      }
+    }
+    for (int tagIndex = tagSOPInstanceUIDs.size() - 1; tagIndex >= 0; --tagIndex)
+    {
+      if (failedCopySOPInstanceUIDs.contains(tagSOPInstanceUIDs[tagIndex].toString()))
+      {
+        tagSOPInstanceUIDs.removeAt(tagIndex);
+        tagTags.removeAt(tagIndex);
+        tagValues.removeAt(tagIndex);
+      }
+    }
+  }
+
+  if (!removedSOPInstanceUIDs.isEmpty())
+  {
+    QSqlQuery removeImagesStatement(d->Database);
+    removeImagesStatement.prepare("DELETE FROM Images WHERE SOPInstanceUID == ?");
+    removeImagesStatement.addBindValue(removedSOPInstanceUIDs);
+    if (!d->loggedExecBatch(removeImagesStatement))
+    {
+      logger.error("SQLITE ERROR deleting old image rows: " + removeImagesStatement.lastError().driverText());
+    }
+  }
+
+  // SOP instance UIDs of the image rows that are actually inserted
+  QStringList addedSOPInstanceUIDs;
+  if (!imageSOPInstanceUIDs.isEmpty())
+  {
+    // Files that are already in the database with a different SOP instance UID are ignored
+    // (same as in single-file insert) instead of failing the whole batch.
+    // Rows are inserted one by one (QSQLITE emulates batch execution the same way) so that
+    // the number of affected rows tells which rows are inserted.
+    QSqlQuery insertImageStatement(d->Database);
+    insertImageStatement.prepare("INSERT OR IGNORE INTO Images ( 'SOPInstanceUID', 'Filename', 'SeriesInstanceUID', 'InsertTimestamp' ) VALUES ( ?, ?, ?, ? )");
+    for (int imageIndex = 0; imageIndex < imageSOPInstanceUIDs.size(); ++imageIndex)
+    {
+      insertImageStatement.bindValue(0, imageSOPInstanceUIDs[imageIndex]);
+      insertImageStatement.bindValue(1, imageFilenames[imageIndex]);
+      insertImageStatement.bindValue(2, imageSeriesInstanceUIDs[imageIndex]);
+      insertImageStatement.bindValue(3, imageInsertTimestamps[imageIndex]);
+      if (!d->loggedExec(insertImageStatement))
+      {
+        logger.error("SQLITE ERROR inserting image row: " + insertImageStatement.lastError().driverText());
+        continue;
+      }
+      if (insertImageStatement.numRowsAffected() > 0)
+      {
+        addedSOPInstanceUIDs << imageSOPInstanceUIDs[imageIndex].toString();
+      }
+    }
+    if (!addedSOPInstanceUIDs.isEmpty())
+    {
+      databaseWasChanged = true;
+    }
+  }
+
+  if (!tagSOPInstanceUIDs.isEmpty())
+  {
+    d->insertCachedTags(tagSOPInstanceUIDs, tagTags, tagValues);
+  }
+
   d->Database.commit();
   d->TagCacheDatabase.commit();
 
+  foreach(const QString& sopInstanceUID, addedSOPInstanceUIDs)
+  {
+    emit instanceAdded(sopInstanceUID);
+  }
+  if (d->LoggedExecVerbose)
+  {
+    qDebug() << addedSOPInstanceUIDs.size() << "instances added";
+  }
+
   if (databaseWasChanged && this->isInMemory())
   {
     emit this->databaseChanged();
@@ -1454,82 +2763,251 @@ bool ctkDICOMDatabasePrivate::applyDisplayedFieldsChanges( QMap<QString, QMap<QS
     }
   } // For each series in displayedFieldsMapSeries
 
+  QStringList patientUIDs;
+  foreach (int patientUID, patientCompositeIdToPatientUidMap.values())
+  {
+    patientUIDs << QString::number(patientUID);
+  }
+  this->updateFullTextSearchIndex("Patients", "rowid", patientUIDs);
+  this->updateFullTextSearchIndex("Studies", "StudyInstanceUID", displayedFieldsMapStudy.keys());
+  this->updateFullTextSearchIndex("Series", "SeriesInstanceUID", displayedFieldsMapSeries.keys());
+
   return true;
 }
 
 //------------------------------------------------------------------------------
-void ctkDICOMDatabasePrivate::setCountToSeriesDisplayedFields(QMap<QString, QMap<QString, QString> > &displayedFieldsMapSeries)
+void ctkDICOMDatabasePrivate::setCountToSeriesDisplayedFields(QMap<QString, QMap<QString, QString> > &displayedFieldsMapSeries)
+{
+  // Counts are maintained by triggers, only series that have no count yet need to be counted.
+  // Counting and writing in one statement does not lose increments committed by other connections meanwhile.
+  this->execForValues(this->Database, "UPDATE Series SET DisplayedCount = "
+    "(SELECT COUNT(*) FROM Images WHERE Images.SeriesInstanceUID = Series.SeriesInstanceUID) "
+    "WHERE DisplayedCount IS NULL AND SeriesInstanceUID IN (%1)", displayedFieldsMapSeries.keys());
+  QMap<QString, QMap<QString, QString> >::iterator seriesIt;
+  for (seriesIt = displayedFieldsMapSeries.begin(); seriesIt != displayedFieldsMapSeries.end(); ++seriesIt)
+  {
+    seriesIt.value().remove("DisplayedCount");
+  }
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMDatabasePrivate::setNumberOfSeriesToStudyDisplayedFields(QMap<QString, QMap<QString, QString> > &displayedFieldsMapStudy)
+{
+  // Counts are maintained by triggers, only studies that have no count yet need to be counted
+  this->execForValues(this->Database, "UPDATE Studies SET DisplayedNumberOfSeries = "
+    "(SELECT COUNT(*) FROM Series WHERE Series.StudyInstanceUID = Studies.StudyInstanceUID) "
+    "WHERE DisplayedNumberOfSeries IS NULL AND StudyInstanceUID IN (%1)", displayedFieldsMapStudy.keys());
+  QMap<QString, QMap<QString, QString> >::iterator studyIt;
+  for (studyIt = displayedFieldsMapStudy.begin(); studyIt != displayedFieldsMapStudy.end(); ++studyIt)
+  {
+    studyIt.value().remove("DisplayedNumberOfSeries");
+  }
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMDatabasePrivate::setNumberOfStudiesToPatientDisplayedFields(QMap<QString, QMap<QString, QString> >& displayedFieldsMapPatient)
+{
+  // Counts are maintained by triggers, only patients that have no count yet need to be counted
+  QStringList patientUIDs;
+  QMap<QString, QMap<QString, QString> >::iterator patientIt;
+  for (patientIt = displayedFieldsMapPatient.begin(); patientIt != displayedFieldsMapPatient.end(); ++patientIt)
+  {
+    patientUIDs << patientIt.value()["UID"];
+    // the patient fields are read from the database, the count may be outdated when they are written back
+    patientIt.value().remove("DisplayedNumberOfStudies");
+  }
+  this->execForValues(this->Database, "UPDATE Patients SET DisplayedNumberOfStudies = "
+    "(SELECT COUNT(*) FROM Studies WHERE Studies.PatientsUID = Patients.UID) "
+    "WHERE DisplayedNumberOfStudies IS NULL AND UID IN (%1)", patientUIDs);
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabasePrivate::updateDisplayedFieldsCountTriggers(bool recreate)
+{
+  // Trigger name, definition
+  QList<QPair<QString, QString> > triggers;
+  triggers << qMakePair(QString("DisplayedCountOnImageInsert"), QString(
+    "AFTER INSERT ON Images BEGIN "
+    "UPDATE Series SET DisplayedCount = DisplayedCount + 1 WHERE SeriesInstanceUID = NEW.SeriesInstanceUID; END"));
+  triggers << qMakePair(QString("DisplayedCountOnImageDelete"), QString(
+    "AFTER DELETE ON Images BEGIN "
+    "UPDATE Series SET DisplayedCount = DisplayedCount - 1 WHERE SeriesInstanceUID = OLD.SeriesInstanceUID; END"));
+  triggers << qMakePair(QString("DisplayedNumberOfSeriesOnSeriesInsert"), QString(
+    "AFTER INSERT ON Series BEGIN "
+    "UPDATE Studies SET DisplayedNumberOfSeries = DisplayedNumberOfSeries + 1 WHERE StudyInstanceUID = NEW.StudyInstanceUID; END"));
+  triggers << qMakePair(QString("DisplayedNumberOfSeriesOnSeriesDelete"), QString(
+    "AFTER DELETE ON Series BEGIN "
+    "UPDATE Studies SET DisplayedNumberOfSeries = DisplayedNumberOfSeries - 1 WHERE StudyInstanceUID = OLD.StudyInstanceUID; END"));
+  triggers << qMakePair(QString("DisplayedNumberOfStudiesOnStudyInsert"), QString(
+    "AFTER INSERT ON Studies BEGIN "
+    "UPDATE Patients SET DisplayedNumberOfStudies = DisplayedNumberOfStudies + 1 WHERE UID = NEW.PatientsUID; END"));
+  triggers << qMakePair(QString("DisplayedNumberOfStudiesOnStudyDelete"), QString(
+    "AFTER DELETE ON Studies BEGIN "
+    "UPDATE Patients SET DisplayedNumberOfStudies = DisplayedNumberOfStudies - 1 WHERE UID = OLD.PatientsUID; END"));
+  triggers << qMakePair(QString("DisplayedNumberOfStudiesOnStudyPatientUpdate"), QString(
+    "AFTER UPDATE OF PatientsUID ON Studies WHEN OLD.PatientsUID != NEW.PatientsUID BEGIN "
+    "UPDATE Patients SET DisplayedNumberOfStudies = DisplayedNumberOfStudies - 1 WHERE UID = OLD.PatientsUID; "
+    "UPDATE Patients SET DisplayedNumberOfStudies = DisplayedNumberOfStudies + 1 WHERE UID = NEW.PatientsUID; END"));
+
+  bool success = true;
+  QStringList existingTriggerNames;
+  if (!recreate)
+  {
+    QSqlQuery existingTriggersQuery(this->Database);
+    success = this->loggedExec(existingTriggersQuery, QString("SELECT name FROM sqlite_master WHERE type = 'trigger' ;"));
+    while (existingTriggersQuery.next())
+    {
+      existingTriggerNames << existingTriggersQuery.value(0).toString();
+    }
+  }
+  for (int triggerIndex = 0; triggerIndex < triggers.size(); ++triggerIndex)
+  {
+    if (recreate)
+    {
+      QSqlQuery dropTriggerQuery(this->Database);
+      success = this->loggedExec(dropTriggerQuery,
+        QString("DROP TRIGGER IF EXISTS %1 ;").arg(triggers[triggerIndex].first)) && success;
+    }
+    // Triggers refer to displayed fields columns, they must not be created if the columns are missing
+    if (!this->DisplayedFieldsTableAvailable || existingTriggerNames.contains(triggers[triggerIndex].first))
+    {
+      continue;
+    }
+    QSqlQuery createTriggerQuery(this->Database);
+    success = this->loggedExec(createTriggerQuery,
+      QString("CREATE TRIGGER IF NOT EXISTS %1 %2 ;").arg(triggers[triggerIndex].first).arg(triggers[triggerIndex].second)) && success;
+  }
+  return success;
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabasePrivate::createDirectoryFingerprintsTable()
+{
+  QSqlQuery createQuery(this->Database);
+  return this->loggedExec(createQuery,
+    "CREATE TABLE IF NOT EXISTS DirectoryFingerprints ("
+    "Path TEXT NOT NULL PRIMARY KEY, ModifiedTime INTEGER, Inode INTEGER) ;");
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabasePrivate::createFullTextSearchIndex(bool recreate)
 {
-  foreach (QString currentSeriesInstanceUid, displayedFieldsMapSeries.keys())
+  this->FullTextSearchIndexFieldNames.clear();
+  QStringList tableNames = this->Database.tables();
+  bool transactionStarted = false;
+  bool success = true;
+  foreach(const QString& tableName, QStringList() << "Patients" << "Studies" << "Series")
   {
-    QSqlQuery countQuery(this->Database);
-    countQuery.prepare("SELECT COUNT(*) FROM Images WHERE SeriesInstanceUID = ? ;");
-    countQuery.addBindValue(currentSeriesInstanceUid);
-    if (!countQuery.exec())
+    if (!tableNames.contains(tableName))
     {
-      logger.error("SQLITE ERROR: " + countQuery.lastError().driverText());
       continue;
     }
+    QString indexTableName = tableName + "FTS";
+    if (tableNames.contains(indexTableName))
+    {
+      if (!recreate)
+      {
+        QSqlQuery checkIndexQuery(this->Database);
+        if (!checkIndexQuery.exec(QString("SELECT rowid FROM %1 LIMIT 0 ;").arg(indexTableName)))
+        {
+          // Index was created by an SQLite library that has FTS5, but this one does not
+          logger.warn("Full-text search index is not available: " + checkIndexQuery.lastError().driverText());
+          continue;
+        }
+        QSqlRecord indexRecord = this->Database.record(indexTableName);
+        for (int field = 0; field < indexRecord.count(); ++field)
+        {
+          this->FullTextSearchIndexFieldNames[tableName] << indexRecord.fieldName(field);
+        }
+        continue;
+      }
+      QSqlQuery dropIndexQuery(this->Database);
+      this->loggedExec(dropIndexQuery, QString("DROP TABLE %1 ;").arg(indexTableName));
+    }
 
-    countQuery.first();
-    int currentCount = countQuery.value(0).toInt();
-
-    QMap<QString, QString> displayedFieldsForCurrentSeries = displayedFieldsMapSeries[currentSeriesInstanceUid];
-    displayedFieldsForCurrentSeries["DisplayedCount"] = QString::number(currentCount);
-    displayedFieldsMapSeries[currentSeriesInstanceUid] = displayedFieldsForCurrentSeries;
+    QStringList fieldNames;
+    QSqlRecord tableRecord = this->Database.record(tableName);
+    for (int field = 0; field < tableRecord.count(); ++field)
+    {
+      fieldNames << tableRecord.fieldName(field);
+    }
+    if (!transactionStarted)
+    {
+      transactionStarted = this->Database.transaction();
+    }
+    QSqlQuery createIndexQuery(this->Database);
+    if (!createIndexQuery.exec(QString("CREATE VIRTUAL TABLE %1 USING fts5(\"%2\") ;")
+      .arg(indexTableName).arg(fieldNames.join("\", \""))))
+    {
+      // Filtering uses pattern matching if the SQLite library is built without FTS5
+      logger.warn("Full-text search index is not available: " + createIndexQuery.lastError().driverText());
+      success = false;
+      break;
+    }
+    QSqlQuery fillIndexQuery(this->Database);
+    if (!this->loggedExec(fillIndexQuery, QString("INSERT INTO %1 (rowid, \"%2\") SELECT rowid, \"%2\" FROM %3 ;")
+      .arg(indexTableName).arg(fieldNames.join("\", \"")).arg(tableName)))
+    {
+      success = false;
+      break;
+    }
+    this->FullTextSearchIndexFieldNames[tableName] = fieldNames;
   }
-}
-
-//------------------------------------------------------------------------------
-void ctkDICOMDatabasePrivate::setNumberOfSeriesToStudyDisplayedFields(QMap<QString, QMap<QString, QString> > &displayedFieldsMapStudy)
-{
-  foreach (QString currentStudyInstanceUid, displayedFieldsMapStudy.keys())
+  if (transactionStarted)
   {
-    QSqlQuery numberOfSeriesQuery(this->Database);
-    numberOfSeriesQuery.prepare("SELECT COUNT(*) FROM Series WHERE StudyInstanceUID = ? ;");
-    numberOfSeriesQuery.addBindValue(currentStudyInstanceUid);
-    if (!numberOfSeriesQuery.exec())
+    if (success)
     {
-      logger.error("SQLITE ERROR: " + numberOfSeriesQuery.lastError().driverText());
-      continue;
+      this->Database.commit();
     }
-
-    numberOfSeriesQuery.first();
-    int currentNumberOfSeries = numberOfSeriesQuery.value(0).toInt();
-
-    QMap<QString, QString> displayedFieldsForCurrentStudy = displayedFieldsMapStudy[currentStudyInstanceUid];
-    displayedFieldsForCurrentStudy["DisplayedNumberOfSeries"] = QString::number(currentNumberOfSeries);
-    displayedFieldsMapStudy[currentStudyInstanceUid] = displayedFieldsForCurrentStudy;
+    else
+    {
+      this->Database.rollback();
+    }
+  }
+  if (!success)
+  {
+    this->FullTextSearchIndexFieldNames.clear();
   }
+  return success;
 }
 
 //------------------------------------------------------------------------------
-void ctkDICOMDatabasePrivate::setNumberOfStudiesToPatientDisplayedFields(QMap<QString, QMap<QString, QString> >& displayedFieldsMapPatient)
+bool ctkDICOMDatabasePrivate::updateFullTextSearchIndex(const QString& tableName, const QString& keyFieldName,
+  const QStringList& keys)
 {
-  foreach(QString compositeID, displayedFieldsMapPatient.keys())
+  if (keys.isEmpty() || !this->FullTextSearchIndexFieldNames.contains(tableName))
   {
-    QMap<QString, QString> displayedFieldsForCurrentPatient = displayedFieldsMapPatient[compositeID];
-    int patientUID = displayedFieldsForCurrentPatient["UID"].toInt();
-    QSqlQuery numberOfStudiesQuery(this->Database);
-    numberOfStudiesQuery.prepare("SELECT COUNT(*) FROM Studies WHERE PatientsUID = ? ;");
-    numberOfStudiesQuery.addBindValue(patientUID);
-    if (!numberOfStudiesQuery.exec())
-    {
-      logger.error("SQLITE ERROR: " + numberOfStudiesQuery.lastError().driverText());
-      continue;
-    }
-
-    numberOfStudiesQuery.first();
-    int currentNumberOfStudies = numberOfStudiesQuery.value(0).toInt();
-
-    displayedFieldsForCurrentPatient["DisplayedNumberOfStudies"] = QString::number(currentNumberOfStudies);
-    displayedFieldsMapPatient[compositeID] = displayedFieldsForCurrentPatient;
+    return true;
+  }
+  QString indexTableName = tableName + "FTS";
+  QString fieldNames = this->FullTextSearchIndexFieldNames[tableName].join("\", \"");
+  QString rowIdCondition = "rowid IN (%1)";
+  if (keyFieldName != "rowid")
+  {
+    rowIdCondition = QString("rowid IN (SELECT rowid FROM %1 WHERE %2 IN (%3))").arg(tableName).arg(keyFieldName).arg("%1");
   }
+  bool success = this->execForValues(this->Database,
+    QString("DELETE FROM %1 WHERE %2 ;").arg(indexTableName).arg(rowIdCondition), keys);
+  success = this->execForValues(this->Database,
+    QString("INSERT INTO %1 (rowid, \"%2\") SELECT rowid, \"%2\" FROM %3 WHERE %4 ;")
+      .arg(indexTableName).arg(fieldNames).arg(tableName).arg(rowIdCondition), keys) && success;
+  return success;
 }
 
 //------------------------------------------------------------------------------
 CTK_GET_CPP(ctkDICOMDatabase, bool, isDisplayedFieldsTableAvailable, DisplayedFieldsTableAvailable);
 
+//------------------------------------------------------------------------------
+QString ctkDICOMDatabase::fullTextSearchIndexTableName(const QString& tableName) const
+{
+  Q_D(const ctkDICOMDatabase);
+  if (!d->FullTextSearchIndexFieldNames.contains(tableName))
+  {
+    return QString();
+  }
+  return tableName + "FTS";
+}
+
 //------------------------------------------------------------------------------
 // ctkDICOMDatabase methods
 //------------------------------------------------------------------------------
@@ -1556,6 +3034,8 @@ ctkDICOMDatabase::ctkDICOMDatabase(QObject* parent)
 //------------------------------------------------------------------------------
 ctkDICOMDatabase::~ctkDICOMDatabase()
 {
+  // Do not leave files of removed items in the database folder
+  this->waitForFileRemoval();
 }
 
 //------------------------------------------------------------------------------
@@ -1581,10 +3061,7 @@ void ctkDICOMDatabase::openDatabase(const QString databaseFile, const QString& c
     return;
   }
 
-  // Disable synchronous writing to make modifications faster
-  QSqlQuery pragmaSyncQuery(d->Database);
-  pragmaSyncQuery.exec("PRAGMA synchronous = OFF");
-  pragmaSyncQuery.finish();
+  d->applyDatabasePragmas(d->Database);
 
   if ( d->Database.tables().empty() )
   {
@@ -1599,8 +3076,12 @@ void ctkDICOMDatabase::openDatabase(const QString databaseFile, const QString& c
     }
   }
   d->resetLastInsertedValues();
+  d->clearLookupCache();
 
   d->DisplayedFieldsTableAvailable = d->Database.tables().contains("ColumnDisplayProperties");
+  d->updateDisplayedFieldsCountTriggers(false);
+  d->createDirectoryFingerprintsTable();
+  d->createFullTextSearchIndex(false);
 
   if (!isInMemory())
   {
@@ -1649,6 +3130,45 @@ const QString ctkDICOMDatabase::databaseDirectory() const {
   return QFileInfo ( databaseFile ).absoluteDir().path();
 }
 
+//------------------------------------------------------------------------------
+QString ctkDICOMDatabase::storagePathForInstance(const QString& studyInstanceUID, const QString& seriesInstanceUID,
+  const QString& sopInstanceUID) const
+{
+  if (sopInstanceUID.isEmpty() || this->isInMemory())
+  {
+    return QString();
+  }
+  return this->databaseDirectory() + "/dicom/" + studyInstanceUID + "/" + seriesInstanceUID + "/" + sopInstanceUID;
+}
+
+//------------------------------------------------------------------------------
+QString ctkDICOMDatabase::storeDataset(DcmDataset* dataset)
+{
+  if (!dataset)
+  {
+    return QString();
+  }
+  OFString studyInstanceUID, seriesInstanceUID, sopInstanceUID;
+  dataset->findAndGetOFString(DCM_StudyInstanceUID, studyInstanceUID);
+  dataset->findAndGetOFString(DCM_SeriesInstanceUID, seriesInstanceUID);
+  dataset->findAndGetOFString(DCM_SOPInstanceUID, sopInstanceUID);
+  QString storedFilePath = this->storagePathForInstance(
+    studyInstanceUID.c_str(), seriesInstanceUID.c_str(), sopInstanceUID.c_str());
+  if (storedFilePath.isEmpty())
+  {
+    return QString();
+  }
+  // A removed instance may be stored again at the same path (see storeDatasetFile)
+  cancelPendingFileRemoval(storedFilePath);
+  QDir().mkpath(QFileInfo(storedFilePath).absolutePath());
+  if (!saveDatasetFile(dataset, storedFilePath))
+  {
+    logger.error("Error saving file: " + storedFilePath);
+    return QString();
+  }
+  return storedFilePath;
+}
+
 //------------------------------------------------------------------------------
 const QSqlDatabase& ctkDICOMDatabase::database() const {
   Q_D(const ctkDICOMDatabase);
@@ -1673,12 +3193,21 @@ bool ctkDICOMDatabase::initializeDatabase(const char* sqlFileName/* = ":/dicom/d
   Q_D(ctkDICOMDatabase);
 
   d->resetLastInsertedValues();
+  d->clearLookupCache();
 
   // remove any existing schema info - this handles the case where an
   // old schema should be loaded for testing.
   QSqlQuery dropSchemaInfo(d->Database);
   d->loggedExec( dropSchemaInfo, QString("DROP TABLE IF EXISTS 'SchemaInfo';") );
   const bool r = d->executeScript(sqlFileName);
+  d->DisplayedFieldsTableAvailable = d->Database.tables().contains("ColumnDisplayProperties");
+  d->updateDisplayedFieldsCountTriggers(true);
+  // All files will be indexed again
+  QSqlQuery dropDirectoryFingerprints(d->Database);
+  d->loggedExec(dropDirectoryFingerprints, QString("DROP TABLE IF EXISTS DirectoryFingerprints;"));
+  d->createDirectoryFingerprintsTable();
+  d->createFullTextSearchIndex(true);
+  emit itemsRemoved();
   emit databaseChanged();
   return r;
 }
@@ -1770,6 +3299,7 @@ bool ctkDICOMDatabase::updateSchema(
   }
 
   d->resetLastInsertedValues();
+  d->clearLookupCache();
   this->initializeDatabase(schemaFile);
 
   emit schemaUpdateStarted(allFiles.length());
@@ -1803,6 +3333,8 @@ void ctkDICOMDatabase::closeDatabase()
   bool wasOpen = this->isOpen();
   d->Database.close();
   d->TagCacheDatabase.close();
+  d->clearLookupCache();
+  d->FullTextSearchIndexFieldNames.clear();
   if (wasOpen)
   {
     emit closed();
@@ -1848,15 +3380,20 @@ QStringList ctkDICOMDatabase::studiesForPatient(QString dbPatientID)
 QString ctkDICOMDatabase::studyForSeries(QString seriesUID)
 {
   Q_D(ctkDICOMDatabase);
+  QString result;
+  if (d->cachedLookup("studyForSeries", seriesUID, result))
+  {
+    return result;
+  }
   QSqlQuery query(d->Database);
   query.prepare( "SELECT StudyInstanceUID FROM Series WHERE SeriesInstanceUID= ?" );
   query.addBindValue( seriesUID );
   query.exec();
-  QString result;
   if (query.next())
   {
     result = query.value(0).toString();
   }
+  d->cacheLookup("studyForSeries", seriesUID, result);
   return( result );
 }
 
@@ -1864,15 +3401,20 @@ QString ctkDICOMDatabase::studyForSeries(QString seriesUID)
 QString ctkDICOMDatabase::patientForStudy(QString studyUID)
 {
   Q_D(ctkDICOMDatabase);
+  QString result;
+  if (d->cachedLookup("patientForStudy", studyUID, result))
+  {
+    return result;
+  }
   QSqlQuery query(d->Database);
   query.prepare( "SELECT PatientsUID FROM Studies WHERE StudyInstanceUID= ?" );
   query.addBindValue( studyUID );
   query.exec();
-  QString result;
   if (query.next())
   {
     result = query.value(0).toString();
   }
+  d->cacheLookup("patientForStudy", studyUID, result);
   return( result );
 }
 
@@ -1917,6 +3459,10 @@ QString ctkDICOMDatabase::descriptionForSeries(const QString seriesUID)
   Q_D(ctkDICOMDatabase);
 
   QString result;
+  if (d->cachedLookup("descriptionForSeries", seriesUID, result))
+  {
+    return result;
+  }
 
   QSqlQuery query(d->Database);
   query.prepare( "SELECT SeriesDescription FROM Series WHERE SeriesInstanceUID= ?" );
@@ -1927,6 +3473,7 @@ QString ctkDICOMDatabase::descriptionForSeries(const QString seriesUID)
     result = query.value(0).toString();
   }
 
+  d->cacheLookup("descriptionForSeries", seriesUID, result);
   return result;
 }
 
@@ -1936,6 +3483,10 @@ QString ctkDICOMDatabase::descriptionForStudy(const QString studyUID)
   Q_D(ctkDICOMDatabase);
 
   QString result;
+  if (d->cachedLookup("descriptionForStudy", studyUID, result))
+  {
+    return result;
+  }
 
   QSqlQuery query(d->Database);
   query.prepare( "SELECT StudyDescription FROM Studies WHERE StudyInstanceUID= ?" );
@@ -1946,6 +3497,7 @@ QString ctkDICOMDatabase::descriptionForStudy(const QString studyUID)
     result =  query.value(0).toString();
   }
 
+  d->cacheLookup("descriptionForStudy", studyUID, result);
   return result;
 }
 
@@ -1955,6 +3507,10 @@ QString ctkDICOMDatabase::nameForPatient(const QString patientUID)
   Q_D(ctkDICOMDatabase);
 
   QString result;
+  if (d->cachedLookup("nameForPatient", patientUID, result))
+  {
+    return result;
+  }
 
   QSqlQuery query(d->Database);
   query.prepare( "SELECT PatientsName FROM Patients WHERE UID= ?" );
@@ -1965,6 +3521,7 @@ QString ctkDICOMDatabase::nameForPatient(const QString patientUID)
     result =  query.value(0).toString();
   }
 
+  d->cacheLookup("nameForPatient", patientUID, result);
   return result;
 }
 
@@ -2021,15 +3578,20 @@ QStringList ctkDICOMDatabase::filesForSeries(QString seriesUID)
 QString ctkDICOMDatabase::fileForInstance(QString sopInstanceUID)
 {
   Q_D(ctkDICOMDatabase);
+  QString result;
+  if (d->cachedLookup("fileForInstance", sopInstanceUID, result))
+  {
+    return result;
+  }
   QSqlQuery query(d->Database);
   query.prepare( "SELECT Filename FROM Images WHERE SOPInstanceUID=?");
   query.addBindValue( sopInstanceUID );
   query.exec();
-  QString result;
   if (query.next())
   {
     result = query.value(0).toString();
   }
+  d->cacheLookup("fileForInstance", sopInstanceUID, result);
   return( result );
 }
 
@@ -2037,15 +3599,20 @@ QString ctkDICOMDatabase::fileForInstance(QString sopInstanceUID)
 QString ctkDICOMDatabase::seriesForFile(QString fileName)
 {
   Q_D(ctkDICOMDatabase);
+  QString result;
+  if (d->cachedLookup("seriesForFile", fileName, result))
+  {
+    return result;
+  }
   QSqlQuery query(d->Database);
   query.prepare( "SELECT SeriesInstanceUID FROM Images WHERE Filename=?");
   query.addBindValue( fileName );
   query.exec();
-  QString result;
   if (query.next())
   {
     result = query.value(0).toString();
   }
+  d->cacheLookup("seriesForFile", fileName, result);
   return( result );
 }
 
@@ -2053,15 +3620,20 @@ QString ctkDICOMDatabase::seriesForFile(QString fileName)
 QString ctkDICOMDatabase::instanceForFile(QString fileName)
 {
   Q_D(ctkDICOMDatabase);
+  QString result;
+  if (d->cachedLookup("instanceForFile", fileName, result))
+  {
+    return result;
+  }
   QSqlQuery query(d->Database);
   query.prepare( "SELECT SOPInstanceUID FROM Images WHERE Filename=?");
   query.addBindValue( fileName );
   query.exec();
-  QString result;
   if (query.next())
   {
     result = query.value(0).toString();
   }
+  d->cacheLookup("instanceForFile", fileName, result);
   return( result );
 }
 
@@ -2338,6 +3910,61 @@ bool ctkDICOMDatabase::instanceValueExists(const QString sopInstanceUID, const u
   }
 }
 
+//------------------------------------------------------------------------------
+QList<QStringList> ctkDICOMDatabase::instanceValues(const QStringList& sopInstanceUIDs, const QStringList& tags)
+{
+  Q_D(ctkDICOMDatabase);
+  QStringList fileNames;
+  for (int instanceIndex = 0; instanceIndex < sopInstanceUIDs.size(); ++instanceIndex)
+  {
+    // file names are only looked up if needed
+    fileNames << QString();
+  }
+  return d->valuesForInstances(sopInstanceUIDs, fileNames, tags);
+}
+
+//------------------------------------------------------------------------------
+QList<QStringList> ctkDICOMDatabase::fileValues(const QStringList& fileNames, const QStringList& tags)
+{
+  Q_D(ctkDICOMDatabase);
+  QList<QSqlRecord> records;
+  d->selectForValues(d->Database, "SELECT Filename, SOPInstanceUID FROM Images WHERE Filename IN (%1)",
+    fileNames, records);
+  QHash<QString, QString> sopInstanceUIDForFileName;
+  foreach(const QSqlRecord& record, records)
+  {
+    sopInstanceUIDForFileName[record.value(0).toString()] = record.value(1).toString();
+  }
+  QStringList sopInstanceUIDs;
+  foreach(const QString& fileName, fileNames)
+  {
+    sopInstanceUIDs << sopInstanceUIDForFileName.value(fileName);
+  }
+  return d->valuesForInstances(sopInstanceUIDs, fileNames, tags);
+}
+
+//------------------------------------------------------------------------------
+QList<QStringList> ctkDICOMDatabase::seriesValues(const QString& seriesInstanceUID, const QStringList& tags,
+  QStringList& sopInstanceUIDs)
+{
+  Q_D(ctkDICOMDatabase);
+  sopInstanceUIDs.clear();
+  QStringList fileNames;
+  QSqlQuery query(d->Database);
+  query.prepare("SELECT SOPInstanceUID, Filename FROM Images WHERE SeriesInstanceUID = ?");
+  query.addBindValue(seriesInstanceUID);
+  if (!d->loggedExec(query))
+  {
+    return QList<QStringList>();
+  }
+  while (query.next())
+  {
+    sopInstanceUIDs << query.value(0).toString();
+    fileNames << query.value(1).toString();
+  }
+  return d->valuesForInstances(sopInstanceUIDs, fileNames, tags);
+}
+
 //------------------------------------------------------------------------------
 bool ctkDICOMDatabase::fileValueExists(const QString fileName, QString tag)
 {
@@ -2452,6 +4079,7 @@ void ctkDICOMDatabase::prepareInsert()
   // items are still in the database. We clear cached Last... IDs to make sure
   // the patient, study, series items are created.
   d->resetLastInsertedValues();
+  d->clearLookupCache();
 }
 
 //------------------------------------------------------------------------------
@@ -2467,69 +4095,219 @@ void ctkDICOMDatabase::insert( DcmItem *item, bool storeFile, bool generateThumb
 }
 
 //------------------------------------------------------------------------------
-void ctkDICOMDatabase::insert( const ctkDICOMItem& dataset, bool storeFile, bool generateThumbnail)
+void ctkDICOMDatabase::insert( const ctkDICOMItem& dataset, bool storeFile, bool generateThumbnail)
+{
+  Q_D(ctkDICOMDatabase);
+  d->insert(dataset, QString(), storeFile, generateThumbnail);
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMDatabase::insert(const QString& filePath, const ctkDICOMItem& dataset,
+  bool storeFile, bool generateThumbnail)
+{
+  Q_D(ctkDICOMDatabase);
+  d->insert(dataset, filePath, storeFile, generateThumbnail);
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMDatabase::insert( const QString& filePath, bool storeFile, bool generateThumbnail, bool createHierarchy, const QString& destinationDirectoryName)
+{
+  Q_D(ctkDICOMDatabase);
+  Q_UNUSED(createHierarchy);
+  Q_UNUSED(destinationDirectoryName);
+
+  /// first we check if the file is already in the database
+  if (fileExistsAndUpToDate(filePath))
+  {
+    logger.debug( "File " + filePath + " already added.");
+    return;
+  }
+
+  if (d->LoggedExecVerbose)
+  {
+    logger.debug( "Processing " + filePath );
+  }
+
+  ctkDICOMItem dataset;
+
+  dataset.InitializeFromFile(filePath);
+  if ( dataset.IsInitialized() )
+  {
+    d->insert( dataset, filePath, storeFile, generateThumbnail );
+  }
+  else
+  {
+    logger.warn(QString("Could not read DICOM file:") + filePath);
+  }
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMDatabase::setTagsToPrecache(const QStringList tags)
+{
+  Q_D(ctkDICOMDatabase);
+  if (d->TagsToPrecache == tags)
+  {
+    return;
+  }
+  d->TagsToPrecache = tags;
+  emit tagsToPrecacheChanged();
+}
+
+//------------------------------------------------------------------------------
+const QStringList ctkDICOMDatabase::tagsToPrecache()
+{
+  Q_D(ctkDICOMDatabase);
+  return d->TagsToPrecache;
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabase::setDatabasePragma(const QString& name, const QString& value)
+{
+  Q_D(ctkDICOMDatabase);
+  QString pragmaName = name.toLower();
+  bool supported = false;
+  for (int pragmaIndex = 0; SUPPORTED_DATABASE_PRAGMAS[pragmaIndex]; ++pragmaIndex)
+  {
+    if (pragmaName == SUPPORTED_DATABASE_PRAGMAS[pragmaIndex])
+    {
+      supported = true;
+      break;
+    }
+  }
+  if (!supported)
+  {
+    logger.error("Failed to set database pragma: " + name + " is not supported");
+    return false;
+  }
+  // Pragma values cannot be bound to statements, therefore only simple values (keywords and numbers) are allowed
+  foreach(const QChar& character, value)
+  {
+    if (!character.isLetterOrNumber() && character != QLatin1Char('-') && character != QLatin1Char('_'))
+    {
+      logger.error("Failed to set database pragma " + name + ": invalid value " + value);
+      return false;
+    }
+  }
+  if (value.isEmpty())
+  {
+    if (!d->DatabasePragmas.contains(pragmaName))
+    {
+      return true;
+    }
+    d->DatabasePragmas.remove(pragmaName);
+  }
+  else
+  {
+    if (d->DatabasePragmas.value(pragmaName) == value)
+    {
+      return true;
+    }
+    d->DatabasePragmas[pragmaName] = value;
+    // Apply to already open connections
+    if (d->Database.isOpen())
+    {
+      d->applyDatabasePragmas(d->Database, pragmaName);
+    }
+    if (d->TagCacheDatabase.isOpen())
+    {
+      d->applyDatabasePragmas(d->TagCacheDatabase, pragmaName);
+    }
+  }
+  emit databasePragmasChanged();
+  return true;
+}
+
+//------------------------------------------------------------------------------
+QString ctkDICOMDatabase::databasePragma(const QString& name) const
+{
+  Q_D(const ctkDICOMDatabase);
+  return d->DatabasePragmas.value(name.toLower());
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMDatabase::setDatabasePragmas(const QMap<QString, QString>& pragmas)
+{
+  Q_D(ctkDICOMDatabase);
+  foreach(const QString& name, d->DatabasePragmas.keys())
+  {
+    if (!pragmas.contains(name))
+    {
+      this->setDatabasePragma(name, QString());
+    }
+  }
+  foreach(const QString& name, pragmas.keys())
+  {
+    this->setDatabasePragma(name, pragmas[name]);
+  }
+}
+
+//------------------------------------------------------------------------------
+QMap<QString, QString> ctkDICOMDatabase::databasePragmas() const
+{
+  Q_D(const ctkDICOMDatabase);
+  return d->DatabasePragmas;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMDatabase::setNumberOfStorageCopyThreads(int count)
+{
+  Q_D(ctkDICOMDatabase);
+  d->StorageCopyThreadPool.setMaxThreadCount(qMax(1, count));
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMDatabase::numberOfStorageCopyThreads() const
 {
-  Q_D(ctkDICOMDatabase);
-  d->insert(dataset, QString(), storeFile, generateThumbnail);
+  Q_D(const ctkDICOMDatabase);
+  return d->StorageCopyThreadPool.maxThreadCount();
 }
 
 //------------------------------------------------------------------------------
-void ctkDICOMDatabase::insert(const QString& filePath, const ctkDICOMItem& dataset,
-  bool storeFile, bool generateThumbnail)
+void ctkDICOMDatabase::setLookupCacheSize(int size)
 {
   Q_D(ctkDICOMDatabase);
-  d->insert(dataset, filePath, storeFile, generateThumbnail);
+  QMutexLocker locker(&d->LookupCacheMutex);
+  d->LookupCache.setMaxCost(qMax(size, 0));
 }
 
 //------------------------------------------------------------------------------
-void ctkDICOMDatabase::insert( const QString& filePath, bool storeFile, bool generateThumbnail, bool createHierarchy, const QString& destinationDirectoryName)
+int ctkDICOMDatabase::lookupCacheSize() const
 {
-  Q_D(ctkDICOMDatabase);
-  Q_UNUSED(createHierarchy);
-  Q_UNUSED(destinationDirectoryName);
-
-  /// first we check if the file is already in the database
-  if (fileExistsAndUpToDate(filePath))
-  {
-    logger.debug( "File " + filePath + " already added.");
-    return;
-  }
-
-  if (d->LoggedExecVerbose)
-  {
-    logger.debug( "Processing " + filePath );
-  }
+  Q_D(const ctkDICOMDatabase);
+  QMutexLocker locker(&d->LookupCacheMutex);
+  return d->LookupCache.maxCost();
+}
 
-  ctkDICOMItem dataset;
+//------------------------------------------------------------------------------
+void ctkDICOMDatabase::clearLookupCache()
+{
+  Q_D(ctkDICOMDatabase);
+  d->clearLookupCache();
+}
 
-  dataset.InitializeFromFile(filePath);
-  if ( dataset.IsInitialized() )
-  {
-    d->insert( dataset, filePath, storeFile, generateThumbnail );
-  }
-  else
-  {
-    logger.warn(QString("Could not read DICOM file:") + filePath);
-  }
+//------------------------------------------------------------------------------
+int ctkDICOMDatabase::lookupCacheHitCount() const
+{
+  Q_D(const ctkDICOMDatabase);
+  QMutexLocker locker(&d->LookupCacheMutex);
+  return d->LookupCacheHitCount;
 }
 
 //------------------------------------------------------------------------------
-void ctkDICOMDatabase::setTagsToPrecache(const QStringList tags)
+int ctkDICOMDatabase::lookupCacheMissCount() const
 {
-  Q_D(ctkDICOMDatabase);
-  if (d->TagsToPrecache == tags)
-  {
-    return;
-  }
-  d->TagsToPrecache = tags;
-  emit tagsToPrecacheChanged();
+  Q_D(const ctkDICOMDatabase);
+  QMutexLocker locker(&d->LookupCacheMutex);
+  return d->LookupCacheMissCount;
 }
 
 //------------------------------------------------------------------------------
-const QStringList ctkDICOMDatabase::tagsToPrecache()
+void ctkDICOMDatabase::resetLookupCacheCounters()
 {
   Q_D(ctkDICOMDatabase);
-  return d->TagsToPrecache;
+  QMutexLocker locker(&d->LookupCacheMutex);
+  d->LookupCacheHitCount = 0;
+  d->LookupCacheMissCount = 0;
 }
 
 //------------------------------------------------------------------------------
@@ -2591,6 +4369,108 @@ bool ctkDICOMDatabase::allFilesModifiedTimes(QMap<QString, QDateTime>& modifiedT
   return success;
 }
 
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabase::filesModifiedTimesInDirectory(const QString& directoryPath, QMap<QString, QDateTime>& modifiedTimeForFilepath)
+{
+  Q_D(ctkDICOMDatabase);
+  // Prefix is compared with substr instead of LIKE, as file paths may contain wildcard characters
+  QString pathPrefix = QDir::cleanPath(directoryPath) + "/";
+  QSqlQuery filesModifiedQuery(database());
+  filesModifiedQuery.setForwardOnly(true);
+  filesModifiedQuery.prepare("SELECT Filename, InsertTimestamp FROM Images WHERE substr(Filename, 1, ?) = ?;");
+  filesModifiedQuery.addBindValue(pathPrefix.length());
+  filesModifiedQuery.addBindValue(pathPrefix);
+  bool success = d->loggedExec(filesModifiedQuery);
+  while (filesModifiedQuery.next())
+  {
+    QString filename = filesModifiedQuery.value(0).toString();
+    QDateTime modifiedTime = QDateTime::fromString(filesModifiedQuery.value(1).toString(), Qt::ISODate);
+    if (modifiedTimeForFilepath.contains(filename) && modifiedTimeForFilepath[filename] <= modifiedTime)
+    {
+      continue;
+    }
+    modifiedTimeForFilepath[filename] = modifiedTime;
+  }
+  filesModifiedQuery.finish();
+  return success;
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabase::directoryFingerprints(QHash<QString, DirectoryFingerprint>& fingerprintForDirectory)
+{
+  Q_D(ctkDICOMDatabase);
+  QSqlQuery fingerprintsQuery(d->Database);
+  fingerprintsQuery.setForwardOnly(true);
+  if (!d->loggedExec(fingerprintsQuery, "SELECT Path, ModifiedTime, Inode FROM DirectoryFingerprints;"))
+  {
+    return false;
+  }
+  while (fingerprintsQuery.next())
+  {
+    DirectoryFingerprint& fingerprint = fingerprintForDirectory[fingerprintsQuery.value(0).toString()];
+    fingerprint.modifiedTime = fingerprintsQuery.value(1).toLongLong();
+    fingerprint.inode = fingerprintsQuery.value(2).toULongLong();
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabase::setDirectoryFingerprints(const QHash<QString, DirectoryFingerprint>& fingerprintForDirectory)
+{
+  Q_D(ctkDICOMDatabase);
+  if (fingerprintForDirectory.isEmpty())
+  {
+    return true;
+  }
+  QVariantList paths;
+  QVariantList modifiedTimes;
+  QVariantList inodes;
+  QHash<QString, DirectoryFingerprint>::const_iterator it;
+  for (it = fingerprintForDirectory.constBegin(); it != fingerprintForDirectory.constEnd(); ++it)
+  {
+    paths << it.key();
+    modifiedTimes << it.value().modifiedTime;
+    // SQLite integers are signed 64-bit
+    inodes << static_cast<qint64>(it.value().inode);
+  }
+  d->Database.transaction();
+  QSqlQuery insertQuery(d->Database);
+  insertQuery.prepare("INSERT OR REPLACE INTO DirectoryFingerprints (Path, ModifiedTime, Inode) VALUES (?, ?, ?)");
+  insertQuery.addBindValue(paths);
+  insertQuery.addBindValue(modifiedTimes);
+  insertQuery.addBindValue(inodes);
+  bool success = d->loggedExecBatch(insertQuery);
+  d->Database.commit();
+  return success;
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabase::removeDirectoryFingerprints(const QStringList& directoryPaths)
+{
+  Q_D(ctkDICOMDatabase);
+  if (directoryPaths.isEmpty())
+  {
+    return true;
+  }
+  QVariantList paths;
+  foreach(const QString& directoryPath, directoryPaths)
+  {
+    paths << directoryPath;
+  }
+  QSqlQuery removeQuery(d->Database);
+  removeQuery.prepare("DELETE FROM DirectoryFingerprints WHERE Path = ?");
+  removeQuery.addBindValue(paths);
+  return d->loggedExecBatch(removeQuery);
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabase::removeAllDirectoryFingerprints()
+{
+  Q_D(ctkDICOMDatabase);
+  QSqlQuery removeQuery(d->Database);
+  return d->loggedExec(removeQuery, "DELETE FROM DirectoryFingerprints;");
+}
+
 //------------------------------------------------------------------------------
 bool ctkDICOMDatabase::isOpen() const
 {
@@ -2606,117 +4486,184 @@ bool ctkDICOMDatabase::isInMemory() const
 }
 
 //------------------------------------------------------------------------------
-bool ctkDICOMDatabase::removeSeries(const QString& seriesInstanceUID, bool clearCachedTags/*=true*/)
+bool ctkDICOMDatabase::removeItems(const QStringList& patientUIDs, const QStringList& studyInstanceUIDs,
+  const QStringList& seriesInstanceUIDs, bool clearCachedTags/*=false*/)
 {
   Q_D(ctkDICOMDatabase);
 
-  // get all images from series
-  QSqlQuery fileExistsQuery(d->Database);
-  fileExistsQuery.prepare("SELECT Filename, SOPInstanceUID, StudyInstanceUID FROM Images,Series WHERE Series.SeriesInstanceUID = Images.SeriesInstanceUID AND Images.SeriesInstanceUID = :seriesID");
-  fileExistsQuery.bindValue(":seriesID", seriesInstanceUID);
-  bool success = fileExistsQuery.exec();
+  // get all series of the patients and studies
+  QList<QSqlRecord> records;
+  QStringList allStudyInstanceUIDs = studyInstanceUIDs;
+  bool success = d->selectForValues(d->Database, "SELECT StudyInstanceUID FROM Studies WHERE PatientsUID IN (%1)",
+    patientUIDs, records);
+  foreach (const QSqlRecord& record, records)
+  {
+    allStudyInstanceUIDs << record.value(0).toString();
+  }
+  records.clear();
+  QStringList allSeriesInstanceUIDs = seriesInstanceUIDs;
+  success = d->selectForValues(d->Database, "SELECT SeriesInstanceUID FROM Series WHERE StudyInstanceUID IN (%1)",
+    allStudyInstanceUIDs, records) && success;
+  foreach (const QSqlRecord& record, records)
+  {
+    allSeriesInstanceUIDs << record.value(0).toString();
+  }
+  allSeriesInstanceUIDs.removeDuplicates();
+
+  // get the rows whose full-text search index entries change: removed rows and their parents
+  records.clear();
+  success = d->selectForValues(d->Database, "SELECT Series.rowid, Studies.rowid, Studies.PatientsUID "
+    "FROM Series, Studies WHERE Studies.StudyInstanceUID = Series.StudyInstanceUID AND Series.SeriesInstanceUID IN (%1)",
+    allSeriesInstanceUIDs, records) && success;
+  QStringList indexedSeriesRowIds;
+  QStringList indexedStudyRowIds;
+  QStringList indexedPatientRowIds = patientUIDs;
+  foreach (const QSqlRecord& record, records)
+  {
+    indexedSeriesRowIds << record.value(0).toString();
+    indexedStudyRowIds << record.value(1).toString();
+    indexedPatientRowIds << record.value(2).toString();
+  }
+  indexedStudyRowIds.removeDuplicates();
+  indexedPatientRowIds.removeDuplicates();
+
+  // get all images of the series
+  records.clear();
+  success = d->selectForValues(d->Database, "SELECT Filename, SOPInstanceUID, StudyInstanceUID, Images.SeriesInstanceUID "
+    "FROM Images, Series WHERE Series.SeriesInstanceUID = Images.SeriesInstanceUID AND Images.SeriesInstanceUID IN (%1)",
+    allSeriesInstanceUIDs, records) && success;
   if (!success)
   {
-    logger.error("SQLITE ERROR: " + fileExistsQuery.lastError().driverText());
+    logger.error("SQLITE ERROR: failed to get items to remove");
     return false;
   }
 
-  QList< QPair<QString, QString> > removeList;
-  QStringList removeTagCacheSOPInstanceUIDs;
-  while (fileExistsQuery.next())
+  QString databaseFolder = this->databaseDirectory();
+  QStringList filesToRemove;
+  QStringList thumbnailsToRemove;
+  QStringList removedSOPInstanceUIDs;
+  QSet<QString> removedFileDirectories;
+  foreach (const QSqlRecord& record, records)
   {
-    QString dbFilePath = fileExistsQuery.value(fileExistsQuery.record().indexOf("Filename")).toString();
-    QString sopInstanceUID = fileExistsQuery.value(fileExistsQuery.record().indexOf("SOPInstanceUID")).toString();
-    QString studyInstanceUID = fileExistsQuery.value(fileExistsQuery.record().indexOf("StudyInstanceUID")).toString();
-    QString internalFilePath = studyInstanceUID + "/" + seriesInstanceUID + "/" + sopInstanceUID;
-    removeList << qMakePair(dbFilePath, internalFilePath);
-    if (clearCachedTags)
+    QString dbFilePath = record.value(0).toString();
+    removedFileDirectories.insert(QFileInfo(dbFilePath).path());
+    QString sopInstanceUID = record.value(1).toString();
+    QString internalFilePath = record.value(2).toString() + "/" + record.value(3).toString() + "/" + sopInstanceUID;
+    removedSOPInstanceUIDs << sopInstanceUID;
+
+    // only delete files that are below our internal storage
+    QString fileToRemove;
+    if (dbFilePath.startsWith(databaseFolder + "/dicom/"))
     {
-      removeTagCacheSOPInstanceUIDs << sopInstanceUID;
+      if (!dbFilePath.endsWith(internalFilePath))
+      {
+        logger.error("Database inconsistency detected during delete (stored file found ouside database folder)");
+        continue;
+      }
+      fileToRemove = dbFilePath;
     }
+    filesToRemove << fileToRemove;
+    thumbnailsToRemove << databaseFolder + "/thumbs/" + internalFilePath + ".png";
   }
 
-  QSqlQuery fileRemove(d->Database);
-  fileRemove.prepare("DELETE FROM Images WHERE SeriesInstanceUID == :seriesID");
-  fileRemove.bindValue(":seriesID", seriesInstanceUID);
-  logger.debug("SQLITE: removing seriesInstanceUID " + seriesInstanceUID);
-  success = fileRemove.exec();
-  if (!success)
+  // Remove all the records in one transaction
+  bool transactionStarted = d->Database.transaction();
+  logger.debug(QString("SQLITE: removing %1 series").arg(allSeriesInstanceUIDs.size()));
+  success = d->execForValues(d->Database, "DELETE FROM Images WHERE SeriesInstanceUID IN (%1)", allSeriesInstanceUIDs);
+  if (success)
   {
-    logger.error("SQLITE ERROR: could not remove seriesInstanceUID " + seriesInstanceUID);
-    logger.error("SQLITE ERROR: " + fileRemove.lastError().driverText());
+    // Make sure the directories are not skipped when they are indexed again
+    this->removeDirectoryFingerprints(removedFileDirectories.values());
+    // Remove series, studies, and patients that are left without images
+    this->cleanup();
+    // Remove the index entries of removed rows and update the counts of the remaining parents
+    d->updateFullTextSearchIndex("Series", "rowid", indexedSeriesRowIds);
+    d->updateFullTextSearchIndex("Studies", "rowid", indexedStudyRowIds);
+    d->updateFullTextSearchIndex("Patients", "rowid", indexedPatientRowIds);
   }
-
-  if (!removeTagCacheSOPInstanceUIDs.isEmpty())
+  if (transactionStarted)
   {
-    d->TagCacheDatabase.transaction();
-    // Remove values from tag cache (may be important for patient confidentiality)
-    foreach(QString sopInstanceUID, removeTagCacheSOPInstanceUIDs)
+    if (success)
     {
-      removeCachedTags(sopInstanceUID);
+      d->Database.commit();
+    }
+    else
+    {
+      d->Database.rollback();
     }
-    d->TagCacheDatabase.commit();
   }
-
-  QPair<QString,QString> fileToRemove;
-  QStringList foldersToRemove;
-  foreach (fileToRemove, removeList)
+  if (!success)
   {
-    QString dbFilePath = fileToRemove.first;
-    QString thumbnailToRemove = databaseDirectory() + "/thumbs/" + fileToRemove.second + ".png";
+    logger.error("SQLITE ERROR: failed to remove items, the database is not changed");
+    return false;
+  }
 
-    // check that the file is below our internal storage
-    if (dbFilePath.startsWith( databaseDirectory() + "/dicom/"))
+  if (clearCachedTags && !removedSOPInstanceUIDs.isEmpty() && this->tagCacheExists())
+  {
+    // Remove values from tag cache (may be important for patient confidentiality)
+    QVariantList sopInstanceUIDs;
+    foreach (const QString& sopInstanceUID, removedSOPInstanceUIDs)
     {
-      if (!dbFilePath.endsWith(fileToRemove.second))
-      {
-        logger.error("Database inconsistency detected during delete (stored file found ouside database folder)");
-        continue;
-      }
-      if (QFile( dbFilePath ).remove())
-      {
-        if (d->LoggedExecVerbose)
-        {
-          logger.debug("Removed file " + dbFilePath );
-        }
-        QString fileFolder = QFileInfo(dbFilePath).absoluteDir().path();
-        if (foldersToRemove.isEmpty() || foldersToRemove.last() != fileFolder)
-        {
-          foldersToRemove << fileFolder;
-        }
-      }
-      else
-      {
-        logger.warn("Failed to remove file " + dbFilePath );
-      }
+      sopInstanceUIDs << sopInstanceUID;
     }
-    // Remove thumbnail (if exists)
-    QFile thumbnailFile(thumbnailToRemove);
-    if (thumbnailFile.exists())
+    d->TagCacheDatabase.transaction();
+    QSqlQuery deleteValues(d->TagCacheDatabase);
+    QSqlQuery deleteInstances(d->TagCacheDatabase);
+    QSqlQuery dropTable(d->TagCacheDatabase);
+    if (!d->createTemporaryInstanceTable(d->TagCacheDatabase, "RemovedInstances", sopInstanceUIDs)
+      || !d->loggedExec(deleteValues, "DELETE FROM TagCacheValues WHERE InstanceID IN "
+        "(SELECT InstanceID FROM TagCacheInstances WHERE SOPInstanceUID IN (SELECT SOPInstanceUID FROM temp.RemovedInstances))")
+      || !d->loggedExec(deleteInstances, "DELETE FROM TagCacheInstances WHERE SOPInstanceUID IN "
+        "(SELECT SOPInstanceUID FROM temp.RemovedInstances)"))
     {
-      if (!thumbnailFile.remove())
-      {
-      logger.warn("Failed to remove thumbnail " + thumbnailToRemove);
-      }
-      QString fileFolder = QFileInfo(thumbnailFile).absoluteDir().path();
-      if (foldersToRemove.isEmpty() || foldersToRemove.last() != fileFolder)
-      {
-        foldersToRemove << fileFolder;
-      }
+      logger.error("SQLITE ERROR deleting tag cache rows of removed instances");
     }
+    d->loggedExec(dropTable, "DROP TABLE IF EXISTS temp.RemovedInstances");
+    d->TagCacheDatabase.commit();
   }
 
-  // Delete all empty folders that are left after removing DICOM files
-  foreach (QString folderToRemove, foldersToRemove)
+  d->resetLastInsertedValues();
+  d->clearLookupCache();
+
+  d->startFileRemoval(filesToRemove, thumbnailsToRemove);
+
+  if (!allSeriesInstanceUIDs.isEmpty())
   {
-    QDir().rmpath(folderToRemove);
+    emit itemsRemoved();
   }
+  return true;
+}
 
-  this->cleanup();
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabase::isFileRemovalInProgress() const
+{
+  Q_D(const ctkDICOMDatabase);
+  return d->FileRemovalProcessedCount.loadAcquire() < d->FileRemovalTotalCount.loadAcquire();
+}
 
-  d->resetLastInsertedValues();
+//------------------------------------------------------------------------------
+void ctkDICOMDatabase::waitForFileRemoval()
+{
+  Q_D(ctkDICOMDatabase);
+  d->FileRemovalThreadPool.waitForDone();
+}
 
-  return true;
+//------------------------------------------------------------------------------
+void ctkDICOMDatabase::cancelFileRemoval()
+{
+  Q_D(ctkDICOMDatabase);
+  // Remaining files are skipped by the removal tasks, so that progress still reaches the total
+  d->FileRemovalCancelled.storeRelease(1);
+  d->FileRemovalThreadPool.waitForDone();
+  d->FileRemovalCancelled.storeRelease(0);
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMDatabase::removeSeries(const QString& seriesInstanceUID, bool clearCachedTags/*=true*/)
+{
+  bool success = this->removeItems(QStringList(), QStringList(), QStringList() << seriesInstanceUID, clearCachedTags);
+  this->waitForFileRemoval();
+  return success;
 }
 
 //------------------------------------------------------------------------------
@@ -2727,11 +4674,17 @@ bool ctkDICOMDatabase::cleanup(bool vacuum/*=false*/)
   seriesCleanup.exec("DELETE FROM Series WHERE ( SELECT COUNT(*) FROM Images WHERE Images.SeriesInstanceUID = Series.SeriesInstanceUID ) = 0;");
   seriesCleanup.exec("DELETE FROM Studies WHERE ( SELECT COUNT(*) FROM Series WHERE Series.StudyInstanceUID = Studies.StudyInstanceUID ) = 0;");
   seriesCleanup.exec("DELETE FROM Patients WHERE ( SELECT COUNT(*) FROM Studies WHERE Studies.PatientsUID = Patients.UID ) = 0;");
+  d->clearLookupCache();
   if (vacuum)
   {
     seriesCleanup.exec("VACUUM;");
+    // Vacuum may renumber the rows of tables that do not have an integer primary key
+    if (!d->FullTextSearchIndexFieldNames.isEmpty())
+    {
+      d->createFullTextSearchIndex(true);
+    }
     QSqlQuery tagcacheCleanup(d->TagCacheDatabase);
-    seriesCleanup.exec("VACUUM;");
+    tagcacheCleanup.exec("VACUUM;");
   }
   return true;
 }
@@ -2739,55 +4692,17 @@ bool ctkDICOMDatabase::cleanup(bool vacuum/*=false*/)
 //------------------------------------------------------------------------------
 bool ctkDICOMDatabase::removeStudy(const QString& studyInstanceUID)
 {
-  Q_D(ctkDICOMDatabase);
-
-  QSqlQuery seriesForStudy( d->Database );
-  seriesForStudy.prepare("SELECT SeriesInstanceUID FROM Series WHERE StudyInstanceUID = :studyID");
-  seriesForStudy.bindValue(":studyID", studyInstanceUID);
-  bool success = seriesForStudy.exec();
-  if (!success)
-  {
-    logger.error("SQLITE ERROR: " + seriesForStudy.lastError().driverText());
-    return false;
-  }
-  bool result = true;
-  while ( seriesForStudy.next() )
-  {
-    QString seriesInstanceUID = seriesForStudy.value(seriesForStudy.record().indexOf("SeriesInstanceUID")).toString();
-    if ( ! this->removeSeries(seriesInstanceUID) )
-    {
-      result = false;
-    }
-  }
-  d->resetLastInsertedValues();
-  return result;
+  bool success = this->removeItems(QStringList(), QStringList() << studyInstanceUID, QStringList());
+  this->waitForFileRemoval();
+  return success;
 }
 
 //------------------------------------------------------------------------------
 bool ctkDICOMDatabase::removePatient(const QString& patientID)
 {
-  Q_D(ctkDICOMDatabase);
-
-  QSqlQuery studiesForPatient( d->Database );
-  studiesForPatient.prepare("SELECT StudyInstanceUID FROM Studies WHERE PatientsUID = :patientsID");
-  studiesForPatient.bindValue(":patientsID", patientID);
-  bool success = studiesForPatient.exec();
-  if (!success)
-  {
-    logger.error("SQLITE ERROR: " + studiesForPatient.lastError().driverText());
-    return false;
-  }
-  bool result = true;
-  while ( studiesForPatient.next() )
-  {
-    QString studyInstanceUID = studiesForPatient.value(studiesForPatient.record().indexOf("StudyInstanceUID")).toString();
-    if ( ! this->removeStudy(studyInstanceUID) )
-    {
-      result = false;
-    }
-  }
-  d->resetLastInsertedValues();
-  return result;
+  bool success = this->removeItems(QStringList() << patientID, QStringList(), QStringList());
+  this->waitForFileRemoval();
+  return success;
 }
 
 ///
@@ -2814,9 +4729,20 @@ bool ctkDICOMDatabase::tagCacheExists()
     return false;
   }
 
+  // convert legacy tag cache (TagCache was a table, now it is a view)
+  QStringList tables = d->TagCacheDatabase.tables();
+  if (tables.contains("TagCache") && !tables.contains("TagCacheValues"))
+  {
+    if (!d->migrateLegacyTagCache())
+    {
+      logger.error("Failed to convert tag cache to compact layout");
+      return false;
+    }
+  }
+
   // check that the table exists
   QSqlQuery cacheExists( d->TagCacheDatabase );
-  cacheExists.prepare("SELECT * FROM TagCache LIMIT 1");
+  cacheExists.prepare("SELECT * FROM TagCacheValues LIMIT 1");
   bool success = d->loggedExec(cacheExists);
   if (success)
   {
@@ -2833,21 +4759,33 @@ bool ctkDICOMDatabase::initializeTagCache()
   Q_D(ctkDICOMDatabase);
 
   // First, drop any existing table
-  if ( this->tagCacheExists() )
+  if (!d->openTagCacheDatabase())
+  {
+    return false;
+  }
+  d->TagCacheVerified = false;
+  qDebug() << "TagCacheDatabase drop existing tables\n";
+  QStringList dropStatements;
+  if (d->TagCacheDatabase.tables().contains("TagCache"))
+  {
+    // legacy tag cache table
+    dropStatements << "DROP TABLE TagCache";
+  }
+  else
+  {
+    dropStatements << "DROP VIEW IF EXISTS TagCache";
+  }
+  dropStatements << "DROP TABLE IF EXISTS TagCacheValues";
+  dropStatements << "DROP TABLE IF EXISTS TagCacheInstances";
+  foreach(const QString& dropStatement, dropStatements)
   {
-    qDebug() << "TagCacheDatabase drop existing table\n";
     QSqlQuery dropCacheTable( d->TagCacheDatabase );
-    dropCacheTable.prepare( "DROP TABLE TagCache" );
-    d->loggedExec(dropCacheTable);
+    d->loggedExec(dropCacheTable, dropStatement);
   }
 
-  // now create a table
-  qDebug() << "TagCacheDatabase adding table\n";
-  QSqlQuery createCacheTable( d->TagCacheDatabase );
-  createCacheTable.prepare(
-    "CREATE TABLE TagCache (SOPInstanceUID, Tag, Value, PRIMARY KEY (SOPInstanceUID, Tag))" );
-  bool success = d->loggedExec(createCacheTable);
-  if (!success)
+  // now create the tables
+  qDebug() << "TagCacheDatabase adding tables\n";
+  if (!d->createTagCacheTables())
   {
     return false;
   }
@@ -2867,10 +4805,16 @@ QString ctkDICOMDatabase::cachedTag(const QString sopInstanceUID, const QString
       return( "" );
     }
   }
+  qint64 tagCacheKey = 0;
+  if (!tagCacheKeyForTag(tag, tagCacheKey))
+  {
+    return( "" );
+  }
   QSqlQuery selectValue( d->TagCacheDatabase );
-  selectValue.prepare( "SELECT Value FROM TagCache WHERE SOPInstanceUID = :sopInstanceUID AND Tag = :tag" );
+  selectValue.prepare( "SELECT Value FROM TagCacheValues WHERE InstanceID = "
+    "(SELECT InstanceID FROM TagCacheInstances WHERE SOPInstanceUID = :sopInstanceUID) AND Tag = :tag" );
   selectValue.bindValue(":sopInstanceUID",sopInstanceUID);
-  selectValue.bindValue(":tag",tag);
+  selectValue.bindValue(":tag",tagCacheKey);
   d->loggedExec(selectValue);
   QString result("");
   if (selectValue.next())
@@ -2898,14 +4842,15 @@ void ctkDICOMDatabase::getCachedTags(const QString sopInstanceUID, QMap<QString,
     }
   }
   QSqlQuery selectValue( d->TagCacheDatabase );
-  selectValue.prepare( "SELECT Tag, Value FROM TagCache WHERE SOPInstanceUID = :sopInstanceUID" );
+  selectValue.prepare( "SELECT Tag, Value FROM TagCacheValues WHERE InstanceID = "
+    "(SELECT InstanceID FROM TagCacheInstances WHERE SOPInstanceUID = :sopInstanceUID)" );
   selectValue.bindValue(":sopInstanceUID",sopInstanceUID);
   d->loggedExec(selectValue);
   QString tag;
   QString value;
   while (selectValue.next())
   {
-    tag = selectValue.value(0).toString();
+    tag = tagForTagCacheKey(selectValue.value(0).toLongLong());
     value = selectValue.value(1).toString();
     if (value == TagNotInInstance || value == ValueIsEmptyString || value == ValueIsNotStored)
     {
@@ -2944,37 +4889,18 @@ bool ctkDICOMDatabase::cacheTags(const QStringList sopInstanceUIDs, const QStrin
       }
     }
 
-  d->TagCacheDatabase.transaction();
-
-  QSqlQuery insertTags(d->TagCacheDatabase);
-  insertTags.prepare( "INSERT OR REPLACE INTO TagCache VALUES(?,?,?)" );
-
-  QStringList::const_iterator sopInstanceUIDsIt = sopInstanceUIDs.begin();
-  QStringList::const_iterator tagsIt = tags.begin();
-  QStringList::const_iterator valuesIt = values.begin();
-  bool success = true;
+  QVariantList sopInstanceUIDValues;
+  QVariantList tagValues;
+  QVariantList valueValues;
   for (int i = 0; i<itemCount; ++i)
   {
-    insertTags.bindValue(0, *sopInstanceUIDsIt);
-    insertTags.bindValue(1, *tagsIt);
-    if (valuesIt->isEmpty())
-    {
-      // replace empty strings with special flag string
-      insertTags.bindValue(2, TagNotInInstance);
-    }
-    else
-    {
-      insertTags.bindValue(2, *valuesIt);
-    }
-    if (!insertTags.exec())
-    {
-      success = false;
-    }
-    ++sopInstanceUIDsIt;
-    ++tagsIt;
-    ++valuesIt;
+    sopInstanceUIDValues << sopInstanceUIDs[i];
+    tagValues << tags[i];
+    valueValues << values[i];
   }
 
+  d->TagCacheDatabase.transaction();
+  bool success = d->insertCachedTags(sopInstanceUIDValues, tagValues, valueValues);
   d->TagCacheDatabase.commit();
 
   return success;
@@ -2988,13 +4914,20 @@ void ctkDICOMDatabase::removeCachedTags(const QString sopInstanceUID)
   {
     return;
   }
-  QSqlQuery deleteFile(d->TagCacheDatabase);
-  deleteFile.prepare("DELETE FROM TagCache WHERE SOPInstanceUID == :sopInstanceUID");
-  deleteFile.bindValue(":sopInstanceUID", sopInstanceUID);
-  bool success = deleteFile.exec();
-  if (!success)
+  QSqlQuery deleteValues(d->TagCacheDatabase);
+  deleteValues.prepare("DELETE FROM TagCacheValues WHERE InstanceID = "
+    "(SELECT InstanceID FROM TagCacheInstances WHERE SOPInstanceUID = :sopInstanceUID)");
+  deleteValues.bindValue(":sopInstanceUID", sopInstanceUID);
+  if (!deleteValues.exec())
   {
-    logger.error("SQLITE ERROR deleting tag cache row: " + deleteFile.lastError().driverText());
+    logger.error("SQLITE ERROR deleting tag cache row: " + deleteValues.lastError().driverText());
+  }
+  QSqlQuery deleteInstance(d->TagCacheDatabase);
+  deleteInstance.prepare("DELETE FROM TagCacheInstances WHERE SOPInstanceUID = :sopInstanceUID");
+  deleteInstance.bindValue(":sopInstanceUID", sopInstanceUID);
+  if (!deleteInstance.exec())
+  {
+    logger.error("SQLITE ERROR deleting tag cache row: " + deleteInstance.lastError().driverText());
   }
 }
 
@@ -3006,7 +4939,15 @@ void ctkDICOMDatabase::updateDisplayedFields()
   // Get the files for which the displayed fields have not been created yet (DisplayedFieldsUpdatedTimestamp is NULL)
   //TODO: handle cases when the values actually changed; now we only cover insertion and schema update
   QSqlQuery newFilesQuery(d->Database);
-  d->loggedExec(newFilesQuery,QString("SELECT SOPInstanceUID, SeriesInstanceUID FROM Images WHERE DisplayedFieldsUpdatedTimestamp IS NULL;"));
+  d->loggedExec(newFilesQuery,QString("SELECT SOPInstanceUID, SeriesInstanceUID FROM Images WHERE DisplayedFieldsUpdatedTimestamp IS NULL ORDER BY SOPInstanceUID;"));
+  QVariantList newSOPInstanceUIDs;
+  QStringList newSeriesInstanceUIDs;
+  while (newFilesQuery.next())
+  {
+    newSOPInstanceUIDs << newFilesQuery.value(0);
+    newSeriesInstanceUIDs << newFilesQuery.value(1).toString();
+  }
+  newFilesQuery.finish();
 
   // Populate displayed fields maps from the current display tables
   QMap<QString /*SeriesInstanceUID*/, QMap<QString /*DisplayField*/, QString /*Value*/> > displayedFieldsMapSeries;
@@ -3018,13 +4959,46 @@ void ctkDICOMDatabase::updateDisplayedFields()
   int progressValue = 0;
   emit displayedFieldsUpdateProgress(++progressValue);
 
+  // Get cached tags of all the new files in one query. Both the new files list and the cached tags
+  // are sorted by SOP instance UID, so the tags of each instance can be collected while iterating
+  // through the new files, without keeping the tags of all instances in memory.
+  QSqlQuery cachedTagsQuery(d->TagCacheDatabase);
+  bool cachedTagsAvailable = false;
+  if (!newSOPInstanceUIDs.isEmpty() && (this->tagCacheExists() || this->initializeTagCache()))
+  {
+    if (d->createTemporaryInstanceTable(d->TagCacheDatabase, "DisplayedFieldsUpdateInstances", newSOPInstanceUIDs))
+    {
+      cachedTagsAvailable = d->loggedExec(cachedTagsQuery,
+        "SELECT TagCacheInstances.SOPInstanceUID, TagCacheValues.Tag, TagCacheValues.Value "
+        "FROM temp.DisplayedFieldsUpdateInstances "
+        "INNER JOIN TagCacheInstances ON TagCacheInstances.SOPInstanceUID = DisplayedFieldsUpdateInstances.SOPInstanceUID "
+        "INNER JOIN TagCacheValues ON TagCacheValues.InstanceID = TagCacheInstances.InstanceID "
+        "ORDER BY TagCacheInstances.SOPInstanceUID;");
+      cachedTagsAvailable = cachedTagsAvailable && cachedTagsQuery.next();
+    }
+  }
+
   // Get display names for newly added files and add them into the display tables
-  while (newFilesQuery.next())
+  for (int newFileIndex = 0; newFileIndex < newSOPInstanceUIDs.size(); ++newFileIndex)
   {
-    QString sopInstanceUID = newFilesQuery.value(0).toString();
-    QString seriesInstanceUID = newFilesQuery.value(1).toString();
+    QString sopInstanceUID = newSOPInstanceUIDs[newFileIndex].toString();
+    const QString& seriesInstanceUID = newSeriesInstanceUIDs[newFileIndex];
     QMap<QString, QString> cachedTags;
-    this->getCachedTags(sopInstanceUID, cachedTags);
+    // Skip tags of instances that are not in the new files list (should not happen, as they are joined)
+    while (cachedTagsAvailable && cachedTagsQuery.value(0).toString() < sopInstanceUID)
+    {
+      cachedTagsAvailable = cachedTagsQuery.next();
+    }
+    while (cachedTagsAvailable && cachedTagsQuery.value(0).toString() == sopInstanceUID)
+    {
+      QString value = cachedTagsQuery.value(2).toString();
+      if (value == TagNotInInstance || value == ValueIsEmptyString || value == ValueIsNotStored)
+      {
+        value = QString("");
+      }
+      cachedTags.insert(tagForTagCacheKey(cachedTagsQuery.value(1).toLongLong()), value);
+      cachedTagsAvailable = cachedTagsQuery.next();
+    }
 
     // Patient
     QString patientsName = cachedTags[ctkDICOMItem::TagKeyStripped(DCM_PatientName)];
@@ -3078,6 +5052,13 @@ void ctkDICOMDatabase::updateDisplayedFields()
     displayedFieldsMapPatient[ compositeId ] = displayedFieldsForCurrentPatient;
   } // For each instance
 
+  cachedTagsQuery.finish();
+  if (!newSOPInstanceUIDs.isEmpty() && d->TagCacheDatabase.isOpen())
+  {
+    QSqlQuery dropTableQuery(d->TagCacheDatabase);
+    d->loggedExec(dropTableQuery, QString("DROP TABLE IF EXISTS temp.DisplayedFieldsUpdateInstances ;"));
+  }
+
   emit displayedFieldsUpdateProgress(++progressValue);
 
   // Calculate number of images in each updated series
@@ -3099,15 +5080,15 @@ void ctkDICOMDatabase::updateDisplayedFields()
 
     if (d->applyDisplayedFieldsChanges(displayedFieldsMapSeries, displayedFieldsMapStudy, displayedFieldsMapPatient))
     {
-      // Update image timestamp
-      newFilesQuery.first();
-      newFilesQuery.previous(); // Need to go one before the first record
-      while (newFilesQuery.next())
+      // Update image timestamp of all the processed files in one statement
+      if (d->createTemporaryInstanceTable(d->Database, "DisplayedFieldsUpdateInstances", newSOPInstanceUIDs))
       {
         QSqlQuery updateDisplayedFieldsUpdatedTimestampStatement(d->Database);
-        QString updateDisplayedFieldsUpdatedTimestampStatementString =
-          QString("UPDATE IMAGES SET DisplayedFieldsUpdatedTimestamp=CURRENT_TIMESTAMP WHERE SOPInstanceUID='%1';").arg(newFilesQuery.value(0).toString());
-        d->loggedExec(updateDisplayedFieldsUpdatedTimestampStatement, updateDisplayedFieldsUpdatedTimestampStatementString);
+        d->loggedExec(updateDisplayedFieldsUpdatedTimestampStatement,
+          "UPDATE Images SET DisplayedFieldsUpdatedTimestamp=CURRENT_TIMESTAMP "
+          "WHERE SOPInstanceUID IN (SELECT SOPInstanceUID FROM temp.DisplayedFieldsUpdateInstances);");
+        QSqlQuery dropTableQuery(d->Database);
+        d->loggedExec(dropTableQuery, QString("DROP TABLE IF EXISTS temp.DisplayedFieldsUpdateInstances ;"));
       }
     }
 
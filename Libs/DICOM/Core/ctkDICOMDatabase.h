@@ -64,10 +64,32 @@ class CTK_DICOM_CORE_EXPORT ctkDICOMDatabase : public QObject
 public:
   struct IndexingResult
   {
+    IndexingResult()
+      : copyFile(false)
+      , overwriteExistingDataset(false)
+      , incompleteDataset(false)
+    {
+    }
     QString filePath;
     QSharedPointer<ctkDICOMItem> dataset;
     bool copyFile;
     bool overwriteExistingDataset;
+    /// Dataset contains only a subset of the elements of the file (e.g., it is created
+    /// from DICOMDIR records). Tags that are not in the dataset are not stored in the
+    /// tag cache as missing, so they are read from the file when they are requested.
+    bool incompleteDataset;
+  };
+
+  /// State of a directory at the time its files were last indexed.
+  /// Used by the indexer for skipping unchanged directories when
+  /// a folder is indexed again.
+  struct DirectoryFingerprint
+  {
+    /// Last modification time of the directory (milliseconds since epoch).
+    /// Changes when files are added to, removed from, or renamed in the directory.
+    qint64 modifiedTime;
+    /// File system inode number of the directory (0 if not available)
+    quint64 inode;
   };
 
   explicit ctkDICOMDatabase(QObject *parent = 0);
@@ -95,6 +117,20 @@ public:
   /// @return True if in memory mode, false otherwise.
   bool isInMemory() const;
 
+  /// Return the path of the file in the database folder where the instance is stored
+  /// when it is inserted with storing of the file enabled.
+  /// Files can be saved there directly and then inserted without copying.
+  /// @return Empty string if the database is in memory or sopInstanceUID is empty.
+  QString storagePathForInstance(const QString& studyInstanceUID, const QString& seriesInstanceUID,
+    const QString& sopInstanceUID) const;
+
+  /// Save the dataset to its storage path in the database folder (see storagePathForInstance).
+  /// The dataset is written to a temporary file first, which then replaces the stored file,
+  /// so that a previously stored version of the file is kept if saving fails.
+  /// The dataset is not copied, it can be modified while it is written.
+  /// @return Path of the stored file, empty string if the dataset could not be stored.
+  QString storeDataset(DcmDataset* dataset);
+
   /// Set thumbnail generator object
   Q_INVOKABLE void setThumbnailGenerator(ctkDICOMAbstractThumbnailGenerator* generator);
   /// Get thumbnail generator object
@@ -176,6 +212,18 @@ public:
   Q_INVOKABLE QStringList allFiles ();
 
   bool allFilesModifiedTimes(QMap<QString, QDateTime>& modifiedTimeForFilepath);
+  /// Get insert time of files that are in the specified directory or in its subdirectories.
+  /// Existing items of modifiedTimeForFilepath are only replaced by more recent times.
+  bool filesModifiedTimesInDirectory(const QString& directoryPath, QMap<QString, QDateTime>& modifiedTimeForFilepath);
+
+  /// \brief Fingerprints of indexed directories (directory path -> fingerprint)
+  /// setDirectoryFingerprints adds new fingerprints or replaces existing ones.
+  /// Fingerprint of a directory is removed when an image that is in that directory
+  /// is removed from the database, so that the file is indexed again on next import.
+  bool directoryFingerprints(QHash<QString, DirectoryFingerprint>& fingerprintForDirectory);
+  bool setDirectoryFingerprints(const QHash<QString, DirectoryFingerprint>& fingerprintForDirectory);
+  Q_INVOKABLE bool removeDirectoryFingerprints(const QStringList& directoryPaths);
+  Q_INVOKABLE bool removeAllDirectoryFingerprints();
 
   /// \brief Load the header from a file and allow access to elements
   /// @param sopInstanceUID A string with the uid for a given instance
@@ -207,6 +255,43 @@ public:
   void setTagsToExcludeFromStorage(const QStringList tags);
   const QStringList tagsToExcludeFromStorage();
 
+  /// \brief SQLite pragmas applied to the database connections.
+  /// Pragmas are set on both the main and the tag cache database connections when they are opened
+  /// (and immediately, if they are already open). Setting "journal_mode" to "WAL" allows reading
+  /// the database (e.g., in the DICOM browser) while an import is writing to it.
+  /// Supported pragmas: page_size, journal_mode, synchronous, cache_size, mmap_size, temp_store.
+  /// page_size is only applied when the database file is created. Setting empty value removes the pragma
+  /// (SQLite default is used the next time the database is opened).
+  /// By default only synchronous is set (to OFF, to make modifications faster).
+  /// Returns false if the pragma name is not supported or the value is invalid.
+  Q_INVOKABLE bool setDatabasePragma(const QString& name, const QString& value);
+  Q_INVOKABLE QString databasePragma(const QString& name) const;
+  void setDatabasePragmas(const QMap<QString, QString>& pragmas);
+  QMap<QString, QString> databasePragmas() const;
+
+  /// Number of threads that copy files into the database folder when a batch of indexing results
+  /// is inserted with copyFile enabled. Files are copied without re-encoding the datasets
+  /// (using copy-on-write cloning if the file system supports it) and image rows are only
+  /// inserted for files that are copied successfully. Default is 4.
+  void setNumberOfStorageCopyThreads(int count);
+  int numberOfStorageCopyThreads() const;
+
+  /// \brief Cache of frequent lookups
+  /// Results of fileForInstance, seriesForFile, instanceForFile, studyForSeries, patientForStudy,
+  /// descriptionForSeries, descriptionForStudy and nameForPatient are kept in a least-recently-used
+  /// in-memory cache, which is cleared when records are inserted or removed.
+  /// Size is the maximum number of cached lookup results. Setting 0 disables the cache.
+  /// Default size is 10000.
+  void setLookupCacheSize(int size);
+  int lookupCacheSize() const;
+  /// Remove all lookup results from the cache. Needs to be called if the database
+  /// is modified through a different connection (e.g., by background indexing).
+  Q_INVOKABLE void clearLookupCache();
+  /// Number of lookups that were found/not found in the cache (since the counters were reset)
+  int lookupCacheHitCount() const;
+  int lookupCacheMissCount() const;
+  void resetLookupCacheCounters();
+
   /// Insert into the database if not already existing.
   /// @param dataset The dataset to store into the database. Usually, this is
   ///                is a complete DICOM object, like a complete image. However
@@ -247,6 +332,12 @@ public:
   /// that did not contain ColumnDisplayProperties table.
   Q_INVOKABLE bool isDisplayedFieldsTableAvailable() const;
 
+  /// Get the name of the SQLite FTS5 table that indexes all the fields of the Patients, Studies, or Series table.
+  /// Rowids of the index are the rowids of the indexed rows. The index is updated with the rows that are
+  /// inserted, updated, or removed, entries of removed rows may be left in the index.
+  /// Returns an empty string if the table is not indexed (e.g., FTS5 is not available in the SQLite library).
+  Q_INVOKABLE QString fullTextSearchIndexTableName(const QString& tableName) const;
+
   /// Reset cached item IDs to make sure previous
   /// inserts do not interfere with upcoming insert operations.
   /// Typically, it should be call just before a batch of files
@@ -262,12 +353,30 @@ public:
   /// Check if file is already in database and up-to-date
   Q_INVOKABLE bool fileExistsAndUpToDate(const QString& filePath);
 
+  /// Remove patients, studies, and series from the database in a single transaction.
+  /// Database records are removed before the method returns. Files and thumbnails stored in the
+  /// database folder are deleted in background threads afterwards, see fileRemovalStarted,
+  /// fileRemovalProgress, and fileRemovalFinished signals.
+  /// patientUIDs are database patient indices (Patients.UID), as in removePatient.
+  /// If clearCachedTags is set to true then cached tags of the removed instances are deleted, too.
+  /// Returns false (without changing the database) if the records could not be removed.
+  Q_INVOKABLE bool removeItems(const QStringList& patientUIDs, const QStringList& studyInstanceUIDs,
+    const QStringList& seriesInstanceUIDs, bool clearCachedTags=false);
+  /// Returns true while files of removed items are being deleted
+  Q_INVOKABLE bool isFileRemovalInProgress() const;
+  /// Wait until all files of removed items are deleted
+  Q_INVOKABLE void waitForFileRemoval();
+  /// Stop deleting files of removed items. Files that are not deleted yet are left in the database folder.
+  Q_INVOKABLE void cancelFileRemoval();
+
   /// Remove the series from the database, including images and thumbnails
   /// If clearCachedTags is set to true then cached tags associated with the series are deleted,
   /// if set to False the they are left in the database unchanced.
   /// By default clearCachedTags is disabled because it significantly increases deletion time
   /// on large databases.
   Q_INVOKABLE bool removeSeries(const QString& seriesInstanceUID, bool clearCachedTags=false);
+  /// Remove the study (or patient) from the database, including images and thumbnails.
+  /// Same as removeItems, but the method returns after all files are deleted.
   Q_INVOKABLE bool removeStudy(const QString& studyInstanceUID);
   Q_INVOKABLE bool removePatient(const QString& patientID);
   /// Remove all patients, studies, series, which do not have associated images.
@@ -302,6 +411,20 @@ public:
   Q_INVOKABLE bool fileValueExists(const QString fileName, const QString tag);
   Q_INVOKABLE bool fileValueExists(const QString fileName, const unsigned short group, const unsigned short element);
 
+  /// \brief Get values of several tags for several instances at once.
+  /// Cached values are read using a single query. Values that are not in the tag cache
+  /// are read from the files (in parallel, reading only the header) and added to the tag cache.
+  /// Returns a table with one row for each instance (in the order of sopInstanceUIDs) and
+  /// one column for each tag (in the order of tags). Tags are "gggg,eeee" strings.
+  /// Values are empty if the tag is not present in the instance.
+  Q_INVOKABLE QList<QStringList> instanceValues(const QStringList& sopInstanceUIDs, const QStringList& tags);
+  /// \brief Get values of several tags for several files at once.
+  /// Same as instanceValues, but rows correspond to the files in fileNames.
+  Q_INVOKABLE QList<QStringList> fileValues(const QStringList& fileNames, const QStringList& tags);
+  /// \brief Get values of several tags for all instances of a series.
+  /// Same as instanceValues, the SOP instance UID corresponding to each row is returned in sopInstanceUIDs.
+  QList<QStringList> seriesValues(const QString& seriesInstanceUID, const QStringList& tags, QStringList& sopInstanceUIDs);
+
   /// \brief Store values of previously requested instance elements
   /// These are meant to be internal methods used by the instanceValue and fileValue
   /// methods, but they can be used by calling classes to populate or access
@@ -378,12 +501,20 @@ Q_SIGNALS:
   /// Indicate that an in-memory database has been updated
   void databaseChanged();
 
+  /// Indicate that patients, studies, series, or instances have been removed from the database
+  /// (by removeItems or by initializing the database). Unlike databaseChanged, it is not emitted
+  /// when items are only inserted or when displayed fields are updated.
+  void itemsRemoved();
+
   /// Indicate that tagsToPrecache list changed
   void tagsToPrecacheChanged();
 
   /// Indicate that tagsToExcludeFromStorage list changed
   void tagsToExcludeFromStorageChanged();
 
+  /// Indicate that database pragmas changed
+  void databasePragmasChanged();
+
   /// Indicate that the schema is about to be updated and how many files will be processed
   void schemaUpdateStarted(int);
   /// Indicate progress in updating schema (int is file number, string is file name)
@@ -392,6 +523,13 @@ Q_SIGNALS:
   /// Indicate schema update finished
   void schemaUpdated();
 
+  /// Indicate that files of removed items are being deleted (int is the number of files to process)
+  void fileRemovalStarted(int);
+  /// Indicate progress in deleting files of removed items (int is the number of files processed)
+  void fileRemovalProgress(int);
+  /// Indicate that all files of removed items are deleted (or skipped, if removal was cancelled)
+  void fileRemovalFinished();
+
   /// Trigger showing progress dialog for displayed fields update
   void displayedFieldsUpdateStarted();
   /// Indicate progress in updating displayed fields (int is step number)
@@ -407,5 +545,7 @@ private:
   Q_DISABLE_COPY(ctkDICOMDatabase);
 };
 
+Q_DECLARE_METATYPE(ctkDICOMDatabase::IndexingResult)
+
 #endif
 
@@ -0,0 +1,573 @@
+/*=========================================================================
+
+  Library:   CTK
+
+  Copyright (c) Kitware Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0.txt
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+=========================================================================*/
+
+// Qt includes
+#include <QDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThreadPool>
+
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <sys/sendfile.h>
+#endif
+
+// ctkDICOMCore includes
+#include "ctkDICOMExporter.h"
+#include "ctkLogger.h"
+
+// DCMTK includes
+#include <dcmtk/dcmdata/dcddirif.h>   /* for class DicomDirInterface */
+
+static ctkLogger logger("org.commontk.dicom.DICOMExporter");
+
+/// Default number of threads that copy files.
+/// Copying is I/O bound, therefore it does not depend on the number of processor cores.
+static int DEFAULT_EXPORT_THREAD_COUNT = 4;
+/// Number of files that are exported by a single task of the thread pool
+static int EXPORT_BATCH_SIZE = 16;
+/// Size of the buffer used for copying files if sendfile cannot be used
+static int EXPORT_BUFFER_SIZE = 1024 * 1024;
+
+//------------------------------------------------------------------------------
+/// Copy file contents with a large buffer. The destination file must not exist.
+static bool copyFileBuffered(const QString& sourceFilePath, const QString& destinationFilePath,
+  qint64& copiedBytes, QString& error)
+{
+  QFile sourceFile(sourceFilePath);
+  if (!sourceFile.open(QIODevice::ReadOnly))
+  {
+    error = "Failed to read " + sourceFilePath + ": " + sourceFile.errorString();
+    return false;
+  }
+  QFile destinationFile(destinationFilePath);
+  if (!destinationFile.open(QIODevice::WriteOnly))
+  {
+    error = "Failed to create " + destinationFilePath + ": " + destinationFile.errorString();
+    return false;
+  }
+  QByteArray buffer(EXPORT_BUFFER_SIZE, Qt::Uninitialized);
+  qint64 readBytes = 0;
+  while ((readBytes = sourceFile.read(buffer.data(), buffer.size())) > 0)
+  {
+    if (destinationFile.write(buffer.constData(), readBytes) != readBytes)
+    {
+      error = "Failed to write " + destinationFilePath + ": " + destinationFile.errorString();
+      destinationFile.remove();
+      return false;
+    }
+    copiedBytes += readBytes;
+  }
+  if (readBytes < 0)
+  {
+    error = "Failed to read " + sourceFilePath + ": " + sourceFile.errorString();
+    destinationFile.remove();
+    return false;
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+/// Export a single file by creating a hard link (if requested and possible) or copying it.
+/// The destination file must not exist.
+static bool exportFile(const QString& sourceFilePath, const QString& destinationFilePath, bool linkFile,
+  qint64& exportedBytes, QString& error)
+{
+  exportedBytes = 0;
+  QFileInfo sourceFileInfo(sourceFilePath);
+  if (!sourceFileInfo.exists())
+  {
+    error = "Export source file not found: " + sourceFilePath;
+    return false;
+  }
+  if (QFileInfo(destinationFilePath).exists())
+  {
+    error = "Export destination file already exists: " + destinationFilePath;
+    return false;
+  }
+#ifdef Q_OS_UNIX
+  if (linkFile
+    && ::link(QFile::encodeName(sourceFilePath).constData(), QFile::encodeName(destinationFilePath).constData()) == 0)
+  {
+    // no data is copied, the file is shared by the database and the export folder
+    exportedBytes = sourceFileInfo.size();
+    return true;
+  }
+#else
+  Q_UNUSED(linkFile);
+#endif
+#ifdef Q_OS_LINUX
+  // Copy in the kernel, without passing the data through user space buffers
+  int sourceFile = ::open(QFile::encodeName(sourceFilePath).constData(), O_RDONLY);
+  if (sourceFile >= 0)
+  {
+    struct stat sourceStat;
+    int destinationFile = -1;
+    if (::fstat(sourceFile, &sourceStat) == 0)
+    {
+      destinationFile = ::open(QFile::encodeName(destinationFilePath).constData(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    }
+    if (destinationFile >= 0)
+    {
+      off_t offset = 0;
+      bool sent = true;
+      while (offset < sourceStat.st_size)
+      {
+        if (::sendfile(destinationFile, sourceFile, &offset, sourceStat.st_size - offset) <= 0)
+        {
+          sent = false;
+          break;
+        }
+      }
+      bool closed = (::close(destinationFile) == 0);
+      ::close(sourceFile);
+      if (sent && closed)
+      {
+        exportedBytes = offset;
+        return true;
+      }
+      // sendfile is not supported by the file systems, make a regular copy
+      QFile::remove(destinationFilePath);
+    }
+    else
+    {
+      ::close(sourceFile);
+    }
+  }
+#endif
+  return copyFileBuffered(sourceFilePath, destinationFilePath, exportedBytes, error);
+}
+
+class ctkDICOMExporterPrivate;
+
+//------------------------------------------------------------------------------
+// Exports a batch of files in a thread of the exporter's thread pool.
+class ctkDICOMExporterWorker : public QRunnable
+{
+public:
+  ctkDICOMExporterWorker(ctkDICOMExporter* exporter, ctkDICOMExporterPrivate* exporterPrivate,
+    const QStringList& sourceFilePaths, const QStringList& destinationFilePaths)
+    : Exporter(exporter)
+    , Private(exporterPrivate)
+    , SourceFilePaths(sourceFilePaths)
+    , DestinationFilePaths(destinationFilePaths)
+  {
+  }
+
+  virtual void run();
+
+protected:
+  ctkDICOMExporter* Exporter;
+  ctkDICOMExporterPrivate* Private;
+  QStringList SourceFilePaths;
+  QStringList DestinationFilePaths;
+};
+
+//------------------------------------------------------------------------------
+class ctkDICOMExporterPrivate
+{
+  Q_DECLARE_PUBLIC(ctkDICOMExporter);
+
+protected:
+  ctkDICOMExporter* const q_ptr;
+
+public:
+  ctkDICOMExporterPrivate(ctkDICOMExporter& obj);
+  ~ctkDICOMExporterPrivate();
+
+  /// Create (or open the existing) DICOMDIR file in the export folder
+  void startDicomDir(const QString& exportFolder);
+  /// Add the record of an exported file to the DICOMDIR (called from worker threads)
+  void addToDicomDir(const QString& destinationFilePath);
+  /// Write the DICOMDIR file and release it
+  void finishDicomDir();
+
+  QThreadPool ThreadPool;
+  bool LinkFiles;
+  bool WriteDicomDir;
+  QAtomicInt Cancelled;
+
+  int TotalFileCount;
+  int ProcessedFileCount;
+  int SkippedFileCount;
+  QElapsedTimer Timer;
+  /// Duration of the last export, -1 while exporting
+  qint64 ElapsedMsec;
+
+  /// Protects the results that are updated by the worker threads
+  mutable QMutex ResultMutex;
+  int ExportedFileCount;
+  qint64 ExportedBytes;
+  QStringList Errors;
+
+  /// DICOMDIR interface is not thread-safe, files are added one at a time
+  QMutex DicomDirMutex;
+  DicomDirInterface* DicomDir;
+  QString DicomDirFolder;
+};
+
+//------------------------------------------------------------------------------
+void ctkDICOMExporterWorker::run()
+{
+  int exportedFileCount = 0;
+  int skippedFileCount = 0;
+  qint64 exportedBytes = 0;
+  QStringList errors;
+  QString lastDestinationFolder;
+  for (int fileIndex = 0; fileIndex < this->SourceFilePaths.size(); ++fileIndex)
+  {
+    if (this->Private->Cancelled.loadAcquire())
+    {
+      skippedFileCount += this->SourceFilePaths.size() - fileIndex;
+      break;
+    }
+    const QString& destinationFilePath = this->DestinationFilePaths[fileIndex];
+    QString destinationFolder = QFileInfo(destinationFilePath).absolutePath();
+    if (destinationFolder != lastDestinationFolder)
+    {
+      if (!QDir().mkpath(destinationFolder))
+      {
+        errors << "Unable to create export destination directory: " + destinationFolder;
+        continue;
+      }
+      lastDestinationFolder = destinationFolder;
+    }
+    qint64 fileBytes = 0;
+    QString error;
+    if (!exportFile(this->SourceFilePaths[fileIndex], destinationFilePath, this->Private->LinkFiles, fileBytes, error))
+    {
+      errors << error;
+      continue;
+    }
+    exportedFileCount++;
+    exportedBytes += fileBytes;
+    this->Private->addToDicomDir(destinationFilePath);
+  }
+  {
+    QMutexLocker locker(&this->Private->ResultMutex);
+    this->Private->ExportedFileCount += exportedFileCount;
+    this->Private->ExportedBytes += exportedBytes;
+    this->Private->SkippedFileCount += skippedFileCount;
+    this->Private->Errors << errors;
+  }
+  QMetaObject::invokeMethod(this->Exporter, "onFilesProcessed", Qt::QueuedConnection,
+    Q_ARG(int, this->SourceFilePaths.size()));
+}
+
+//------------------------------------------------------------------------------
+// ctkDICOMExporterPrivate methods
+
+//------------------------------------------------------------------------------
+ctkDICOMExporterPrivate::ctkDICOMExporterPrivate(ctkDICOMExporter& obj)
+  : q_ptr(&obj)
+  , LinkFiles(false)
+  , WriteDicomDir(false)
+  , TotalFileCount(0)
+  , ProcessedFileCount(0)
+  , SkippedFileCount(0)
+  , ElapsedMsec(0)
+  , ExportedFileCount(0)
+  , ExportedBytes(0)
+  , DicomDir(0)
+{
+  this->ThreadPool.setMaxThreadCount(DEFAULT_EXPORT_THREAD_COUNT);
+}
+
+//------------------------------------------------------------------------------
+ctkDICOMExporterPrivate::~ctkDICOMExporterPrivate()
+{
+  delete this->DicomDir;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMExporterPrivate::startDicomDir(const QString& exportFolder)
+{
+  delete this->DicomDir;
+  this->DicomDir = 0;
+  this->DicomDirFolder = exportFolder;
+  if (!this->WriteDicomDir || exportFolder.isEmpty())
+  {
+    return;
+  }
+  QDir().mkpath(exportFolder);
+  this->DicomDir = new DicomDirInterface;
+  // do not reject files because of missing type 1 attributes or compressed transfer syntax
+  this->DicomDir->enableInventMode();
+  this->DicomDir->enableInventPatientIDMode();
+  this->DicomDir->disableTransferSyntaxCheck();
+  QString dicomDirPath = QDir(exportFolder).absoluteFilePath("DICOMDIR");
+  QByteArray dicomDirPathEncoded = QFile::encodeName(QDir::toNativeSeparators(dicomDirPath));
+  OFCondition status = QFileInfo(dicomDirPath).exists()
+    ? this->DicomDir->appendToDicomDir(DicomDirInterface::AP_GeneralPurpose, dicomDirPathEncoded.constData())
+    : this->DicomDir->createNewDicomDir(DicomDirInterface::AP_GeneralPurpose, dicomDirPathEncoded.constData());
+  if (status.bad())
+  {
+    this->Errors << QString("Failed to create DICOMDIR file %1: %2").arg(dicomDirPath).arg(status.text());
+    delete this->DicomDir;
+    this->DicomDir = 0;
+  }
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMExporterPrivate::addToDicomDir(const QString& destinationFilePath)
+{
+  if (!this->DicomDir)
+  {
+    return;
+  }
+  // file IDs are relative to the folder of the DICOMDIR file
+  QString relativeFilePath = QDir(this->DicomDirFolder).relativeFilePath(destinationFilePath);
+  QMutexLocker locker(&this->DicomDirMutex);
+  OFCondition status = this->DicomDir->addDicomFile(
+    QFile::encodeName(QDir::toNativeSeparators(relativeFilePath)).constData(),
+    QFile::encodeName(QDir::toNativeSeparators(this->DicomDirFolder)).constData());
+  if (status.bad())
+  {
+    QMutexLocker resultLocker(&this->ResultMutex);
+    this->Errors << QString("Failed to add %1 to DICOMDIR: %2").arg(destinationFilePath).arg(status.text());
+  }
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMExporterPrivate::finishDicomDir()
+{
+  if (!this->DicomDir)
+  {
+    return;
+  }
+  OFCondition status = this->DicomDir->writeDicomDir();
+  if (status.bad())
+  {
+    QMutexLocker locker(&this->ResultMutex);
+    this->Errors << QString("Failed to write DICOMDIR file in %1: %2").arg(this->DicomDirFolder).arg(status.text());
+  }
+  delete this->DicomDir;
+  this->DicomDir = 0;
+}
+
+//------------------------------------------------------------------------------
+// ctkDICOMExporter methods
+
+//------------------------------------------------------------------------------
+ctkDICOMExporter::ctkDICOMExporter(QObject* parent)
+  : QObject(parent)
+  , d_ptr(new ctkDICOMExporterPrivate(*this))
+{
+}
+
+//------------------------------------------------------------------------------
+ctkDICOMExporter::~ctkDICOMExporter()
+{
+  Q_D(ctkDICOMExporter);
+  d->Cancelled.storeRelease(1);
+  d->ThreadPool.waitForDone();
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMExporter::setNumberOfThreads(int count)
+{
+  Q_D(ctkDICOMExporter);
+  d->ThreadPool.setMaxThreadCount(qMax(1, count));
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMExporter::numberOfThreads()const
+{
+  Q_D(const ctkDICOMExporter);
+  return d->ThreadPool.maxThreadCount();
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMExporter::setLinkFiles(bool link)
+{
+  Q_D(ctkDICOMExporter);
+  d->LinkFiles = link;
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMExporter::linkFiles()const
+{
+  Q_D(const ctkDICOMExporter);
+  return d->LinkFiles;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMExporter::setWriteDicomDir(bool write)
+{
+  Q_D(ctkDICOMExporter);
+  d->WriteDicomDir = write;
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMExporter::writeDicomDir()const
+{
+  Q_D(const ctkDICOMExporter);
+  return d->WriteDicomDir;
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMExporter::startExport(const QStringList& sourceFilePaths, const QStringList& destinationFilePaths,
+  const QString& exportFolder/*=QString()*/)
+{
+  Q_D(ctkDICOMExporter);
+  if (this->isExporting())
+  {
+    logger.error("Cannot start export: an export is already in progress");
+    return false;
+  }
+  if (sourceFilePaths.size() != destinationFilePaths.size())
+  {
+    logger.error("Cannot start export: number of source and destination files do not match");
+    return false;
+  }
+  d->Cancelled.storeRelease(0);
+  d->TotalFileCount = sourceFilePaths.size();
+  d->ProcessedFileCount = 0;
+  d->SkippedFileCount = 0;
+  d->ExportedFileCount = 0;
+  d->ExportedBytes = 0;
+  d->Errors.clear();
+  d->ElapsedMsec = -1;
+  d->Timer.start();
+  d->startDicomDir(exportFolder);
+
+  emit exportStarted(d->TotalFileCount);
+  if (d->TotalFileCount == 0)
+  {
+    d->finishDicomDir();
+    d->ElapsedMsec = d->Timer.elapsed();
+    emit exportFinished();
+    return true;
+  }
+  for (int batchStart = 0; batchStart < sourceFilePaths.size(); batchStart += EXPORT_BATCH_SIZE)
+  {
+    d->ThreadPool.start(new ctkDICOMExporterWorker(this, d,
+      sourceFilePaths.mid(batchStart, EXPORT_BATCH_SIZE), destinationFilePaths.mid(batchStart, EXPORT_BATCH_SIZE)));
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMExporter::isExporting()const
+{
+  Q_D(const ctkDICOMExporter);
+  return d->ProcessedFileCount < d->TotalFileCount;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMExporter::waitForExportFinished()
+{
+  if (!this->isExporting())
+  {
+    return;
+  }
+  QEventLoop loop;
+  connect(this, SIGNAL(exportFinished()), &loop, SLOT(quit()));
+  loop.exec();
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMExporter::numberOfProcessedFiles()const
+{
+  Q_D(const ctkDICOMExporter);
+  return d->ProcessedFileCount;
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMExporter::numberOfExportedFiles()const
+{
+  Q_D(const ctkDICOMExporter);
+  QMutexLocker locker(&d->ResultMutex);
+  return d->ExportedFileCount;
+}
+
+//------------------------------------------------------------------------------
+qint64 ctkDICOMExporter::numberOfExportedBytes()const
+{
+  Q_D(const ctkDICOMExporter);
+  QMutexLocker locker(&d->ResultMutex);
+  return d->ExportedBytes;
+}
+
+//------------------------------------------------------------------------------
+double ctkDICOMExporter::throughput()const
+{
+  Q_D(const ctkDICOMExporter);
+  qint64 elapsedMsec = (d->ElapsedMsec >= 0 ? d->ElapsedMsec : d->Timer.elapsed());
+  if (elapsedMsec <= 0)
+  {
+    return 0.0;
+  }
+  return this->numberOfExportedBytes() * 1000.0 / elapsedMsec;
+}
+
+//------------------------------------------------------------------------------
+QStringList ctkDICOMExporter::errors()const
+{
+  Q_D(const ctkDICOMExporter);
+  QMutexLocker locker(&d->ResultMutex);
+  return d->Errors;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMExporter::cancel()
+{
+  Q_D(ctkDICOMExporter);
+  if (this->isExporting())
+  {
+    d->Cancelled.storeRelease(1);
+  }
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMExporter::onFilesProcessed(int numberOfFiles)
+{
+  Q_D(ctkDICOMExporter);
+  d->ProcessedFileCount += numberOfFiles;
+  emit exportProgress(d->ProcessedFileCount);
+  if (d->ProcessedFileCount < d->TotalFileCount)
+  {
+    return;
+  }
+  // all workers are done, DICOMDIR records can be written
+  d->finishDicomDir();
+  d->ElapsedMsec = d->Timer.elapsed();
+  if (d->SkippedFileCount > 0)
+  {
+    QMutexLocker locker(&d->ResultMutex);
+    d->Errors << QString("Export cancelled, %1 files were not exported").arg(d->SkippedFileCount);
+  }
+  logger.info(QString("Exported %1 of %2 files (%3 MB, %4 MB/s)")
+    .arg(this->numberOfExportedFiles()).arg(d->TotalFileCount)
+    .arg(this->numberOfExportedBytes() / (1024.0 * 1024.0), 0, 'f', 1)
+    .arg(this->throughput() / (1024.0 * 1024.0), 0, 'f', 1));
+  emit exportFinished();
+}
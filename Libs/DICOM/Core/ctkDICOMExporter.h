@@ -0,0 +1,121 @@
+/*=========================================================================
+
+  Library:   CTK
+
+  Copyright (c) Kitware Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0.txt
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+=========================================================================*/
+
+#ifndef __ctkDICOMExporter_h
+#define __ctkDICOMExporter_h
+
+// Qt includes
+#include <QObject>
+#include <QStringList>
+
+#include "ctkDICOMCoreExport.h"
+
+class ctkDICOMExporterPrivate;
+
+/// \ingroup DICOM_Core
+///
+/// \brief Copies DICOM files to an export folder in background threads
+///
+/// Files are copied in parallel with large buffers (using sendfile on Linux), or
+/// hard linked if linkFiles is enabled and the destination is on the same file system.
+/// Errors do not stop the export, they are collected and can be retrieved by errors()
+/// when the export is finished.
+///
+/// If writeDicomDir is enabled then a DICOMDIR file is created in the export folder
+/// (or extended, if it already exists). Records are added as the files are exported and
+/// the file is written when the export is finished. Exported file names must be valid
+/// DICOM file IDs in this case (up to 8 upper case letters, digits or underscores in each
+/// path component).
+///
+class CTK_DICOM_CORE_EXPORT ctkDICOMExporter : public QObject
+{
+  Q_OBJECT
+  Q_PROPERTY(int numberOfThreads READ numberOfThreads WRITE setNumberOfThreads);
+  Q_PROPERTY(bool linkFiles READ linkFiles WRITE setLinkFiles);
+  Q_PROPERTY(bool writeDicomDir READ writeDicomDir WRITE setWriteDicomDir);
+  Q_PROPERTY(bool exporting READ isExporting);
+
+public:
+  explicit ctkDICOMExporter(QObject* parent = 0);
+  virtual ~ctkDICOMExporter();
+
+  /// Number of files copied in parallel. Copying is I/O bound, default is 4.
+  void setNumberOfThreads(int count);
+  int numberOfThreads()const;
+
+  /// Create hard links instead of copies when possible (the file systems of the
+  /// source and destination are the same). Disabled by default.
+  void setLinkFiles(bool link);
+  bool linkFiles()const;
+
+  /// Write a DICOMDIR file in the export folder. Disabled by default.
+  void setWriteDicomDir(bool write);
+  bool writeDicomDir()const;
+
+  /// Start exporting files. Returns immediately.
+  /// destinationFilePaths must contain the destination of each file in sourceFilePaths,
+  /// missing folders are created. Existing files are not overwritten.
+  /// exportFolder is the folder where the DICOMDIR file is written, all destination files
+  /// must be in this folder or its subfolders.
+  /// Returns false if an export is already in progress or the lists do not match.
+  Q_INVOKABLE bool startExport(const QStringList& sourceFilePaths, const QStringList& destinationFilePaths,
+    const QString& exportFolder = QString());
+
+  /// Returns true while files are being exported
+  bool isExporting()const;
+  /// Wait until all files are exported
+  Q_INVOKABLE void waitForExportFinished();
+
+  /// Number of files of the current (or last) export that are processed
+  Q_INVOKABLE int numberOfProcessedFiles()const;
+  /// Number of files of the current (or last) export that are exported successfully
+  Q_INVOKABLE int numberOfExportedFiles()const;
+  /// Number of bytes exported by the current (or last) export
+  Q_INVOKABLE qint64 numberOfExportedBytes()const;
+  /// Average throughput of the current (or last) export in bytes per second
+  Q_INVOKABLE double throughput()const;
+  /// Error messages of the current (or last) export, one for each file that could not be exported
+  Q_INVOKABLE QStringList errors()const;
+
+public Q_SLOTS:
+  /// Skip the files that are not exported yet. Files that are being copied are completed.
+  void cancel();
+
+Q_SIGNALS:
+  /// Export started (int is the number of files to export)
+  void exportStarted(int);
+  /// Indicate progress of the export (int is the number of processed files)
+  void exportProgress(int);
+  /// All files are processed and the DICOMDIR file is written
+  void exportFinished();
+
+protected Q_SLOTS:
+  /// Called (in the main thread) when a batch of files is processed in a worker thread
+  void onFilesProcessed(int numberOfFiles);
+
+protected:
+  QScopedPointer<ctkDICOMExporterPrivate> d_ptr;
+
+private:
+  Q_DECLARE_PRIVATE(ctkDICOMExporter);
+  Q_DISABLE_COPY(ctkDICOMExporter);
+};
+
+#endif
@@ -22,10 +22,37 @@
 
 #include "ctkDICOMModel.h"
 
+// Qt includes
+#include <QHash>
+#include <QRegExp>
+
 //logger
 #include <ctkLogger.h>
 static ctkLogger logger("org.commontk.DICOM.Core.ctkDICOMFilterProxyModel");
 
+//----------------------------------------------------------------------------
+/// Matches the display text of a row against a search text.
+/// Search texts without regular expression characters are matched as plain
+/// strings, others are compiled once when the search text changes.
+struct ctkDICOMFilterProxyModelMatcher
+{
+    ctkDICOMFilterProxyModelMatcher(): MatchAll(true), UseRegExp(false){}
+    void setText(const QString& text);
+    bool matches(const QString& value)const;
+
+    QString Text;
+    bool MatchAll;
+    bool UseRegExp;
+    QRegExp RegExp;
+};
+
+//----------------------------------------------------------------------------
+/// Cached type and display text of a row of the source model
+struct ctkDICOMFilterProxyModelRow
+{
+    int Type;
+    QString Text;
+};
 
 //----------------------------------------------------------------------------
 class ctkDICOMFilterProxyModelPrivate
@@ -37,17 +64,82 @@ protected:
 public:
   ctkDICOMFilterProxyModelPrivate(ctkDICOMFilterProxyModel* parent = 0);
 
+  /// Cached row of a source index
+  const ctkDICOMFilterProxyModelRow& row(ctkDICOMModel* model, const QModelIndex& index)const;
+  const ctkDICOMFilterProxyModelMatcher* matcher(int type)const;
+
   QString searchTextName;
   QString searchTextStudy;
   QString searchTextSeries;
   QString searchTextID;
+
+  ctkDICOMFilterProxyModelMatcher nameMatcher;
+  ctkDICOMFilterProxyModelMatcher studyMatcher;
+  ctkDICOMFilterProxyModelMatcher seriesMatcher;
+
+  /// Display text of the rows, keyed by the internal id of the source index
+  mutable QHash<quintptr, ctkDICOMFilterProxyModelRow> rowCache;
 };
 
+//----------------------------------------------------------------------------
+void ctkDICOMFilterProxyModelMatcher::setText(const QString& text){
+    this->Text = text;
+    this->MatchAll = text.isEmpty();
+    this->UseRegExp = false;
+    const QString regExpCharacters("\\^$.|?*+()[]{}");
+    foreach(const QChar& character, text){
+        if(regExpCharacters.contains(character)){
+            this->UseRegExp = true;
+            break;
+        }
+    }
+    this->RegExp = this->UseRegExp ? QRegExp(text) : QRegExp();
+}
+
+//----------------------------------------------------------------------------
+bool ctkDICOMFilterProxyModelMatcher::matches(const QString& value)const{
+    if(this->MatchAll){
+        return true;
+    }
+    if(!this->UseRegExp){
+        return value.contains(this->Text);
+    }
+    return value.contains(this->RegExp);
+}
+
 //----------------------------------------------------------------------------
 ctkDICOMFilterProxyModelPrivate::ctkDICOMFilterProxyModelPrivate(ctkDICOMFilterProxyModel* parent): q_ptr(parent){
 
 }
 
+//----------------------------------------------------------------------------
+const ctkDICOMFilterProxyModelMatcher* ctkDICOMFilterProxyModelPrivate::matcher(int type)const{
+    switch(type){
+        case ctkDICOMModel::PatientType:
+            return &this->nameMatcher;
+        case ctkDICOMModel::StudyType:
+            return &this->studyMatcher;
+        case ctkDICOMModel::SeriesType:
+            return &this->seriesMatcher;
+        default:
+            return 0;
+    }
+}
+
+//----------------------------------------------------------------------------
+const ctkDICOMFilterProxyModelRow& ctkDICOMFilterProxyModelPrivate::row(ctkDICOMModel* model, const QModelIndex& index)const{
+    QHash<quintptr, ctkDICOMFilterProxyModelRow>::iterator it = this->rowCache.find(index.internalId());
+    if(it == this->rowCache.end()){
+        // read the type and the formatted name only once per row
+        ctkDICOMFilterProxyModelRow row;
+        row.Type = model->data(index, ctkDICOMModel::TypeRole).toInt();
+        row.Text = (row.Type >= ctkDICOMModel::PatientType && row.Type <= ctkDICOMModel::SeriesType) ?
+            model->data(index, Qt::DisplayRole).toString() : QString();
+        it = this->rowCache.insert(index.internalId(), row);
+    }
+    return it.value();
+}
+
 //----------------------------------------------------------------------------
 ctkDICOMFilterProxyModel::ctkDICOMFilterProxyModel(QObject *parent):Superclass(parent),
     d_ptr(new ctkDICOMFilterProxyModelPrivate(this))
@@ -60,10 +152,50 @@ ctkDICOMFilterProxyModel::~ctkDICOMFilterProxyModel(){
 
 }
 
+//----------------------------------------------------------------------------
+void ctkDICOMFilterProxyModel::setSourceModel(QAbstractItemModel* model){
+    if(this->sourceModel()){
+        QObject::disconnect(this->sourceModel(), 0, this, SLOT(clearRowCache()));
+        QObject::disconnect(this->sourceModel(), 0, this, SLOT(onSourceDataChanged(QModelIndex,QModelIndex)));
+    }
+    this->clearRowCache();
+    if(model){
+        // Cached rows are keyed by the internal pointers of the source model.
+        // Connected before the proxy connects to the model, so that the cache
+        // is updated before the changed rows are filtered again.
+        QObject::connect(model, SIGNAL(modelReset()), this, SLOT(clearRowCache()));
+        QObject::connect(model, SIGNAL(layoutChanged()), this, SLOT(clearRowCache()));
+        QObject::connect(model, SIGNAL(rowsRemoved(QModelIndex,int,int)), this, SLOT(clearRowCache()));
+        QObject::connect(model, SIGNAL(dataChanged(QModelIndex,QModelIndex)),
+            this, SLOT(onSourceDataChanged(QModelIndex,QModelIndex)));
+    }
+    this->Superclass::setSourceModel(model);
+}
+
+//----------------------------------------------------------------------------
+void ctkDICOMFilterProxyModel::clearRowCache(){
+    Q_D(ctkDICOMFilterProxyModel);
+    d->rowCache.clear();
+}
+
+//----------------------------------------------------------------------------
+void ctkDICOMFilterProxyModel::onSourceDataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight){
+    Q_D(ctkDICOMFilterProxyModel);
+    const QAbstractItemModel* model = topLeft.model();
+    if(!model){
+        return;
+    }
+    // only the changed rows are read again
+    for(int row = topLeft.row(); row <= bottomRight.row(); ++row){
+        d->rowCache.remove(model->index(row, 0, topLeft.parent()).internalId());
+    }
+}
+
 //----------------------------------------------------------------------------
 void ctkDICOMFilterProxyModel::setNameSearchText(const QString &text){
     Q_D(ctkDICOMFilterProxyModel);
     d->searchTextName = text;
+    d->nameMatcher.setText(text);
     this->invalidateFilter();
 }
 
@@ -71,6 +203,7 @@ void ctkDICOMFilterProxyModel::setNameSearchText(const QString &text){
 void ctkDICOMFilterProxyModel::setStudySearchText(const QString &text){
     Q_D(ctkDICOMFilterProxyModel);
     d->searchTextStudy = text;
+    d->studyMatcher.setText(text);
     this->invalidateFilter();
 }
 
@@ -78,6 +211,7 @@ void ctkDICOMFilterProxyModel::setStudySearchText(const QString &text){
 void ctkDICOMFilterProxyModel::setSeriesSearchText(const QString &text){
     Q_D(ctkDICOMFilterProxyModel);
     d->searchTextSeries = text;
+    d->seriesMatcher.setText(text);
     this->invalidateFilter();
 }
 
@@ -95,27 +229,10 @@ bool ctkDICOMFilterProxyModel::filterAcceptsRow(int source_row, const QModelInde
 
     if(model){
         QModelIndex index = model->index(source_row, 0, source_parent);
-        if(model->data(index, ctkDICOMModel::TypeRole) == static_cast<int>(ctkDICOMModel::PatientType)){
-            QRegExp regExp = QRegExp(d->searchTextName);
-            if(model->data(index, Qt::DisplayRole).toString().contains(regExp)){
-                return true;
-            }else{
-                return false;
-            }
-        }else if(model->data(index, ctkDICOMModel::TypeRole) == static_cast<int>(ctkDICOMModel::StudyType)){
-            QRegExp regExp = QRegExp(d->searchTextStudy);
-            if(model->data(index, Qt::DisplayRole).toString().contains(regExp)){
-                return true;
-            }else{
-                return false;
-            }
-        }else if(model->data(index, ctkDICOMModel::TypeRole) == static_cast<int>(ctkDICOMModel::SeriesType)){
-            QRegExp regExp = QRegExp(d->searchTextSeries);
-            if(model->data(index, Qt::DisplayRole).toString().contains(regExp)){
-                return true;
-            }else{
-                return false;
-            }
+        const ctkDICOMFilterProxyModelRow& row = d->row(model, index);
+        const ctkDICOMFilterProxyModelMatcher* matcher = d->matcher(row.Type);
+        if(matcher){
+            return matcher->matches(row.Text);
         }
     }
 
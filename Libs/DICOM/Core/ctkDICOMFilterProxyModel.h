@@ -39,6 +39,12 @@ public:
 
     virtual bool filterAcceptsRow ( int source_row, const QModelIndex & source_parent ) const;
 
+    virtual void setSourceModel(QAbstractItemModel* model);
+
+protected Q_SLOTS:
+    void clearRowCache();
+    void onSourceDataChanged(const QModelIndex& topLeft, const QModelIndex& bottomRight);
+
 protected:
     QScopedPointer<ctkDICOMFilterProxyModelPrivate> d_ptr;
 
@@ -31,6 +31,10 @@
 #include <QFileInfo>
 #include <QDebug>
 
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
 // ctkDICOM includes
 #include "ctkLogger.h"
 #include "ctkDICOMIndexer.h"
@@ -53,16 +57,280 @@
 //------------------------------------------------------------------------------
 static ctkLogger logger("org.commontk.dicom.DICOMIndexer" );
 
-/// How many files to parse before inserting results into the database.
-/// Increasing cache size increases maximum memory usage, very low cache size
-/// slows down database insertion.
-static int REQUEST_RESULTS_CACHE_MAXIMUM_SIZE = 5000;
+/// How often the worker thread checks parser results and reports progress
+/// while parser threads are running.
+static int PARSER_PROGRESS_REPORT_INTERVAL_MSEC = 100;
+
+/// All elements that ctkDICOMDatabase::insert() reads from a dataset are in the groups
+/// up to 0x0020 (patient, study, series, frame of reference modules), therefore
+/// in header-only parsing mode at least these groups are always read.
+static DcmTagKey LAST_ELEMENT_REQUIRED_FOR_INSERT(0x0020, 0xffff);
+
+/// Fingerprints of directories that were modified less than this time before
+/// enumeration started are not stored, as files may still be added to them
+/// without changing the modification time (if file system time resolution is coarse).
+static qint64 DIRECTORY_FINGERPRINT_MINIMUM_AGE_MSEC = 2000;
+
+//------------------------------------------------------------------------------
+/// Get modification time and inode of a directory. Returns false if the directory does not exist.
+static bool getDirectoryFingerprint(const QString& directoryPath, ctkDICOMDatabase::DirectoryFingerprint& fingerprint)
+{
+  fingerprint.inode = 0;
+#ifdef Q_OS_UNIX
+  struct stat directoryStatus;
+  if (::stat(QFile::encodeName(directoryPath).constData(), &directoryStatus) != 0)
+  {
+    return false;
+  }
+  fingerprint.inode = directoryStatus.st_ino;
+  fingerprint.modifiedTime = QFileInfo(directoryPath).lastModified().toMSecsSinceEpoch();
+#else
+  QFileInfo directoryInfo(directoryPath);
+  if (!directoryInfo.exists())
+  {
+    return false;
+  }
+  fingerprint.modifiedTime = directoryInfo.lastModified().toMSecsSinceEpoch();
+#endif
+  return true;
+}
 //------------------------------------------------------------------------------
 
 
 //------------------------------------------------------------------------------
-// ctkDICOMIndexerPrivate methods
+/// Create a dataset for an instance from the records of a DICOMDIR file.
+/// All elements of the records are copied, except the directory record specific elements (group 0x0004).
+static QSharedPointer<ctkDICOMItem> datasetFromDicomdirRecords(const QList<DcmDirectoryRecord*>& records,
+  const OFString& sopInstanceUID, const OFString& defaultSpecificCharacterSet)
+{
+  DcmDataset* dataset = new DcmDataset;
+  foreach(DcmDirectoryRecord* record, records)
+  {
+    for (unsigned long elementIndex = 0; elementIndex < record->card(); ++elementIndex)
+    {
+      DcmElement* element = record->getElement(elementIndex);
+      if (!element || element->getGTag() == 0x0004)
+      {
+        continue;
+      }
+      dataset->insert(OFstatic_cast(DcmElement*, element->clone()), true /* replace */);
+    }
+  }
+  dataset->putAndInsertOFStringArray(DCM_SOPInstanceUID, sopInstanceUID);
+  OFString sopClassUID;
+  if (records.last()->findAndGetOFStringArray(DCM_ReferencedSOPClassUIDInFile, sopClassUID).good())
+  {
+    dataset->putAndInsertOFStringArray(DCM_SOPClassUID, sopClassUID);
+  }
+  if (!dataset->tagExists(DCM_SpecificCharacterSet) && !defaultSpecificCharacterSet.empty())
+  {
+    dataset->putAndInsertOFStringArray(DCM_SpecificCharacterSet, defaultSpecificCharacterSet);
+  }
+  QSharedPointer<ctkDICOMItem> item(new ctkDICOMItem);
+  item->InitializeFromItem(dataset, true /* take ownership */);
+  return item;
+}
+
+//------------------------------------------------------------------------------
+// ctkDICOMIndexerPrivateEnumerator methods
+
+//------------------------------------------------------------------------------
+ctkDICOMIndexerPrivateEnumerator::ctkDICOMIndexerPrivateEnumerator(
+  const DICOMIndexingQueue::IndexingRequest& indexingRequest, DICOMIndexingFileQueue* fileQueue)
+: IndexingRequest(indexingRequest)
+, FileQueue(fileQueue)
+, KnownDirectoryFingerprints(nullptr)
+, NewDirectoryFingerprints(nullptr)
+, SkippedDirectoryCount(nullptr)
+, EnumerationStartTime(0)
+{
+}
+
+//------------------------------------------------------------------------------
+ctkDICOMIndexerPrivateEnumerator::~ctkDICOMIndexerPrivateEnumerator()
+{
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMIndexerPrivateEnumerator::setDirectoryFingerprints(
+  const QHash<QString, ctkDICOMDatabase::DirectoryFingerprint>* knownFingerprints,
+  QHash<QString, ctkDICOMDatabase::DirectoryFingerprint>* newFingerprints, int* skippedDirectoryCount)
+{
+  this->KnownDirectoryFingerprints = knownFingerprints;
+  this->NewDirectoryFingerprints = newFingerprints;
+  this->SkippedDirectoryCount = skippedDirectoryCount;
+}
 
+//------------------------------------------------------------------------------
+bool ctkDICOMIndexerPrivateEnumerator::enumerateDirectory(const QString& directoryPath, QDir::Filters hiddenFilter)
+{
+  // Get the fingerprint before listing the files, so that any change during listing
+  // makes the directory to be checked again next time.
+  ctkDICOMDatabase::DirectoryFingerprint fingerprint;
+  if (!getDirectoryFingerprint(directoryPath, fingerprint))
+  {
+    return true;
+  }
+  QDir directory(directoryPath);
+
+  QHash<QString, ctkDICOMDatabase::DirectoryFingerprint>::const_iterator knownFingerprintIt =
+    this->KnownDirectoryFingerprints->constFind(directoryPath);
+  if (knownFingerprintIt != this->KnownDirectoryFingerprints->constEnd()
+    && knownFingerprintIt.value().modifiedTime == fingerprint.modifiedTime
+    && knownFingerprintIt.value().inode == fingerprint.inode)
+  {
+    // Files of this directory have not changed since they were indexed
+    (*this->SkippedDirectoryCount)++;
+  }
+  else
+  {
+    QStringList files = directory.entryList(QDir::Files | hiddenFilter, QDir::NoSort);
+    foreach(const QString& file, files)
+    {
+      if (!this->FileQueue->pushFile(directory.filePath(file)))
+      {
+        return false;
+      }
+    }
+    if (fingerprint.modifiedTime < this->EnumerationStartTime - DIRECTORY_FINGERPRINT_MINIMUM_AGE_MSEC)
+    {
+      this->NewDirectoryFingerprints->insert(directoryPath, fingerprint);
+    }
+  }
+
+  // Subdirectories must be checked even if the directory is unchanged,
+  // as modifications in a subdirectory do not change the parent directory
+  QStringList subdirectories = directory.entryList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::NoSymLinks | hiddenFilter, QDir::NoSort);
+  foreach(const QString& subdirectory, subdirectories)
+  {
+    if (!this->enumerateDirectory(directory.filePath(subdirectory), hiddenFilter))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMIndexerPrivateEnumerator::run()
+{
+  // Each file must be parsed only once, as parsers do not update ModifiedTimeForFilepath
+  this->IndexingRequest.inputFilesPath.removeDuplicates();
+  bool stopped = false;
+  foreach(const QString& filePath, this->IndexingRequest.inputFilesPath)
+  {
+    if (!this->FileQueue->pushFile(filePath))
+    {
+      stopped = true;
+      break;
+    }
+  }
+  if (!stopped && !this->IndexingRequest.inputFolderPath.isEmpty() && this->KnownDirectoryFingerprints)
+  {
+    this->EnumerationStartTime = QDateTime::currentMSecsSinceEpoch();
+    // Use the same path format as in file paths stored in the database, so that directory
+    // fingerprints can be found from file paths
+    this->enumerateDirectory(QDir::cleanPath(this->IndexingRequest.inputFolderPath),
+      this->IndexingRequest.includeHidden ? QDir::Hidden : QDir::Filters());
+  }
+  else if (!stopped && !this->IndexingRequest.inputFolderPath.isEmpty())
+  {
+    QDir::Filters filters = QDir::Files;
+    if (this->IndexingRequest.includeHidden)
+    {
+      filters |= QDir::Hidden;
+    }
+    QDirIterator it(this->IndexingRequest.inputFolderPath, filters, QDirIterator::Subdirectories);
+    while (it.hasNext())
+    {
+      if (!this->FileQueue->pushFile(it.next()))
+      {
+        break;
+      }
+    }
+  }
+  this->FileQueue->setEnumerationCompleted();
+}
+
+//------------------------------------------------------------------------------
+// ctkDICOMIndexerPrivateParser methods
+
+//------------------------------------------------------------------------------
+ctkDICOMIndexerPrivateParser::ctkDICOMIndexerPrivateParser(DICOMIndexingQueue* queue, DICOMIndexingFileQueue* fileQueue,
+  const QMap<QString, QDateTime>& modifiedTimeForFilepath, QReadWriteLock* modifiedTimeForFilepathLock,
+  bool copyFile, QAtomicInt* alreadyAddedFileCount)
+: RequestQueue(queue)
+, FileQueue(fileQueue)
+, ModifiedTimeForFilepath(modifiedTimeForFilepath)
+, ModifiedTimeForFilepathLock(modifiedTimeForFilepathLock)
+, CopyFile(copyFile)
+, HeaderOnlyParsing(false)
+, StopParsingAtElement(DCM_UndefinedTagKey)
+, AlreadyAddedFileCount(alreadyAddedFileCount)
+{
+}
+
+//------------------------------------------------------------------------------
+ctkDICOMIndexerPrivateParser::~ctkDICOMIndexerPrivateParser()
+{
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMIndexerPrivateParser::setHeaderOnlyParsing(bool enabled, const DcmTagKey& stopParsingAtElement)
+{
+  this->HeaderOnlyParsing = enabled;
+  this->StopParsingAtElement = stopParsingAtElement;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMIndexerPrivateParser::run()
+{
+  QString filePath;
+  while (!this->RequestQueue->isStopRequested() && this->FileQueue->takeFile(filePath))
+  {
+    QDateTime fileModifiedTime = QFileInfo(filePath).lastModified();
+    bool datasetAlreadyInDatabase = false;
+    bool datasetUpToDate = false;
+    {
+      QReadLocker locker(this->ModifiedTimeForFilepathLock);
+      QMap<QString, QDateTime>::const_iterator modifiedTimeIt = this->ModifiedTimeForFilepath.constFind(filePath);
+      datasetAlreadyInDatabase = (modifiedTimeIt != this->ModifiedTimeForFilepath.constEnd());
+      datasetUpToDate = datasetAlreadyInDatabase && modifiedTimeIt.value() >= fileModifiedTime;
+    }
+    if (datasetUpToDate)
+    {
+      this->AlreadyAddedFileCount->fetchAndAddOrdered(1);
+      continue;
+    }
+
+    ctkDICOMDatabase::IndexingResult indexingResult;
+    indexingResult.dataset = QSharedPointer<ctkDICOMItem>(new ctkDICOMItem);
+    if (this->HeaderOnlyParsing)
+    {
+      indexingResult.dataset->InitializeFromFileUntilTag(filePath, this->StopParsingAtElement);
+    }
+    else
+    {
+      indexingResult.dataset->InitializeFromFile(filePath);
+    }
+    if (indexingResult.dataset->IsInitialized())
+    {
+      indexingResult.filePath = filePath;
+      indexingResult.copyFile = this->CopyFile;
+      indexingResult.overwriteExistingDataset = datasetAlreadyInDatabase;
+      qint64 memorySize = sizeof(ctkDICOMItem) + indexingResult.dataset->GetEstimatedMemorySize();
+      // blocks if memory budget of the queue is exceeded
+      this->RequestQueue->pushIndexingResult(indexingResult, memorySize);
+    }
+    else
+    {
+      logger.warn(QString("Could not read DICOM file:") + filePath);
+    }
+  }
+}
+
+//------------------------------------------------------------------------------
+// ctkDICOMIndexerPrivateWorker methods
 
 //------------------------------------------------------------------------------
 ctkDICOMIndexerPrivateWorker::ctkDICOMIndexerPrivateWorker(DICOMIndexingQueue* queue)
@@ -70,6 +338,8 @@ ctkDICOMIndexerPrivateWorker::ctkDICOMIndexerPrivateWorker(DICOMIndexingQueue* q
 , RemainingRequestCount(0)
 , CompletedRequestCount(0)
 , TimePercentageIndexing(95.0)
+, AllModifiedTimesLoaded(false)
+, NewDirectoryFingerprintsDiscarded(false)
 {
 }
 
@@ -77,6 +347,7 @@ ctkDICOMIndexerPrivateWorker::ctkDICOMIndexerPrivateWorker(DICOMIndexingQueue* q
 ctkDICOMIndexerPrivateWorker::~ctkDICOMIndexerPrivateWorker()
 {
   this->RequestQueue->setStopRequested(true);
+  this->ParserThreadPool.waitForDone();
 }
 
 //------------------------------------------------------------------------------
@@ -84,6 +355,7 @@ void ctkDICOMIndexerPrivateWorker::start()
 {
   emit updatingDatabase(true);
   ctkDICOMDatabase database;
+  database.setDatabasePragmas(this->RequestQueue->databasePragmas());
   database.openDatabase(this->RequestQueue->databaseFilename());
   database.setTagsToPrecache(this->RequestQueue->tagsToPrecache());
   database.setTagsToExcludeFromStorage(this->RequestQueue->tagsToExcludeFromStorage());
@@ -97,12 +369,22 @@ void ctkDICOMIndexerPrivateWorker::start()
   int seriesCountAfter = seriesCountBefore;
   int imagesCountAfter = imagesCountBefore;
 
+  // Modified times of indexed files are loaded when a request needs them
+  this->ModifiedTimeForFilepath.clear();
+  this->AllModifiedTimesLoaded = false;
+  this->ResultsParsingStartTime = QDateTime();
+  this->DirectoryFingerprints.clear();
+  this->NewDirectoryFingerprints.clear();
+  this->NewDirectoryFingerprintsDiscarded = false;
+  if (this->RequestQueue->isFastRescanEnabled())
+  {
+    database.directoryFingerprints(this->DirectoryFingerprints);
+  }
+
   do
   {
     emit progressStep("Parsing DICOM files");
     emit progress(0);
-    // Make a local copy to avoid the need of frequent locking
-    this->RequestQueue->modifiedTimeForFilepath(this->ModifiedTimeForFilepath);
     this->CompletedRequestCount = 0;
     do
     {
@@ -110,6 +392,8 @@ void ctkDICOMIndexerPrivateWorker::start()
       {
         this->RequestQueue->clear();
         this->RequestQueue->setStopRequested(false);
+        // Parsed results have been discarded, directories must be checked again next time
+        this->NewDirectoryFingerprintsDiscarded = true;
       }
       DICOMIndexingQueue::IndexingRequest indexingRequest;
       this->RemainingRequestCount = this->RequestQueue->popIndexingRequest(indexingRequest);
@@ -137,6 +421,14 @@ void ctkDICOMIndexerPrivateWorker::start()
   // restart if new requests has been queued during displayed fields update
   } while (!this->RequestQueue->isEmpty());
 
+  // All indexing results are in the database now
+  if (!this->NewDirectoryFingerprintsDiscarded && !this->RequestQueue->isStopRequested())
+  {
+    database.setDirectoryFingerprints(this->NewDirectoryFingerprints);
+  }
+  this->NewDirectoryFingerprints.clear();
+  this->DirectoryFingerprints.clear();
+
   database.closeDatabase();
   emit updatingDatabase(false);
 
@@ -150,78 +442,145 @@ void ctkDICOMIndexerPrivateWorker::start()
 //------------------------------------------------------------------------------
 void ctkDICOMIndexerPrivateWorker::processIndexingRequest(DICOMIndexingQueue::IndexingRequest& indexingRequest, ctkDICOMDatabase& database)
 {
-  if (!indexingRequest.inputFolderPath.isEmpty())
+  QTime timeProbe;
+  timeProbe.start();
+
+  // Files that are modified after this time will be re-indexed next time
+  this->RequestParsingStartTime = QDateTime::currentDateTime();
+  if (!this->ResultsParsingStartTime.isValid())
   {
-    QDir::Filters filters = QDir::Files;
-    if (indexingRequest.includeHidden)
+    this->ResultsParsingStartTime = this->RequestParsingStartTime;
+  }
+
+  // Add results that do not require parsing
+  foreach(const ctkDICOMDatabase::IndexingResult& indexingResult, indexingRequest.indexingResults)
+  {
+    if (this->RequestQueue->isStopRequested())
     {
-      filters |= QDir::Hidden;
+      break;
     }
-    QDirIterator it(indexingRequest.inputFolderPath, filters, QDirIterator::Subdirectories);
-    while (it.hasNext())
+    if (this->RequestQueue->isResultsMemoryReleaseNeeded())
     {
-      indexingRequest.inputFilesPath << it.next();
+      emit progressStep("Updating database fields");
+      this->writeIndexingResultsToDatabase(database);
+    }
+    qint64 memorySize = sizeof(ctkDICOMItem) + indexingResult.dataset->GetEstimatedMemorySize();
+    if (this->RequestQueue->pushIndexingResult(indexingResult, memorySize, false) < 0)
+    {
+      // This thread is the only one that writes results to the database and releases their memory,
+      // therefore it must not wait for memory. No parsers are running at this point, so all memory
+      // is released after the queued results are written and the result can be added.
+      emit progressStep("Updating database fields");
+      this->writeIndexingResultsToDatabase(database);
+      this->RequestQueue->pushIndexingResult(indexingResult, memorySize);
     }
   }
+  indexingRequest.indexingResults.clear();
+
+  // Files are enumerated in one thread of the pool while the others are parsing
+  // the files that are already found.
+  DICOMIndexingFileQueue fileQueue(this->RequestQueue);
+  QAtomicInt alreadyAddedFileCount(0);
+  int parserThreadCount = qMax(1, this->RequestQueue->parserThreadCount());
+  this->ParserThreadPool.setMaxThreadCount(parserThreadCount + 1);
+  // Fingerprints are only used when files are indexed in place, as copied files are
+  // stored in the database folder (and source folders are rarely imported again).
+  QHash<QString, ctkDICOMDatabase::DirectoryFingerprint> requestDirectoryFingerprints;
+  int skippedDirectoryCount = 0;
+  bool fastRescan = this->RequestQueue->isFastRescanEnabled() && !indexingRequest.copyFile;
+  bool hasFilesToParse = !indexingRequest.inputFilesPath.isEmpty() || !indexingRequest.inputFolderPath.isEmpty();
+  if (hasFilesToParse && !this->AllModifiedTimesLoaded)
+  {
+    if (fastRescan && indexingRequest.inputFilesPath.isEmpty())
+    {
+      // Only files of changed directories are checked, therefore it is enough
+      // to get the modified times of files in the imported folder.
+      database.filesModifiedTimesInDirectory(indexingRequest.inputFolderPath, this->ModifiedTimeForFilepath);
+    }
+    else
+    {
+      database.allFilesModifiedTimes(this->ModifiedTimeForFilepath);
+      this->AllModifiedTimesLoaded = true;
+    }
+  }
+  ctkDICOMIndexerPrivateEnumerator* enumerator = new ctkDICOMIndexerPrivateEnumerator(indexingRequest, &fileQueue);
+  if (fastRescan)
+  {
+    enumerator->setDirectoryFingerprints(&this->DirectoryFingerprints, &requestDirectoryFingerprints, &skippedDirectoryCount);
+  }
+  this->ParserThreadPool.start(enumerator);
+  bool headerOnlyParsing = this->RequestQueue->isHeaderOnlyParsingEnabled();
+  DcmTagKey parsingStopTag = this->stopParsingAtElement(database);
+  for (int parserIndex = 0; parserIndex < parserThreadCount; ++parserIndex)
+  {
+    ctkDICOMIndexerPrivateParser* parser = new ctkDICOMIndexerPrivateParser(this->RequestQueue,
+      &fileQueue, this->ModifiedTimeForFilepath, &this->ModifiedTimeForFilepathLock,
+      indexingRequest.copyFile, &alreadyAddedFileCount);
+    parser->setHeaderOnlyParsing(headerOnlyParsing, parsingStopTag);
+    this->ParserThreadPool.start(parser);
+  }
 
-  QTime timeProbe;
-  timeProbe.start();
-
-  int currentFileIndex = 0;
-  int lastReportedPercent = 0;
-  int alreadyAddedFileCount = 0;
-  QStringList alreadyAddedFiles;
-  foreach(const QString& filePath, indexingRequest.inputFilesPath)
+  // Insert parsing results into the database while parsers are running
+  int lastReportedFileCount = -1;
+  bool parsingCompleted = false;
+  while (!parsingCompleted)
   {
-    int percent = int(this->TimePercentageIndexing * (this->CompletedRequestCount + double(currentFileIndex++) / double(indexingRequest.inputFilesPath.size()))
-      / double(this->CompletedRequestCount + this->RemainingRequestCount + 1));
-    emit this->progress(percent);
-    emit progressDetail(filePath);
+    parsingCompleted = this->ParserThreadPool.waitForDone(PARSER_PROGRESS_REPORT_INTERVAL_MSEC);
 
-    QDateTime fileModifiedTime = QFileInfo(filePath).lastModified();
-    bool datasetAlreadyInDatabase = this->ModifiedTimeForFilepath.contains(filePath);
-    if (datasetAlreadyInDatabase && this->ModifiedTimeForFilepath[filePath] >= fileModifiedTime)
+    int processedFileCount = fileQueue.processedFileCount();
+    if (processedFileCount > lastReportedFileCount)
     {
-      alreadyAddedFileCount++;
-      if (alreadyAddedFileCount < 10)
+      // Total number of files is only known when enumeration is completed
+      double requestFraction = 0.0;
+      if (fileQueue.isEnumerationCompleted() && fileQueue.discoveredFileCount() > 0)
       {
-        alreadyAddedFiles << filePath;
+        requestFraction = double(processedFileCount) / double(fileQueue.discoveredFileCount());
       }
-      continue;
+      int percent = int(this->TimePercentageIndexing * (this->CompletedRequestCount + requestFraction)
+        / double(this->CompletedRequestCount + this->RemainingRequestCount + 1));
+      double elapsedTimeInSeconds = timeProbe.elapsed() / 1000.0;
+      double filesPerSecond = (elapsedTimeInSeconds > 0.0 ? processedFileCount / elapsedTimeInSeconds : 0.0);
+      emit this->progress(percent);
+      emit filesProcessed(processedFileCount, filesPerSecond);
+      emit progressStep(QString("Parsing DICOM files (%1 files, %2 files/s)")
+        .arg(processedFileCount).arg(QString::number(filesPerSecond, 'f', 0)));
+      emit progressDetail(fileQueue.lastTakenFilePath());
+      lastReportedFileCount = processedFileCount;
     }
-    this->ModifiedTimeForFilepath[filePath] = fileModifiedTime;
 
-    ctkDICOMDatabase::IndexingResult indexingResult;
-    indexingResult.dataset = QSharedPointer<ctkDICOMItem>(new ctkDICOMItem);
-    indexingResult.dataset->InitializeFromFile(filePath);
-    if (indexingResult.dataset->IsInitialized())
+    if (this->RequestQueue->isResultsMemoryReleaseNeeded())
     {
-      indexingResult.filePath = filePath;
-      indexingResult.copyFile = indexingRequest.copyFile;
-      indexingResult.overwriteExistingDataset = datasetAlreadyInDatabase;
-      int resultsCount = this->RequestQueue->pushIndexingResult(indexingResult);
-      if (resultsCount >= REQUEST_RESULTS_CACHE_MAXIMUM_SIZE)
-      {
-        emit progressStep("Updating database fields");
-        this->writeIndexingResultsToDatabase(database);
-        emit progressStep("Parsing DICOM files");
-      }
+      emit progressStep("Updating database fields");
+      this->writeIndexingResultsToDatabase(database);
+      emit progressStep("Parsing DICOM files");
     }
-    else
+  }
+
+  if (alreadyAddedFileCount.load() > 0)
+  {
+    logger.debug(QString("Skipped %1 files that were already in the database").arg(alreadyAddedFileCount.load()));
+  }
+
+  if (fastRescan)
+  {
+    if (skippedDirectoryCount > 0)
     {
-      logger.warn(QString("Could not read DICOM file:") + filePath);
+      logger.debug(QString("Skipped %1 directories that have not changed since last indexing").arg(skippedDirectoryCount));
     }
-
     if (this->RequestQueue->isStopRequested())
     {
-      break;
+      this->NewDirectoryFingerprintsDiscarded = true;
+    }
+    else
+    {
+      // Unchanged directories are skipped in upcoming requests, too
+      QHash<QString, ctkDICOMDatabase::DirectoryFingerprint>::const_iterator it;
+      for (it = requestDirectoryFingerprints.constBegin(); it != requestDirectoryFingerprints.constEnd(); ++it)
+      {
+        this->DirectoryFingerprints[it.key()] = it.value();
+        this->NewDirectoryFingerprints[it.key()] = it.value();
+      }
     }
-  }
-
-  if (alreadyAddedFileCount > 0)
-  {
-    logger.debug(QString("Skipped %1 files that were already in the database: %2...").arg(
-      alreadyAddedFileCount).arg(alreadyAddedFiles.join(", ")));
   }
 
   if (this->RequestQueue->isIndexingRequestsEmpty())
@@ -232,18 +591,47 @@ void ctkDICOMIndexerPrivateWorker::processIndexingRequest(DICOMIndexingQueue::In
   }
 
   float elapsedTimeInSeconds = timeProbe.elapsed() / 1000.0;
-  qDebug() << QString("DICOM indexer has successfully processed %1 files [%2s]")
-    .arg(currentFileIndex).arg(QString::number(elapsedTimeInSeconds, 'f', 2));
+  qDebug() << QString("DICOM indexer has successfully processed %1 files using %2 parser threads [%3s]")
+    .arg(fileQueue.processedFileCount()).arg(parserThreadCount).arg(QString::number(elapsedTimeInSeconds, 'f', 2));
 }
 
+//------------------------------------------------------------------------------
+DcmTagKey ctkDICOMIndexerPrivateWorker::stopParsingAtElement(ctkDICOMDatabase& database)
+{
+  DcmTagKey lastRequiredElement = LAST_ELEMENT_REQUIRED_FOR_INSERT;
+  foreach(const QString& tag, database.tagsToPrecache())
+  {
+    unsigned short group, element;
+    if (!database.tagToGroupElement(tag, group, element))
+    {
+      continue;
+    }
+    DcmTagKey tagKey(group, element);
+    if (lastRequiredElement < tagKey)
+    {
+      lastRequiredElement = tagKey;
+    }
+  }
+  if (lastRequiredElement.getElement() == 0xffff)
+  {
+    if (lastRequiredElement.getGroup() == 0xffff)
+    {
+      // all elements are needed
+      return DCM_UndefinedTagKey;
+    }
+    return DcmTagKey(lastRequiredElement.getGroup() + 1, 0x0000);
+  }
+  return DcmTagKey(lastRequiredElement.getGroup(), lastRequiredElement.getElement() + 1);
+}
 
 //------------------------------------------------------------------------------
 void ctkDICOMIndexerPrivateWorker::writeIndexingResultsToDatabase(ctkDICOMDatabase& database)
 {
   QList<ctkDICOMDatabase::IndexingResult> indexingResults;
-  this->RequestQueue->popAllIndexingResults(indexingResults);
+  qint64 indexingResultsMemorySize = this->RequestQueue->popAllIndexingResults(indexingResults);
   if (indexingResults.isEmpty())
   {
+    this->RequestQueue->releaseResultsMemory(indexingResultsMemorySize);
     return;
   }
 
@@ -256,9 +644,36 @@ void ctkDICOMIndexerPrivateWorker::writeIndexingResultsToDatabase(ctkDICOMDataba
   this->NumberOfInstancesToInsert = 0;
   this->NumberOfInstancesInserted = 0;
 
+  // Remember the files of the inserted results to avoid parsing them again in upcoming requests.
+  // Files that were skipped are already in ModifiedTimeForFilepath with an up-to-date time.
+  {
+    QWriteLocker locker(&this->ModifiedTimeForFilepathLock);
+    foreach(const ctkDICOMDatabase::IndexingResult& indexingResult, indexingResults)
+    {
+      QMap<QString, QDateTime>::iterator modifiedTimeIt = this->ModifiedTimeForFilepath.find(indexingResult.filePath);
+      if (modifiedTimeIt == this->ModifiedTimeForFilepath.end())
+      {
+        this->ModifiedTimeForFilepath.insert(indexingResult.filePath, this->ResultsParsingStartTime);
+      }
+      else if (modifiedTimeIt.value() < this->ResultsParsingStartTime)
+      {
+        modifiedTimeIt.value() = this->ResultsParsingStartTime;
+      }
+    }
+  }
+  // Results that are queued from now on are parsed by the current request
+  this->ResultsParsingStartTime = this->RequestParsingStartTime;
+
+  int insertedResultsCount = indexingResults.count();
+  indexingResults.clear();
+  this->RequestQueue->releaseResultsMemory(indexingResultsMemorySize);
+
   float elapsedTimeInSeconds = timeProbe.elapsed() / 1000.0;
-  qDebug() << QString("DICOM indexer has successfully inserted %1 files [%2s]")
-    .arg(indexingResults.count()).arg(QString::number(elapsedTimeInSeconds, 'f', 2));
+  qDebug() << QString("DICOM indexer has successfully inserted %1 files (%2 MB) [%3s]")
+    .arg(insertedResultsCount).arg(indexingResultsMemorySize / (1024 * 1024))
+    .arg(QString::number(elapsedTimeInSeconds, 'f', 2));
+  emit indexingResultsInserted(insertedResultsCount,
+    elapsedTimeInSeconds > 0 ? insertedResultsCount / elapsedTimeInSeconds : 0.0);
 
 }
 
@@ -270,6 +685,7 @@ ctkDICOMIndexerPrivate::ctkDICOMIndexerPrivate(ctkDICOMIndexer& o)
   : q_ptr(&o)
   , Database(nullptr)
   , BackgroundImportEnabled(false)
+  , FastDicomdirImportEnabled(false)
 {
   ctkDICOMIndexerPrivateWorker* worker = new ctkDICOMIndexerPrivateWorker(&this->RequestQueue);
   worker->moveToThread(&this->WorkerThread);
@@ -277,10 +693,16 @@ ctkDICOMIndexerPrivate::ctkDICOMIndexerPrivate(ctkDICOMIndexer& o)
   connect(&this->WorkerThread, &QThread::finished, worker, &QObject::deleteLater);
   connect(this, &ctkDICOMIndexerPrivate::startWorker, worker, &ctkDICOMIndexerPrivateWorker::start);
 
+  // Lookup cache is cleared before the signals are forwarded, so that receivers get up-to-date results
+  connect(worker, &ctkDICOMIndexerPrivateWorker::updatingDatabase, this, &ctkDICOMIndexerPrivate::clearDatabaseLookupCache);
+  connect(worker, &ctkDICOMIndexerPrivateWorker::indexingComplete, this, &ctkDICOMIndexerPrivate::clearDatabaseLookupCache);
+
   // Progress report
   connect(worker, &ctkDICOMIndexerPrivateWorker::progress, q_ptr, &ctkDICOMIndexer::progress);
   connect(worker, &ctkDICOMIndexerPrivateWorker::progressDetail, q_ptr, &ctkDICOMIndexer::progressDetail);
   connect(worker, &ctkDICOMIndexerPrivateWorker::progressStep, q_ptr, &ctkDICOMIndexer::progressStep);
+  connect(worker, &ctkDICOMIndexerPrivateWorker::filesProcessed, q_ptr, &ctkDICOMIndexer::filesProcessed);
+  connect(worker, &ctkDICOMIndexerPrivateWorker::indexingResultsInserted, q_ptr, &ctkDICOMIndexer::indexingResultsInserted);
   connect(worker, &ctkDICOMIndexerPrivateWorker::updatingDatabase, q_ptr, &ctkDICOMIndexer::updatingDatabase);
   connect(worker, &ctkDICOMIndexerPrivateWorker::indexingComplete, q_ptr, &ctkDICOMIndexer::indexingComplete);
 
@@ -297,6 +719,15 @@ ctkDICOMIndexerPrivate::~ctkDICOMIndexerPrivate()
   q->setDatabase(nullptr);
 }
 
+//------------------------------------------------------------------------------
+void ctkDICOMIndexerPrivate::clearDatabaseLookupCache()
+{
+  if (this->Database)
+  {
+    this->Database->clearLookupCache();
+  }
+}
+
 //------------------------------------------------------------------------------
 void ctkDICOMIndexerPrivate::pushIndexingRequest(const DICOMIndexingQueue::IndexingRequest& request)
 {
@@ -306,9 +737,6 @@ void ctkDICOMIndexerPrivate::pushIndexingRequest(const DICOMIndexingQueue::Index
   {
     // Start background indexing
     this->RequestQueue.setIndexing(true);
-    QMap<QString, QDateTime> modifiedTimeForFilepath;
-    this->Database->allFilesModifiedTimes(modifiedTimeForFilepath);
-    this->RequestQueue.setModifiedTimeForFilepath(modifiedTimeForFilepath);
     emit startWorker();
   }
 }
@@ -316,6 +744,8 @@ void ctkDICOMIndexerPrivate::pushIndexingRequest(const DICOMIndexingQueue::Index
 //------------------------------------------------------------------------------
 CTK_GET_CPP(ctkDICOMIndexer, bool, isBackgroundImportEnabled, BackgroundImportEnabled);
 CTK_SET_CPP(ctkDICOMIndexer, bool, setBackgroundImportEnabled, BackgroundImportEnabled);
+CTK_GET_CPP(ctkDICOMIndexer, bool, isFastDicomdirImportEnabled, FastDicomdirImportEnabled);
+CTK_SET_CPP(ctkDICOMIndexer, bool, setFastDicomdirImportEnabled, FastDicomdirImportEnabled);
 
 //------------------------------------------------------------------------------
 // ctkDICOMIndexer methods
@@ -345,6 +775,7 @@ void ctkDICOMIndexer::setDatabase(ctkDICOMDatabase* database)
     QObject::disconnect(d->Database, SIGNAL(opened()), this, SLOT(databaseFilenameChanged()));
     QObject::disconnect(d->Database, SIGNAL(tagsToPrecacheChanged()), this, SLOT(tagsToPrecacheChanged()));
     QObject::disconnect(d->Database, SIGNAL(tagsToExcludeFromStorageChanged()), this, SLOT(tagsToExcludeFromStorageChanged()));
+    QObject::disconnect(d->Database, SIGNAL(databasePragmasChanged()), this, SLOT(databasePragmasChanged()));
   }
   d->Database = database;
   if (d->Database)
@@ -352,15 +783,18 @@ void ctkDICOMIndexer::setDatabase(ctkDICOMDatabase* database)
     QObject::connect(d->Database, SIGNAL(opened()), this, SLOT(databaseFilenameChanged()));
     QObject::connect(d->Database, SIGNAL(tagsToPrecacheChanged()), this, SLOT(tagsToPrecacheChanged()));
     QObject::connect(d->Database, SIGNAL(tagsToExcludeFromStorageChanged()), this, SLOT(tagsToExcludeFromStorageChanged()));
+    QObject::connect(d->Database, SIGNAL(databasePragmasChanged()), this, SLOT(databasePragmasChanged()));
     d->RequestQueue.setDatabaseFilename(d->Database->databaseFilename());
     d->RequestQueue.setTagsToPrecache(d->Database->tagsToPrecache());
     d->RequestQueue.setTagsToExcludeFromStorage(d->Database->tagsToExcludeFromStorage());
+    d->RequestQueue.setDatabasePragmas(d->Database->databasePragmas());
   }
   else
   {
     d->RequestQueue.setDatabaseFilename(QString());
     d->RequestQueue.setTagsToPrecache(QStringList());
     d->RequestQueue.setTagsToExcludeFromStorage(QStringList());
+    d->RequestQueue.setDatabasePragmas(QMap<QString, QString>());
   }
 }
 
@@ -413,6 +847,20 @@ ctkDICOMDatabase* ctkDICOMIndexer::database()
    }
  }
 
+ //------------------------------------------------------------------------------
+ void ctkDICOMIndexer::databasePragmasChanged()
+ {
+   Q_D(ctkDICOMIndexer);
+   if (d->Database)
+   {
+     d->RequestQueue.setDatabasePragmas(d->Database->databasePragmas());
+   }
+   else
+   {
+     d->RequestQueue.setDatabasePragmas(QMap<QString, QString>());
+   }
+ }
+
  //------------------------------------------------------------------------------
  void ctkDICOMIndexer::addFile(ctkDICOMDatabase* db, const QString filePath, bool copyFile/*=false*/)
  {
@@ -489,6 +937,47 @@ void ctkDICOMIndexer::addListOfFiles(const QStringList& listOfFiles, bool copyFi
   }
 }
 
+//------------------------------------------------------------------------------
+void ctkDICOMIndexer::addIndexingResults(const QList<ctkDICOMDatabase::IndexingResult>& indexingResults)
+{
+  Q_D(ctkDICOMIndexer);
+  if (indexingResults.isEmpty())
+  {
+    return;
+  }
+  if (d->Database && d->Database->isInMemory())
+  {
+    // The worker would open a new, empty in-memory database, insert into this connection instead
+    QTime timeProbe;
+    timeProbe.start();
+    int patientsCountBefore = d->Database->patientsCount();
+    int studiesCountBefore = d->Database->studiesCount();
+    int seriesCountBefore = d->Database->seriesCount();
+    int imagesCountBefore = d->Database->imagesCount();
+    emit updatingDatabase(true);
+    d->Database->insert(indexingResults);
+    d->Database->updateDisplayedFields();
+    float elapsedTimeInSeconds = timeProbe.elapsed() / 1000.0;
+    emit indexingResultsInserted(indexingResults.size(),
+      elapsedTimeInSeconds > 0 ? indexingResults.size() / elapsedTimeInSeconds : 0.0);
+    emit updatingDatabase(false);
+    emit indexingComplete(d->Database->patientsCount() - patientsCountBefore,
+      d->Database->studiesCount() - studiesCountBefore,
+      d->Database->seriesCount() - seriesCountBefore,
+      d->Database->imagesCount() - imagesCountBefore);
+    return;
+  }
+  DICOMIndexingQueue::IndexingRequest request;
+  request.includeHidden = true;
+  request.copyFile = false;
+  request.indexingResults = indexingResults;
+  d->pushIndexingRequest(request);
+  if (!d->BackgroundImportEnabled)
+  {
+    this->waitForImportFinished();
+  }
+}
+
 //------------------------------------------------------------------------------
 bool ctkDICOMIndexer::addDicomdir(ctkDICOMDatabase* db, const QString& directoryName, bool copyFile/*=false*/)
 {
@@ -499,6 +988,7 @@ bool ctkDICOMIndexer::addDicomdir(ctkDICOMDatabase* db, const QString& directory
 //------------------------------------------------------------------------------
 bool ctkDICOMIndexer::addDicomdir(const QString& directoryName, bool copyFile/*=false*/)
 {
+  Q_D(ctkDICOMIndexer);
   //Initialize dicomdir with directory path
   QString dcmFilePath = directoryName;
   dcmFilePath.append("/DICOMDIR");
@@ -511,6 +1001,15 @@ bool ctkDICOMIndexer::addDicomdir(const QString& directoryName, bool copyFile/*=
   QString instanceFilePath;
   QStringList listOfInstances;
 
+  // In fast mode, datasets are created from the records instead of parsing the files
+  bool useRecords = d->FastDicomdirImportEnabled && !copyFile;
+  QList<ctkDICOMDatabase::IndexingResult> indexingResults;
+  OFString defaultSpecificCharacterSet;
+  if (useRecords && dicomDir->getDirFileFormat().getDataset())
+  {
+    dicomDir->getDirFileFormat().getDataset()->findAndGetOFStringArray(DCM_SpecificCharacterSet, defaultSpecificCharacterSet);
+  }
+
   DcmDirectoryRecord* rootRecord = &(dicomDir->getRootRecord());
   DcmDirectoryRecord* patientRecord = NULL;
   DcmDirectoryRecord* studyRecord = NULL;
@@ -575,7 +1074,20 @@ bool ctkDICOMIndexer::addDicomdir(const QString& directoryName, bool copyFile/*=
             instanceFilePath.append("/");
             instanceFilePath.append(QString( referencedFileName.c_str() ));
             instanceFilePath.replace("\\","/");
-            listOfInstances << instanceFilePath;
+            if (useRecords)
+            {
+              QList<DcmDirectoryRecord*> records;
+              records << patientRecord << studyRecord << seriesRecord << fileRecord;
+              ctkDICOMDatabase::IndexingResult indexingResult;
+              indexingResult.filePath = instanceFilePath;
+              indexingResult.dataset = datasetFromDicomdirRecords(records, sopInstanceUID, defaultSpecificCharacterSet);
+              indexingResult.incompleteDataset = true;
+              indexingResults << indexingResult;
+            }
+            else
+            {
+              listOfInstances << instanceFilePath;
+            }
           }
         }
       }
@@ -585,8 +1097,24 @@ bool ctkDICOMIndexer::addDicomdir(const QString& directoryName, bool copyFile/*=
         << QString("DICOM indexer has successfully processed DICOMDIR in %1 [%2s]")
            .arg(directoryName)
            .arg(QString::number(elapsedTimeInSeconds,'f', 2));
-    this->addListOfFiles(listOfInstances, copyFile);
+    if (useRecords)
+    {
+      DICOMIndexingQueue::IndexingRequest request;
+      request.includeHidden = true;
+      request.copyFile = false;
+      request.indexingResults = indexingResults;
+      d->pushIndexingRequest(request);
+      if (!d->BackgroundImportEnabled)
+      {
+        this->waitForImportFinished();
+      }
+    }
+    else
+    {
+      this->addListOfFiles(listOfInstances, copyFile);
+    }
   }
+  delete dicomDir;
   return success;
 }
 
@@ -613,6 +1141,69 @@ void ctkDICOMIndexer::waitForImportFinished(int msecTimeout /*=-1*/)
   loop.exec();
 }
 
+//------------------------------------------------------------------------------
+void ctkDICOMIndexer::setNumberOfParserThreads(int count)
+{
+  Q_D(ctkDICOMIndexer);
+  d->RequestQueue.setParserThreadCount(qMax(1, count));
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMIndexer::numberOfParserThreads() const
+{
+  Q_D(const ctkDICOMIndexer);
+  return d->RequestQueue.parserThreadCount();
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMIndexer::setHeaderOnlyParsingEnabled(bool enabled)
+{
+  Q_D(ctkDICOMIndexer);
+  d->RequestQueue.setHeaderOnlyParsingEnabled(enabled);
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMIndexer::isHeaderOnlyParsingEnabled() const
+{
+  Q_D(const ctkDICOMIndexer);
+  return d->RequestQueue.isHeaderOnlyParsingEnabled();
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMIndexer::setFastRescanEnabled(bool enabled)
+{
+  Q_D(ctkDICOMIndexer);
+  d->RequestQueue.setFastRescanEnabled(enabled);
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMIndexer::isFastRescanEnabled() const
+{
+  Q_D(const ctkDICOMIndexer);
+  return d->RequestQueue.isFastRescanEnabled();
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMIndexer::setIndexingResultsMemoryBudget(qint64 bytes)
+{
+  Q_D(ctkDICOMIndexer);
+  d->RequestQueue.setResultsMemoryBudget(bytes);
+}
+
+//------------------------------------------------------------------------------
+qint64 ctkDICOMIndexer::indexingResultsMemoryBudget() const
+{
+  Q_D(const ctkDICOMIndexer);
+  return d->RequestQueue.resultsMemoryBudget();
+}
+
+//------------------------------------------------------------------------------
+qint64 ctkDICOMIndexer::indexingResultsMemorySize() const
+{
+  Q_D(const ctkDICOMIndexer);
+  return d->RequestQueue.resultsMemorySize();
+}
+
 //------------------------------------------------------------------------------
 bool ctkDICOMIndexer::isImporting()
 {
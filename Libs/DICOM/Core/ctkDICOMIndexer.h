@@ -39,6 +39,12 @@ class CTK_DICOM_CORE_EXPORT ctkDICOMIndexer : public QObject
   Q_OBJECT
   Q_PROPERTY(bool backgroundImportEnabled READ isBackgroundImportEnabled WRITE setBackgroundImportEnabled)
   Q_PROPERTY(bool importing READ isImporting)
+  Q_PROPERTY(int numberOfParserThreads READ numberOfParserThreads WRITE setNumberOfParserThreads)
+  Q_PROPERTY(bool headerOnlyParsingEnabled READ isHeaderOnlyParsingEnabled WRITE setHeaderOnlyParsingEnabled)
+  Q_PROPERTY(bool fastRescanEnabled READ isFastRescanEnabled WRITE setFastRescanEnabled)
+  Q_PROPERTY(bool fastDicomdirImportEnabled READ isFastDicomdirImportEnabled WRITE setFastDicomdirImportEnabled)
+  Q_PROPERTY(qint64 indexingResultsMemoryBudget READ indexingResultsMemoryBudget WRITE setIndexingResultsMemoryBudget)
+  Q_PROPERTY(qint64 indexingResultsMemorySize READ indexingResultsMemorySize)
 
 public:
   explicit ctkDICOMIndexer(QObject *parent = 0);
@@ -57,6 +63,48 @@ public:
   /// Returns with true if background importing is currently in progress.
   bool isImporting();
 
+  /// Number of threads that parse DICOM files in parallel during indexing.
+  /// Parsed datasets are inserted into the database by a single thread.
+  /// Default is the number of processor cores (QThread::idealThreadCount()).
+  /// The new value is used starting from the next indexing request.
+  void setNumberOfParserThreads(int count);
+  int numberOfParserThreads() const;
+
+  /// If enabled, files are only parsed up to the last element that is needed
+  /// for inserting them into the database (patient, study, series, instance fields
+  /// and tags to precache), so large trailing elements such as pixel data are not read.
+  /// Enabled by default.
+  void setHeaderOnlyParsingEnabled(bool);
+  bool isHeaderOnlyParsingEnabled() const;
+
+  /// If enabled, fingerprints of directories (modification time and inode)
+  /// are stored in the database when a folder is indexed (without copying the files) and
+  /// files of directories that have not changed since then are not checked again.
+  /// This makes re-scanning large, mostly unchanged folders much faster, but files that are
+  /// modified in place (without adding, removing, or renaming files in their directory)
+  /// are not detected. Use ctkDICOMDatabase::removeAllDirectoryFingerprints() to force a full scan.
+  /// Disabled by default.
+  void setFastRescanEnabled(bool);
+  bool isFastRescanEnabled() const;
+
+  /// If enabled, addDicomdir inserts patients, studies, series, and images into the database
+  /// using the information in the DICOMDIR records, without reading the referenced files
+  /// (which can be very slow, for example on optical media). Tags that are not in the records
+  /// are read from the files when they are first requested.
+  /// Only used when files are not copied into the database. Disabled by default.
+  void setFastDicomdirImportEnabled(bool);
+  bool isFastDicomdirImportEnabled() const;
+
+  /// Maximum memory (in bytes) that parsed datasets waiting for database insertion may use.
+  /// Results are written to the database when half of the budget is used, and parser threads
+  /// are blocked while the budget is exceeded. Default is 256MB.
+  void setIndexingResultsMemoryBudget(qint64 bytes);
+  qint64 indexingResultsMemoryBudget() const;
+
+  /// Memory (in bytes) currently used by parsed datasets that are waiting for
+  /// database insertion or are being inserted.
+  qint64 indexingResultsMemorySize() const;
+
   ///
   /// \brief Adds directory to database and optionally copies files to
   /// destinationDirectory.
@@ -108,6 +156,16 @@ public:
   /// Kept for backward compatibility
   Q_INVOKABLE void addFile(ctkDICOMDatabase* db, const QString filePath, bool copyFile = false);
 
+  ///
+  /// \brief Adds datasets that are already in memory (e.g., received from a server) to the database.
+  ///
+  /// Datasets are inserted in the indexing thread, in the same batches as parsed files.
+  /// Set copyFile of the results to store the datasets in the database folder.
+  /// If the database is in memory then the datasets are inserted in the calling thread,
+  /// as the indexing thread cannot open another connection to an in-memory database.
+  ///
+  Q_INVOKABLE void addIndexingResults(const QList<ctkDICOMDatabase::IndexingResult>& indexingResults);
+
   ///
   /// \brief Wait for all the indexing operations to complete
   /// This can be useful to ensure that importing is completed when background indexing is enabled.
@@ -121,6 +179,13 @@ Q_SIGNALS:
   void progressDetail(QString);
   /// Progress in percentage
   void progress(int);
+  /// Number of files processed in the current indexing request and the processing speed.
+  /// Files are parsed while the input folder is still being searched, therefore the total
+  /// number of files (and so the percentage of completion) is often not known during parsing.
+  void filesProcessed(int processedFileCount, double filesPerSecond);
+  /// A batch of parsed files or datasets is written to the database.
+  /// insertedPerSecond is the speed of writing this batch to the database.
+  void indexingResultsInserted(int insertedCount, double insertedPerSecond);
   /// Indexing is completed.
   void indexingComplete(int patientsAdded, int studiesAdded, int seriesAdded, int imagesAdded);
   void updatingDatabase(bool);
@@ -133,6 +198,7 @@ protected Q_SLOTS:
   void databaseFilenameChanged();
   void tagsToPrecacheChanged();
   void tagsToExcludeFromStorageChanged();
+  void databasePragmasChanged();
 
 protected:
   QScopedPointer<ctkDICOMIndexerPrivate> d_ptr;
@@ -21,7 +21,15 @@
 #ifndef CTKDICOMINDEXERPRIVATE_H
 #define CTKDICOMINDEXERPRIVATE_H
 
+#include <QAtomicInt>
+#include <QDir>
+#include <QHash>
 #include <QObject>
+#include <QQueue>
+#include <QReadWriteLock>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QWaitCondition>
 
 #include "ctkDICOMIndexer.h"
 #include "ctkDICOMItem.h"
@@ -43,10 +51,20 @@ public:
     /// Make a copy of the indexed file into the database.
     /// If false then only a link to the existing file is added.
     bool copyFile;
+    /// Results that are inserted into the database without parsing any files
+    /// (e.g., datasets created from DICOMDIR records).
+    QList<ctkDICOMDatabase::IndexingResult> indexingResults;
   };
 
   DICOMIndexingQueue()
     : Mutex(QMutex::Recursive)
+    , ParserThreadCount(QThread::idealThreadCount())
+    , HeaderOnlyParsingEnabled(true)
+    , FastRescanEnabled(false)
+    , QueuedResultsMemorySize(0)
+    , ResultsMemorySize(0)
+    , ResultsMemoryBudget(Q_INT64_C(256) * 1024 * 1024)
+    , MemoryWaitingParserCount(0)
     , IsIndexing(false)
     , StopRequested(false)
   {
@@ -92,11 +110,111 @@ public:
     this->TagsToExcludeFromStorage = tags;
   }
 
-  void clear()
+  QMap<QString, QString> databasePragmas()
   {
     QMutexLocker locker(&this->Mutex);
-    this->IndexingRequests.clear();
-    this->IndexingResults.clear();
+    return this->DatabasePragmas;
+  }
+
+  void setDatabasePragmas(const QMap<QString, QString>& pragmas)
+  {
+    QMutexLocker locker(&this->Mutex);
+    this->DatabasePragmas = pragmas;
+  }
+
+  int parserThreadCount() const
+  {
+    QMutexLocker locker(&this->Mutex);
+    return this->ParserThreadCount;
+  }
+
+  void setParserThreadCount(int count)
+  {
+    QMutexLocker locker(&this->Mutex);
+    this->ParserThreadCount = count;
+  }
+
+  bool isHeaderOnlyParsingEnabled() const
+  {
+    QMutexLocker locker(&this->Mutex);
+    return this->HeaderOnlyParsingEnabled;
+  }
+
+  void setHeaderOnlyParsingEnabled(bool enabled)
+  {
+    QMutexLocker locker(&this->Mutex);
+    this->HeaderOnlyParsingEnabled = enabled;
+  }
+
+  bool isFastRescanEnabled() const
+  {
+    QMutexLocker locker(&this->Mutex);
+    return this->FastRescanEnabled;
+  }
+
+  void setFastRescanEnabled(bool enabled)
+  {
+    QMutexLocker locker(&this->Mutex);
+    this->FastRescanEnabled = enabled;
+  }
+
+  qint64 resultsMemoryBudget() const
+  {
+    QMutexLocker memoryLocker(&this->ResultsMemoryMutex);
+    return this->ResultsMemoryBudget;
+  }
+
+  void setResultsMemoryBudget(qint64 bytes)
+  {
+    QMutexLocker memoryLocker(&this->ResultsMemoryMutex);
+    this->ResultsMemoryBudget = bytes;
+    this->ResultsMemoryReleased.wakeAll();
+  }
+
+  /// Memory used by indexing results that are in the queue or are being inserted into the database
+  qint64 resultsMemorySize() const
+  {
+    QMutexLocker memoryLocker(&this->ResultsMemoryMutex);
+    return this->ResultsMemorySize;
+  }
+
+  /// Release memory of indexing results that are removed by popAllIndexingResults
+  /// and are not used anymore. Parsers that wait for memory are woken up.
+  void releaseResultsMemory(qint64 bytes)
+  {
+    QMutexLocker memoryLocker(&this->ResultsMemoryMutex);
+    this->ResultsMemorySize -= bytes;
+    this->ResultsMemoryReleased.wakeAll();
+  }
+
+  /// Returns true if queued results should be written to the database to free up memory:
+  /// either half of the memory budget is used by queued results or a parser is waiting for memory.
+  bool isResultsMemoryReleaseNeeded()
+  {
+    qint64 budget = 0;
+    {
+      QMutexLocker memoryLocker(&this->ResultsMemoryMutex);
+      if (this->MemoryWaitingParserCount > 0)
+      {
+        return true;
+      }
+      budget = this->ResultsMemoryBudget;
+    }
+    QMutexLocker locker(&this->Mutex);
+    return (!this->IndexingResults.isEmpty() && this->QueuedResultsMemorySize >= budget / 2);
+  }
+
+  void clear()
+  {
+    qint64 queuedResultsMemorySize = 0;
+    {
+      QMutexLocker locker(&this->Mutex);
+      this->IndexingRequests.clear();
+      this->IndexingResults.clear();
+      queuedResultsMemorySize = this->QueuedResultsMemorySize;
+      this->QueuedResultsMemorySize = 0;
+    }
+    this->releaseResultsMemory(queuedResultsMemorySize);
   }
 
   int popIndexingRequest(IndexingRequest& indexingRequest)
@@ -122,32 +240,52 @@ public:
     return this->IndexingResults.size();
   }
 
-  void popAllIndexingResults(QList<ctkDICOMDatabase::IndexingResult>& indexingResults)
+  /// Take all indexing results from the queue.
+  /// Returns the memory size of the results, which must be released by calling
+  /// releaseResultsMemory when the results are not used anymore.
+  qint64 popAllIndexingResults(QList<ctkDICOMDatabase::IndexingResult>& indexingResults)
   {
     QMutexLocker locker(&this->Mutex);
     indexingResults = this->IndexingResults;
     this->IndexingResults.clear();
+    qint64 memorySize = this->QueuedResultsMemorySize;
+    this->QueuedResultsMemorySize = 0;
+    return memorySize;
   }
 
-  int pushIndexingResult(const ctkDICOMDatabase::IndexingResult& indexingResult)
+  /// Add an indexing result to the queue.
+  /// If adding the result would exceed the memory budget then the call blocks
+  /// until memory is released (or stop is requested). A result is always accepted
+  /// if no memory is in use, so that results larger than the budget can be processed, too.
+  /// If waitForMemory is false then the call does not block but returns -1 and the result
+  /// is not added. This must be used by the worker thread, as it is the thread that releases memory.
+  int pushIndexingResult(const ctkDICOMDatabase::IndexingResult& indexingResult, qint64 memorySize,
+    bool waitForMemory = true)
   {
+    {
+      QMutexLocker memoryLocker(&this->ResultsMemoryMutex);
+      if (this->ResultsMemorySize > 0 && this->ResultsMemorySize + memorySize > this->ResultsMemoryBudget)
+      {
+        if (!waitForMemory)
+        {
+          return -1;
+        }
+        this->MemoryWaitingParserCount++;
+        while (!this->StopRequested && this->ResultsMemorySize > 0
+          && this->ResultsMemorySize + memorySize > this->ResultsMemoryBudget)
+        {
+          this->ResultsMemoryReleased.wait(&this->ResultsMemoryMutex, 100);
+        }
+        this->MemoryWaitingParserCount--;
+      }
+      this->ResultsMemorySize += memorySize;
+    }
     QMutexLocker locker(&this->Mutex);
     this->IndexingResults.push_back(indexingResult);
+    this->QueuedResultsMemorySize += memorySize;
     return this->IndexingResults.size();
   }
 
-  void modifiedTimeForFilepath(QMap<QString, QDateTime>& timesForPaths)
-  {
-    QMutexLocker locker(&this->Mutex);
-    timesForPaths = this->ModifiedTimeForFilepath;
-  }
-
-  void setModifiedTimeForFilepath(const QMap<QString, QDateTime>& timesForPaths)
-  {
-    QMutexLocker locker(&this->Mutex);
-    this->ModifiedTimeForFilepath = timesForPaths;
-  }
-
   void setIndexing(bool indexing)
   {
     QMutexLocker locker(&this->Mutex);
@@ -180,18 +318,36 @@ public:
   void setStopRequested(bool stop)
   {
     this->StopRequested = stop;
+    if (stop)
+    {
+      // wake up parsers that wait for memory
+      QMutexLocker memoryLocker(&this->ResultsMemoryMutex);
+      this->ResultsMemoryReleased.wakeAll();
+    }
   }
 
 protected:
-  // List of already indexed file paths and oldest file modified time in the database
-  QMap<QString, QDateTime> ModifiedTimeForFilepath;
-
   QList<IndexingRequest> IndexingRequests;
   QList<ctkDICOMDatabase::IndexingResult> IndexingResults;
+  // Memory used by results in IndexingResults (protected by Mutex)
+  qint64 QueuedResultsMemorySize;
+
+  // Memory used by queued results and results that are being inserted into the database.
+  // Members below are protected by ResultsMemoryMutex (it cannot be the recursive Mutex,
+  // because QWaitCondition requires a non-recursive mutex).
+  qint64 ResultsMemorySize;
+  qint64 ResultsMemoryBudget;
+  int MemoryWaitingParserCount;
+  mutable QMutex ResultsMemoryMutex;
+  QWaitCondition ResultsMemoryReleased;
 
   QString DatabaseFilename;
   QStringList TagsToPrecache;
+  QMap<QString, QString> DatabasePragmas;
   QStringList TagsToExcludeFromStorage;
+  int ParserThreadCount;
+  bool HeaderOnlyParsingEnabled;
+  bool FastRescanEnabled;
 
   bool IsIndexing;
   bool StopRequested;
@@ -200,6 +356,177 @@ protected:
 };
 
 
+//------------------------------------------------------------------------------
+/// Paths of files of an indexing request that are waiting to be parsed.
+/// The enumerator pushes paths as they are discovered and parsers take them
+/// concurrently, so parsing starts as soon as the first file is found.
+/// The number of waiting paths is limited so that memory usage remains bounded
+/// even if millions of files are found.
+class DICOMIndexingFileQueue
+{
+public:
+  DICOMIndexingFileQueue(DICOMIndexingQueue* requestQueue, int maximumQueuedFileCount = 10000)
+    : RequestQueue(requestQueue)
+    , MaximumQueuedFileCount(qMax(1, maximumQueuedFileCount))
+    , DiscoveredFileCount(0)
+    , ProcessedFileCount(0)
+    , EnumerationCompleted(false)
+  {
+  }
+
+  /// Add a file to the queue. Blocks while the queue is full.
+  /// Returns false if indexing is stopped.
+  bool pushFile(const QString& filePath)
+  {
+    QMutexLocker locker(&this->Mutex);
+    while (this->FilePaths.size() >= this->MaximumQueuedFileCount)
+    {
+      if (this->RequestQueue->isStopRequested())
+      {
+        return false;
+      }
+      this->FileTaken.wait(&this->Mutex, 100);
+    }
+    this->FilePaths.enqueue(filePath);
+    this->DiscoveredFileCount++;
+    this->FileAdded.wakeOne();
+    return true;
+  }
+
+  /// Indicate that all files have been pushed into the queue.
+  void setEnumerationCompleted()
+  {
+    QMutexLocker locker(&this->Mutex);
+    this->EnumerationCompleted = true;
+    this->FileAdded.wakeAll();
+  }
+
+  bool isEnumerationCompleted() const
+  {
+    QMutexLocker locker(&this->Mutex);
+    return this->EnumerationCompleted;
+  }
+
+  /// Take the next file from the queue. Blocks while the queue is empty and
+  /// enumeration is not completed yet. Returns false if there are no more files
+  /// or indexing is stopped.
+  bool takeFile(QString& filePath)
+  {
+    QMutexLocker locker(&this->Mutex);
+    while (this->FilePaths.isEmpty())
+    {
+      if (this->EnumerationCompleted || this->RequestQueue->isStopRequested())
+      {
+        return false;
+      }
+      this->FileAdded.wait(&this->Mutex, 100);
+    }
+    filePath = this->FilePaths.dequeue();
+    this->LastTakenFilePath = filePath;
+    this->ProcessedFileCount++;
+    this->FileTaken.wakeOne();
+    return true;
+  }
+
+  /// Number of files that have been pushed into the queue so far
+  int discoveredFileCount() const
+  {
+    QMutexLocker locker(&this->Mutex);
+    return this->DiscoveredFileCount;
+  }
+
+  /// Number of files that have been taken from the queue so far
+  int processedFileCount() const
+  {
+    QMutexLocker locker(&this->Mutex);
+    return this->ProcessedFileCount;
+  }
+
+  QString lastTakenFilePath() const
+  {
+    QMutexLocker locker(&this->Mutex);
+    return this->LastTakenFilePath;
+  }
+
+protected:
+  DICOMIndexingQueue* RequestQueue;
+  QQueue<QString> FilePaths;
+  QString LastTakenFilePath;
+  int MaximumQueuedFileCount;
+  int DiscoveredFileCount;
+  int ProcessedFileCount;
+  bool EnumerationCompleted;
+  mutable QMutex Mutex;
+  QWaitCondition FileAdded;
+  QWaitCondition FileTaken;
+};
+
+
+//------------------------------------------------------------------------------
+/// Finds files of an indexing request (by recursively walking the input folder
+/// or using the input file list) and pushes them into the file queue.
+/// Runs in the parser thread pool, in parallel with the parsers.
+class ctkDICOMIndexerPrivateEnumerator : public QRunnable
+{
+public:
+  ctkDICOMIndexerPrivateEnumerator(const DICOMIndexingQueue::IndexingRequest& indexingRequest,
+    DICOMIndexingFileQueue* fileQueue);
+  virtual ~ctkDICOMIndexerPrivateEnumerator();
+
+  /// If set then files of directories that have the same fingerprint as in knownFingerprints
+  /// are not pushed into the file queue. Fingerprints of all other directories are added
+  /// to newFingerprints. The hash tables must not be accessed while the enumerator is running.
+  void setDirectoryFingerprints(const QHash<QString, ctkDICOMDatabase::DirectoryFingerprint>* knownFingerprints,
+    QHash<QString, ctkDICOMDatabase::DirectoryFingerprint>* newFingerprints, int* skippedDirectoryCount);
+
+  virtual void run();
+
+private:
+  /// Push files of the directory and its subdirectories into the file queue,
+  /// skipping unchanged directories. Returns false if indexing is stopped.
+  bool enumerateDirectory(const QString& directoryPath, QDir::Filters hiddenFilter);
+
+  DICOMIndexingQueue::IndexingRequest IndexingRequest;
+  DICOMIndexingFileQueue* FileQueue;
+  const QHash<QString, ctkDICOMDatabase::DirectoryFingerprint>* KnownDirectoryFingerprints;
+  QHash<QString, ctkDICOMDatabase::DirectoryFingerprint>* NewDirectoryFingerprints;
+  int* SkippedDirectoryCount;
+  qint64 EnumerationStartTime;
+};
+
+
+//------------------------------------------------------------------------------
+/// Parses DICOM files in a thread of the parser thread pool.
+/// All parsers of an indexing request take the next unprocessed file from
+/// the same file queue. Parsed datasets are pushed into the
+/// indexing queue, the database is only accessed by the worker thread.
+class ctkDICOMIndexerPrivateParser : public QRunnable
+{
+public:
+  /// modifiedTimeForFilepath is updated by the worker thread while parsers are running,
+  /// it is only read while modifiedTimeForFilepathLock is locked for reading.
+  ctkDICOMIndexerPrivateParser(DICOMIndexingQueue* queue, DICOMIndexingFileQueue* fileQueue,
+    const QMap<QString, QDateTime>& modifiedTimeForFilepath, QReadWriteLock* modifiedTimeForFilepathLock,
+    bool copyFile, QAtomicInt* alreadyAddedFileCount);
+  virtual ~ctkDICOMIndexerPrivateParser();
+
+  /// If enabled then only elements that precede stopParsingAtElement are read from the files.
+  void setHeaderOnlyParsing(bool enabled, const DcmTagKey& stopParsingAtElement);
+
+  virtual void run();
+
+private:
+  DICOMIndexingQueue* RequestQueue;
+  DICOMIndexingFileQueue* FileQueue;
+  const QMap<QString, QDateTime>& ModifiedTimeForFilepath;
+  QReadWriteLock* ModifiedTimeForFilepathLock;
+  bool CopyFile;
+  bool HeaderOnlyParsing;
+  DcmTagKey StopParsingAtElement;
+  QAtomicInt* AlreadyAddedFileCount;
+};
+
+
 class ctkDICOMIndexerPrivateWorker : public QObject
 {
   Q_OBJECT
@@ -215,6 +542,8 @@ Q_SIGNALS:
   void progress(int);
   void progressDetail(QString);
   void progressStep(QString);
+  void filesProcessed(int, double);
+  void indexingResultsInserted(int, double);
   void updatingDatabase(bool);
   void indexingComplete(int, int, int, int);
 
@@ -223,6 +552,10 @@ private:
   void processIndexingRequest(DICOMIndexingQueue::IndexingRequest& request, ctkDICOMDatabase& database);
   void writeIndexingResultsToDatabase(ctkDICOMDatabase& database);
 
+  /// Get the first tag that is not needed for inserting a dataset into the database.
+  /// Parsing of files can be stopped when this tag is reached.
+  DcmTagKey stopParsingAtElement(ctkDICOMDatabase& database);
+
   DICOMIndexingQueue* RequestQueue;
   int NumberOfInstancesToInsert;
   int NumberOfInstancesInserted;
@@ -233,8 +566,29 @@ private:
   int CompletedRequestCount; // the current request in progress is not included
 
   // List of already indexed file paths and oldest file modified time in the database.
-  // Cached here to avoid locking/unlocking a mutex each time a file is looked up.
+  // Loaded from the database by the worker thread when indexing starts (in fast rescan mode
+  // only the files of the imported folder are loaded). Files of indexing results are added
+  // by the worker thread when the results are written to the database, while parsers may be
+  // running, therefore parsers only access it while ModifiedTimeForFilepathLock is locked.
   QMap<QString, QDateTime> ModifiedTimeForFilepath;
+  QReadWriteLock ModifiedTimeForFilepathLock;
+  bool AllModifiedTimesLoaded;
+  // Files that are modified after this time will be re-indexed next time. It is the time
+  // parsing of the oldest indexing results that are not written to the database yet was started.
+  QDateTime ResultsParsingStartTime;
+  // Time parsing of the current indexing request was started
+  QDateTime RequestParsingStartTime;
+
+  // Fingerprints of directories whose files are already indexed (used in fast rescan mode).
+  // Like ModifiedTimeForFilepath, it is only modified while no parsers are running.
+  QHash<QString, ctkDICOMDatabase::DirectoryFingerprint> DirectoryFingerprints;
+  // Fingerprints of directories indexed by the current run, which are stored in the database
+  // when all the results are inserted. They are discarded if indexing is stopped.
+  QHash<QString, ctkDICOMDatabase::DirectoryFingerprint> NewDirectoryFingerprints;
+  bool NewDirectoryFingerprintsDiscarded;
+
+  // Threads that parse DICOM files, the worker thread only inserts the results into the database.
+  QThreadPool ParserThreadPool;
 };
 
 
@@ -257,13 +611,17 @@ public:
 Q_SIGNALS:
   void startWorker();
 
-//public Q_SLOTS:
+public Q_SLOTS:
+  /// Clear lookup cache of the database, as it is modified by the worker
+  /// through its own database connection.
+  void clearDatabaseLookupCache();
 
 public:
   DICOMIndexingQueue RequestQueue;
   QThread WorkerThread;
   ctkDICOMDatabase* Database;
   bool BackgroundImportEnabled;
+  bool FastDicomdirImportEnabled;
 };
 
 
@@ -129,6 +129,35 @@ void ctkDICOMItem::InitializeFromFile(const QString& filename,
   InitializeFromItem(dataset, true);
 }
 
+void ctkDICOMItem::InitializeFromFileUntilTag(const QString& filename,
+                                         const DcmTagKey& stopParsingAtElement,
+                                         const E_TransferSyntax readXfer,
+                                         const E_GrpLenEncoding groupLength,
+                                         const Uint32 maxReadLength,
+                                         const E_FileReadMode readMode)
+{
+#if OFFIS_DCMTK_VERSION_NUMBER < 362
+  Q_UNUSED(stopParsingAtElement);
+  InitializeFromFile(filename, readXfer, groupLength, maxReadLength, readMode);
+#else
+  DcmDataset *dataset;
+
+  DcmFileFormat fileformat;
+  OFCondition status = fileformat.loadFileUntilTag(filename.toUtf8().data(), readXfer, groupLength, maxReadLength, readMode,
+    stopParsingAtElement);
+  dataset = fileformat.getAndRemoveDataset();
+
+  if (!status.good())
+  {
+    qDebug() << "Could not load " << filename << "\nDCMTK says: " << status.text();
+    delete dataset;
+    return;
+  }
+
+  InitializeFromItem(dataset, true);
+#endif
+}
+
 void ctkDICOMItem::Serialize()
 {
   Q_D(ctkDICOMItem);
@@ -439,6 +468,32 @@ OFString ctkDICOMItem::Encode( const DcmTag& tag, const QString& qstring ) const
   return OFString( qstring.toLatin1().data() ); // Latin1 is ISO 8859, which is the default character set of DICOM (PS 3.5-2008, Page 18)
 }
 
+quint64 ctkDICOMItem::GetEstimatedMemorySize() const
+{
+  this->EnsureDcmDataSetIsInitialized();
+
+  // Approximate size of a DCMTK element object without its value
+  const quint64 elementObjectSize = 64;
+
+  quint64 memorySize = 0;
+  DcmStack stack;
+  DcmItem& item = GetDcmItem();
+  while (item.nextObject(stack, OFTrue).good())
+  {
+    DcmObject* object = stack.top();
+    memorySize += elementObjectSize;
+    if (object->isLeaf())
+    {
+      DcmElement* element = static_cast<DcmElement*>(object);
+      if (element->valueLoaded())
+      {
+        memorySize += element->getLength();
+      }
+    }
+  }
+  return memorySize;
+}
+
 QString ctkDICOMItem::GetAllElementValuesAsString( const DcmTag& tag ) const
 {
   this->EnsureDcmDataSetIsInitialized();
@@ -93,6 +93,20 @@ public:
                     const Uint32 maxReadLength = DCM_MaxReadLength,
                     const E_FileReadMode readMode = ERM_autoDetect);
 
+    ///
+    /// \brief For initialization from file, reading only the elements that precede stopParsingAtElement.
+    ///
+    /// Elements with a tag equal to or greater than stopParsingAtElement (for example pixel data)
+    /// are not read, which makes loading much faster and uses less memory when only header
+    /// information is needed. If the DCMTK version does not support partial loading
+    /// then the complete file is read.
+    ///
+    virtual void InitializeFromFileUntilTag(const QString& filename,
+                    const DcmTagKey& stopParsingAtElement,
+                    const E_TransferSyntax readXfer = EXS_Unknown,
+                    const E_GrpLenEncoding groupLength = EGL_noChange,
+                    const Uint32 maxReadLength = DCM_MaxReadLength,
+                    const E_FileReadMode readMode = ERM_autoDetect);
 
 
     /// \brief Save dataset to file
@@ -211,6 +225,15 @@ public:
     bool SetElementAsUnsignedShort( const DcmTag& tag, int value, unsigned long pos = 0 ); // type US
 
 
+    ///
+    /// \brief Approximate memory size of the dataset in bytes.
+    ///
+    /// It is the total length of element values that are loaded into memory plus
+    /// a fixed overhead for each element. Values that are not loaded yet (large values
+    /// that DCMTK reads from file on demand) are not included.
+    ///
+    quint64 GetEstimatedMemorySize() const;
+
     /// Some convenience getter
     QString GetStudyInstanceUID() const;
     QString GetSeriesInstanceUID() const;
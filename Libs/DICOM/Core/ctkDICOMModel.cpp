@@ -19,6 +19,7 @@
 =========================================================================*/
 
 // Qt includes
+#include <QHash>
 #include <QStringList>
 #include <QSqlDriver>
 #include <QSqlError>
@@ -28,6 +29,7 @@
 
 #include <QTime>
 #include <QDebug>
+#include <QVector>
 
 // dcmtk includes
 #include "dcmtk/dcmdata/dcvrpn.h"
@@ -39,6 +41,30 @@
 static ctkLogger logger ( "org.commontk.dicom.DICOMModel" );
 struct Node;
 
+//------------------------------------------------------------------------------
+/// Row of the hierarchy index: a patient, study, series or image.
+/// Column values are stored in ctkDICOMModelIndexLevel::Values.
+struct ctkDICOMModelIndexEntry
+{
+  /// Id of the interned UID string
+  int UID;
+  /// Entry of the parent in the previous level, -1 for patients
+  int Parent;
+  /// Entries of the children in the next level, in display order
+  QVector<int> Children;
+};
+
+//------------------------------------------------------------------------------
+/// All the entries of one level of the hierarchy index
+struct ctkDICOMModelIndexLevel
+{
+  QVector<ctkDICOMModelIndexEntry> Entries;
+  /// Ids of the interned column values, one per header column for each entry
+  QVector<int> Values;
+  /// Entry of each interned UID
+  QHash<int, int> EntryForUID;
+};
+
 Q_DECLARE_METATYPE(Qt::CheckState);
 Q_DECLARE_METATYPE(QStringList);
 
@@ -64,7 +90,36 @@ public:
   QVariant value(Node* parentValue, int row, int field)const;
   QVariant value(const QModelIndex& indexValue, int row, int field)const;
   QString  generateQuery(const QString& fields, const QString& table, const QString& conditions = QString())const;
+  /// Query of the children of a node of type parentType.
+  /// If parentUID is null then the children of all parents are selected and the UID of
+  /// their parent is returned in a "ParentUID" field. If uid is not empty then only
+  /// the child with that UID is selected.
+  QString  levelQuery(ctkDICOMModel::IndexType parentType, const QString& parentUID, const QString& uid = QString())const;
   void updateQueries(Node* node)const;
+  /// Create the root node, in index mode the hierarchy index is loaded first
+  void createRootNode();
+
+  enum
+    {
+    /// Value id of a column that is null in the database
+    NullValue = -1,
+    /// Value id of a column that is not selected at the level of the entry
+    MissingValue = -2
+    };
+  int internString(const QVariant& value);
+  /// Load all the levels until EndLevel in the hierarchy index
+  void loadHierarchyIndex();
+  /// Append the current row of the query in the index, returns the new entry or -1
+  /// if the parent is not in the index. fieldForColumn maps header columns to query fields.
+  int addIndexEntry(ctkDICOMModel::IndexType type, const QSqlQuery& query, const QVector<int>& fieldForColumn);
+  QVector<int> fieldForColumn(const QSqlRecord& record)const;
+  /// Entry of the item of the given type, it is read from the database if it is not indexed yet
+  int indexedEntry(ctkDICOMModel::IndexType type, const QString& uid);
+  /// Entries of the children of a node
+  const QVector<int>& childEntries(Node* node)const;
+  /// Node of an index entry, 0 if it has not been created yet
+  Node* nodeFromEntry(ctkDICOMModel::IndexType type, int entry)const;
+  QModelIndex indexFromNode(Node* node)const;
 
   Node*        RootNode;
   QSqlDatabase DataBase;
@@ -74,6 +129,15 @@ public:
 
   ctkDICOMModel::IndexType StartLevel;
   ctkDICOMModel::IndexType EndLevel;
+
+  bool HierarchyIndexEnabled;
+  /// Levels of the index: patients, studies, series, images
+  ctkDICOMModelIndexLevel IndexLevels[4];
+  /// Entries of the patients, in display order
+  QVector<int> IndexRootChildren;
+  /// Interned strings: UIDs and column values
+  QVector<QString> IndexStrings;
+  QHash<QString, int> IndexStringIds;
 };
 
 //------------------------------------------------------------------------------
@@ -93,6 +157,8 @@ struct Node
   Node*                           Parent;
   QVector<Node*>                  Children;
   int                             Row;
+  /// Entry in the hierarchy index, -1 for the root or if the index is not used
+  int                             Entry;
   QSqlQuery                       Query;
   QString                         UID;
   int                             RowCount;
@@ -107,6 +173,7 @@ ctkDICOMModelPrivate::ctkDICOMModelPrivate(ctkDICOMModel& o):q_ptr(&o)
   this->RootNode     = 0;
   this->StartLevel = ctkDICOMModel::RootType;
   this->EndLevel = ctkDICOMModel::ImageType;
+  this->HierarchyIndexEnabled = false;
 }
 
 //------------------------------------------------------------------------------
@@ -239,7 +306,20 @@ Node* ctkDICOMModelPrivate::createNode(int row, const QModelIndex& parentValue)c
     node->Type = ctkDICOMModel::IndexType(nodeParent->Type + 1);
     }
   node->Row = row;
-  if (node->Type != ctkDICOMModel::RootType)
+  node->Entry = -1;
+  if (node->Type != ctkDICOMModel::RootType && this->HierarchyIndexEnabled)
+    {
+    node->Entry = this->childEntries(nodeParent).value(row, -1);
+    if (node->Entry >= 0)
+      {
+      const ctkDICOMModelIndexLevel& level = this->IndexLevels[node->Type - 1];
+      node->UID = this->IndexStrings[level.Entries[node->Entry].UID];
+      }
+#if CHECKABLE_COLUMNS
+    node->Data[Qt::CheckStateRole] = node->Parent->Data[Qt::CheckStateRole];
+#endif
+    }
+  else if (node->Type != ctkDICOMModel::RootType)
     {
     int field = 0;//nodeParent->Query.record().indexOf("UID");
     node->UID = this->value(parentValue, row, field).toString();
@@ -276,6 +356,19 @@ QVariant ctkDICOMModelPrivate::value(Node* parentNode, int row, int column) cons
     return QVariant();
     }
 
+  if (this->HierarchyIndexEnabled)
+    {
+    // column is a header column
+    int entry = this->childEntries(parentNode).value(row, -1);
+    if (entry < 0 || column >= this->Headers.size())
+      {
+      return QVariant();
+      }
+    const ctkDICOMModelIndexLevel& level = this->IndexLevels[parentNode->Type];
+    int valueId = level.Values[entry * this->Headers.size() + column];
+    return valueId >= 0 ? QVariant(this->IndexStrings[valueId]) : QVariant();
+    }
+
   if (!parentNode->Query.seek(row))
     {
     qDebug() << parentNode->Query.lastError();
@@ -304,64 +397,98 @@ QString ctkDICOMModelPrivate::generateQuery(const QString& fields, const QString
 }
 
 //------------------------------------------------------------------------------
-void ctkDICOMModelPrivate::updateQueries(Node* node)const
+QString ctkDICOMModelPrivate::levelQuery(ctkDICOMModel::IndexType parentType, const QString& parentUID, const QString& uid)const
 {
   // are you kidding me, it should be virtualized here :-)
-  QString query;
-  QString condition;
-  switch(node->Type)
+  QString fields;
+  QString table;
+  QString uidField;
+  QString parentField;
+  QStringList conditions;
+  switch(parentType)
     {
     default:
-      Q_ASSERT(node->Type == ctkDICOMModel::RootType);
-      break;
+      Q_ASSERT(parentType == ctkDICOMModel::RootType);
+      return QString();
     case ctkDICOMModel::RootType:
-      //query = QString("SELECT  FROM ");
       if(this->SearchParameters["Name"].toString() != ""){
-        condition.append("PatientsName LIKE \"%" + this->SearchParameters["Name"].toString() + "%\"");
+        conditions << "PatientsName LIKE \"%" + this->SearchParameters["Name"].toString() + "%\"";
       }
-      query = this->generateQuery("UID as UID, PatientsName as Name, PatientsAge as Age, PatientsBirthDate as Date, PatientID as \"Subject ID\"","Patients", condition);
-      logger.debug ( "ctkDICOMModelPrivate::updateQueries for Root: query is: " + query );
+      fields = "UID as UID, PatientsName as Name, PatientsAge as Age, PatientsBirthDate as Date, PatientID as \"Subject ID\"";
+      table = "Patients";
+      uidField = "UID";
       break;
     case ctkDICOMModel::PatientType:
-      //query = QString("SELECT  FROM Studies WHERE PatientsUID='%1'").arg(node->UID);
       if(this->SearchParameters["Study"].toString() != "")
         {
-        condition.append("StudyDescription LIKE \"%" + this->SearchParameters["Study"].toString() + "%\"" + " AND ");
+        conditions << "StudyDescription LIKE \"%" + this->SearchParameters["Study"].toString() + "%\"";
         }
       if(this->SearchParameters["Modalities"].value<QStringList>().count() > 0)
         {
-        condition.append("ModalitiesInStudy IN (\"" + this->SearchParameters["Modalities"].value<QStringList>().join("\",\"") + "\") AND ");
+        conditions << "ModalitiesInStudy IN (\"" + this->SearchParameters["Modalities"].value<QStringList>().join("\",\"") + "\")";
         }
       if(this->SearchParameters["StartDate"].toString() != "" &&
          this->SearchParameters["EndDate"].toString() != "")
         {
-          condition.append(" ( StudyDate BETWEEN \'" + QDate::fromString(this->SearchParameters["StartDate"].toString(), "yyyyMMdd").toString("yyyy-MM-dd")
-                           + "\' AND \'" + QDate::fromString(this->SearchParameters["EndDate"].toString(), "yyyyMMdd").toString("yyyy-MM-dd") + "\' ) AND ");
+          conditions << " ( StudyDate BETWEEN \'" + QDate::fromString(this->SearchParameters["StartDate"].toString(), "yyyyMMdd").toString("yyyy-MM-dd")
+                           + "\' AND \'" + QDate::fromString(this->SearchParameters["EndDate"].toString(), "yyyyMMdd").toString("yyyy-MM-dd") + "\' )";
         }
-      query = this->generateQuery("StudyInstanceUID as UID, StudyDescription as Name, ModalitiesInStudy as Scan, StudyDate as Date, AccessionNumber as Number, InstitutionName as Institution, ReferringPhysician as Referrer, PerformingPhysiciansName as Performer", "Studies", condition + QString("PatientsUID='%1'").arg(node->UID));
-      logger.debug ( "ctkDICOMModelPrivate::updateQueries for Patient: query is: " + query );
+      fields = "StudyInstanceUID as UID, StudyDescription as Name, ModalitiesInStudy as Scan, StudyDate as Date, AccessionNumber as Number, InstitutionName as Institution, ReferringPhysician as Referrer, PerformingPhysiciansName as Performer";
+      table = "Studies";
+      uidField = "StudyInstanceUID";
+      parentField = "PatientsUID";
       break;
     case ctkDICOMModel::StudyType:
-      //query = QString("SELECT SeriesInstanceUID as UID, SeriesDescription as Name, BodyPartExamined as Scan, SeriesDate as Date, AcquisitionNumber as Number FROM Series WHERE StudyInstanceUID='%1'").arg(node->UID);
       if(this->SearchParameters["Series"].toString() != "")
         {
-        condition.append("SeriesDescription LIKE \"%" + this->SearchParameters["Series"].toString() + "%\"" + " AND ");
+        conditions << "SeriesDescription LIKE \"%" + this->SearchParameters["Series"].toString() + "%\"";
         }
-      query = this->generateQuery("SeriesInstanceUID as UID, SeriesDescription as Name, Modality as Age, SeriesNumber as Scan, BodyPartExamined as \"Subject ID\", SeriesDate as Date, AcquisitionNumber as Number","Series",condition + QString("StudyInstanceUID='%1'").arg(node->UID));
-      logger.debug ( "ctkDICOMModelPrivate::updateQueries for Study: query is: " + query );
+      fields = "SeriesInstanceUID as UID, SeriesDescription as Name, Modality as Age, SeriesNumber as Scan, BodyPartExamined as \"Subject ID\", SeriesDate as Date, AcquisitionNumber as Number";
+      table = "Series";
+      uidField = "SeriesInstanceUID";
+      parentField = "StudyInstanceUID";
       break;
     case ctkDICOMModel::SeriesType:
       if(this->SearchParameters["ID"].toString() != "")
         {
-        condition.append("SOPInstanceUID LIKE \"%" + this->SearchParameters["ID"].toString() + "%\"" + " AND ");
+        conditions << "SOPInstanceUID LIKE \"%" + this->SearchParameters["ID"].toString() + "%\"";
         }
-      //query = QString("SELECT Filename as UID, Filename as Name, SeriesInstanceUID as Date FROM Images WHERE SeriesInstanceUID='%1'").arg(node->UID);
-      query = this->generateQuery("SOPInstanceUID as UID, Filename as Name, SeriesInstanceUID as Date", "Images", condition + QString("SeriesInstanceUID='%1'").arg(node->UID));
-      logger.debug ( "ctkDICOMModelPrivate::updateQueries for Series: query is: " + query );
+      fields = "SOPInstanceUID as UID, Filename as Name, SeriesInstanceUID as Date";
+      table = "Images";
+      uidField = "SOPInstanceUID";
+      parentField = "SeriesInstanceUID";
       break;
     case ctkDICOMModel::ImageType:
-      break;
+      return QString();
     }
+  if (!parentField.isEmpty())
+    {
+    if (parentUID.isNull())
+      {
+      fields += ", " + parentField + " as ParentUID";
+      }
+    else
+      {
+      conditions << QString("%1='%2'").arg(parentField).arg(parentUID);
+      }
+    }
+  if (!uid.isEmpty())
+    {
+    conditions << QString("%1='%2'").arg(uidField).arg(QString(uid).replace("'", "''"));
+    }
+  return this->generateQuery(fields, table, conditions.join(" AND "));
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMModelPrivate::updateQueries(Node* node)const
+{
+  if (this->HierarchyIndexEnabled)
+    {
+    // children are read from the index
+    return;
+    }
+  QString query = this->levelQuery(node->Type, node->Type == ctkDICOMModel::RootType ? QString("") : node->UID);
+  logger.debug ( "ctkDICOMModelPrivate::updateQueries: query is: " + query );
   node->Query = QSqlQuery(query, this->DataBase);
   foreach(Node* child, node->Children)
     {
@@ -369,6 +496,217 @@ void ctkDICOMModelPrivate::updateQueries(Node* node)const
     }
 }
 
+//------------------------------------------------------------------------------
+void ctkDICOMModelPrivate::createRootNode()
+{
+  if (this->HierarchyIndexEnabled)
+    {
+    this->loadHierarchyIndex();
+    }
+  this->RootNode = this->createNode(-1, QModelIndex());
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMModelPrivate::internString(const QVariant& value)
+{
+  if (value.isNull())
+    {
+    return NullValue;
+    }
+  QString string = value.toString();
+  QHash<QString, int>::const_iterator it = this->IndexStringIds.constFind(string);
+  if (it != this->IndexStringIds.constEnd())
+    {
+    return it.value();
+    }
+  int id = this->IndexStrings.count();
+  this->IndexStrings.append(string);
+  this->IndexStringIds.insert(string, id);
+  return id;
+}
+
+//------------------------------------------------------------------------------
+QVector<int> ctkDICOMModelPrivate::fieldForColumn(const QSqlRecord& record)const
+{
+  QVector<int> fields;
+  foreach(const QMap<int, QVariant>& header, this->Headers)
+    {
+    fields << record.indexOf(header[Qt::DisplayRole].toString());
+    }
+  return fields;
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMModelPrivate::addIndexEntry(ctkDICOMModel::IndexType type, const QSqlQuery& query,
+                                        const QVector<int>& fieldForColumn)
+{
+  Q_Q(ctkDICOMModel);
+  int parentEntry = -1;
+  if (type != ctkDICOMModel::PatientType)
+    {
+    int parentUID = this->internString(query.value(query.record().indexOf("ParentUID")));
+    parentEntry = this->IndexLevels[type - 2].EntryForUID.value(parentUID, -1);
+    if (parentEntry < 0)
+      {
+      // parent is filtered out
+      return -1;
+      }
+    }
+  ctkDICOMModelIndexLevel& level = this->IndexLevels[type - 1];
+  int uid = this->internString(query.value(0));
+  if (level.EntryForUID.contains(uid))
+    {
+    return level.EntryForUID[uid];
+    }
+  QVector<int>& siblings = (type == ctkDICOMModel::PatientType) ?
+    this->IndexRootChildren : this->IndexLevels[type - 2].Entries[parentEntry].Children;
+
+  // Notify views if the children of the parent are already fetched
+  Node* parentNode = this->RootNode ? (type == ctkDICOMModel::PatientType ?
+    this->RootNode : this->nodeFromEntry(ctkDICOMModel::IndexType(type - 1), parentEntry)) : 0;
+  bool notify = parentNode && parentNode->AtEnd;
+  if (notify)
+    {
+    q->beginInsertRows(this->indexFromNode(parentNode), siblings.count(), siblings.count());
+    }
+
+  int entry = level.Entries.count();
+  ctkDICOMModelIndexEntry newEntry;
+  newEntry.UID = uid;
+  newEntry.Parent = parentEntry;
+  level.Entries.append(newEntry);
+  foreach(int field, fieldForColumn)
+    {
+    level.Values.append(field >= 0 ? this->internString(query.value(field)) : int(MissingValue));
+    }
+  level.EntryForUID.insert(uid, entry);
+  siblings.append(entry);
+
+  if (notify)
+    {
+    parentNode->RowCount = siblings.count();
+    q->endInsertRows();
+    }
+  return entry;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMModelPrivate::loadHierarchyIndex()
+{
+  for (int level = 0; level < 4; ++level)
+    {
+    this->IndexLevels[level] = ctkDICOMModelIndexLevel();
+    }
+  this->IndexRootChildren.clear();
+  this->IndexStrings.clear();
+  this->IndexStringIds.clear();
+
+  // One query per level instead of one query per node
+  for (int type = ctkDICOMModel::PatientType; type <= this->EndLevel && type <= ctkDICOMModel::ImageType; ++type)
+    {
+    QSqlQuery query(this->DataBase);
+    query.setForwardOnly(true);
+    if (!query.exec(this->levelQuery(ctkDICOMModel::IndexType(type - 1), QString())))
+      {
+      logger.error("ctkDICOMModelPrivate::loadHierarchyIndex: query failed: " + query.lastError().text());
+      continue;
+      }
+    QVector<int> fields = this->fieldForColumn(query.record());
+    while (query.next())
+      {
+      this->addIndexEntry(ctkDICOMModel::IndexType(type), query, fields);
+      }
+    }
+  logger.debug(QString("ctkDICOMModelPrivate::loadHierarchyIndex: %1 patients, %2 studies, %3 series, %4 images, %5 strings")
+    .arg(this->IndexLevels[0].Entries.count()).arg(this->IndexLevels[1].Entries.count())
+    .arg(this->IndexLevels[2].Entries.count()).arg(this->IndexLevels[3].Entries.count())
+    .arg(this->IndexStrings.count()));
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMModelPrivate::indexedEntry(ctkDICOMModel::IndexType type, const QString& uid)
+{
+  if (type < ctkDICOMModel::PatientType || type > ctkDICOMModel::ImageType)
+    {
+    return -1;
+    }
+  ctkDICOMModelIndexLevel& level = this->IndexLevels[type - 1];
+  QHash<QString, int>::const_iterator uidId = this->IndexStringIds.constFind(uid);
+  if (uidId != this->IndexStringIds.constEnd() && level.EntryForUID.contains(uidId.value()))
+    {
+    return level.EntryForUID[uidId.value()];
+    }
+  QSqlQuery query(this->DataBase);
+  if (!query.exec(this->levelQuery(ctkDICOMModel::IndexType(type - 1), QString(), uid)) || !query.next())
+    {
+    // not in the database or filtered out
+    return -1;
+    }
+  if (type != ctkDICOMModel::PatientType
+    && this->indexedEntry(ctkDICOMModel::IndexType(type - 1), query.value(query.record().indexOf("ParentUID")).toString()) < 0)
+    {
+    return -1;
+    }
+  return this->addIndexEntry(type, query, this->fieldForColumn(query.record()));
+}
+
+//------------------------------------------------------------------------------
+const QVector<int>& ctkDICOMModelPrivate::childEntries(Node* node)const
+{
+  static const QVector<int> noEntries;
+  if (!node)
+    {
+    return noEntries;
+    }
+  if (node->Type == ctkDICOMModel::RootType)
+    {
+    return this->IndexRootChildren;
+    }
+  if (node->Entry < 0 || node->Type > ctkDICOMModel::ImageType)
+    {
+    return noEntries;
+    }
+  return this->IndexLevels[node->Type - 1].Entries[node->Entry].Children;
+}
+
+//------------------------------------------------------------------------------
+Node* ctkDICOMModelPrivate::nodeFromEntry(ctkDICOMModel::IndexType type, int entry)const
+{
+  if (type == ctkDICOMModel::RootType)
+    {
+    return this->RootNode;
+    }
+  if (entry < 0 || type > ctkDICOMModel::ImageType)
+    {
+    return 0;
+    }
+  Node* parentNode = this->nodeFromEntry(ctkDICOMModel::IndexType(type - 1),
+    this->IndexLevels[type - 1].Entries[entry].Parent);
+  if (!parentNode)
+    {
+    return 0;
+    }
+  foreach(Node* child, parentNode->Children)
+    {
+    if (child->Entry == entry)
+      {
+      return child;
+      }
+    }
+  return 0;
+}
+
+//------------------------------------------------------------------------------
+QModelIndex ctkDICOMModelPrivate::indexFromNode(Node* node)const
+{
+  Q_Q(const ctkDICOMModel);
+  if (!node || node == this->RootNode)
+    {
+    return QModelIndex();
+    }
+  return q->createIndex(node->Row, 0, node);
+}
+
 //------------------------------------------------------------------------------
 void ctkDICOMModelPrivate::fetch(const QModelIndex& indexValue, int limit)
 {
@@ -383,8 +721,14 @@ void ctkDICOMModelPrivate::fetch(const QModelIndex& indexValue, int limit)
   int newRowCount;
   const int oldRowCount = node->RowCount;
 
+  if (this->HierarchyIndexEnabled)
+    {
+    // all the children are in the index
+    newRowCount = this->childEntries(node).count();
+    node->AtEnd = true;
+    }
   // try to seek directly
-  if (node->Query.seek(limit - 1))
+  else if (node->Query.seek(limit - 1))
     {
     newRowCount = limit;
     }
@@ -492,7 +836,17 @@ QVariant ctkDICOMModel::data ( const QModelIndex & dataIndex, int role ) const
     const_cast<ctkDICOMModelPrivate *>(d)->fetch(dataIndex, dataIndex.row());
     }
   QString columnName = d->Headers[dataIndex.column()][Qt::DisplayRole].toString();
-  int field = parentNode->Query.record().indexOf(columnName);
+  int field = d->HierarchyIndexEnabled ?
+    dataIndex.column() : parentNode->Query.record().indexOf(columnName);
+  if (d->HierarchyIndexEnabled)
+    {
+    int entry = d->childEntries(parentNode).value(dataIndex.row(), -1);
+    const ctkDICOMModelIndexLevel& level = d->IndexLevels[parentNode->Type];
+    if (entry < 0 || level.Values[entry * d->Headers.size() + field] == ctkDICOMModelPrivate::MissingValue)
+      {
+      field = -1;
+      }
+    }
   if (field < 0)
     {
     // Not all the columns are in the record, it's ok to have no field here.
@@ -606,6 +960,11 @@ bool ctkDICOMModel::hasChildren ( const QModelIndex & parentIndex ) const
   // We want to show only until EndLevel
   if(node->Type >= d->EndLevel)return false;
 
+  if (d->HierarchyIndexEnabled)
+    {
+    return !d->childEntries(node).isEmpty();
+    }
+
   // It's not because we don't have row that we don't have children, maybe it
   // just means that the children haven't been fetched yet
   if (node->RowCount == 0 && !node->AtEnd)
@@ -653,15 +1012,30 @@ QModelIndex ctkDICOMModel::index ( int row, int column, const QModelIndex & pare
     return QModelIndex();
     }
   Node* parentNode = d->nodeFromIndex(parentIndex);
-  int field = 0;// always 0//parentNode->Query.record().indexOf("UID");
-  QString uid = d->value(parentIndex, row, field).toString();
   Node* node = 0;
-  foreach(Node* tmpNode, parentNode->Children)
+  if (d->HierarchyIndexEnabled)
     {
-    if (tmpNode->UID == uid)
+    // rows of the index never move, new items are appended
+    foreach(Node* tmpNode, parentNode->Children)
       {
-      node = tmpNode;
-      break;
+      if (tmpNode->Row == row)
+        {
+        node = tmpNode;
+        break;
+        }
+      }
+    }
+  else
+    {
+    int field = 0;// always 0//parentNode->Query.record().indexOf("UID");
+    QString uid = d->value(parentIndex, row, field).toString();
+    foreach(Node* tmpNode, parentNode->Children)
+      {
+      if (tmpNode->UID == uid)
+        {
+        node = tmpNode;
+        break;
+        }
       }
     }
   // TODO: Here it is assumed that ctkDICOMModel::index is called with valid
@@ -859,12 +1233,13 @@ void ctkDICOMModel::setDatabase(const QSqlDatabase &db)
     return;
     }
 
-  d->RootNode = d->createNode(-1, QModelIndex());
+  d->createRootNode();
 
   this->endResetModel();
 
   // TODO, use hasQuerySize everywhere, not only in setDataBase()
-  bool hasQuerySize = d->RootNode->Query.driver()->hasFeature(QSqlDriver::QuerySize);
+  bool hasQuerySize = !d->HierarchyIndexEnabled &&
+    d->RootNode->Query.driver()->hasFeature(QSqlDriver::QuerySize);
   if (hasQuerySize && d->RootNode->Query.size() > 0)
     {
     int newRowCount= d->RootNode->Query.size();
@@ -895,12 +1270,13 @@ void ctkDICOMModel::setDatabase(const QSqlDatabase &db,const QMap<QString, QVari
     return;
     }
 
-  d->RootNode = d->createNode(-1, QModelIndex());
+  d->createRootNode();
 
   this->endResetModel();
 
   // TODO, use hasQuerySize everywhere, not only in setDataBase()
-  bool hasQuerySize = d->RootNode->Query.driver()->hasFeature(QSqlDriver::QuerySize);
+  bool hasQuerySize = !d->HierarchyIndexEnabled &&
+    d->RootNode->Query.driver()->hasFeature(QSqlDriver::QuerySize);
   if (hasQuerySize && d->RootNode->Query.size() > 0)
     {
     int newRowCount= d->RootNode->Query.size();
@@ -926,6 +1302,101 @@ void ctkDICOMModel::setEndLevel(ctkDICOMModel::IndexType level)
   d->EndLevel = level;
 }
 
+//------------------------------------------------------------------------------
+bool ctkDICOMModel::isHierarchyIndexEnabled()const
+{
+  Q_D(const ctkDICOMModel);
+  return d->HierarchyIndexEnabled;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMModel::setHierarchyIndexEnabled(bool enabled)
+{
+  Q_D(ctkDICOMModel);
+  if (d->HierarchyIndexEnabled == enabled)
+    {
+    return;
+    }
+  d->HierarchyIndexEnabled = enabled;
+  if (!enabled)
+    {
+    for (int level = 0; level < 4; ++level)
+      {
+      d->IndexLevels[level] = ctkDICOMModelIndexLevel();
+      }
+    d->IndexRootChildren.clear();
+    d->IndexStrings.clear();
+    d->IndexStringIds.clear();
+    }
+  if (d->RootNode)
+    {
+    this->reset();
+    }
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMModel::onInstanceAdded(const QString& sopInstanceUID)
+{
+  Q_D(ctkDICOMModel);
+  if (!d->HierarchyIndexEnabled || !d->RootNode)
+    {
+    return;
+    }
+  if (d->EndLevel >= ImageType)
+    {
+    d->indexedEntry(ImageType, sopInstanceUID);
+    return;
+    }
+  // images are not shown, only the series of the instance may be new
+  QSqlQuery query(d->DataBase);
+  query.prepare("SELECT SeriesInstanceUID FROM Images WHERE SOPInstanceUID=?");
+  query.addBindValue(sopInstanceUID);
+  if (!query.exec() || !query.next())
+    {
+    return;
+    }
+  QString uid = query.value(0).toString();
+  query.finish();
+  IndexType type = SeriesType;
+  // find the level of the ancestor that is shown
+  while (type > d->EndLevel)
+    {
+    type = IndexType(type - 1);
+    if (type == StudyType)
+      {
+      query.prepare("SELECT StudyInstanceUID FROM Series WHERE SeriesInstanceUID=?");
+      }
+    else if (type == PatientType)
+      {
+      query.prepare("SELECT PatientsUID FROM Studies WHERE StudyInstanceUID=?");
+      }
+    else
+      {
+      return;
+      }
+    query.addBindValue(uid);
+    if (!query.exec() || !query.next())
+      {
+      return;
+      }
+    uid = query.value(0).toString();
+    query.finish();
+    }
+  d->indexedEntry(type, uid);
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMModel::onItemsRemoved()
+{
+  Q_D(ctkDICOMModel);
+  if (!d->HierarchyIndexEnabled || !d->RootNode)
+    {
+    return;
+    }
+  // removed items may be anywhere in the hierarchy, the index is rebuilt
+  this->reset();
+}
+
 //------------------------------------------------------------------------------
 void ctkDICOMModel::reset()
 {
@@ -959,7 +1430,7 @@ void ctkDICOMModel::sort(int column, Qt::SortOrder order)
   d->Sort = QString("\"%1\" %2")
     .arg(d->Headers[column][Qt::DisplayRole].toString())
     .arg(order == Qt::AscendingOrder ? "ASC" : "DESC");
-  d->RootNode = d->createNode(-1, QModelIndex());
+  d->createRootNode();
 
   this->endResetModel();
 }
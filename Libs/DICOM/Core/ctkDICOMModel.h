@@ -41,6 +41,7 @@ class CTK_DICOM_CORE_EXPORT ctkDICOMModel
   Q_ENUMS(IndexType)
   /// startLevel contains the hierarchy depth the model contains
   Q_PROPERTY(IndexType endLevel READ endLevel WRITE setEndLevel);
+  Q_PROPERTY(bool hierarchyIndexEnabled READ isHierarchyIndexEnabled WRITE setHierarchyIndexEnabled);
 public:
 
   enum {
@@ -66,6 +67,16 @@ public:
   ctkDICOMModel::IndexType endLevel()const;
   void setEndLevel(ctkDICOMModel::IndexType level);
 
+  /// If enabled, the patient/study/series/image hierarchy (until endLevel) is read
+  /// with one query per level when the database is set, and kept in memory with
+  /// interned strings. Expanding items then does not query the database.
+  /// Connect onInstanceAdded() and onItemsRemoved() to the instanceAdded() and itemsRemoved()
+  /// signals of the ctkDICOMDatabase to keep the index up to date; new items are appended to their parent.
+  /// databaseChanged() does not need to be connected, it is also emitted after inserts.
+  /// Values are returned as strings. Disabled by default.
+  bool isHierarchyIndexEnabled()const;
+  void setHierarchyIndexEnabled(bool enabled);
+
   virtual bool canFetchMore ( const QModelIndex & parent ) const;
   virtual int columnCount ( const QModelIndex & parent = QModelIndex() ) const;
   virtual QVariant data ( const QModelIndex & index, int role = Qt::DisplayRole ) const;
@@ -84,6 +95,13 @@ public:
   virtual void sort(int column, Qt::SortOrder order = Qt::AscendingOrder);
 public Q_SLOTS:
   virtual void reset();
+
+  /// Add the instance and its missing parents to the hierarchy index.
+  /// Does nothing if the hierarchy index is disabled.
+  void onInstanceAdded(const QString& sopInstanceUID);
+  /// Rebuild the hierarchy index after items are removed from the database.
+  /// Does nothing if the hierarchy index is disabled.
+  void onItemsRemoved();
 protected:
   QScopedPointer<ctkDICOMModelPrivate> d_ptr;
 
@@ -19,6 +19,9 @@
 =========================================================================*/
 
 // Qt includes
+#include <QAtomicInt>
+#include <QRunnable>
+#include <QSharedPointer>
 #include <QSqlQuery>
 #include <QSqlRecord>
 #include <QVariant>
@@ -29,8 +32,11 @@
 #include <QDirIterator>
 #include <QFileInfo>
 #include <QDebug>
+#include <QThreadPool>
+#include <QVector>
 
 // ctkDICOMCore includes
+#include "ctkDICOMItem.h"
 #include "ctkDICOMQuery.h"
 #include "ctkDICOMUtil.h"
 #include "ctkLogger.h"
@@ -53,6 +59,8 @@
 
 static ctkLogger logger ( "org.commontk.dicom.DICOMQuery" );
 
+static const int DEFAULT_NUMBER_OF_SERIES_QUERY_ASSOCIATIONS = 1;
+
 //------------------------------------------------------------------------------
 // A customized implemenation so that Qt signals can be emitted
 // when query results are obtained
@@ -79,6 +87,145 @@ public:
     };
 };
 
+//------------------------------------------------------------------------------
+// Series level queries of the found studies, shared between all the associations
+// that send queries. Each study is queried by exactly one association, which
+// stores the results in the elements that belong to that study.
+struct ctkDICOMQuerySeriesQueries
+{
+  ctkDICOMQuerySeriesQueries()
+    : Canceled(NULL)
+  {
+  }
+
+  /// Returns false if there are no more studies to query.
+  /// Called concurrently from all associations.
+  bool queryNextStudy(DcmSCU& scu, T_ASC_PresentationContextID presentationContext, DcmDataset& query);
+
+  QStringList StudyInstanceUIDs;
+  QList<DcmDataset*> StudyDatasets;
+  QAtomicInt* Canceled;
+  QAtomicInt NextStudyIndex;
+  QAtomicInt CompletedStudyCount;
+  /// Elements are allocated before starting the queries, one for each study.
+  QVector<bool> QuerySucceeded;
+  QVector<QList<QSharedPointer<ctkDICOMItem> > > SeriesDatasets;
+};
+
+//------------------------------------------------------------------------------
+bool ctkDICOMQuerySeriesQueries::queryNextStudy(DcmSCU& scu, T_ASC_PresentationContextID presentationContext,
+  DcmDataset& query)
+{
+  if (this->Canceled->load())
+  {
+    return false;
+  }
+  int studyIndex = this->NextStudyIndex.fetchAndAddOrdered(1);
+  if (studyIndex >= this->StudyInstanceUIDs.size())
+  {
+    return false;
+  }
+  const QString& studyInstanceUID = this->StudyInstanceUIDs[studyIndex];
+  DcmDataset* studyDataset = this->StudyDatasets[studyIndex];
+  logger.debug ( "Starting Series C-FIND for Study: " + studyInstanceUID );
+
+  query.putAndInsertString ( DCM_StudyInstanceUID, studyInstanceUID.toStdString().c_str() );
+  OFList<QRResponse *> responses;
+  OFCondition status = scu.sendFINDRequest ( presentationContext, &query, &responses );
+  this->QuerySucceeded[studyIndex] = status.good();
+  for ( OFListIterator(QRResponse*) it = responses.begin(); it != responses.end(); it++ )
+  {
+    DcmDataset *dataset = (*it)->m_dataset;
+    if ( status.good() && dataset != NULL )
+    {
+      // the response owns its dataset, make a copy that can be kept until the database insert
+      DcmDataset* seriesDataset = new DcmDataset(*dataset);
+      // add the patient elements not provided for the series level query
+      DcmElement* element = NULL;
+      if (studyDataset->findAndGetElement(DCM_PatientName, element).good() && element)
+      {
+        seriesDataset->insert(OFstatic_cast(DcmElement*, element->clone()), true);
+      }
+      element = NULL;
+      if (studyDataset->findAndGetElement(DCM_PatientID, element).good() && element)
+      {
+        seriesDataset->insert(OFstatic_cast(DcmElement*, element->clone()), true);
+      }
+      QSharedPointer<ctkDICOMItem> seriesItem(new ctkDICOMItem);
+      seriesItem->InitializeFromItem(seriesDataset, true /* take ownership */);
+      this->SeriesDatasets[studyIndex] << seriesItem;
+    }
+    delete *it;
+  }
+  this->CompletedStudyCount.fetchAndAddOrdered(1);
+  return true;
+}
+
+//------------------------------------------------------------------------------
+// Sends series level queries on an additional association, in parallel with the
+// main association of the query.
+// The query dataset is copied in the constructor, which must be called on the thread
+// that owns the dataset (copying a DcmDataset modifies the list cursor of the source).
+class ctkDICOMQuerySeriesQueryRunnable : public QRunnable
+{
+public:
+  ctkDICOMQuerySeriesQueryRunnable(const QString& callingAETitle, const QString& calledAETitle,
+    const QString& host, int port, const DcmDataset& seriesQuery, ctkDICOMQuerySeriesQueries* seriesQueries)
+    : CallingAETitle(callingAETitle)
+    , CalledAETitle(calledAETitle)
+    , Host(host)
+    , Port(port)
+    , SeriesQuery(seriesQuery)
+    , SeriesQueries(seriesQueries)
+  {
+  }
+
+  virtual void run()
+  {
+    DcmSCU scu;
+    scu.setAETitle ( OFString(this->CallingAETitle.toStdString().c_str()) );
+    scu.setPeerAETitle ( OFString(this->CalledAETitle.toStdString().c_str()) );
+    scu.setPeerHostName ( OFString(this->Host.toStdString().c_str()) );
+    scu.setPeerPort ( this->Port );
+
+    OFList<OFString> transferSyntaxes;
+    transferSyntaxes.push_back ( UID_LittleEndianExplicitTransferSyntax );
+    transferSyntaxes.push_back ( UID_BigEndianExplicitTransferSyntax );
+    transferSyntaxes.push_back ( UID_LittleEndianImplicitTransferSyntax );
+    scu.addPresentationContext ( UID_FINDStudyRootQueryRetrieveInformationModel, transferSyntaxes );
+
+    // Studies that are not queried here are queried by the other associations
+    if ( !scu.initNetwork().good() )
+    {
+      logger.warn( "Error initializing the network for additional series query association" );
+      return;
+    }
+    OFCondition result = scu.negotiateAssociation();
+    if ( result.bad() )
+    {
+      logger.warn( "Error negotiating additional series query association: " + QString(result.text()) );
+      return;
+    }
+    T_ASC_PresentationContextID presentationContext =
+      scu.findPresentationContextID ( UID_FINDStudyRootQueryRetrieveInformationModel, "" );
+    if ( presentationContext != 0 )
+    {
+      while (this->SeriesQueries->queryNextStudy(scu, presentationContext, this->SeriesQuery))
+      {
+      }
+    }
+    scu.closeAssociation ( DCMSCU_RELEASE_ASSOCIATION );
+  }
+
+protected:
+  QString CallingAETitle;
+  QString CalledAETitle;
+  QString Host;
+  int Port;
+  DcmDataset SeriesQuery;
+  ctkDICOMQuerySeriesQueries* SeriesQueries;
+};
+
 //------------------------------------------------------------------------------
 class ctkDICOMQueryPrivate
 {
@@ -94,12 +241,13 @@ public:
   QString                 Host;
   int                     Port;
   bool                    PreferCGET;
+  int                     NumberOfSeriesQueryAssociations;
   QMap<QString,QVariant>  Filters;
   ctkDICOMQuerySCUPrivate SCU;
   DcmDataset*             Query;
   QStringList             StudyInstanceUIDList;
   QList<DcmDataset*>      StudyDatasetList;
-  bool                    Canceled;
+  QAtomicInt              Canceled;
 };
 
 //------------------------------------------------------------------------------
@@ -110,8 +258,9 @@ ctkDICOMQueryPrivate::ctkDICOMQueryPrivate()
 {
   this->Query = new DcmDataset();
   this->Port = 0;
-  this->Canceled = false;
+  this->Canceled.store(0);
   this->PreferCGET = false;
+  this->NumberOfSeriesQueryAssociations = DEFAULT_NUMBER_OF_SERIES_QUERY_ASSOCIATIONS;
 }
 
 //------------------------------------------------------------------------------
@@ -215,6 +364,20 @@ bool ctkDICOMQuery::preferCGET()const
   return d->PreferCGET;
 }
 
+//------------------------------------------------------------------------------
+void ctkDICOMQuery::setNumberOfSeriesQueryAssociations ( int count )
+{
+  Q_D(ctkDICOMQuery);
+  d->NumberOfSeriesQueryAssociations = qMax(1, count);
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMQuery::numberOfSeriesQueryAssociations()const
+{
+  Q_D(const ctkDICOMQuery);
+  return d->NumberOfSeriesQueryAssociations;
+}
+
 //------------------------------------------------------------------------------
 void ctkDICOMQuery::setFilters( const QMap<QString,QVariant>& filters )
 {
@@ -258,9 +421,10 @@ bool ctkDICOMQuery::query(ctkDICOMDatabase& database )
     emit progress("DB not open in Query");
     }
   emit progress(0);
-  if (d->Canceled) {return false;}
+  if (d->Canceled.load()) {return false;}
 
   d->StudyInstanceUIDList.clear();
+  d->StudyDatasetList.clear();
   d->SCU.setAETitle ( OFString(this->callingAETitle().toStdString().c_str()) );
   d->SCU.setPeerAETitle ( OFString(this->calledAETitle().toStdString().c_str()) );
   d->SCU.setPeerHostName ( OFString(this->host().toStdString().c_str()) );
@@ -269,7 +433,7 @@ bool ctkDICOMQuery::query(ctkDICOMDatabase& database )
   logger.error ( "Setting Transfer Syntaxes" );
   emit progress("Setting Transfer Syntaxes");
   emit progress(10);
-  if (d->Canceled) {return false;}
+  if (d->Canceled.load()) {return false;}
 
   OFList<OFString> transferSyntaxes;
   transferSyntaxes.push_back ( UID_LittleEndianExplicitTransferSyntax );
@@ -288,7 +452,7 @@ bool ctkDICOMQuery::query(ctkDICOMDatabase& database )
   logger.debug ( "Negotiating Association" );
   emit progress("Negotiating Association");
   emit progress(20);
-  if (d->Canceled) {return false;}
+  if (d->Canceled.load()) {return false;}
 
   OFCondition result = d->SCU.negotiateAssociation();
   if (result.bad())
@@ -379,7 +543,7 @@ bool ctkDICOMQuery::query(ctkDICOMDatabase& database )
     logger.debug("Query on study date " + dateRange);
     }
   emit progress(30);
-  if (d->Canceled) {return false;}
+  if (d->Canceled.load()) {return false;}
 
   OFList<QRResponse *> responses;
 
@@ -397,7 +561,7 @@ bool ctkDICOMQuery::query(ctkDICOMDatabase& database )
     emit progress("Found useful presentation context");
     }
   emit progress(40);
-  if (d->Canceled) {return false;}
+  if (d->Canceled.load()) {return false;}
 
   OFCondition status = d->SCU.sendFINDRequest ( presentationContext, d->Query, &responses );
   if ( !status.good() )
@@ -411,20 +575,25 @@ bool ctkDICOMQuery::query(ctkDICOMDatabase& database )
   logger.debug ( "Find succeded");
   emit progress("Find succeded");
   emit progress(50);
-  if (d->Canceled) {return false;}
+  if (d->Canceled.load()) {return false;}
 
+  // All results are inserted into the database in a single batch at the end
+  QList<ctkDICOMDatabase::IndexingResult> indexingResults;
   for ( OFListIterator(QRResponse*) it = responses.begin(); it != responses.end(); it++ )
     {
     DcmDataset *dataset = (*it)->m_dataset;
     if ( dataset != NULL ) // the last response is always empty
       {
-      database.insert ( dataset, false /* do not store to disk*/, false /* no thumbnail*/);
+      ctkDICOMDatabase::IndexingResult indexingResult;
+      indexingResult.dataset = QSharedPointer<ctkDICOMItem>(new ctkDICOMItem);
+      indexingResult.dataset->InitializeFromItem(dataset); // the response keeps the ownership
+      indexingResults << indexingResult;
       OFString StudyInstanceUID;
       dataset->findAndGetOFString ( DCM_StudyInstanceUID, StudyInstanceUID );
       d->addStudyInstanceUIDAndDataset ( StudyInstanceUID.c_str(), dataset );
       emit progress(QString("Processing: ") + QString(StudyInstanceUID.c_str()));
       emit progress(50);
-      if (d->Canceled) {return false;}
+      if (d->Canceled.load()) {return false;}
       }
     }
 
@@ -443,52 +612,69 @@ bool ctkDICOMQuery::query(ctkDICOMDatabase& database )
 
   // Now search each within each Study that was identified
   d->Query->putAndInsertString ( DCM_QueryRetrieveLevel, "SERIES" );
+
+  // Studies are distributed between the main association and additional associations
+  // (opened only if there are enough studies), which send the queries in parallel.
+  ctkDICOMQuerySeriesQueries seriesQueries;
+  seriesQueries.StudyInstanceUIDs = d->StudyInstanceUIDList;
+  seriesQueries.StudyDatasets = d->StudyDatasetList;
+  seriesQueries.Canceled = &d->Canceled;
+  seriesQueries.QuerySucceeded.fill(false, d->StudyInstanceUIDList.count());
+  seriesQueries.SeriesDatasets.resize(d->StudyInstanceUIDList.count());
+
+  // Each association gets its own copy of the query, made on this thread
+  DcmDataset seriesQuery(*d->Query);
+  QThreadPool seriesQueryThreadPool;
+  int numberOfAdditionalAssociations = qMin(d->NumberOfSeriesQueryAssociations, d->StudyInstanceUIDList.count()) - 1;
+  if (numberOfAdditionalAssociations > 0)
+    {
+    seriesQueryThreadPool.setMaxThreadCount(numberOfAdditionalAssociations);
+    for (int i = 0; i < numberOfAdditionalAssociations; ++i)
+      {
+      seriesQueryThreadPool.start(new ctkDICOMQuerySeriesQueryRunnable(this->callingAETitle(), this->calledAETitle(),
+        this->host(), this->port(), seriesQuery, &seriesQueries));
+      }
+    }
+
   float progressRatio = 25. / d->StudyInstanceUIDList.count();
-  int i = 0; 
+  while (seriesQueries.queryNextStudy(d->SCU, presentationContext, seriesQuery))
+    {
+    int completedStudyCount = seriesQueries.CompletedStudyCount.fetchAndAddOrdered(0);
+    emit progress(QString("Series C-FIND completed for %1 of %2 studies")
+      .arg(completedStudyCount).arg(d->StudyInstanceUIDList.count()));
+    emit progress(50 + (progressRatio * completedStudyCount));
+    }
+  seriesQueryThreadPool.waitForDone();
+  if (d->Canceled.load())
+    {
+    d->SCU.closeAssociation ( DCMSCU_RELEASE_ASSOCIATION );
+    return false;
+    }
 
-  QListIterator<DcmDataset*> datasetIterator(d->StudyDatasetList);
-  foreach ( QString StudyInstanceUID, d->StudyInstanceUIDList )
+  for (int studyIndex = 0; studyIndex < d->StudyInstanceUIDList.count(); ++studyIndex)
     {
-    DcmDataset *studyDataset = datasetIterator.next();
-    DcmElement *patientName, *patientID;
-    studyDataset->findAndGetElement(DCM_PatientName, patientName);
-    studyDataset->findAndGetElement(DCM_PatientID, patientID);
-
-    logger.debug ( "Starting Series C-FIND for Study: " + StudyInstanceUID );
-    emit progress(QString("Starting Series C-FIND for Study: ") + StudyInstanceUID);
-    emit progress(50 + (progressRatio * i++));
-    if (d->Canceled) {return false;}
-
-    d->Query->putAndInsertString ( DCM_StudyInstanceUID, StudyInstanceUID.toStdString().c_str() );
-    OFList<QRResponse *> responses;
-    status = d->SCU.sendFINDRequest ( presentationContext, d->Query, &responses );
-    if ( status.good() )
+    const QString& studyInstanceUID = d->StudyInstanceUIDList[studyIndex];
+    if ( seriesQueries.QuerySucceeded[studyIndex] )
       {
-      for ( OFListIterator(QRResponse*) it = responses.begin(); it != responses.end(); it++ )
+      logger.debug ( "Find succeded on Series level for Study: " + studyInstanceUID );
+      foreach (const QSharedPointer<ctkDICOMItem>& seriesDataset, seriesQueries.SeriesDatasets[studyIndex])
         {
-        DcmDataset *dataset = (*it)->m_dataset;
-        if ( dataset != NULL )
-          {
-          // add the patient elements not provided for the series level query
-          dataset->insert( patientName, true );
-          dataset->insert( patientID, true );
-          // insert series dataset 
-          database.insert ( dataset, false /* do not store */, false /* no thumbnail */ );
-          }
+        ctkDICOMDatabase::IndexingResult indexingResult;
+        indexingResult.dataset = seriesDataset;
+        indexingResults << indexingResult;
         }
-      logger.debug ( "Find succeded on Series level for Study: " + StudyInstanceUID );
-      emit progress(QString("Find succeded on Series level for Study: ") + StudyInstanceUID);
-      emit progress(50 + (progressRatio * i++));
-      if (d->Canceled) {return false;}
       }
     else
       {
-      logger.error ( "Find on Series level failed for Study: " + StudyInstanceUID );
-      emit progress(QString("Find on Series level failed for Study: ") + StudyInstanceUID);
+      logger.error ( "Find on Series level failed for Study: " + studyInstanceUID );
+      emit progress(QString("Find on Series level failed for Study: ") + studyInstanceUID);
       }
-    emit progress(50 + (progressRatio * i++));
-    if (d->Canceled) {return false;}
     }
+
+  emit progress("Inserting query results into the database");
+  emit progress(75);
+  database.insert(indexingResults);
+
   d->SCU.closeAssociation ( DCMSCU_RELEASE_ASSOCIATION );
   emit progress(100);
   return true;
@@ -498,5 +684,5 @@ bool ctkDICOMQuery::query(ctkDICOMDatabase& database )
 void ctkDICOMQuery::cancel()
 {
   Q_D(ctkDICOMQuery);
-  d->Canceled = true;
+  d->Canceled.store(1);
 }
@@ -44,6 +44,7 @@ class CTK_DICOM_CORE_EXPORT ctkDICOMQuery : public QObject
   Q_PROPERTY(QString host READ host WRITE setHost);
   Q_PROPERTY(int port READ port WRITE setPort);
   Q_PROPERTY(bool preferCGET READ preferCGET WRITE setPreferCGET);
+  Q_PROPERTY(int numberOfSeriesQueryAssociations READ numberOfSeriesQueryAssociations WRITE setNumberOfSeriesQueryAssociations);
 
 public:
   explicit ctkDICOMQuery(QObject* parent = 0);
@@ -68,6 +69,12 @@ public:
   /// false by default
   void setPreferCGET ( bool preferCGET );
   bool preferCGET()const;
+  /// Maximum number of associations that are used concurrently for querying
+  /// the series of the found studies. Additional associations are only opened
+  /// if there are more studies than associations. Some servers limit the number
+  /// of concurrent associations, therefore the default is 1.
+  void setNumberOfSeriesQueryAssociations ( int count );
+  int numberOfSeriesQueryAssociations()const;
 
   /// Query a remote DICOM Image Store SCP
   /// You must at least set the host and port before calling query()
@@ -21,8 +21,12 @@
 #include <stdexcept>
 
 // Qt includes
+#include <QElapsedTimer>
+#include <QMetaMethod>
 
 // ctkDICOMCore includes
+#include "ctkDICOMIndexer.h"
+#include "ctkDICOMItem.h"
 #include "ctkDICOMRetrieve.h"
 #include "ctkLogger.h"
 
@@ -49,6 +53,8 @@
 
 static ctkLogger logger("org.commontk.dicom.DICOMRetrieve");
 
+static const int DEFAULT_STORE_BATCH_SIZE = 50;
+
 //------------------------------------------------------------------------------
 // A customized local implemenation of the DcmSCU so that Qt signals can be emitted
 // when retrieve results are obtained
@@ -84,30 +90,7 @@ public:
   virtual OFCondition handleSTORERequest(const T_ASC_PresentationContextID presID,
                                          DcmDataset *incomingObject,
                                          OFBool& continueCGETSession,
-                                         Uint16& cStoreReturnStatus)
-    {
-      if (this->retrieve)
-        {
-        OFString instanceUID;
-        incomingObject->findAndGetOFString(DCM_SOPInstanceUID, instanceUID);
-        QString qInstanceUID(instanceUID.c_str());
-        emit this->retrieve->progress("Got STORE request for " + qInstanceUID);
-        emit this->retrieve->progress(0);
-        continueCGETSession = !this->retrieve->wasCanceled();
-        if (this->retrieve && this->retrieve->database())
-          {
-          this->retrieve->database()->insert(incomingObject);
-          return EC_Normal;
-          }
-        else
-          {
-          return this->DcmSCU::handleSTORERequest(
-                          presID, incomingObject, continueCGETSession, cStoreReturnStatus);
-          }
-        }
-      //return false;
-      return EC_IllegalCall;
-    };
+                                         Uint16& cStoreReturnStatus);
 
   // called when status information from remote server
   // comes in from CGET
@@ -148,6 +131,27 @@ public:
   QSharedPointer<ctkDICOMDatabase> Database;
   ctkDICOMRetrieveSCUPrivate        SCU;
   QString MoveDestinationAETitle;
+  int           StoreBatchSize;
+  /// Datasets received via get that are not yet handed over to the indexer
+  QList<ctkDICOMDatabase::IndexingResult> RetrievedIndexingResults;
+  /// Indexer set by the application, writes into the database in its own thread
+  ctkDICOMIndexer* Indexer;
+  /// Used if no indexer is set, created when the first dataset is received
+  QScopedPointer<ctkDICOMIndexer> InternalIndexer;
+  /// Throughput of the current get request
+  QElapsedTimer TransferTimer;
+  int ReceivedDatasetCount;
+  int IndexedDatasetCount;
+  /// Returns true if received datasets are inserted into a database or
+  /// processed by an object connected to datasetsRetrieved.
+  bool isRetrievedDatasetConsumerAvailable();
+  /// Save the dataset into the database folder and keep its header for inserting in the next batch
+  void addRetrievedDataset(DcmDataset* dataset);
+  /// Hand over all received datasets to the indexer and emit datasetsRetrieved
+  void storeRetrievedDatasets();
+  /// Wait until the internal indexer inserts all received datasets
+  void waitForRetrievedDatasetsStored();
+  void onIndexingResultsInserted(int insertedCount, double insertedPerSecond);
   // do the retrieve, handling both series and study retrieves
   enum RetrieveType { RetrieveNone, RetrieveSeries, RetrieveStudy };
   bool initializeSCU(const QString& studyInstanceUID,
@@ -162,6 +166,38 @@ public:
                   const RetrieveType retrieveType );
 };
 
+//------------------------------------------------------------------------------
+// called when a data set is coming in from a server in
+// response to a CGET
+OFCondition ctkDICOMRetrieveSCUPrivate::handleSTORERequest(const T_ASC_PresentationContextID presID,
+                                                           DcmDataset *incomingObject,
+                                                           OFBool& continueCGETSession,
+                                                           Uint16& cStoreReturnStatus)
+{
+  if (this->retrieve)
+    {
+    OFString instanceUID;
+    incomingObject->findAndGetOFString(DCM_SOPInstanceUID, instanceUID);
+    QString qInstanceUID(instanceUID.c_str());
+    emit this->retrieve->progress("Got STORE request for " + qInstanceUID);
+    emit this->retrieve->progress(0);
+    continueCGETSession = !this->retrieve->wasCanceled();
+    if (this->retrieve->d_func()->isRetrievedDatasetConsumerAvailable())
+      {
+      // datasets are inserted into the database in batches
+      this->retrieve->d_func()->addRetrievedDataset(incomingObject);
+      return EC_Normal;
+      }
+    else
+      {
+      return this->DcmSCU::handleSTORERequest(
+                      presID, incomingObject, continueCGETSession, cStoreReturnStatus);
+      }
+    }
+  //return false;
+  return EC_IllegalCall;
+}
+
 //------------------------------------------------------------------------------
 // ctkDICOMRetrievePrivate methods
 
@@ -174,6 +210,12 @@ ctkDICOMRetrievePrivate::ctkDICOMRetrievePrivate(ctkDICOMRetrieve& obj)
   this->KeepAssociationOpen = true;
   this->ConnectionParamsChanged = false;
   this->LastRetrieveType = RetrieveNone;
+  this->StoreBatchSize = DEFAULT_STORE_BATCH_SIZE;
+  this->Indexer = 0;
+  this->ReceivedDatasetCount = 0;
+  this->IndexedDatasetCount = 0;
+  // for handing over received datasets to an indexer in another thread
+  qRegisterMetaType<QList<ctkDICOMDatabase::IndexingResult> >("QList<ctkDICOMDatabase::IndexingResult>");
 
   // Register the JPEG libraries in case we need them
   // (registration only happens once, so it's okay to call repeatedly)
@@ -213,6 +255,129 @@ ctkDICOMRetrievePrivate::~ctkDICOMRetrievePrivate()
     }
 }
 
+//------------------------------------------------------------------------------
+bool ctkDICOMRetrievePrivate::isRetrievedDatasetConsumerAvailable()
+{
+  Q_Q(ctkDICOMRetrieve);
+  return !this->Database.isNull()
+    || q->isSignalConnected(QMetaMethod::fromSignal(&ctkDICOMRetrieve::datasetsRetrieved));
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrievePrivate::addRetrievedDataset(DcmDataset* dataset)
+{
+  this->ReceivedDatasetCount++;
+
+  // The incoming dataset is deleted by the SCU after the store request is handled.
+  // It is saved into the database folder right away, so that only the header has to be kept
+  // in memory until it is inserted into the database by the indexer.
+  ctkDICOMDatabase::IndexingResult indexingResult;
+  indexingResult.dataset = QSharedPointer<ctkDICOMItem>(new ctkDICOMItem);
+  QString storagePath;
+  if (this->Database && !this->Database->isInMemory())
+    {
+    // the dataset is saved without copying it, through a temporary file
+    storagePath = this->Database->storeDataset(dataset);
+    if (!storagePath.isEmpty())
+      {
+      // only the other elements are copied into the header, pixel data is not cloned
+      DcmDataset* header = new DcmDataset;
+      for (unsigned long elementIndex = 0; elementIndex < dataset->card(); ++elementIndex)
+        {
+        DcmElement* element = dataset->getElement(elementIndex);
+        if (element->getTag() == DCM_PixelData)
+          {
+          continue;
+          }
+        header->insert(OFstatic_cast(DcmElement*, element->clone()));
+        }
+      indexingResult.dataset->InitializeFromItem(header, true /* take ownership */);
+      indexingResult.filePath = storagePath;
+      indexingResult.copyFile = false;
+      // tags that are not in the header are read from the saved file when needed
+      indexingResult.incompleteDataset = true;
+      }
+    else
+      {
+      logger.error("Error saving received dataset");
+      }
+    }
+  if (storagePath.isEmpty())
+    {
+    // keep the complete dataset, it is stored when it is inserted into the database
+    indexingResult.dataset->InitializeFromItem(new DcmDataset(*dataset), true /* take ownership */);
+    indexingResult.copyFile = true;
+    }
+  this->RetrievedIndexingResults << indexingResult;
+  if (this->RetrievedIndexingResults.size() >= this->StoreBatchSize)
+    {
+    this->storeRetrievedDatasets();
+    }
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrievePrivate::storeRetrievedDatasets()
+{
+  Q_Q(ctkDICOMRetrieve);
+  if (this->RetrievedIndexingResults.isEmpty())
+    {
+    return;
+    }
+  QList<ctkDICOMDatabase::IndexingResult> indexingResults;
+  indexingResults.swap(this->RetrievedIndexingResults);
+  emit q->datasetsRetrieved(indexingResults);
+  if (!this->Database)
+    {
+    return;
+    }
+  if (!this->Indexer && this->Database->isInMemory())
+    {
+    // the indexer thread cannot open another connection to an in-memory database
+    this->Database->insert(indexingResults);
+    this->IndexedDatasetCount += indexingResults.size();
+    return;
+    }
+  ctkDICOMIndexer* indexer = this->Indexer;
+  if (!indexer)
+    {
+    if (!this->InternalIndexer)
+      {
+      this->InternalIndexer.reset(new ctkDICOMIndexer);
+      this->InternalIndexer->setBackgroundImportEnabled(true);
+      QObject::connect(this->InternalIndexer.data(), &ctkDICOMIndexer::indexingResultsInserted,
+        this, &ctkDICOMRetrievePrivate::onIndexingResultsInserted);
+      }
+    if (this->InternalIndexer->database() != this->Database.data())
+      {
+      this->InternalIndexer->setDatabase(this->Database.data());
+      }
+    indexer = this->InternalIndexer.data();
+    }
+  // the indexer may be used in another thread (e.g., by a retrieve scheduler)
+  QMetaObject::invokeMethod(indexer, "addIndexingResults", Qt::AutoConnection,
+    Q_ARG(QList<ctkDICOMDatabase::IndexingResult>, indexingResults));
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrievePrivate::waitForRetrievedDatasetsStored()
+{
+  if (!this->Indexer && this->InternalIndexer)
+    {
+    this->InternalIndexer->waitForImportFinished();
+    }
+  Q_Q(ctkDICOMRetrieve);
+  logger.debug(QString("Received %1 datasets (%2 datasets/s), inserted %3 datasets into the database (%4 datasets/s)")
+    .arg(this->ReceivedDatasetCount).arg(q->receivedDatasetsPerSecond(), 0, 'f', 1)
+    .arg(this->IndexedDatasetCount).arg(q->indexedDatasetsPerSecond(), 0, 'f', 1));
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrievePrivate::onIndexingResultsInserted(int insertedCount, double insertedPerSecond)
+{
+  Q_UNUSED(insertedPerSecond);
+  this->IndexedDatasetCount += insertedCount;
+}
+
 //------------------------------------------------------------------------------
 bool ctkDICOMRetrievePrivate::initializeSCU( const QString& studyInstanceUID,
                                          const QString& seriesInstanceUID,
@@ -412,8 +577,13 @@ bool ctkDICOMRetrievePrivate::get ( const QString& studyInstanceUID,
   emit q->progress(1);
 
   // do the actual move request
+  this->ReceivedDatasetCount = 0;
+  this->IndexedDatasetCount = 0;
+  this->TransferTimer.start();
   OFCondition status = this->SCU.sendCGETRequest ( 
                           presID, retrieveParameters, &responses );
+  // insert the last batch of received datasets
+  this->storeRetrievedDatasets();
 
   emit q->progress("Sent Get Request");
   emit q->progress(2);
@@ -425,6 +595,7 @@ bool ctkDICOMRetrievePrivate::get ( const QString& studyInstanceUID,
     }
   // Free some (little) memory
   delete retrieveParameters;
+  this->waitForRetrievedDatasetsStored();
 
   // If we do not receive a single response, something is fishy
   if ( responses.begin() == responses.end() )
@@ -633,6 +804,64 @@ QSharedPointer<ctkDICOMDatabase> ctkDICOMRetrieve::database()const
   return d->Database;
 }
 
+//------------------------------------------------------------------------------
+void ctkDICOMRetrieve::setStoreBatchSize(int batchSize)
+{
+  Q_D(ctkDICOMRetrieve);
+  d->StoreBatchSize = qMax(1, batchSize);
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMRetrieve::storeBatchSize()const
+{
+  Q_D(const ctkDICOMRetrieve);
+  return d->StoreBatchSize;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrieve::setIndexer(ctkDICOMIndexer* indexer)
+{
+  Q_D(ctkDICOMRetrieve);
+  d->Indexer = indexer;
+}
+
+//------------------------------------------------------------------------------
+ctkDICOMIndexer* ctkDICOMRetrieve::indexer()const
+{
+  Q_D(const ctkDICOMRetrieve);
+  return d->Indexer;
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMRetrieve::receivedDatasetCount()const
+{
+  Q_D(const ctkDICOMRetrieve);
+  return d->ReceivedDatasetCount;
+}
+
+//------------------------------------------------------------------------------
+double ctkDICOMRetrieve::receivedDatasetsPerSecond()const
+{
+  Q_D(const ctkDICOMRetrieve);
+  qint64 elapsedTimeMsec = d->TransferTimer.isValid() ? d->TransferTimer.elapsed() : 0;
+  return elapsedTimeMsec > 0 ? d->ReceivedDatasetCount * 1000.0 / elapsedTimeMsec : 0.0;
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMRetrieve::indexedDatasetCount()const
+{
+  Q_D(const ctkDICOMRetrieve);
+  return d->IndexedDatasetCount;
+}
+
+//------------------------------------------------------------------------------
+double ctkDICOMRetrieve::indexedDatasetsPerSecond()const
+{
+  Q_D(const ctkDICOMRetrieve);
+  qint64 elapsedTimeMsec = d->TransferTimer.isValid() ? d->TransferTimer.elapsed() : 0;
+  return elapsedTimeMsec > 0 ? d->IndexedDatasetCount * 1000.0 / elapsedTimeMsec : 0.0;
+}
+
 //------------------------------------------------------------------------------
 void ctkDICOMRetrieve::setKeepAssociationOpen(const bool keepOpen)
 {
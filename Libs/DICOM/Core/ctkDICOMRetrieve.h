@@ -32,6 +32,7 @@
 // CTK Core includes
 #include "ctkDICOMDatabase.h"
 
+class ctkDICOMIndexer;
 class ctkDICOMRetrievePrivate;
 
 /// \ingroup DICOM_Core
@@ -45,6 +46,7 @@ class CTK_DICOM_CORE_EXPORT ctkDICOMRetrieve : public QObject
   Q_PROPERTY(QString moveDestinationAETitle READ moveDestinationAETitle WRITE setMoveDestinationAETitle);
   Q_PROPERTY(bool keepAssociationOpen READ keepAssociationOpen WRITE setKeepAssociationOpen);
   Q_PROPERTY(bool wasCanceled READ wasCanceled WRITE setWasCanceled);
+  Q_PROPERTY(int storeBatchSize READ storeBatchSize WRITE setStoreBatchSize);
 
 public:
   explicit ctkDICOMRetrieve(QObject* parent = 0);
@@ -83,6 +85,32 @@ public:
   Q_INVOKABLE void setDatabase(ctkDICOMDatabase& dicomDatabase);
   void setDatabase(QSharedPointer<ctkDICOMDatabase> dicomDatabase);
   Q_INVOKABLE QSharedPointer<ctkDICOMDatabase> database()const;
+  /// Number of datasets received via get that are collected before they are
+  /// inserted into the database in one batch (and datasetsRetrieved is emitted).
+  /// Remaining datasets are inserted when the get request is completed.
+  /// Default is 50.
+  Q_INVOKABLE void setStoreBatchSize(int batchSize);
+  Q_INVOKABLE int storeBatchSize()const;
+  /// Indexer that inserts the datasets received via get into the database.
+  /// Received datasets are saved into the database folder immediately and then
+  /// inserted in batches by the indexer in its background thread, so that database
+  /// writes do not slow down the network transfer.
+  /// If not set then an internal indexer is used, and get functions return
+  /// when all received datasets are inserted. If set, then the get functions
+  /// do not wait for the insertion. The indexer may belong to another thread.
+  Q_INVOKABLE void setIndexer(ctkDICOMIndexer* indexer);
+  Q_INVOKABLE ctkDICOMIndexer* indexer()const;
+
+  /// Number of datasets received in the current (or last) get request
+  Q_INVOKABLE int receivedDatasetCount()const;
+  /// Number of received datasets per second in the current (or last) get request
+  Q_INVOKABLE double receivedDatasetsPerSecond()const;
+  /// Number of datasets of the current (or last) get request that are inserted
+  /// into the database. Only available if the internal indexer is used.
+  Q_INVOKABLE int indexedDatasetCount()const;
+  /// Number of datasets inserted into the database per second in the current (or last)
+  /// get request. Only available if the internal indexer is used.
+  Q_INVOKABLE double indexedDatasetsPerSecond()const;
 
 public Q_SLOTS:
   /// Use CMOVE to ask peer host to store data to move destination
@@ -113,6 +141,11 @@ Q_SIGNALS:
   /// Signal is emitted inside the retrieve() function when finished with value 
   /// true for success or false for error
   void done(const bool& error);
+  /// Signal is emitted inside the get functions when a batch of received datasets
+  /// is ready, before it is handed over to the indexer (if a database is set).
+  /// If there is no database then received datasets are only reported by this signal.
+  /// The signal is emitted in the thread that called the get function.
+  void datasetsRetrieved(const QList<ctkDICOMDatabase::IndexingResult>& indexingResults);
 
 protected:
   QScopedPointer<ctkDICOMRetrievePrivate> d_ptr;
@@ -0,0 +1,590 @@
+/*=========================================================================
+
+  Library:   CTK
+
+  Copyright (c) Kitware Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0.txt
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+=========================================================================*/
+
+// Qt includes
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QHash>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QTimer>
+
+// ctkDICOMCore includes
+#include "ctkDICOMIndexer.h"
+#include "ctkDICOMRetrieve.h"
+#include "ctkDICOMRetrieveScheduler.h"
+#include "ctkLogger.h"
+
+static ctkLogger logger("org.commontk.dicom.DICOMRetrieveScheduler");
+
+static const int DEFAULT_MAXIMUM_NUMBER_OF_RETRIEVES = 4;
+static const int DEFAULT_MAXIMUM_NUMBER_OF_RETRIEVES_PER_PEER = 2;
+static const int DEFAULT_MAXIMUM_NUMBER_OF_RETRIES = 2;
+static const int DEFAULT_RETRY_DELAY_MSEC = 5000;
+static const int DEFAULT_STORE_BATCH_SIZE = 50;
+
+//------------------------------------------------------------------------------
+struct ctkDICOMRetrieveSchedulerRequest
+{
+  ctkDICOMRetrieveSchedulerRequest()
+    : Id(0)
+    , Port(0)
+    , UseCGET(true)
+    , RetryCount(0)
+    , NotBefore(0)
+  {
+  }
+
+  /// Retrieves from the same peer are limited by maximumNumberOfRetrievesPerPeer
+  QString peer() const
+  {
+    return this->Host + ":" + QString::number(this->Port);
+  }
+
+  int Id;
+  QString StudyInstanceUID;
+  /// Empty for study retrieves
+  QString SeriesInstanceUID;
+  QString CalledAETitle;
+  QString Host;
+  int Port;
+  bool UseCGET;
+  int RetryCount;
+  /// Time (milliseconds since epoch) before the request must not be started (used for delaying retries)
+  qint64 NotBefore;
+};
+
+//------------------------------------------------------------------------------
+// Runs a retrieve in a thread of the scheduler's thread pool.
+// The retrieve object is created and deleted in the main thread.
+class ctkDICOMRetrieveSchedulerWorker : public QRunnable
+{
+public:
+  ctkDICOMRetrieveSchedulerWorker(ctkDICOMRetrieveScheduler* scheduler, ctkDICOMRetrieve* retrieve,
+    const ctkDICOMRetrieveSchedulerRequest& request)
+    : Scheduler(scheduler)
+    , Retrieve(retrieve)
+    , Request(request)
+  {
+  }
+
+  virtual void run()
+  {
+    bool success = false;
+    if (this->Request.SeriesInstanceUID.isEmpty())
+    {
+      success = this->Request.UseCGET ? this->Retrieve->getStudy(this->Request.StudyInstanceUID)
+        : this->Retrieve->moveStudy(this->Request.StudyInstanceUID);
+    }
+    else
+    {
+      success = this->Request.UseCGET
+        ? this->Retrieve->getSeries(this->Request.StudyInstanceUID, this->Request.SeriesInstanceUID)
+        : this->Retrieve->moveSeries(this->Request.StudyInstanceUID, this->Request.SeriesInstanceUID);
+    }
+    QMetaObject::invokeMethod(this->Scheduler, "onRetrieveFinished", Qt::QueuedConnection,
+      Q_ARG(int, this->Request.Id), Q_ARG(bool, success));
+  }
+
+protected:
+  ctkDICOMRetrieveScheduler* Scheduler;
+  ctkDICOMRetrieve* Retrieve;
+  ctkDICOMRetrieveSchedulerRequest Request;
+};
+
+//------------------------------------------------------------------------------
+class ctkDICOMRetrieveSchedulerPrivate : public QObject
+{
+  Q_DECLARE_PUBLIC(ctkDICOMRetrieveScheduler);
+
+protected:
+  ctkDICOMRetrieveScheduler* const q_ptr;
+
+public:
+  ctkDICOMRetrieveSchedulerPrivate(ctkDICOMRetrieveScheduler& obj);
+  ~ctkDICOMRetrieveSchedulerPrivate();
+
+  void addRequest(const ctkDICOMRetrieveSchedulerRequest& request);
+  void startRequest(const ctkDICOMRetrieveSchedulerRequest& request);
+  /// Called from the worker threads when a batch of datasets is received
+  void onDatasetsRetrieved(const QList<ctkDICOMDatabase::IndexingResult>& indexingResults);
+  void onIndexingResultsInserted(int insertedCount, double insertedPerSecond);
+  /// Emit retrievesFinished if all requests are completed and all datasets are inserted
+  void checkRetrievesFinished();
+
+  ctkDICOMDatabase* Database;
+  ctkDICOMIndexer Indexer;
+  QString CallingAETitle;
+  QString MoveDestinationAETitle;
+  int MaximumNumberOfRetrieves;
+  int MaximumNumberOfRetrievesPerPeer;
+  int MaximumNumberOfRetries;
+  int RetryDelay;
+  int StoreBatchSize;
+
+  QList<ctkDICOMRetrieveSchedulerRequest> QueuedRequests;
+  QHash<int, ctkDICOMRetrieveSchedulerRequest> RunningRequests;
+  QHash<int, ctkDICOMRetrieve*> RunningRetrieves;
+  QThreadPool ThreadPool;
+  QTimer RetryTimer;
+  int NextRequestId;
+  bool Canceled;
+
+  /// Statistics of the requests since the scheduler was last idle
+  int RequestCount;
+  int SucceededCount;
+  int FailedCount;
+
+  /// Throughput since the scheduler was last idle
+  QElapsedTimer TransferTimer;
+  QAtomicInt ReceivedDatasetCount;
+  int IndexedDatasetCount;
+};
+
+//------------------------------------------------------------------------------
+// ctkDICOMRetrieveSchedulerPrivate methods
+
+//------------------------------------------------------------------------------
+ctkDICOMRetrieveSchedulerPrivate::ctkDICOMRetrieveSchedulerPrivate(ctkDICOMRetrieveScheduler& obj)
+  : q_ptr(&obj)
+  , Database(0)
+  , CallingAETitle("ANY-SCU")
+  , MaximumNumberOfRetrieves(DEFAULT_MAXIMUM_NUMBER_OF_RETRIEVES)
+  , MaximumNumberOfRetrievesPerPeer(DEFAULT_MAXIMUM_NUMBER_OF_RETRIEVES_PER_PEER)
+  , MaximumNumberOfRetries(DEFAULT_MAXIMUM_NUMBER_OF_RETRIES)
+  , RetryDelay(DEFAULT_RETRY_DELAY_MSEC)
+  , StoreBatchSize(DEFAULT_STORE_BATCH_SIZE)
+  , NextRequestId(1)
+  , Canceled(false)
+  , RequestCount(0)
+  , SucceededCount(0)
+  , FailedCount(0)
+  , IndexedDatasetCount(0)
+{
+  this->Indexer.setBackgroundImportEnabled(true);
+  this->ThreadPool.setMaxThreadCount(this->MaximumNumberOfRetrieves);
+  this->RetryTimer.setSingleShot(true);
+}
+
+//------------------------------------------------------------------------------
+ctkDICOMRetrieveSchedulerPrivate::~ctkDICOMRetrieveSchedulerPrivate()
+{
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrieveSchedulerPrivate::addRequest(const ctkDICOMRetrieveSchedulerRequest& request)
+{
+  Q_Q(ctkDICOMRetrieveScheduler);
+  if (this->RequestCount == 0)
+  {
+    this->TransferTimer.start();
+    this->ReceivedDatasetCount = 0;
+    this->IndexedDatasetCount = 0;
+  }
+  this->QueuedRequests.append(request);
+  this->QueuedRequests.last().Id = this->NextRequestId++;
+  this->RequestCount++;
+  this->Canceled = false;
+  q->startQueuedRetrieves();
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrieveSchedulerPrivate::startRequest(const ctkDICOMRetrieveSchedulerRequest& request)
+{
+  Q_Q(ctkDICOMRetrieveScheduler);
+  ctkDICOMRetrieve* retrieve = new ctkDICOMRetrieve;
+  retrieve->setCallingAETitle(this->CallingAETitle);
+  retrieve->setCalledAETitle(request.CalledAETitle);
+  retrieve->setHost(request.Host);
+  retrieve->setPort(request.Port);
+  retrieve->setMoveDestinationAETitle(this->MoveDestinationAETitle);
+  retrieve->setKeepAssociationOpen(false);
+  retrieve->setStoreBatchSize(this->StoreBatchSize);
+  // The retrieve runs in a worker thread. It saves the received datasets into the database
+  // folder and hands them over in batches to the indexer, which inserts them in its own thread.
+  if (this->Database)
+  {
+    retrieve->setDatabase(*this->Database);
+  }
+  retrieve->setIndexer(&this->Indexer);
+  QObject::connect(retrieve, &ctkDICOMRetrieve::datasetsRetrieved,
+    this, &ctkDICOMRetrieveSchedulerPrivate::onDatasetsRetrieved, Qt::DirectConnection);
+
+  this->RunningRequests[request.Id] = request;
+  this->RunningRetrieves[request.Id] = retrieve;
+  logger.debug("Starting retrieve of study " + request.StudyInstanceUID + " series " + request.SeriesInstanceUID
+    + " from " + request.peer());
+  emit q->retrieveStarted(request.StudyInstanceUID, request.SeriesInstanceUID);
+  this->ThreadPool.start(new ctkDICOMRetrieveSchedulerWorker(q, retrieve, request));
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrieveSchedulerPrivate::onDatasetsRetrieved(const QList<ctkDICOMDatabase::IndexingResult>& indexingResults)
+{
+  this->ReceivedDatasetCount.fetchAndAddOrdered(indexingResults.size());
+  if (!this->Database)
+  {
+    logger.error(QString("No database is set, %1 retrieved datasets are discarded").arg(indexingResults.size()));
+  }
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrieveSchedulerPrivate::onIndexingResultsInserted(int insertedCount, double insertedPerSecond)
+{
+  Q_UNUSED(insertedPerSecond);
+  this->IndexedDatasetCount += insertedCount;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrieveSchedulerPrivate::checkRetrievesFinished()
+{
+  Q_Q(ctkDICOMRetrieveScheduler);
+  if (this->RequestCount == 0 || !this->QueuedRequests.isEmpty() || !this->RunningRequests.isEmpty())
+  {
+    return;
+  }
+  // Retrieves hand over their last batch of datasets to the indexer before they
+  // report completion, therefore the indexer is already busy with them at this point.
+  if (this->Indexer.isImporting())
+  {
+    return;
+  }
+  int succeededCount = this->SucceededCount;
+  int failedCount = this->FailedCount;
+  this->RequestCount = 0;
+  this->SucceededCount = 0;
+  this->FailedCount = 0;
+  this->Canceled = false;
+  logger.debug(QString("Received %1 datasets (%2 datasets/s), inserted %3 datasets into the database (%4 datasets/s)")
+    .arg(this->ReceivedDatasetCount.load()).arg(q->receivedDatasetsPerSecond(), 0, 'f', 1)
+    .arg(this->IndexedDatasetCount).arg(q->indexedDatasetsPerSecond(), 0, 'f', 1));
+  emit q->progress(100);
+  emit q->retrievesFinished(succeededCount, failedCount);
+}
+
+//------------------------------------------------------------------------------
+// ctkDICOMRetrieveScheduler methods
+
+//------------------------------------------------------------------------------
+ctkDICOMRetrieveScheduler::ctkDICOMRetrieveScheduler(QObject* parent)
+  : QObject(parent)
+  , d_ptr(new ctkDICOMRetrieveSchedulerPrivate(*this))
+{
+  Q_D(ctkDICOMRetrieveScheduler);
+  connect(&d->RetryTimer, &QTimer::timeout, this, &ctkDICOMRetrieveScheduler::startQueuedRetrieves);
+  connect(&d->Indexer, &ctkDICOMIndexer::indexingComplete, this, &ctkDICOMRetrieveScheduler::onIndexingComplete);
+  connect(&d->Indexer, &ctkDICOMIndexer::indexingResultsInserted,
+    d, &ctkDICOMRetrieveSchedulerPrivate::onIndexingResultsInserted);
+}
+
+//------------------------------------------------------------------------------
+ctkDICOMRetrieveScheduler::~ctkDICOMRetrieveScheduler()
+{
+  Q_D(ctkDICOMRetrieveScheduler);
+  this->cancel();
+  d->ThreadPool.waitForDone();
+  qDeleteAll(d->RunningRetrieves);
+  d->RunningRetrieves.clear();
+  // Do not lose datasets that have been already received
+  QCoreApplication::sendPostedEvents(&d->Indexer);
+  d->Indexer.waitForImportFinished();
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrieveScheduler::setDatabase(ctkDICOMDatabase* database)
+{
+  Q_D(ctkDICOMRetrieveScheduler);
+  d->Database = database;
+  d->Indexer.setDatabase(database);
+}
+
+//------------------------------------------------------------------------------
+ctkDICOMDatabase* ctkDICOMRetrieveScheduler::database()const
+{
+  Q_D(const ctkDICOMRetrieveScheduler);
+  return d->Database;
+}
+
+//------------------------------------------------------------------------------
+CTK_GET_CPP(ctkDICOMRetrieveScheduler, QString, callingAETitle, CallingAETitle);
+CTK_SET_CPP(ctkDICOMRetrieveScheduler, const QString&, setCallingAETitle, CallingAETitle);
+CTK_GET_CPP(ctkDICOMRetrieveScheduler, QString, moveDestinationAETitle, MoveDestinationAETitle);
+CTK_SET_CPP(ctkDICOMRetrieveScheduler, const QString&, setMoveDestinationAETitle, MoveDestinationAETitle);
+CTK_GET_CPP(ctkDICOMRetrieveScheduler, int, maximumNumberOfRetrieves, MaximumNumberOfRetrieves);
+CTK_GET_CPP(ctkDICOMRetrieveScheduler, int, maximumNumberOfRetrievesPerPeer, MaximumNumberOfRetrievesPerPeer);
+CTK_GET_CPP(ctkDICOMRetrieveScheduler, int, maximumNumberOfRetries, MaximumNumberOfRetries);
+CTK_GET_CPP(ctkDICOMRetrieveScheduler, int, retryDelay, RetryDelay);
+CTK_GET_CPP(ctkDICOMRetrieveScheduler, int, storeBatchSize, StoreBatchSize);
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrieveScheduler::setMaximumNumberOfRetrieves(int count)
+{
+  Q_D(ctkDICOMRetrieveScheduler);
+  d->MaximumNumberOfRetrieves = qMax(1, count);
+  d->ThreadPool.setMaxThreadCount(d->MaximumNumberOfRetrieves);
+  this->startQueuedRetrieves();
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrieveScheduler::setMaximumNumberOfRetrievesPerPeer(int count)
+{
+  Q_D(ctkDICOMRetrieveScheduler);
+  d->MaximumNumberOfRetrievesPerPeer = qMax(1, count);
+  this->startQueuedRetrieves();
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrieveScheduler::setMaximumNumberOfRetries(int count)
+{
+  Q_D(ctkDICOMRetrieveScheduler);
+  d->MaximumNumberOfRetries = qMax(0, count);
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrieveScheduler::setRetryDelay(int msec)
+{
+  Q_D(ctkDICOMRetrieveScheduler);
+  d->RetryDelay = qMax(0, msec);
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrieveScheduler::setStoreBatchSize(int batchSize)
+{
+  Q_D(ctkDICOMRetrieveScheduler);
+  d->StoreBatchSize = qMax(1, batchSize);
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrieveScheduler::addSeriesRetrieve(const QString& studyInstanceUID, const QString& seriesInstanceUID,
+  const QString& calledAETitle, const QString& host, int port, bool useCGET/*=true*/)
+{
+  Q_D(ctkDICOMRetrieveScheduler);
+  if (studyInstanceUID.isEmpty() || seriesInstanceUID.isEmpty())
+  {
+    logger.error("Cannot retrieve series: Either Study or Series Instance UID empty.");
+    return;
+  }
+  ctkDICOMRetrieveSchedulerRequest request;
+  request.StudyInstanceUID = studyInstanceUID;
+  request.SeriesInstanceUID = seriesInstanceUID;
+  request.CalledAETitle = calledAETitle;
+  request.Host = host;
+  request.Port = port;
+  request.UseCGET = useCGET;
+  d->addRequest(request);
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrieveScheduler::addStudyRetrieve(const QString& studyInstanceUID,
+  const QString& calledAETitle, const QString& host, int port, bool useCGET/*=true*/)
+{
+  Q_D(ctkDICOMRetrieveScheduler);
+  if (studyInstanceUID.isEmpty())
+  {
+    logger.error("Cannot retrieve study: Study Instance UID empty.");
+    return;
+  }
+  ctkDICOMRetrieveSchedulerRequest request;
+  request.StudyInstanceUID = studyInstanceUID;
+  request.CalledAETitle = calledAETitle;
+  request.Host = host;
+  request.Port = port;
+  request.UseCGET = useCGET;
+  d->addRequest(request);
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMRetrieveScheduler::isRetrieving()
+{
+  Q_D(ctkDICOMRetrieveScheduler);
+  if (!d->QueuedRequests.isEmpty() || !d->RunningRequests.isEmpty())
+  {
+    return true;
+  }
+  return d->Indexer.isImporting();
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMRetrieveScheduler::numberOfPendingRetrieves()const
+{
+  Q_D(const ctkDICOMRetrieveScheduler);
+  return d->QueuedRequests.size() + d->RunningRequests.size();
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMRetrieveScheduler::receivedDatasetCount()const
+{
+  Q_D(const ctkDICOMRetrieveScheduler);
+  return d->ReceivedDatasetCount.load();
+}
+
+//------------------------------------------------------------------------------
+double ctkDICOMRetrieveScheduler::receivedDatasetsPerSecond()const
+{
+  Q_D(const ctkDICOMRetrieveScheduler);
+  qint64 elapsedTimeMsec = d->TransferTimer.isValid() ? d->TransferTimer.elapsed() : 0;
+  return elapsedTimeMsec > 0 ? d->ReceivedDatasetCount.load() * 1000.0 / elapsedTimeMsec : 0.0;
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMRetrieveScheduler::indexedDatasetCount()const
+{
+  Q_D(const ctkDICOMRetrieveScheduler);
+  return d->IndexedDatasetCount;
+}
+
+//------------------------------------------------------------------------------
+double ctkDICOMRetrieveScheduler::indexedDatasetsPerSecond()const
+{
+  Q_D(const ctkDICOMRetrieveScheduler);
+  qint64 elapsedTimeMsec = d->TransferTimer.isValid() ? d->TransferTimer.elapsed() : 0;
+  return elapsedTimeMsec > 0 ? d->IndexedDatasetCount * 1000.0 / elapsedTimeMsec : 0.0;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrieveScheduler::waitForRetrievesFinished(int msecTimeout /*=-1*/)
+{
+  if (!this->isRetrieving())
+  {
+    return;
+  }
+  QTimer timer;
+  timer.setSingleShot(true);
+  QEventLoop loop;
+  connect(this, &ctkDICOMRetrieveScheduler::retrievesFinished, &loop, &QEventLoop::quit);
+  if (msecTimeout >= 0)
+  {
+    connect(&timer, &QTimer::timeout, &loop, &QEventLoop::quit);
+    timer.start(msecTimeout);
+  }
+  loop.exec();
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrieveScheduler::cancel()
+{
+  Q_D(ctkDICOMRetrieveScheduler);
+  d->Canceled = true;
+  d->RetryTimer.stop();
+  QList<ctkDICOMRetrieveSchedulerRequest> canceledRequests = d->QueuedRequests;
+  d->QueuedRequests.clear();
+  foreach(const ctkDICOMRetrieveSchedulerRequest& request, canceledRequests)
+  {
+    d->FailedCount++;
+    emit retrieveFinished(request.StudyInstanceUID, request.SeriesInstanceUID, false);
+  }
+  // Running C-GET requests are stopped when the next dataset is received
+  foreach(ctkDICOMRetrieve* retrieve, d->RunningRetrieves)
+  {
+    retrieve->cancel();
+  }
+  d->checkRetrievesFinished();
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrieveScheduler::startQueuedRetrieves()
+{
+  Q_D(ctkDICOMRetrieveScheduler);
+  QHash<QString, int> runningCountForPeer;
+  foreach(const ctkDICOMRetrieveSchedulerRequest& request, d->RunningRequests)
+  {
+    runningCountForPeer[request.peer()]++;
+  }
+
+  qint64 currentTime = QDateTime::currentMSecsSinceEpoch();
+  qint64 nextRetryTime = -1;
+  QList<ctkDICOMRetrieveSchedulerRequest>::iterator requestIt = d->QueuedRequests.begin();
+  while (requestIt != d->QueuedRequests.end() && d->RunningRequests.size() < d->MaximumNumberOfRetrieves)
+  {
+    if (requestIt->NotBefore > currentTime)
+    {
+      // failed request, wait before trying again
+      nextRetryTime = (nextRetryTime < 0 ? requestIt->NotBefore : qMin(nextRetryTime, requestIt->NotBefore));
+      ++requestIt;
+      continue;
+    }
+    QString peer = requestIt->peer();
+    if (runningCountForPeer.value(peer) >= d->MaximumNumberOfRetrievesPerPeer)
+    {
+      ++requestIt;
+      continue;
+    }
+    ctkDICOMRetrieveSchedulerRequest request = *requestIt;
+    requestIt = d->QueuedRequests.erase(requestIt);
+    runningCountForPeer[peer]++;
+    d->startRequest(request);
+  }
+  if (nextRetryTime >= 0)
+  {
+    d->RetryTimer.start(static_cast<int>(qMax(Q_INT64_C(0), nextRetryTime - currentTime)));
+  }
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrieveScheduler::onRetrieveFinished(int retrieveId, bool success)
+{
+  Q_D(ctkDICOMRetrieveScheduler);
+  if (!d->RunningRequests.contains(retrieveId))
+  {
+    return;
+  }
+  ctkDICOMRetrieveSchedulerRequest request = d->RunningRequests.take(retrieveId);
+  delete d->RunningRetrieves.take(retrieveId);
+
+  if (!success && !d->Canceled && request.RetryCount < d->MaximumNumberOfRetries)
+  {
+    request.RetryCount++;
+    request.NotBefore = QDateTime::currentMSecsSinceEpoch() + d->RetryDelay;
+    logger.warn(QString("Retrieve of study %1 series %2 from %3 failed, retrying (%4 of %5)")
+      .arg(request.StudyInstanceUID).arg(request.SeriesInstanceUID).arg(request.peer())
+      .arg(request.RetryCount).arg(d->MaximumNumberOfRetries));
+    d->QueuedRequests.append(request);
+  }
+  else
+  {
+    if (success)
+    {
+      d->SucceededCount++;
+    }
+    else
+    {
+      d->FailedCount++;
+      logger.error("Retrieve of study " + request.StudyInstanceUID + " series " + request.SeriesInstanceUID
+        + " from " + request.peer() + " failed");
+    }
+    emit retrieveFinished(request.StudyInstanceUID, request.SeriesInstanceUID, success);
+    if (d->RequestCount > 0)
+    {
+      emit progress(100 * (d->SucceededCount + d->FailedCount) / d->RequestCount);
+    }
+  }
+  this->startQueuedRetrieves();
+  d->checkRetrievesFinished();
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMRetrieveScheduler::onIndexingComplete()
+{
+  Q_D(ctkDICOMRetrieveScheduler);
+  d->checkRetrievesFinished();
+}
@@ -0,0 +1,151 @@
+/*=========================================================================
+
+  Library:   CTK
+
+  Copyright (c) Kitware Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0.txt
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+=========================================================================*/
+
+#ifndef __ctkDICOMRetrieveScheduler_h
+#define __ctkDICOMRetrieveScheduler_h
+
+// Qt includes
+#include <QObject>
+
+#include "ctkDICOMCoreExport.h"
+
+// CTK Core includes
+#include "ctkDICOMDatabase.h"
+
+class ctkDICOMRetrieveSchedulerPrivate;
+
+/// \ingroup DICOM_Core
+///
+/// \brief Retrieves many studies and series from one or more peers in parallel
+///
+/// Retrieve requests are queued and processed by a configurable number of
+/// associations, each running a ctkDICOMRetrieve in a worker thread.
+/// The number of concurrent associations to the same peer (host and port)
+/// can be limited separately, and failed retrieves are queued again
+/// for a configurable number of times.
+///
+/// Datasets received via C-GET are saved into the database folder as they arrive
+/// and handed over to an indexer in batches, which inserts them into the database
+/// in a background thread.
+/// Datasets of C-MOVE requests are sent by the peer to the move destination.
+///
+class CTK_DICOM_CORE_EXPORT ctkDICOMRetrieveScheduler : public QObject
+{
+  Q_OBJECT
+  Q_PROPERTY(QString callingAETitle READ callingAETitle WRITE setCallingAETitle);
+  Q_PROPERTY(QString moveDestinationAETitle READ moveDestinationAETitle WRITE setMoveDestinationAETitle);
+  Q_PROPERTY(int maximumNumberOfRetrieves READ maximumNumberOfRetrieves WRITE setMaximumNumberOfRetrieves);
+  Q_PROPERTY(int maximumNumberOfRetrievesPerPeer READ maximumNumberOfRetrievesPerPeer WRITE setMaximumNumberOfRetrievesPerPeer);
+  Q_PROPERTY(int maximumNumberOfRetries READ maximumNumberOfRetries WRITE setMaximumNumberOfRetries);
+  Q_PROPERTY(int retryDelay READ retryDelay WRITE setRetryDelay);
+  Q_PROPERTY(int storeBatchSize READ storeBatchSize WRITE setStoreBatchSize);
+  Q_PROPERTY(bool retrieving READ isRetrieving);
+
+public:
+  explicit ctkDICOMRetrieveScheduler(QObject* parent = 0);
+  virtual ~ctkDICOMRetrieveScheduler();
+
+  /// Database where retrieved datasets are inserted (must be set for get to succeed)
+  Q_INVOKABLE void setDatabase(ctkDICOMDatabase* database);
+  Q_INVOKABLE ctkDICOMDatabase* database()const;
+
+  /// AE title by which the peers recognize the requests. Default is ANY-SCU.
+  void setCallingAETitle(const QString& callingAETitle);
+  QString callingAETitle()const;
+  /// AE title where peers store the data of C-MOVE requests
+  void setMoveDestinationAETitle(const QString& moveDestinationAETitle);
+  QString moveDestinationAETitle()const;
+
+  /// Maximum number of retrieves (associations) running in parallel. Default is 4.
+  void setMaximumNumberOfRetrieves(int count);
+  int maximumNumberOfRetrieves()const;
+  /// Maximum number of retrieves running in parallel from the same peer. Default is 2.
+  void setMaximumNumberOfRetrievesPerPeer(int count);
+  int maximumNumberOfRetrievesPerPeer()const;
+  /// Number of times a failed retrieve is queued again. Default is 2.
+  void setMaximumNumberOfRetries(int count);
+  int maximumNumberOfRetries()const;
+  /// Time (in milliseconds) to wait before a failed retrieve is started again. Default is 5000.
+  void setRetryDelay(int msec);
+  int retryDelay()const;
+  /// Number of received datasets that are handed over to the indexer in one batch. Default is 50.
+  void setStoreBatchSize(int batchSize);
+  int storeBatchSize()const;
+
+  /// Queue retrieve of a series from a peer.
+  /// If useCGET is false then the peer is asked to store the series to the move destination.
+  Q_INVOKABLE void addSeriesRetrieve(const QString& studyInstanceUID, const QString& seriesInstanceUID,
+    const QString& calledAETitle, const QString& host, int port, bool useCGET = true);
+  /// Queue retrieve of a study from a peer.
+  /// If useCGET is false then the peer is asked to store the study to the move destination.
+  Q_INVOKABLE void addStudyRetrieve(const QString& studyInstanceUID,
+    const QString& calledAETitle, const QString& host, int port, bool useCGET = true);
+
+  /// Returns true if there are queued or running retrieves or
+  /// retrieved datasets are still being inserted into the database.
+  bool isRetrieving();
+  /// Number of retrieves that are queued or running
+  Q_INVOKABLE int numberOfPendingRetrieves()const;
+
+  /// Number of datasets received since the scheduler was last idle
+  Q_INVOKABLE int receivedDatasetCount()const;
+  /// Number of received datasets per second since the scheduler was last idle
+  Q_INVOKABLE double receivedDatasetsPerSecond()const;
+  /// Number of received datasets inserted into the database since the scheduler was last idle
+  Q_INVOKABLE int indexedDatasetCount()const;
+  /// Number of datasets inserted into the database per second since the scheduler was last idle
+  Q_INVOKABLE double indexedDatasetsPerSecond()const;
+
+  /// Wait until all retrieves are completed and datasets are inserted into the database.
+  /// msecTimeout specifies a maximum timeout. If <0 then it means wait indefinitely.
+  Q_INVOKABLE void waitForRetrievesFinished(int msecTimeout = -1);
+
+public Q_SLOTS:
+  /// Remove all queued retrieves and cancel the running ones.
+  /// Datasets that are already received are inserted into the database.
+  void cancel();
+
+Q_SIGNALS:
+  /// Percentage of completed retrieves among all retrieves since the scheduler was last idle
+  void progress(int);
+  /// A retrieve is started. seriesInstanceUID is empty for study retrieves.
+  void retrieveStarted(const QString& studyInstanceUID, const QString& seriesInstanceUID);
+  /// A retrieve is completed (after all retries if it failed).
+  /// seriesInstanceUID is empty for study retrieves.
+  void retrieveFinished(const QString& studyInstanceUID, const QString& seriesInstanceUID, bool success);
+  /// All queued retrieves are completed and retrieved datasets are inserted into the database.
+  void retrievesFinished(int succeededCount, int failedCount);
+
+protected Q_SLOTS:
+  /// Start queued retrieves as long as the limits allow
+  void startQueuedRetrieves();
+  /// Called (in the main thread) when a retrieve running in a worker thread is completed
+  void onRetrieveFinished(int retrieveId, bool success);
+  void onIndexingComplete();
+
+protected:
+  QScopedPointer<ctkDICOMRetrieveSchedulerPrivate> d_ptr;
+
+private:
+  Q_DECLARE_PRIVATE(ctkDICOMRetrieveScheduler);
+  Q_DISABLE_COPY(ctkDICOMRetrieveScheduler);
+};
+
+#endif
@@ -0,0 +1,394 @@
+/*=========================================================================
+
+  Library:   CTK
+
+  Copyright (c) Kitware Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0.txt
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+=========================================================================*/
+
+// Qt includes
+#include <QDir>
+#include <QEventLoop>
+#include <QFileInfo>
+#include <QHash>
+#include <QMap>
+#include <QPair>
+#include <QPointer>
+#include <QRunnable>
+#include <QSet>
+#include <QThread>
+#include <QThreadPool>
+#include <QTimer>
+
+// ctkDICOMCore includes
+#include "ctkDICOMAbstractThumbnailGenerator.h"
+#include "ctkDICOMDatabase.h"
+#include "ctkDICOMThumbnailService.h"
+#include "ctkLogger.h"
+
+// DCMTK includes
+#include <dcmtk/dcmimgle/dcmimage.h>
+
+static ctkLogger logger("org.commontk.dicom.DICOMThumbnailService");
+
+//------------------------------------------------------------------------------
+struct ctkDICOMThumbnailServiceRequest
+{
+  ctkDICOMThumbnailServiceRequest()
+    : Priority(0)
+    , Order(0)
+  {
+  }
+
+  QString SOPInstanceUID;
+  QString FilePath;
+  QString ThumbnailPath;
+  int Priority;
+  /// Requests of the same priority are processed in the order they were queued
+  int Order;
+};
+
+//------------------------------------------------------------------------------
+// Generates a thumbnail in a thread of the service's thread pool.
+class ctkDICOMThumbnailServiceWorker : public QRunnable
+{
+public:
+  ctkDICOMThumbnailServiceWorker(ctkDICOMThumbnailService* service,
+    ctkDICOMAbstractThumbnailGenerator* generator, const ctkDICOMThumbnailServiceRequest& request)
+    : Service(service)
+    , Generator(generator)
+    , Request(request)
+  {
+  }
+
+  virtual void run()
+  {
+    bool success = false;
+    QFileInfo thumbnailInfo(this->Request.ThumbnailPath);
+    if (thumbnailInfo.exists() && thumbnailInfo.lastModified() > QFileInfo(this->Request.FilePath).lastModified())
+    {
+      // thumbnail already exists and up-to-date
+      success = true;
+    }
+    else if (this->Generator)
+    {
+      QDir().mkpath(thumbnailInfo.absolutePath());
+      // Only the first frame is needed, partial access avoids loading the pixel data of all frames
+      DicomImage dcmImage(QDir::toNativeSeparators(this->Request.FilePath).toUtf8(),
+        CIF_UsePartialAccessToPixelData, 0, 1);
+      success = this->Generator->generateThumbnail(&dcmImage, this->Request.ThumbnailPath);
+    }
+    QMetaObject::invokeMethod(this->Service, "onThumbnailGenerated", Qt::QueuedConnection,
+      Q_ARG(QString, this->Request.SOPInstanceUID), Q_ARG(QString, this->Request.ThumbnailPath),
+      Q_ARG(bool, success));
+  }
+
+protected:
+  ctkDICOMThumbnailService* Service;
+  ctkDICOMAbstractThumbnailGenerator* Generator;
+  ctkDICOMThumbnailServiceRequest Request;
+};
+
+//------------------------------------------------------------------------------
+class ctkDICOMThumbnailServicePrivate
+{
+  Q_DECLARE_PUBLIC(ctkDICOMThumbnailService);
+
+protected:
+  ctkDICOMThumbnailService* const q_ptr;
+
+public:
+  ctkDICOMThumbnailServicePrivate(ctkDICOMThumbnailService& obj);
+
+  /// Key of a request in RequestQueue. Requests with higher priority come first,
+  /// requests of the same priority in the order they were queued.
+  static QPair<int, int> queueKey(const ctkDICOMThumbnailServiceRequest& request)
+  {
+    return qMakePair(-request.Priority, request.Order);
+  }
+  void queueRequest(const ctkDICOMThumbnailServiceRequest& request);
+  void setRequestPriority(ctkDICOMThumbnailServiceRequest& request, int priority);
+  ctkDICOMThumbnailServiceRequest takeNextRequest();
+
+  QPointer<ctkDICOMDatabase> Database;
+  QPointer<ctkDICOMAbstractThumbnailGenerator> ThumbnailGenerator;
+
+  /// Queued requests, indexed by SOP instance UID
+  QHash<QString, ctkDICOMThumbnailServiceRequest> QueuedRequests;
+  /// SOP instance UIDs of queued requests in the order they are processed
+  QMap<QPair<int, int>, QString> RequestQueue;
+  /// SOP instance UIDs of requests that are processed by worker threads
+  QSet<QString> RunningRequests;
+  int NextRequestOrder;
+  QThreadPool ThreadPool;
+};
+
+//------------------------------------------------------------------------------
+// ctkDICOMThumbnailServicePrivate methods
+
+//------------------------------------------------------------------------------
+ctkDICOMThumbnailServicePrivate::ctkDICOMThumbnailServicePrivate(ctkDICOMThumbnailService& obj)
+  : q_ptr(&obj)
+  , NextRequestOrder(0)
+{
+  // leave some cores for the application and for indexing
+  this->ThreadPool.setMaxThreadCount(qMax(1, QThread::idealThreadCount() / 2));
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailServicePrivate::queueRequest(const ctkDICOMThumbnailServiceRequest& request)
+{
+  this->QueuedRequests[request.SOPInstanceUID] = request;
+  this->RequestQueue.insert(queueKey(request), request.SOPInstanceUID);
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailServicePrivate::setRequestPriority(ctkDICOMThumbnailServiceRequest& request, int priority)
+{
+  if (request.Priority == priority)
+  {
+    return;
+  }
+  this->RequestQueue.remove(queueKey(request));
+  request.Priority = priority;
+  this->RequestQueue.insert(queueKey(request), request.SOPInstanceUID);
+}
+
+//------------------------------------------------------------------------------
+ctkDICOMThumbnailServiceRequest ctkDICOMThumbnailServicePrivate::takeNextRequest()
+{
+  QMap<QPair<int, int>, QString>::iterator nextRequestIt = this->RequestQueue.begin();
+  ctkDICOMThumbnailServiceRequest request = this->QueuedRequests.take(nextRequestIt.value());
+  this->RequestQueue.erase(nextRequestIt);
+  return request;
+}
+
+//------------------------------------------------------------------------------
+// ctkDICOMThumbnailService methods
+
+//------------------------------------------------------------------------------
+ctkDICOMThumbnailService::ctkDICOMThumbnailService(QObject* parent)
+  : QObject(parent)
+  , d_ptr(new ctkDICOMThumbnailServicePrivate(*this))
+{
+}
+
+//------------------------------------------------------------------------------
+ctkDICOMThumbnailService::~ctkDICOMThumbnailService()
+{
+  Q_D(ctkDICOMThumbnailService);
+  d->QueuedRequests.clear();
+  d->RequestQueue.clear();
+  d->ThreadPool.waitForDone();
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailService::setDatabase(ctkDICOMDatabase* database)
+{
+  Q_D(ctkDICOMThumbnailService);
+  d->Database = database;
+}
+
+//------------------------------------------------------------------------------
+ctkDICOMDatabase* ctkDICOMThumbnailService::database()const
+{
+  Q_D(const ctkDICOMThumbnailService);
+  return d->Database;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailService::setThumbnailGenerator(ctkDICOMAbstractThumbnailGenerator* generator)
+{
+  Q_D(ctkDICOMThumbnailService);
+  d->ThumbnailGenerator = generator;
+}
+
+//------------------------------------------------------------------------------
+ctkDICOMAbstractThumbnailGenerator* ctkDICOMThumbnailService::thumbnailGenerator()const
+{
+  Q_D(const ctkDICOMThumbnailService);
+  return d->ThumbnailGenerator;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailService::setNumberOfThreads(int count)
+{
+  Q_D(ctkDICOMThumbnailService);
+  d->ThreadPool.setMaxThreadCount(qMax(1, count));
+  this->startQueuedThumbnails();
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMThumbnailService::numberOfThreads()const
+{
+  Q_D(const ctkDICOMThumbnailService);
+  return d->ThreadPool.maxThreadCount();
+}
+
+//------------------------------------------------------------------------------
+QString ctkDICOMThumbnailService::thumbnailPath(const QString& studyInstanceUID,
+  const QString& seriesInstanceUID, const QString& sopInstanceUID)const
+{
+  Q_D(const ctkDICOMThumbnailService);
+  if (!d->Database || studyInstanceUID.isEmpty() || seriesInstanceUID.isEmpty() || sopInstanceUID.isEmpty())
+  {
+    return QString();
+  }
+  return d->Database->databaseDirectory() + "/thumbs/" + studyInstanceUID + "/" + seriesInstanceUID
+    + "/" + sopInstanceUID + ".png";
+}
+
+//------------------------------------------------------------------------------
+QString ctkDICOMThumbnailService::requestThumbnail(const QString& studyInstanceUID,
+  const QString& seriesInstanceUID, const QString& sopInstanceUID, int priority/*=0*/)
+{
+  Q_D(ctkDICOMThumbnailService);
+  QString path = this->thumbnailPath(studyInstanceUID, seriesInstanceUID, sopInstanceUID);
+  if (path.isEmpty())
+  {
+    logger.error("Cannot request thumbnail of instance " + sopInstanceUID + ": invalid UID or database is not set");
+    return QString();
+  }
+  if (d->RunningRequests.contains(sopInstanceUID))
+  {
+    return QString();
+  }
+  QHash<QString, ctkDICOMThumbnailServiceRequest>::iterator requestIt = d->QueuedRequests.find(sopInstanceUID);
+  if (requestIt != d->QueuedRequests.end())
+  {
+    d->setRequestPriority(*requestIt, priority);
+    return QString();
+  }
+  ctkDICOMThumbnailServiceRequest request;
+  request.SOPInstanceUID = sopInstanceUID;
+  request.FilePath = d->Database->fileForInstance(sopInstanceUID);
+  request.ThumbnailPath = path;
+  request.Priority = priority;
+  if (request.FilePath.isEmpty())
+  {
+    logger.error("Cannot request thumbnail of instance " + sopInstanceUID + ": file not found in database");
+    return QString();
+  }
+  // Thumbnail is regenerated if the file has been modified since the thumbnail was generated
+  QFileInfo thumbnailInfo(path);
+  if (thumbnailInfo.exists() && thumbnailInfo.lastModified() > QFileInfo(request.FilePath).lastModified())
+  {
+    return path;
+  }
+  request.Order = d->NextRequestOrder++;
+  d->queueRequest(request);
+  // start in the next event loop iteration, so that priorities can be still adjusted
+  // after a group of thumbnails is requested (e.g., when a view is populated)
+  QTimer::singleShot(0, this, SLOT(startQueuedThumbnails()));
+  return QString();
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailService::setThumbnailPriority(const QString& sopInstanceUID, int priority)
+{
+  Q_D(ctkDICOMThumbnailService);
+  QHash<QString, ctkDICOMThumbnailServiceRequest>::iterator requestIt = d->QueuedRequests.find(sopInstanceUID);
+  if (requestIt != d->QueuedRequests.end())
+  {
+    d->setRequestPriority(*requestIt, priority);
+  }
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMThumbnailService::isThumbnailPending(const QString& sopInstanceUID)const
+{
+  Q_D(const ctkDICOMThumbnailService);
+  return d->QueuedRequests.contains(sopInstanceUID) || d->RunningRequests.contains(sopInstanceUID);
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMThumbnailService::isGenerating()const
+{
+  Q_D(const ctkDICOMThumbnailService);
+  return !d->QueuedRequests.isEmpty() || !d->RunningRequests.isEmpty();
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMThumbnailService::numberOfPendingThumbnails()const
+{
+  Q_D(const ctkDICOMThumbnailService);
+  return d->QueuedRequests.size() + d->RunningRequests.size();
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailService::waitForThumbnailsFinished(int msecTimeout /*=-1*/)
+{
+  if (!this->isGenerating())
+  {
+    return;
+  }
+  QTimer timer;
+  timer.setSingleShot(true);
+  QEventLoop loop;
+  connect(this, &ctkDICOMThumbnailService::thumbnailsFinished, &loop, &QEventLoop::quit);
+  if (msecTimeout >= 0)
+  {
+    connect(&timer, &QTimer::timeout, &loop, &QEventLoop::quit);
+    timer.start(msecTimeout);
+  }
+  loop.exec();
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailService::cancel()
+{
+  Q_D(ctkDICOMThumbnailService);
+  d->QueuedRequests.clear();
+  d->RequestQueue.clear();
+  if (d->RunningRequests.isEmpty())
+  {
+    emit thumbnailsFinished();
+  }
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailService::startQueuedThumbnails()
+{
+  Q_D(ctkDICOMThumbnailService);
+  while (!d->QueuedRequests.isEmpty() && d->RunningRequests.size() < d->ThreadPool.maxThreadCount())
+  {
+    // the request with the highest priority, oldest first
+    ctkDICOMThumbnailServiceRequest request = d->takeNextRequest();
+    d->RunningRequests.insert(request.SOPInstanceUID);
+    d->ThreadPool.start(new ctkDICOMThumbnailServiceWorker(this, d->ThumbnailGenerator, request));
+  }
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailService::onThumbnailGenerated(const QString& sopInstanceUID,
+  const QString& thumbnailPath, bool success)
+{
+  Q_D(ctkDICOMThumbnailService);
+  d->RunningRequests.remove(sopInstanceUID);
+  if (success)
+  {
+    emit thumbnailReady(sopInstanceUID, thumbnailPath);
+  }
+  else
+  {
+    logger.warn("Failed to generate thumbnail of instance " + sopInstanceUID);
+    emit thumbnailFailed(sopInstanceUID);
+  }
+  this->startQueuedThumbnails();
+  if (!this->isGenerating())
+  {
+    emit thumbnailsFinished();
+  }
+}
@@ -0,0 +1,123 @@
+/*=========================================================================
+
+  Library:   CTK
+
+  Copyright (c) Kitware Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0.txt
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+=========================================================================*/
+
+#ifndef __ctkDICOMThumbnailService_h
+#define __ctkDICOMThumbnailService_h
+
+// Qt includes
+#include <QObject>
+
+#include "ctkDICOMCoreExport.h"
+
+class ctkDICOMAbstractThumbnailGenerator;
+class ctkDICOMDatabase;
+class ctkDICOMThumbnailServicePrivate;
+
+/// \ingroup DICOM_Core
+///
+/// \brief Generates thumbnails of database instances in background threads
+///
+/// Thumbnails are stored in the "thumbs" folder of the database directory
+/// (the same location where ctkDICOMDatabase stores them) and are reused as long as
+/// they are newer than the DICOM file. Requests are queued and processed by
+/// a pool of worker threads, requests with higher priority first.
+/// Requests can be re-prioritized while they are queued, for example to generate
+/// thumbnails that are currently visible in a view before the others.
+///
+/// The thumbnail generator is used from multiple threads at the same time,
+/// therefore its generateThumbnail method must be reentrant.
+///
+class CTK_DICOM_CORE_EXPORT ctkDICOMThumbnailService : public QObject
+{
+  Q_OBJECT
+  Q_PROPERTY(int numberOfThreads READ numberOfThreads WRITE setNumberOfThreads);
+  Q_PROPERTY(bool generating READ isGenerating);
+
+public:
+  explicit ctkDICOMThumbnailService(QObject* parent = 0);
+  virtual ~ctkDICOMThumbnailService();
+
+  /// Database that is used for finding the DICOM file of instances and
+  /// its directory for storing the thumbnails.
+  Q_INVOKABLE void setDatabase(ctkDICOMDatabase* database);
+  Q_INVOKABLE ctkDICOMDatabase* database()const;
+
+  Q_INVOKABLE void setThumbnailGenerator(ctkDICOMAbstractThumbnailGenerator* generator);
+  Q_INVOKABLE ctkDICOMAbstractThumbnailGenerator* thumbnailGenerator()const;
+
+  /// Number of thumbnails generated in parallel.
+  /// Default is half of the number of processor cores (at least 1).
+  void setNumberOfThreads(int count);
+  int numberOfThreads()const;
+
+  /// Location of the thumbnail of an instance in the cache
+  Q_INVOKABLE QString thumbnailPath(const QString& studyInstanceUID,
+    const QString& seriesInstanceUID, const QString& sopInstanceUID)const;
+
+  /// Request a thumbnail of an instance. Returns immediately.
+  /// If the thumbnail is already in the cache and it is newer than the DICOM file
+  /// then its path is returned and no request is queued.
+  /// Otherwise an empty string is returned and thumbnailReady (or thumbnailFailed)
+  /// is emitted when the thumbnail is generated.
+  /// If the instance is already queued then only its priority is updated.
+  Q_INVOKABLE QString requestThumbnail(const QString& studyInstanceUID,
+    const QString& seriesInstanceUID, const QString& sopInstanceUID, int priority = 0);
+
+  /// Change the priority of a queued request. Requests with higher priority are processed first.
+  Q_INVOKABLE void setThumbnailPriority(const QString& sopInstanceUID, int priority);
+
+  /// Returns true if the thumbnail of the instance is queued or being generated
+  Q_INVOKABLE bool isThumbnailPending(const QString& sopInstanceUID)const;
+  /// Returns true if there are queued or running requests
+  bool isGenerating()const;
+  /// Number of requests that are queued or running
+  Q_INVOKABLE int numberOfPendingThumbnails()const;
+
+  /// Wait until all queued thumbnails are generated.
+  /// msecTimeout specifies a maximum timeout. If <0 then it means wait indefinitely.
+  Q_INVOKABLE void waitForThumbnailsFinished(int msecTimeout = -1);
+
+public Q_SLOTS:
+  /// Remove all queued requests. Running requests are completed.
+  void cancel();
+
+Q_SIGNALS:
+  /// Thumbnail of the instance is stored in the cache
+  void thumbnailReady(const QString& sopInstanceUID, const QString& thumbnailPath);
+  /// Thumbnail of the instance could not be generated
+  void thumbnailFailed(const QString& sopInstanceUID);
+  /// All queued thumbnails are generated
+  void thumbnailsFinished();
+
+protected Q_SLOTS:
+  /// Start queued requests as long as there are available threads
+  void startQueuedThumbnails();
+  /// Called (in the main thread) when a thumbnail is generated in a worker thread
+  void onThumbnailGenerated(const QString& sopInstanceUID, const QString& thumbnailPath, bool success);
+
+protected:
+  QScopedPointer<ctkDICOMThumbnailServicePrivate> d_ptr;
+
+private:
+  Q_DECLARE_PRIVATE(ctkDICOMThumbnailService);
+  Q_DISABLE_COPY(ctkDICOMThumbnailService);
+};
+
+#endif
@@ -0,0 +1,199 @@
+/*=========================================================================
+
+  Library:   CTK
+
+  Copyright (c) Kitware Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0.txt
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+=========================================================================*/
+
+// Qt includes
+#include <QApplication>
+#include <QDir>
+#include <QSignalSpy>
+#include <QTimer>
+
+// ctkDICOMCore includes
+#include "ctkDICOMDatabase.h"
+#include "ctkDICOMTableView.h"
+
+// STD includes
+#include <iostream>
+
+namespace
+{
+//------------------------------------------------------------------------------
+QStringList filteredUids(ctkDICOMTableView& view, const QString& filterText)
+{
+  view.setFilterText(filterText);
+  // skip the delay of the search box
+  QMetaObject::invokeMethod(&view, "updateFilter");
+  return view.uidsForAllRows();
+}
+
+//------------------------------------------------------------------------------
+QStringList asynchronousQueryUids(ctkDICOMTableView& view, const QStringList& parentUids)
+{
+  QSignalSpy spy(&view, SIGNAL(queryChanged(QStringList)));
+  view.onUpdateQuery(parentUids);
+  if (spy.count() == 0 && !spy.wait(5000))
+    {
+    return QStringList() << "timeout";
+    }
+  return spy.last().at(0).toStringList();
+}
+}
+
+int ctkDICOMTableViewTest1( int argc, char * argv [] )
+{
+  QApplication app(argc, argv);
+
+  if (argc <= 2)
+    {
+    std::cerr << "Warning, no sql file given. Test stops" << std::endl;
+    std::cerr << "Usage: ctkDICOMTableViewTest1 <scratch.db> <dumpfile.sql>" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  QFileInfo databasePath;
+  databasePath.setFile(argv[1]);
+  ctkDICOMDatabase myCTK( databasePath.absoluteFilePath() );
+
+  if (!myCTK.initializeDatabase(argv[2]))
+    {
+    std::cerr << "Error when initializing the data base: " << argv[2]
+              << " error: " << myCTK.lastError().toStdString();
+    }
+
+  ctkDICOMTableView view("Patients");
+  if (!view.isFullTextSearchEnabled() || view.filterActive())
+    {
+    std::cerr << "ctkDICOMTableView: invalid default values" << std::endl;
+    return EXIT_FAILURE;
+    }
+  view.setDicomDataBase(&myCTK);
+  if (view.uidsForAllRows().count() != 3)
+    {
+    std::cerr << "ctkDICOMTableView::uidsForAllRows() failed: "
+              << view.uidsForAllRows().count() << " patients" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  for (int fullTextSearch = 1; fullTextSearch >= 0; --fullTextSearch)
+    {
+    view.setFullTextSearchEnabled(fullTextSearch);
+    if (myCTK.fullTextSearchIndexTableName("Patients").isEmpty())
+      {
+      std::cerr << "ctkDICOMDatabase full-text search index is not available" << std::endl;
+      return EXIT_FAILURE;
+      }
+    // the index only matches the beginning of words, pattern matching finds substrings
+    QStringList uids = filteredUids(view, "ustri");
+    if (uids != QStringList() << (fullTextSearch ? "#" : "14"))
+      {
+      std::cerr << "ctkDICOMTableView filter failed with substring: " << qPrintable(uids.join(",")) << std::endl;
+      return EXIT_FAILURE;
+      }
+    // case insensitive match of the beginning of the name
+    uids = filteredUids(view, "austri");
+    if (uids != QStringList() << "14" || !view.filterActive())
+      {
+      std::cerr << "ctkDICOMTableView filter failed: " << qPrintable(uids.join(",")) << std::endl;
+      return EXIT_FAILURE;
+      }
+    // all the words must match
+    uids = filteredUids(view, "mroverlay 13");
+    if (uids != QStringList() << "16")
+      {
+      std::cerr << "ctkDICOMTableView filter failed with multiple words: "
+                << qPrintable(uids.join(",")) << std::endl;
+      return EXIT_FAILURE;
+      }
+    uids = filteredUids(view, "mroverlay austri");
+    if (uids != QStringList() << "#")
+      {
+      std::cerr << "ctkDICOMTableView filter failed with no match: "
+                << qPrintable(uids.join(",")) << std::endl;
+      return EXIT_FAILURE;
+      }
+    // quotes must not break the query
+    uids = filteredUids(view, "o'brien \"x");
+    if (uids != QStringList() << "#")
+      {
+      std::cerr << "ctkDICOMTableView filter failed with quotes: "
+                << qPrintable(uids.join(",")) << std::endl;
+      return EXIT_FAILURE;
+      }
+    uids = filteredUids(view, "");
+    if (uids.count() != 3 || view.filterActive())
+      {
+      std::cerr << "ctkDICOMTableView filter failed to clear: "
+                << qPrintable(uids.join(",")) << std::endl;
+      return EXIT_FAILURE;
+      }
+    }
+
+  // UIDs of the rows are passed through temporary tables and read in the background
+  ctkDICOMTableView studiesView("Studies");
+  studiesView.setQueryForeignKey("PatientsUID");
+  studiesView.setDicomDataBase(&myCTK);
+  if (studiesView.isAsynchronousQuery())
+    {
+    std::cerr << "ctkDICOMTableView: asynchronous query is enabled by default" << std::endl;
+    return EXIT_FAILURE;
+    }
+  studiesView.setAsynchronousQuery(true);
+  QSignalSpy studiesRowUidsSpy(&studiesView, SIGNAL(uidsForAllRowsChanged(QStringList)));
+  studiesView.onUpdateQuery(QStringList() << "14" << "16");
+  // the result is reported through the event loop
+  if (!studiesView.isQueryInProgress())
+    {
+    std::cerr << "ctkDICOMTableView::isQueryInProgress() failed" << std::endl;
+    return EXIT_FAILURE;
+    }
+  QStringList studyUids = asynchronousQueryUids(studiesView, QStringList() << "14" << "16");
+  if (studyUids.count() != 2 || studiesView.isQueryInProgress()
+    || studiesRowUidsSpy.count() == 0
+    || studiesRowUidsSpy.last().at(0).toStringList() != studyUids)
+    {
+    std::cerr << "ctkDICOMTableView asynchronous query failed: " << qPrintable(studyUids.join(",")) << std::endl;
+    return EXIT_FAILURE;
+    }
+  // a query that is replaced before it is finished must not be reported
+  QSignalSpy studiesQuerySpy(&studiesView, SIGNAL(queryChanged(QStringList)));
+  studiesView.onUpdateQuery(QStringList() << "14" << "15" << "16");
+  studyUids = asynchronousQueryUids(studiesView, QStringList() << "15");
+  if (studyUids.count() != 1 || studyUids != studiesView.uidsForAllRows()
+    || studiesQuerySpy.count() != 1
+    || studiesQuerySpy.last().at(0).toStringList() != studyUids)
+    {
+    std::cerr << "ctkDICOMTableView asynchronous query failed to drop stale result: "
+              << qPrintable(studyUids.join(",")) << std::endl;
+    return EXIT_FAILURE;
+    }
+  studyUids = asynchronousQueryUids(studiesView, QStringList() << "#");
+  if (studyUids != QStringList() << "#")
+    {
+    std::cerr << "ctkDICOMTableView asynchronous query failed with no match: "
+              << qPrintable(studyUids.join(",")) << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  view.show();
+  if (argc <= 3 || QString(argv[3]) != "-I")
+    {
+    QTimer::singleShot(200, &app, SLOT(quit()));
+    }
+  return app.exec();
+}
@@ -0,0 +1,101 @@
+/*=========================================================================
+
+  Library:   CTK
+
+  Copyright (c) Kitware Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0.txt
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+=========================================================================*/
+
+// Qt includes
+#include <QApplication>
+#include <QDir>
+#include <QTimer>
+
+// ctkDICOMCore includes
+#include "ctkDICOMDatabase.h"
+#include "ctkDICOMModel.h"
+#include "ctkDICOMThumbnailView.h"
+
+// STD includes
+#include <iostream>
+
+int ctkDICOMThumbnailViewTest1( int argc, char * argv [] )
+{
+  QApplication app(argc, argv);
+
+  if (argc <= 2)
+    {
+    std::cerr << "Warning, no sql file given. Test stops" << std::endl;
+    std::cerr << "Usage: qctkDICOMModelTest1 <scratch.db> <dumpfile.sql>" << std::endl;
+    return EXIT_FAILURE;
+    }
+
+  try
+    {
+    QFileInfo databasePath;
+    databasePath.setFile(argv[1]);
+    ctkDICOMDatabase myCTK( databasePath.absoluteFilePath() );
+
+    if (!myCTK.initializeDatabase(argv[2]))
+      {
+      std::cerr << "Error when initializing the data base: " << argv[2]
+                << " error: " << myCTK.lastError().toStdString();
+      }
+
+    ctkDICOMModel model;
+    model.setDatabase(myCTK.database());
+
+    ctkDICOMThumbnailView widget;
+    widget.setDatabaseDirectory(databasePath.absolutePath());
+    if (widget.thumbnailSize() != QSize(128, 128) || widget.thumbnailService() != 0)
+      {
+      std::cerr << "ctkDICOMThumbnailView: invalid default values" << std::endl;
+      return EXIT_FAILURE;
+      }
+    widget.setPixmapCacheSize(10);
+    if (widget.pixmapCacheSize() != 10)
+      {
+      std::cerr << "ctkDICOMThumbnailView::setPixmapCacheSize() failed" << std::endl;
+      return EXIT_FAILURE;
+      }
+    widget.addThumbnails(model.index(0,0));
+    // one thumbnail per study of the patient
+    model.fetchMore(model.index(0,0));
+    if (widget.numberOfThumbnails() != model.rowCount(model.index(0,0)))
+      {
+      std::cerr << "ctkDICOMThumbnailView::addThumbnails() failed: "
+                << widget.numberOfThumbnails() << " thumbnails" << std::endl;
+      return EXIT_FAILURE;
+      }
+    if (widget.numberOfThumbnails() > 0 && widget.thumbnailSourceIndex(0) != model.index(0, 0, model.index(0,0)))
+      {
+      std::cerr << "ctkDICOMThumbnailView::thumbnailSourceIndex() failed" << std::endl;
+      return EXIT_FAILURE;
+      }
+    widget.show();
+
+    if (argc <= 3 || QString(argv[3]) != "-I")
+      {
+      QTimer::singleShot(200, &app, SLOT(quit()));
+      }
+    return app.exec();
+    }
+  catch (...)
+    {
+    std::cerr << "Error" << std::endl;
+    return EXIT_FAILURE;
+    }
+  return EXIT_FAILURE;
+}
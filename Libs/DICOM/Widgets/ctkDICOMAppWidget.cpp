@@ -53,6 +53,7 @@
 // ctkDICOMWidgets includes
 #include "ctkDICOMAppWidget.h"
 #include "ctkDICOMThumbnailGenerator.h"
+#include "ctkDICOMThumbnailService.h"
 #include "ctkThumbnailLabel.h"
 #include "ctkDICOMQueryResultsTabWidget.h"
 #include "ctkDICOMQueryRetrieveWidget.h"
@@ -81,6 +82,7 @@ public:
 
   QSharedPointer<ctkDICOMDatabase> DICOMDatabase;
   QSharedPointer<ctkDICOMThumbnailGenerator> ThumbnailGenerator;
+  QSharedPointer<ctkDICOMThumbnailService> ThumbnailService;
   ctkDICOMModel DICOMModel;
   ctkDICOMFilterProxyModel DICOMProxyModel;
   QSharedPointer<ctkDICOMIndexer> DICOMIndexer;
@@ -113,6 +115,9 @@ ctkDICOMAppWidgetPrivate::ctkDICOMAppWidgetPrivate(ctkDICOMAppWidget* parent): q
   DICOMDatabase = QSharedPointer<ctkDICOMDatabase> (new ctkDICOMDatabase);
   ThumbnailGenerator = QSharedPointer <ctkDICOMThumbnailGenerator> (new ctkDICOMThumbnailGenerator);
   DICOMDatabase->setThumbnailGenerator(ThumbnailGenerator.data());
+  ThumbnailService = QSharedPointer<ctkDICOMThumbnailService> (new ctkDICOMThumbnailService);
+  ThumbnailService->setDatabase(DICOMDatabase.data());
+  ThumbnailService->setThumbnailGenerator(ThumbnailGenerator.data());
   DICOMIndexer = QSharedPointer<ctkDICOMIndexer> (new ctkDICOMIndexer);
   DICOMIndexer->setDatabase(DICOMDatabase.data());
   IndexerProgress = 0;
@@ -258,6 +263,8 @@ ctkDICOMAppWidget::ctkDICOMAppWidget(QWidget* _parent):Superclass(_parent),
 
   d->ThumbnailsWidget->setThumbnailSize(
     QSize(d->ThumbnailWidthSlider->value(), d->ThumbnailWidthSlider->value()));
+  // missing thumbnails are generated in the background
+  d->ThumbnailsWidget->setThumbnailService(d->ThumbnailService.data());
 
   // Treeview signals
   connect(d->TreeView, SIGNAL(collapsed(QModelIndex)), this, SLOT(onTreeCollapsed(QModelIndex)));
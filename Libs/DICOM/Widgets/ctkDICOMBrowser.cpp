@@ -48,6 +48,7 @@
 
 // ctkDICOMCore includes
 #include "ctkDICOMDatabase.h"
+#include "ctkDICOMExporter.h"
 #include "ctkDICOMIndexer.h"
 
 // ctkDICOMWidgets includes
@@ -139,12 +140,17 @@ public:
 
   QSharedPointer<ctkDICOMDatabase> DICOMDatabase;
   QSharedPointer<ctkDICOMIndexer> DICOMIndexer;
+  QSharedPointer<ctkDICOMExporter> DICOMExporter;
   QProgressDialog *UpdateSchemaProgress;
   QProgressDialog *UpdateDisplayedFieldsProgress;
   QProgressDialog *ExportProgress;
 
   void showUpdateSchemaDialog();
 
+  /// Show a warning and return true if files are being exported.
+  /// Files must not be removed from the database while they are copied.
+  bool warnIfExporting(const QString& operation);
+
   bool DisplayImportSummary;
   bool ConfirmRemove;
   bool ShemaUpdateAutoCreateDirectory;
@@ -180,6 +186,7 @@ ctkDICOMBrowserPrivate::ctkDICOMBrowserPrivate(ctkDICOMBrowser* parent, QSharedP
   , QueryRetrieveWidget(0)
   , DICOMDatabase(database)
   , DICOMIndexer( QSharedPointer<ctkDICOMIndexer>(new ctkDICOMIndexer) )
+  , DICOMExporter( QSharedPointer<ctkDICOMExporter>(new ctkDICOMExporter) )
   , UpdateSchemaProgress(0)
   , UpdateDisplayedFieldsProgress(0)
   , ExportProgress(0)
@@ -247,6 +254,21 @@ void ctkDICOMBrowserPrivate::showUpdateSchemaDialog()
   UpdateSchemaProgress->show();
 }
 
+//----------------------------------------------------------------------------
+bool ctkDICOMBrowserPrivate::warnIfExporting(const QString& operation)
+{
+  if (!this->DICOMExporter->isExporting())
+  {
+    return false;
+  }
+  ctkMessageBox exportInProgressMessageBox;
+  exportInProgressMessageBox.setText(operation
+    + " is not possible while files are exported, please wait until the export is finished.");
+  exportInProgressMessageBox.setIcon(QMessageBox::Warning);
+  exportInProgressMessageBox.exec();
+  return true;
+}
+
 //----------------------------------------------------------------------------
 void ctkDICOMBrowserPrivate::init()
 {
@@ -717,6 +739,13 @@ ctkDICOMTableManager* ctkDICOMBrowser::dicomTableManager()
   return d->dicomTableManager;
 }
 
+//----------------------------------------------------------------------------
+ctkDICOMExporter* ctkDICOMBrowser::exporter()
+{
+  Q_D(ctkDICOMBrowser);
+  return d->DICOMExporter.data();
+}
+
 //----------------------------------------------------------------------------
 void ctkDICOMBrowser::openImportDialog()
 {
@@ -766,6 +795,10 @@ void ctkDICOMBrowser::onRemoveAction()
 void ctkDICOMBrowser::onRepairAction()
 {
   Q_D(ctkDICOMBrowser);
+  if (d->warnIfExporting("Database repair"))
+  {
+    return;
+  }
 
   QMessageBox* repairMessageBox;
   repairMessageBox = new QMessageBox;
@@ -1186,14 +1219,9 @@ void ctkDICOMBrowser::onStudiesRightClicked(const QPoint &point)
   {
     this->showMetadata(this->fileListForCurrentSelection(ctkDICOMModel::StudyType));
   }
-  else if (selectedAction == deleteAction
-      && this->confirmDeleteSelectedUIDs(selectedStudiesUIDs))
+  else if (selectedAction == deleteAction)
   {
-    foreach (const QString& uid, selectedStudiesUIDs)
-    {
-      d->DICOMDatabase->removeStudy(uid);
-      d->dicomTableManager->updateTableViews();
-    }
+    this->removeSelectedItems(ctkDICOMModel::StudyType);
   }
   else if (selectedAction == exportAction)
   {
@@ -1257,14 +1285,9 @@ void ctkDICOMBrowser::onSeriesRightClicked(const QPoint &point)
   {
     this->showMetadata(this->fileListForCurrentSelection(ctkDICOMModel::SeriesType));
   }
-  else if (selectedAction == deleteAction
-      && this->confirmDeleteSelectedUIDs(selectedSeriesUIDs))
+  else if (selectedAction == deleteAction)
   {
-    foreach (const QString& uid, selectedSeriesUIDs)
-    {
-      d->DICOMDatabase->removeSeries(uid);
-      d->dicomTableManager->updateTableViews();
-    }
+    this->removeSelectedItems(ctkDICOMModel::SeriesType);
   }
   else if (selectedAction == exportAction)
   {
@@ -1282,145 +1305,149 @@ void ctkDICOMBrowser::exportSeries(QString dirPath, QStringList uids)
 {
   Q_D(ctkDICOMBrowser);
 
-  foreach (const QString& uid, uids)
+  if (d->DICOMExporter->isExporting())
   {
-    QStringList filesForSeries = d->DICOMDatabase->filesForSeries(uid);
+    ctkMessageBox exportInProgressMessageBox;
+    exportInProgressMessageBox.setText("An export is already in progress, please wait until it is finished.");
+    exportInProgressMessageBox.setIcon(QMessageBox::Warning);
+    exportInProgressMessageBox.exec();
+    return;
+  }
 
-    // Use the first file to get the overall series information
-    QString firstFilePath = filesForSeries[0];
-    QHash<QString,QString> descriptions (d->DICOMDatabase->descriptionsForFile(firstFilePath));
-    QString patientName = descriptions["PatientsName"];
-    QString patientIDTag = QString("0010,0020");
-    QString patientID = d->DICOMDatabase->fileValue(firstFilePath, patientIDTag);
-    QString studyDescription = descriptions["StudyDescription"];
-    QString seriesDescription = descriptions["SeriesDescription"];
-    QString studyDateTag = QString("0008,0020");
-    QString studyDate = d->DICOMDatabase->fileValue(firstFilePath,studyDateTag);
-    QString seriesNumberTag = QString("0020,0011");
-    QString seriesNumber = d->DICOMDatabase->fileValue(firstFilePath,seriesNumberTag);
+  // DICOMDIR can only reference files that have valid file IDs
+  bool useFileIDs = d->DICOMExporter->writeDicomDir();
+  int fileIDSeriesNumber = 0;
 
-    QString sep = "/";
-    QString nameSep = "-";
-    QString destinationDir = dirPath + sep + patientID;
-    if (!patientName.isEmpty())
-    {
-      destinationDir += nameSep + patientName;
-    }
-    destinationDir += sep + studyDate;
-    if (!studyDescription.isEmpty())
+  QStringList sourceFilePaths;
+  QStringList destinationFilePaths;
+  foreach (const QString& uid, uids)
+  {
+    QStringList filesForSeries = d->DICOMDatabase->filesForSeries(uid);
+    if (filesForSeries.isEmpty())
     {
-      destinationDir += nameSep + studyDescription;
+      continue;
     }
-    destinationDir += sep + seriesNumber;
-    if (!seriesDescription.isEmpty())
+
+    QString sep = "/";
+    QString destinationDir;
+    if (useFileIDs)
     {
-      destinationDir += nameSep + seriesDescription;
+      // skip series folders of previous exports, new records are appended to the DICOMDIR
+      do
+      {
+        destinationDir = dirPath + sep + "DICOM" + sep
+          + QString("S%1").arg(++fileIDSeriesNumber, 7, 10, QChar('0')) + sep;
+      }
+      while (QDir().exists(destinationDir));
     }
-    destinationDir += sep;
-
-    // make sure only ascii characters are in the directory path
-    // (while special characters may be used on an internal hard disk, it may not be possible
-    // to use special characters on file systems of an external drive or network storage)
-    destinationDir = QString::fromLatin1(destinationDir.toLatin1());
-    // replace any question marks that were used as replacements for non ascii
-    // characters with underscore
-    destinationDir.replace("?", "_");
-
-    // create the destination directory if necessary
-    if (!QDir().exists(destinationDir))
+    else
     {
-      if (!QDir().mkpath(destinationDir))
+      // Use the first file to get the overall series information
+      QString firstFilePath = filesForSeries[0];
+      QHash<QString,QString> descriptions (d->DICOMDatabase->descriptionsForFile(firstFilePath));
+      QString patientName = descriptions["PatientsName"];
+      QString patientIDTag = QString("0010,0020");
+      QString patientID = d->DICOMDatabase->fileValue(firstFilePath, patientIDTag);
+      QString studyDescription = descriptions["StudyDescription"];
+      QString seriesDescription = descriptions["SeriesDescription"];
+      QString studyDateTag = QString("0008,0020");
+      QString studyDate = d->DICOMDatabase->fileValue(firstFilePath,studyDateTag);
+      QString seriesNumberTag = QString("0020,0011");
+      QString seriesNumber = d->DICOMDatabase->fileValue(firstFilePath,seriesNumberTag);
+
+      QString nameSep = "-";
+      destinationDir = dirPath + sep + patientID;
+      if (!patientName.isEmpty())
       {
-        QString errorString =
-          QString("Unable to create export destination directory:\n\n")
-          + destinationDir
-          + QString("\n\nHalting export.");
-        ctkMessageBox createDirectoryErrorMessageBox;
-        createDirectoryErrorMessageBox.setText(errorString);
-        createDirectoryErrorMessageBox.setIcon(QMessageBox::Warning);
-        createDirectoryErrorMessageBox.exec();
-        return;
+        destinationDir += nameSep + patientName;
       }
-    }
+      destinationDir += sep + studyDate;
+      if (!studyDescription.isEmpty())
+      {
+        destinationDir += nameSep + studyDescription;
+      }
+      destinationDir += sep + seriesNumber;
+      if (!seriesDescription.isEmpty())
+      {
+        destinationDir += nameSep + seriesDescription;
+      }
+      destinationDir += sep;
 
-    // show progress
-    if (d->ExportProgress == 0)
-    {
-      d->ExportProgress = new QProgressDialog(this->tr("DICOM Export"), "Close", 0, 100, this, Qt::WindowTitleHint | Qt::WindowSystemMenuHint);
-      d->ExportProgress->setWindowModality(Qt::ApplicationModal);
-      d->ExportProgress->setMinimumDuration(0);
+      // make sure only ascii characters are in the directory path
+      // (while special characters may be used on an internal hard disk, it may not be possible
+      // to use special characters on file systems of an external drive or network storage)
+      destinationDir = QString::fromLatin1(destinationDir.toLatin1());
+      // replace any question marks that were used as replacements for non ascii
+      // characters with underscore
+      destinationDir.replace("?", "_");
     }
-    QLabel *exportLabel = new QLabel(this->tr("Exporting series ") + seriesNumber);
-    d->ExportProgress->setLabel(exportLabel);
-    d->ExportProgress->setValue(0);
 
     int fileNumber = 0;
-    int numFiles = filesForSeries.size();
-    d->ExportProgress->setMaximum(numFiles);
     foreach (const QString& filePath, filesForSeries)
     {
       QString destinationFileName = destinationDir;
 
       QString fileNumberString;
-      // sequentially number the files
-      fileNumberString.sprintf("%06d", fileNumber);
-
-      destinationFileName += fileNumberString + QString(".dcm");
-
-      // replace non ASCII characters
-      destinationFileName = destinationFileName.toLatin1();
-      // (it is safer to avoid special characters in case the files are
-      // to be more compatible with exported to external drive or network storage)
-      // replace any question marks that were used as replacements for non ascii
-      // characters with underscore
-      destinationFileName.replace("?", "_");
-
-      if (!QFile::exists(filePath))
+      if (useFileIDs)
       {
-        d->ExportProgress->setValue(numFiles);
-        QString errorString = QString("Export source file not found:\n\n")
-          + filePath
-          + QString("\n\nHalting export.\n\nError may be fixed via Repair.");
-        ctkMessageBox copyErrorMessageBox;
-        copyErrorMessageBox.setText(errorString);
-        copyErrorMessageBox.setIcon(QMessageBox::Warning);
-        copyErrorMessageBox.exec();
-        return;
+        fileNumberString.sprintf("I%07d", fileNumber);
+        destinationFileName += fileNumberString;
       }
-      if (QFile::exists(destinationFileName))
+      else
       {
-        d->ExportProgress->setValue(numFiles);
-        QString errorString = QString("Export destination file already exists:\n\n")
-          + destinationFileName
-          + QString("\n\nHalting export.");
-        ctkMessageBox copyErrorMessageBox;
-        copyErrorMessageBox.setText(errorString);
-        copyErrorMessageBox.setIcon(QMessageBox::Warning);
-        copyErrorMessageBox.exec();
-        return;
+        // sequentially number the files
+        fileNumberString.sprintf("%06d", fileNumber);
+        destinationFileName += fileNumberString + QString(".dcm");
       }
 
-      bool copyResult = QFile::copy(filePath, destinationFileName);
-      if (!copyResult)
-      {
-        d->ExportProgress->setValue(numFiles);
-        QString errorString = QString("Failed to copy\n\n")
-          + filePath
-          + QString("\n\nto\n\n")
-          + destinationFileName
-          + QString("\n\nHalting export.");
-        ctkMessageBox copyErrorMessageBox;
-        copyErrorMessageBox.setText(errorString);
-        copyErrorMessageBox.setIcon(QMessageBox::Warning);
-        copyErrorMessageBox.exec();
-        return;
-        }
-
+      sourceFilePaths << filePath;
+      destinationFilePaths << destinationFileName;
       fileNumber++;
-      d->ExportProgress->setValue(fileNumber);
     }
-    d->ExportProgress->setValue(numFiles);
   }
+
+  // show progress
+  if (d->ExportProgress == 0)
+  {
+    d->ExportProgress = new QProgressDialog(this->tr("DICOM Export"), "Cancel", 0, 100, this, Qt::WindowTitleHint | Qt::WindowSystemMenuHint);
+    d->ExportProgress->setWindowModality(Qt::ApplicationModal);
+    d->ExportProgress->setMinimumDuration(0);
+    connect(d->DICOMExporter.data(), SIGNAL(exportProgress(int)), d->ExportProgress, SLOT(setValue(int)));
+    connect(d->ExportProgress, SIGNAL(canceled()), d->DICOMExporter.data(), SLOT(cancel()));
+    connect(d->DICOMExporter.data(), SIGNAL(exportFinished()), this, SLOT(onExportFinished()));
+  }
+  QLabel *exportLabel = new QLabel(this->tr("Exporting %1 series (%2 files)")
+    .arg(uids.size()).arg(sourceFilePaths.size()));
+  d->ExportProgress->setLabel(exportLabel);
+  d->ExportProgress->setMaximum(qMax(1, sourceFilePaths.size()));
+  d->ExportProgress->setValue(0);
+
+  d->DICOMExporter->startExport(sourceFilePaths, destinationFilePaths, dirPath);
+}
+
+//----------------------------------------------------------------------------
+void ctkDICOMBrowser::onExportFinished()
+{
+  Q_D(ctkDICOMBrowser);
+  if (d->ExportProgress)
+  {
+    d->ExportProgress->setValue(d->ExportProgress->maximum());
+  }
+  QStringList errors = d->DICOMExporter->errors();
+  if (errors.isEmpty())
+  {
+    return;
+  }
+  // Show all errors at once, so that a few unreadable files do not block the export
+  QString summary = QString("Exported %1 of %2 files.\n\n%3 errors occurred during export.")
+    .arg(d->DICOMExporter->numberOfExportedFiles())
+    .arg(d->DICOMExporter->numberOfProcessedFiles())
+    .arg(errors.size());
+  ctkMessageBox exportErrorMessageBox;
+  exportErrorMessageBox.setText(summary);
+  exportErrorMessageBox.setDetailedText(errors.join("\n"));
+  exportErrorMessageBox.setIcon(QMessageBox::Warning);
+  exportErrorMessageBox.exec();
 }
 
 //----------------------------------------------------------------------------
@@ -1592,9 +1619,14 @@ void ctkDICOMBrowser::exportSelectedItems(ctkDICOMModel::IndexType level)
 //----------------------------------------------------------------------------
 void ctkDICOMBrowser::removeSelectedItems(ctkDICOMModel::IndexType level)
 {
-  Q_D(const ctkDICOMBrowser);
+  Q_D(ctkDICOMBrowser);
+  if (d->warnIfExporting("Removing items from the database"))
+  {
+    return;
+  }
   QStringList selectedPatientUIDs;
   QStringList selectedStudyUIDs;
+  QStringList selectedSeriesUIDs;
   if (level == ctkDICOMModel::PatientType)
   {
     selectedPatientUIDs = d->dicomTableManager->currentPatientsSelection();
@@ -1602,10 +1634,6 @@ void ctkDICOMBrowser::removeSelectedItems(ctkDICOMModel::IndexType level)
     {
       return;
     }
-    foreach(const QString & uid, selectedPatientUIDs)
-    {
-      selectedStudyUIDs << d->DICOMDatabase->studiesForPatient(uid);
-    }
   }
   if (level == ctkDICOMModel::StudyType)
   {
@@ -1615,8 +1643,6 @@ void ctkDICOMBrowser::removeSelectedItems(ctkDICOMModel::IndexType level)
       return;
     }
   }
-
-  QStringList selectedSeriesUIDs;
   if (level == ctkDICOMModel::SeriesType)
   {
     selectedSeriesUIDs = d->dicomTableManager->currentSeriesSelection();
@@ -1625,26 +1651,9 @@ void ctkDICOMBrowser::removeSelectedItems(ctkDICOMModel::IndexType level)
       return;
     }
   }
-  else
-  {
-    foreach(const QString & uid, selectedStudyUIDs)
-    {
-      selectedSeriesUIDs << d->DICOMDatabase->seriesForStudy(uid);
-    }
-  }
 
-  foreach(const QString & uid, selectedSeriesUIDs)
-  {
-    d->DICOMDatabase->removeSeries(uid);
-  }
-  foreach(const QString & uid, selectedStudyUIDs)
-  {
-    d->DICOMDatabase->removeStudy(uid);
-  }
-  foreach(const QString & uid, selectedPatientUIDs)
-  {
-    d->DICOMDatabase->removePatient(uid);
-  }
+  // Records are removed in one transaction, files are deleted in the background
+  d->DICOMDatabase->removeItems(selectedPatientUIDs, selectedStudyUIDs, selectedSeriesUIDs);
   // Update the table views
   d->dicomTableManager->updateTableViews();
 }
@@ -31,6 +31,7 @@
 
 class ctkDICOMBrowserPrivate;
 class ctkDICOMDatabase;
+class ctkDICOMExporter;
 class ctkDICOMTableManager;
 class ctkFileDialog;
 class ctkThumbnailLabel;
@@ -103,6 +104,13 @@ public:
 
   Q_INVOKABLE ctkDICOMTableManager* dicomTableManager();
 
+  /// Exporter used by exportSeries. Files are copied in background threads.
+  /// If writeDicomDir is enabled in the exporter then the exported files are named
+  /// as DICOM file IDs (DICOM/Snnnnnnn/Innnnnnn) and a DICOMDIR file is written
+  /// in the export folder.
+  /// @see ctkDICOMExporter
+  Q_INVOKABLE ctkDICOMExporter* exporter();
+
   /// Option to show or not import summary dialog.
   /// Since the summary dialog is modal, we give the option of disabling it for batch modes or testing.
   void setDisplayImportSummary(bool);
@@ -267,10 +275,18 @@ protected Q_SLOTS:
     /// Called when a right mouse click is made in the series table
     void onSeriesRightClicked(const QPoint &point);
 
-    /// Called to export the series associated with the selected UIDs
-    /// \sa exportSelectedStudies, exportSelectedPatients
+    /// Called to export the series associated with the selected UIDs.
+    /// Files are exported in the background: the method returns before the files are
+    /// copied, errors are shown in a summary when the export is finished. Callers that
+    /// need the exported files must wait for exporter()->waitForExportFinished() or the
+    /// exportFinished() signal of the exporter. The exported series cannot be removed
+    /// from the database until the export is finished.
+    /// \sa exportSelectedStudies, exportSelectedPatients, exporter
     void exportSeries(QString dirPath, QStringList uids);
 
+    /// Called when all files of an export are processed
+    void onExportFinished();
+
     /// Called to export the studies associated with the selected UIDs
     /// \sa exportSelectedSeries, exportSelectedPatients
     void exportSelectedItems(ctkDICOMModel::IndexType level);
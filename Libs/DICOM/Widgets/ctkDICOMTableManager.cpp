@@ -52,6 +52,10 @@ public:
   /// Flag storing state whether automatic selection of series is enabled.
   /// It is only needed to be able to provide a read function for the property
   bool m_AutoSelectSeries;
+  /// Set when the selection is cleared while the UIDs of all rows of the table are
+  /// still queried, the condition is set when the query is finished
+  bool m_PatientsConditionPending;
+  bool m_StudiesConditionPending;
 };
 
 //------------------------------------------------------------------------------
@@ -60,6 +64,8 @@ ctkDICOMTableManagerPrivate::ctkDICOMTableManagerPrivate(ctkDICOMTableManager &o
   : q_ptr(&obj)
   , m_DynamicTableLayout(false)
   , m_AutoSelectSeries(true)
+  , m_PatientsConditionPending(false)
+  , m_StudiesConditionPending(false)
 {
 
 }
@@ -85,6 +91,16 @@ void ctkDICOMTableManagerPrivate::init()
   this->seriesTable->setQueryTableName("Series");
   this->seriesTable->setQueryForeignKey("StudyInstanceUID");
 
+  // Read the rows that are passed to the next table in the background
+  this->patientsTable->setAsynchronousQuery(true);
+  this->studiesTable->setAsynchronousQuery(true);
+  this->seriesTable->setAsynchronousQuery(true);
+  // Conditions of cleared selections are set when the UIDs of all rows are known
+  QObject::connect(this->patientsTable, SIGNAL(uidsForAllRowsChanged(QStringList)),
+    q, SLOT(onPatientsUidsForAllRowsChanged()));
+  QObject::connect(this->studiesTable, SIGNAL(uidsForAllRowsChanged(QStringList)),
+    q, SLOT(onStudiesUidsForAllRowsChanged()));
+
   this->patientsSearchBox->setAlwaysShowClearIcon(true);
   this->patientsSearchBox->setShowSearchIcon(true);
   QObject::connect(this->patientsSearchBox, SIGNAL(textChanged(QString)),
@@ -277,6 +293,13 @@ void ctkDICOMTableManager::onPatientsSelectionChanged(const QStringList &uids)
   std::pair<QString, QStringList> patientCondition;
   patientCondition.first = "Patients.UID";
   Q_D(ctkDICOMTableManager);
+  d->m_PatientsConditionPending = false;
+  if (uids.empty() && d->patientsTable->isQueryInProgress())
+  {
+    // UIDs of all rows would be the ones of the previous query
+    d->m_PatientsConditionPending = true;
+    return;
+  }
   if (!uids.empty())
   {
     patientCondition.second = uids;
@@ -295,6 +318,13 @@ void ctkDICOMTableManager::onStudiesSelectionChanged(const QStringList &uids)
   std::pair<QString, QStringList> studiesCondition;
   studiesCondition.first = "Studies.StudyInstanceUID";
   Q_D(ctkDICOMTableManager);
+  d->m_StudiesConditionPending = false;
+  if (uids.empty() && d->studiesTable->isQueryInProgress())
+  {
+    // UIDs of all rows would be the ones of the previous query
+    d->m_StudiesConditionPending = true;
+    return;
+  }
   if (!uids.empty())
   {
     studiesCondition.second = uids;
@@ -306,6 +336,33 @@ void ctkDICOMTableManager::onStudiesSelectionChanged(const QStringList &uids)
   d->seriesTable->addSqlWhereCondition(studiesCondition);
 }
 
+//------------------------------------------------------------------------------
+void ctkDICOMTableManager::onPatientsUidsForAllRowsChanged()
+{
+  Q_D(ctkDICOMTableManager);
+  if (!d->m_PatientsConditionPending)
+  {
+    return;
+  }
+  this->onPatientsSelectionChanged(d->patientsTable->currentSelection());
+  // the tables were queried with the condition of the previous query
+  d->studiesTable->onUpdateQuery(d->patientsTable->currentSelection());
+  d->seriesTable->onUpdateQuery(d->studiesTable->currentSelection());
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMTableManager::onStudiesUidsForAllRowsChanged()
+{
+  Q_D(ctkDICOMTableManager);
+  if (!d->m_StudiesConditionPending)
+  {
+    return;
+  }
+  this->onStudiesSelectionChanged(d->studiesTable->currentSelection());
+  // the table was queried with the condition of the previous query
+  d->seriesTable->onUpdateQuery(d->studiesTable->currentSelection());
+}
+
 //------------------------------------------------------------------------------
 void ctkDICOMTableManager::setDynamicTableLayout(bool dynamic)
 {
@@ -119,6 +119,9 @@ public Q_SLOTS:
   void onStudiesSelectionChanged(const QStringList&);
 
 protected Q_SLOTS:
+  /// Set the conditions of cleared selections when the UIDs of all rows are read
+  void onPatientsUidsForAllRowsChanged();
+  void onStudiesUidsForAllRowsChanged();
   void showPatientsFilterActiveWarning(bool);
   void showStudiesFilterActiveWarning(bool);
   void showSeriesFilterActiveWarning(bool);
@@ -23,10 +23,55 @@
 #include "ui_ctkDICOMTableView.h"
 
 // Qt includes
+#include <QAtomicInt>
 #include <QJsonObject>
 #include <QMouseEvent>
-#include <QSortFilterProxyModel>
+#include <QPair>
+#include <QRegExp>
+#include <QRunnable>
+#include <QSqlError>
+#include <QSqlQuery>
 #include <QSqlQueryModel>
+#include <QSqlRecord>
+#include <QThreadPool>
+#include <QTimer>
+#include <QUuid>
+
+class ctkDICOMTableViewPrivate;
+
+/// Name of a temporary table and the UIDs that it contains
+typedef QPair<QString, QStringList> ctkDICOMTableViewUidTable;
+
+//------------------------------------------------------------------------------
+/// Runs the query of the UIDs of all the rows of a table on a separate read
+/// connection. The result is dropped if another query was started meanwhile.
+class ctkDICOMTableViewRowUidsWorker : public QRunnable
+{
+public:
+  virtual void run();
+
+  QObject* TableView;
+  QString DatabaseFilename;
+  QString Query;
+  QList<ctkDICOMTableViewUidTable> UidTables;
+  int Generation;
+  QAtomicInt* CurrentGeneration;
+};
+
+//------------------------------------------------------------------------------
+/// Query model that sorts by rerunning the query with an "order by" clause.
+/// QSqlQueryModel only fetches the rows that the view displays, so sorting
+/// the fetched rows on the client would not sort the whole table.
+class ctkDICOMTableViewSqlModel : public QSqlQueryModel
+{
+public:
+  ctkDICOMTableViewSqlModel();
+  virtual void sort(int column, Qt::SortOrder order);
+
+  ctkDICOMTableViewPrivate* TablePrivate;
+  int SortColumn;
+  Qt::SortOrder SortOrder;
+};
 
 //------------------------------------------------------------------------------
 class ctkDICOMTableViewPrivate : public Ui_ctkDICOMTableView
@@ -50,10 +95,51 @@ public:
 
   void applyColumnProperties();
 
+  /// Select statement of the displayed rows, empty if the table cannot be queried.
+  /// UID lists are not inserted in the statement but read from the temporary tables
+  /// returned in uidTables.
+  QString queryString(const QString& selectedColumns, const QStringList& uids,
+    QList<ctkDICOMTableViewUidTable>& uidTables) const;
+  /// Write UID lists into temporary tables of the database connection
+  static bool writeUidTables(QSqlDatabase database, const QList<ctkDICOMTableViewUidTable>& uidTables);
+  /// Query the UIDs of all the rows on the connection of the view
+  QStringList queryRowUids() const;
+  /// Start the query of the UIDs of all the rows in the background
+  void startRowUidsQuery(const QString& query, const QList<ctkDICOMTableViewUidTable>& uidTables);
+  /// Run the current query again, e.g. after the filter or sort order changed
+  void updateQuery();
+
+  /// Fields of the queried table that the filter text is searched in
+  QStringList filterFieldNames() const;
+  /// SQL condition selecting the rows that match the filter text
+  QString filterCondition() const;
+
   ctkDICOMDatabase* dicomDatabase;
-  QSqlQueryModel dicomSQLModel;
-  QSortFilterProxyModel* dicomSQLFilterModel;
+  ctkDICOMTableViewSqlModel dicomSQLModel;
   QString queryForeignKey;
+  /// UIDs of the last setQuery() call, used when the query is run again
+  QStringList queryUids;
+  /// Query of the key column of all the rows selected by the last setQuery() call
+  QString rowUidsQuery;
+
+  bool asynchronousQuery;
+  /// Runs the row UIDs queries, one at a time
+  QThreadPool queryThreadPool;
+  /// Incremented when a query is started, results of older queries are dropped
+  QAtomicInt queryGeneration;
+  /// UIDs of all the rows, read in the background in asynchronous mode
+  QStringList rowUids;
+  /// Generation of the query that rowUids were read by
+  int rowUidsGeneration;
+  /// Emit queryChanged when the background query of the row UIDs is finished
+  bool queryChangedPending;
+
+  /// Filter text applied in the current query
+  QString appliedFilterText;
+  /// Delays filtering until the user stops typing
+  QTimer filterUpdateTimer;
+
+  bool fullTextSearchEnabled;
 
   QStringList currentSelection;
 
@@ -67,12 +153,40 @@ public:
 
 };
 
+//------------------------------------------------------------------------------
+ctkDICOMTableViewSqlModel::ctkDICOMTableViewSqlModel()
+  : TablePrivate(0)
+  , SortColumn(-1)
+  , SortOrder(Qt::AscendingOrder)
+{
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMTableViewSqlModel::sort(int column, Qt::SortOrder order)
+{
+  if (column == this->SortColumn && order == this->SortOrder)
+  {
+    return;
+  }
+  this->SortColumn = column;
+  this->SortOrder = order;
+  if (this->TablePrivate)
+  {
+    this->TablePrivate->updateQuery();
+  }
+}
+
 //------------------------------------------------------------------------------
 ctkDICOMTableViewPrivate::ctkDICOMTableViewPrivate(ctkDICOMTableView &obj)
   : q_ptr(&obj)
 {
-  this->dicomSQLFilterModel = new QSortFilterProxyModel(&obj);
   this->dicomDatabase = new ctkDICOMDatabase(&obj);
+  this->dicomSQLModel.TablePrivate = this;
+  this->asynchronousQuery = false;
+  this->queryChangedPending = false;
+  this->rowUidsGeneration = 0;
+  this->queryThreadPool.setMaxThreadCount(1);
+  this->fullTextSearchEnabled = true;
   this->batchUpdate = false;
   this->batchUpdateModificationPending = false;
   this->batchUpdateInstanceAddedPending = false;
@@ -83,7 +197,15 @@ ctkDICOMTableViewPrivate::ctkDICOMTableViewPrivate(ctkDICOMTableView &obj, ctkDI
   : q_ptr(&obj)
   , dicomDatabase(db)
 {
-  this->dicomSQLFilterModel = new QSortFilterProxyModel(&obj);
+  this->dicomSQLModel.TablePrivate = this;
+  this->asynchronousQuery = false;
+  this->queryChangedPending = false;
+  this->rowUidsGeneration = 0;
+  this->queryThreadPool.setMaxThreadCount(1);
+  this->fullTextSearchEnabled = true;
+  this->batchUpdate = false;
+  this->batchUpdateModificationPending = false;
+  this->batchUpdateInstanceAddedPending = false;
 }
 
 //------------------------------------------------------------------------------
@@ -102,10 +224,9 @@ void ctkDICOMTableViewPrivate::init()
 
   this->tblDicomDatabaseView->viewport()->installEventFilter(q);
 
-  this->dicomSQLFilterModel->setSourceModel(&this->dicomSQLModel);
-  this->dicomSQLFilterModel->setFilterKeyColumn(-1);
-  this->dicomSQLFilterModel->setFilterCaseSensitivity(Qt::CaseInsensitive);
-  this->tblDicomDatabaseView->setModel(this->dicomSQLFilterModel);
+  // Rows are fetched from the database as the view scrolls, filtering
+  // and sorting are done in the SQL query.
+  this->tblDicomDatabaseView->setModel(&this->dicomSQLModel);
   this->tblDicomDatabaseView->setSortingEnabled(true);
 #if QT_VERSION < QT_VERSION_CHECK(5,0,0)
   this->tblDicomDatabaseView->horizontalHeader()->setResizeMode(QHeaderView::Interactive);
@@ -134,6 +255,10 @@ void ctkDICOMTableViewPrivate::init()
                    q, SLOT(onCustomContextMenuRequested(const QPoint&)));
 
   QObject::connect(this->leSearchBox, SIGNAL(textChanged(QString)), q, SLOT(onFilterChanged(QString)));
+
+  this->filterUpdateTimer.setSingleShot(true);
+  this->filterUpdateTimer.setInterval(300);
+  QObject::connect(&this->filterUpdateTimer, SIGNAL(timeout()), q, SLOT(updateFilter()));
 }
 
 //----------------------------------------------------------------------------
@@ -316,6 +441,268 @@ void ctkDICOMTableViewPrivate::applyColumnProperties()
   header->updateGeometry();
 }
 
+//----------------------------------------------------------------------------
+QString ctkDICOMTableViewPrivate::queryString(const QString& selectedColumns, const QStringList& uids,
+  QList<ctkDICOMTableViewUidTable>& uidTables) const
+{
+  uidTables.clear();
+  if (this->dicomDatabase == 0 || !this->dicomDatabase->isOpen()
+    || (!this->queryForeignKey.isEmpty() && uids.empty()))
+  {
+    return QString();
+  }
+  QString query = ("select distinct %1 from Patients, Series, Studies where "
+                   "Patients.UID = Studies.PatientsUID and Studies.StudyInstanceUID = Series.StudyInstanceUID");
+  query = query.arg(selectedColumns);
+  // Long UID lists would make huge statements, they are read from temporary tables instead
+  QString uidTableName = QString("ctkDICOMTableView%1UIDs%2").arg(this->queryTableName());
+  if (!uids.empty() && this->queryForeignKey.length() != 0)
+  {
+    uidTables << ctkDICOMTableViewUidTable(uidTableName.arg(uidTables.count()), uids);
+    query += " and " + this->queryTableName() + "." + this->queryForeignKey
+      + " in (select UID from temp.\"" + uidTables.last().first + "\")";
+  }
+  QStringList conditionColumns = this->sqlWhereConditions.keys();
+  conditionColumns.sort();
+  foreach(const QString& column, conditionColumns)
+  {
+    QStringList conditionUids = this->sqlWhereConditions.value(column);
+    if (!conditionUids.empty())
+    {
+      uidTables << ctkDICOMTableViewUidTable(uidTableName.arg(uidTables.count()), conditionUids);
+      query += " and " + column + " in (select UID from temp.\"" + uidTables.last().first + "\")";
+    }
+  }
+  QString filterCondition = this->filterCondition();
+  if (!filterCondition.isEmpty())
+  {
+    query += " and " + filterCondition;
+  }
+  return query;
+}
+
+//----------------------------------------------------------------------------
+bool ctkDICOMTableViewPrivate::writeUidTables(QSqlDatabase database, const QList<ctkDICOMTableViewUidTable>& uidTables)
+{
+  QSqlQuery query(database);
+  // do not interfere with a transaction that is already in progress on the connection
+  bool transactionStarted = database.transaction();
+  foreach(const ctkDICOMTableViewUidTable& uidTable, uidTables)
+  {
+    // Column without type, so that it is compared to integer and text UIDs alike
+    QVariantList uids;
+    foreach(const QString& uid, uidTable.second)
+    {
+      uids << uid;
+    }
+    query.exec(QString("CREATE TEMP TABLE IF NOT EXISTS \"%1\" (UID)").arg(uidTable.first));
+    query.exec(QString("DELETE FROM temp.\"%1\"").arg(uidTable.first));
+    query.prepare(QString("INSERT INTO temp.\"%1\" (UID) VALUES (?)").arg(uidTable.first));
+    query.addBindValue(uids);
+    if (!query.execBatch())
+    {
+      qWarning() << "Failed to write UIDs into temporary table" << uidTable.first << ":" << query.lastError().text();
+      if (transactionStarted)
+      {
+        database.rollback();
+      }
+      return false;
+    }
+  }
+  return !transactionStarted || database.commit();
+}
+
+//----------------------------------------------------------------------------
+QStringList ctkDICOMTableViewPrivate::queryRowUids() const
+{
+  QStringList uids;
+  if (this->rowUidsQuery.isEmpty())
+  {
+    return uids;
+  }
+  QSqlQuery query(this->dicomDatabase->database());
+  query.setForwardOnly(true);
+  if (query.exec(this->rowUidsQuery))
+  {
+    while (query.next())
+    {
+      uids << query.value(0).toString();
+    }
+  }
+  return uids;
+}
+
+//----------------------------------------------------------------------------
+void ctkDICOMTableViewPrivate::startRowUidsQuery(const QString& query, const QList<ctkDICOMTableViewUidTable>& uidTables)
+{
+  Q_Q(ctkDICOMTableView);
+  int generation = this->queryGeneration.fetchAndAddOrdered(1) + 1;
+  // Queued queries that did not start yet are stale
+  this->queryThreadPool.clear();
+  if (query.isEmpty())
+  {
+    q->onRowUidsQueryFinished(generation, QStringList());
+    return;
+  }
+  ctkDICOMTableViewRowUidsWorker* worker = new ctkDICOMTableViewRowUidsWorker;
+  worker->TableView = q;
+  worker->DatabaseFilename = this->dicomDatabase->databaseFilename();
+  worker->Query = query;
+  worker->UidTables = uidTables;
+  worker->Generation = generation;
+  worker->CurrentGeneration = &this->queryGeneration;
+  this->queryThreadPool.start(worker);
+}
+
+//----------------------------------------------------------------------------
+void ctkDICOMTableViewRowUidsWorker::run()
+{
+  if (this->Generation != this->CurrentGeneration->loadAcquire())
+  {
+    return;
+  }
+  QStringList uids;
+  bool stale = false;
+  QString connectionName = QUuid::createUuid().toString();
+  {
+    QSqlDatabase database = QSqlDatabase::addDatabase("QSQLITE", connectionName);
+    database.setDatabaseName(this->DatabaseFilename);
+    if (database.open())
+    {
+      if (ctkDICOMTableViewPrivate::writeUidTables(database, this->UidTables))
+      {
+        QSqlQuery query(database);
+        query.setForwardOnly(true);
+        if (query.exec(this->Query))
+        {
+          while (query.next())
+          {
+            uids << query.value(0).toString();
+            if (uids.count() % 1000 == 0
+              && this->Generation != this->CurrentGeneration->loadAcquire())
+            {
+              stale = true;
+              break;
+            }
+          }
+        }
+        else
+        {
+          qWarning() << "Failed to query table rows:" << query.lastError().text();
+        }
+      }
+      database.close();
+    }
+    else
+    {
+      qWarning() << "Failed to open database for querying table rows:" << database.lastError().text();
+    }
+  }
+  QSqlDatabase::removeDatabase(connectionName);
+  if (stale || this->Generation != this->CurrentGeneration->loadAcquire())
+  {
+    return;
+  }
+  QMetaObject::invokeMethod(this->TableView, "onRowUidsQueryFinished", Qt::QueuedConnection,
+    Q_ARG(int, this->Generation), Q_ARG(QStringList, uids));
+}
+
+//----------------------------------------------------------------------------
+void ctkDICOMTableViewPrivate::updateQuery()
+{
+  Q_Q(ctkDICOMTableView);
+  q->setQuery(this->queryUids);
+}
+
+//----------------------------------------------------------------------------
+QStringList ctkDICOMTableViewPrivate::filterFieldNames() const
+{
+  QStringList fieldNames;
+  if (!this->dicomDatabase || !this->dicomDatabase->isOpen())
+  {
+    return fieldNames;
+  }
+  QSqlRecord tableRecord = this->dicomDatabase->database().record(this->queryTableName());
+  bool displayedFieldsAvailable = this->dicomDatabase->isDisplayedFieldsTableAvailable();
+  for (int field = 0; field < tableRecord.count(); ++field)
+  {
+    QString fieldName = tableRecord.fieldName(field);
+    if (displayedFieldsAvailable && !this->dicomDatabase->visibilityForField(this->queryTableName(), fieldName))
+    {
+      // only search in the displayed columns
+      continue;
+    }
+    fieldNames << fieldName;
+  }
+  return fieldNames;
+}
+
+//----------------------------------------------------------------------------
+QString ctkDICOMTableViewPrivate::filterCondition() const
+{
+  // Rows must match all the words of the filter text
+  QStringList terms = this->appliedFilterText.split(QRegExp("\\s+"), QString::SkipEmptyParts);
+  if (terms.isEmpty() || !this->dicomDatabase || !this->dicomDatabase->isOpen())
+  {
+    return QString();
+  }
+  QString tableName = this->queryTableName();
+  QStringList fieldNames = this->filterFieldNames();
+  if (fieldNames.isEmpty())
+  {
+    return QString();
+  }
+
+  QString indexTableName;
+  if (this->fullTextSearchEnabled)
+  {
+    indexTableName = this->dicomDatabase->fullTextSearchIndexTableName(tableName);
+  }
+  if (!indexTableName.isEmpty())
+  {
+    // Words of the displayed fields that start with the terms. Wildcards are
+    // not supported by the index, words are always matched by prefix.
+    QSqlRecord indexRecord = this->dicomDatabase->database().record(indexTableName);
+    QStringList indexedFieldNames;
+    foreach(const QString& fieldName, fieldNames)
+    {
+      if (indexRecord.contains(fieldName))
+      {
+        indexedFieldNames << fieldName;
+      }
+    }
+    QStringList matchTerms;
+    foreach(QString term, terms)
+    {
+      term.remove('*').remove('?');
+      if (!term.isEmpty())
+      {
+        matchTerms << "{" + indexedFieldNames.join(" ") + "} : \"" + term.replace("\"", "\"\"") + "\"*";
+      }
+    }
+    if (matchTerms.isEmpty() || indexedFieldNames.isEmpty())
+    {
+      return QString();
+    }
+    return QString("%1.rowid in (select rowid from %2 where %2 match '%3')")
+      .arg(tableName).arg(indexTableName).arg(matchTerms.join(" AND ").replace("'", "''"));
+  }
+
+  // Substring search in the displayed fields, '*' and '?' are wildcards
+  QStringList termConditions;
+  foreach(QString term, terms)
+  {
+    term.replace("\\", "\\\\").replace("%", "\\%").replace("_", "\\_");
+    term.replace('*', '%').replace('?', '_').replace("'", "''");
+    QStringList fieldConditions;
+    foreach(const QString& fieldName, fieldNames)
+    {
+      fieldConditions << QString("%1.\"%2\" like '%%3%' escape '\\'").arg(tableName).arg(fieldName).arg(term);
+    }
+    termConditions << "(" + fieldConditions.join(" or ") + ")";
+  }
+  return termConditions.join(" and ");
+}
 
 //----------------------------------------------------------------------------
 // ctkDICOMTableView methods
@@ -353,6 +740,10 @@ ctkDICOMTableView::ctkDICOMTableView (ctkDICOMDatabase* dicomDataBase, QString q
 //------------------------------------------------------------------------------
 ctkDICOMTableView::~ctkDICOMTableView()
 {
+  Q_D(ctkDICOMTableView);
+  d->queryGeneration.fetchAndAddOrdered(1);
+  d->queryThreadPool.clear();
+  d->queryThreadPool.waitForDone();
 }
 
 //------------------------------------------------------------------------------
@@ -460,10 +851,18 @@ void ctkDICOMTableView::onUpdateQuery(const QStringList& uids)
 {
   Q_D(ctkDICOMTableView);
 
+  if (d->asynchronousQuery)
+  {
+    // queryChanged is emitted when the background query is finished
+    d->queryChangedPending = true;
+    this->setQuery(uids);
+    return;
+  }
+
   this->setQuery(uids);
 
-  bool showWarning = d->dicomSQLFilterModel->rowCount() == 0 &&
-    d->leSearchBox->text().length() != 0;
+  bool showWarning = d->dicomSQLModel.rowCount() == 0 &&
+    !d->appliedFilterText.isEmpty();
   d->showFilterActiveWarning(showWarning);
   emit showFilterActiveWarning(showWarning);
 
@@ -482,19 +881,114 @@ void ctkDICOMTableView::setFilterText(const QString& filterText)
 void ctkDICOMTableView::onFilterChanged(const QString& filterText)
 {
   Q_D(ctkDICOMTableView);
+  // Query the database when the user stops typing
+  d->filterUpdateTimer.start();
+  emit filterTextChanged(filterText);
+}
 
-  d->dicomSQLFilterModel->setFilterWildcard(filterText);
+//------------------------------------------------------------------------------
+void ctkDICOMTableView::updateFilter()
+{
+  Q_D(ctkDICOMTableView);
+  d->filterUpdateTimer.stop();
+  QString filterText = d->leSearchBox->text().trimmed();
+  if (filterText == d->appliedFilterText)
+  {
+    return;
+  }
+  d->appliedFilterText = filterText;
+  if (d->asynchronousQuery)
+  {
+    d->tblDicomDatabaseView->clearSelection();
+    d->queryChangedPending = true;
+    this->setQuery(d->queryUids);
+    return;
+  }
+  this->setQuery(d->queryUids);
 
   const QStringList uids = this->uidsForAllRows();
 
-  bool showWarning = d->dicomSQLFilterModel->rowCount() == 0 &&
-    d->dicomSQLModel.rowCount() != 0;
+  bool showWarning = d->dicomSQLModel.rowCount() == 0 &&
+    !d->appliedFilterText.isEmpty();
   d->showFilterActiveWarning(showWarning);
   emit showFilterActiveWarning(showWarning);
 
   d->tblDicomDatabaseView->clearSelection();
   emit queryChanged(uids);
-  emit filterTextChanged(filterText);
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMTableView::onRowUidsQueryFinished(int generation, const QStringList& uids)
+{
+  Q_D(ctkDICOMTableView);
+  if (generation != d->queryGeneration.loadAcquire())
+  {
+    // result of a query that was replaced by a newer one
+    return;
+  }
+  d->rowUids = uids;
+  d->rowUidsGeneration = generation;
+  emit uidsForAllRowsChanged(d->rowUids);
+  if (!d->queryChangedPending)
+  {
+    return;
+  }
+  d->queryChangedPending = false;
+
+  bool showWarning = d->rowUids.isEmpty() && !d->appliedFilterText.isEmpty();
+  d->showFilterActiveWarning(showWarning);
+  emit showFilterActiveWarning(showWarning);
+
+  emit queryChanged(this->uidsForAllRows());
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMTableView::isQueryInProgress()const
+{
+  Q_D(const ctkDICOMTableView);
+  return d->asynchronousQuery && d->rowUidsGeneration != d->queryGeneration.loadAcquire();
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMTableView::isAsynchronousQuery()const
+{
+  Q_D(const ctkDICOMTableView);
+  return d->asynchronousQuery;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMTableView::setAsynchronousQuery(bool asynchronous)
+{
+  Q_D(ctkDICOMTableView);
+  if (d->asynchronousQuery == asynchronous)
+  {
+    return;
+  }
+  d->asynchronousQuery = asynchronous;
+  d->queryChangedPending = false;
+  this->setQuery(d->queryUids);
+}
+
+//------------------------------------------------------------------------------
+bool ctkDICOMTableView::isFullTextSearchEnabled()const
+{
+  Q_D(const ctkDICOMTableView);
+  return d->fullTextSearchEnabled;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMTableView::setFullTextSearchEnabled(bool enabled)
+{
+  Q_D(ctkDICOMTableView);
+  if (d->fullTextSearchEnabled == enabled)
+  {
+    return;
+  }
+  d->fullTextSearchEnabled = enabled;
+  if (!d->appliedFilterText.isEmpty())
+  {
+    this->setQuery(d->queryUids);
+  }
 }
 
 //------------------------------------------------------------------------------
@@ -509,6 +1003,8 @@ void ctkDICOMTableView::onInstanceAdded()
   d->sqlWhereConditions.clear();
   d->tblDicomDatabaseView->clearSelection();
   d->leSearchBox->clear();
+  d->filterUpdateTimer.stop();
+  d->appliedFilterText.clear();
   this->setQuery();
 }
 
@@ -559,31 +1055,27 @@ bool ctkDICOMTableView::eventFilter(QObject *obj, QEvent *event)
 void ctkDICOMTableView::setQuery(const QStringList &uids)
 {
   Q_D(ctkDICOMTableView);
-  QString query = ("select distinct %1.* from Patients, Series, Studies where "
-                   "Patients.UID = Studies.PatientsUID and Studies.StudyInstanceUID = Series.StudyInstanceUID");
+  d->queryUids = uids;
   int columnCountBefore = d->dicomSQLModel.columnCount();
-  if (!uids.empty() && d->queryForeignKey.length() != 0)
+  QList<ctkDICOMTableViewUidTable> uidTables;
+  QString query = d->queryString(d->queryTableName() + ".*", uids, uidTables);
+  if (!query.isEmpty())
   {
-    query += " and %1."+d->queryForeignKey+" in ( '";
-    query.append(uids.join("','")).append("')");
-  }
-  if (!d->sqlWhereConditions.empty())
-  {
-    QHash<QString, QStringList>::const_iterator i = d->sqlWhereConditions.begin();
-    while (i != d->sqlWhereConditions.end())
+    // Release the current query, it may read the temporary tables that are overwritten
+    d->dicomSQLModel.query().finish();
+    ctkDICOMTableViewPrivate::writeUidTables(d->dicomDatabase->database(), uidTables);
+
+    QString keyFieldName = d->dicomDatabase->database().record(d->queryTableName()).fieldName(0);
+    QList<ctkDICOMTableViewUidTable> rowUidsTables;
+    d->rowUidsQuery = d->queryString(d->queryTableName() + ".\"" + keyFieldName + "\"", uids, rowUidsTables);
+
+    if (d->dicomSQLModel.SortColumn >= 0)
     {
-      if (!i.value().empty())
-      {
-        query += " and "+i.key()+" in ( '";
-        query.append(i.value().join("','")).append("')");
-      }
-      ++i;
+      query += QString(" order by %1 %2").arg(d->dicomSQLModel.SortColumn + 1)
+        .arg(d->dicomSQLModel.SortOrder == Qt::AscendingOrder ? "asc" : "desc");
     }
-  }
-  if (d->dicomDatabase != 0 && d->dicomDatabase->isOpen()
-    && (d->queryForeignKey.isEmpty() || !uids.empty()) )
-  {
-    d->dicomSQLModel.setQuery(query.arg(d->queryTableName()), d->dicomDatabase->database());
+    // Only the first rows are fetched, the rest is fetched when the view is scrolled
+    d->dicomSQLModel.setQuery(query, d->dicomDatabase->database());
     if (columnCountBefore==0)
     {
       // columns have not been initialized yet
@@ -592,10 +1084,26 @@ void ctkDICOMTableView::setQuery(const QStringList &uids)
   }
   else
   {
+    d->rowUidsQuery.clear();
     d->dicomSQLModel.clear();
   }
+
+  if (d->asynchronousQuery)
+  {
+    if (d->dicomDatabase && !d->dicomDatabase->isInMemory())
+    {
+      d->startRowUidsQuery(d->rowUidsQuery, uidTables);
+    }
+    else
+    {
+      // other connections cannot read an in-memory database
+      int generation = d->queryGeneration.fetchAndAddOrdered(1) + 1;
+      this->onRowUidsQueryFinished(generation, d->queryRowUids());
+    }
+  }
 }
 
+//------------------------------------------------------------------------------
 void ctkDICOMTableView::addSqlWhereCondition(const std::pair<QString, QStringList> &condition)
 {
   Q_D(ctkDICOMTableView);
@@ -606,20 +1114,22 @@ void ctkDICOMTableView::addSqlWhereCondition(const std::pair<QString, QStringLis
 QStringList ctkDICOMTableView::uidsForAllRows() const
 {
   Q_D(const ctkDICOMTableView);
-  QAbstractItemModel* tableModel = d->tblDicomDatabaseView->model();
-  int numberOfRows = tableModel->rowCount();
   QStringList uids;
-  if (numberOfRows == 0)
+  if (d->asynchronousQuery)
   {
-    //Return invalid UID if there are no rows
-    uids << QString("#");
+    // read by the background query
+    uids = d->rowUids;
   }
   else
   {
-    for(int i = 0; i < numberOfRows; ++i)
-    {
-      uids << QString("%1").arg(tableModel->index(i,0).data().toString());
-    }
+    // The model may have fetched only part of the rows, therefore the uids
+    // are read from the database with a query of the first column.
+    uids = d->queryRowUids();
+  }
+  if (uids.isEmpty())
+  {
+    //Return invalid UID if there are no rows
+    uids << QString("#");
   }
   return uids;
 }
@@ -644,7 +1154,7 @@ QStringList ctkDICOMTableView::currentSelection() const
 bool ctkDICOMTableView::filterActive()
 {
   Q_D(ctkDICOMTableView);
-  return (d->leSearchBox->text().length() != 0);
+  return (d->appliedFilterText.length() != 0);
 }
 
 //------------------------------------------------------------------------------
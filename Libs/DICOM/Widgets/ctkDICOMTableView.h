@@ -38,6 +38,10 @@ class QTableView;
  * The ctkDICOMTableView holds a QTableView which displays the content of the selected
  * ctkDICOMDatabase. It also holds a ctkSearchBox which allows filtering of the table content.
  *
+ * Filtering and sorting are done by the database query, and rows are fetched
+ * from the database as the table is scrolled, so that large databases can be
+ * browsed without loading all the rows.
+ *
  * @ingroup DICOM_Widgets
  */
 class CTK_DICOM_WIDGETS_EXPORT ctkDICOMTableView : public QWidget
@@ -46,6 +50,8 @@ class CTK_DICOM_WIDGETS_EXPORT ctkDICOMTableView : public QWidget
   Q_PROPERTY(bool filterActive READ filterActive)
   Q_PROPERTY( QTableView* tblDicomDatabaseView READ tableView )
   Q_PROPERTY(bool headerVisible READ isHeaderVisible WRITE setHeaderVisible)
+  Q_PROPERTY(bool fullTextSearchEnabled READ isFullTextSearchEnabled WRITE setFullTextSearchEnabled)
+  Q_PROPERTY(bool asynchronousQuery READ isAsynchronousQuery WRITE setAsynchronousQuery)
 
 public:
   typedef QWidget Superclass;
@@ -112,6 +118,7 @@ public:
 
   /**
    * @brief Getting the UIDs for all rows
+   * In asynchronous mode the UIDs of the last finished query are returned.
    * @return a QStringList with the uids for all rows
    */
   QStringList uidsForAllRows() const;
@@ -145,6 +152,36 @@ public:
   void setHeaderVisible(bool state);
   bool isHeaderVisible() const;
 
+  /**
+  * @brief Enable/disable full-text search index for filtering.
+  * If enabled, the words of the filter text are matched by prefix in the full-text search
+  * index that the database maintains for the table (\sa ctkDICOMDatabase::fullTextSearchIndexTableName).
+  * If disabled or the table has no index then the displayed fields are searched for the
+  * words of the filter text, with '*' and '?' wildcards.
+  * Enabled by default.
+  */
+  void setFullTextSearchEnabled(bool enabled);
+  bool isFullTextSearchEnabled() const;
+
+  /**
+  * @brief Enable/disable querying the UIDs of all rows in a background thread.
+  * The displayed rows are still fetched on the connection of the database, but
+  * the UIDs of all rows (\sa uidsForAllRows) are read on a separate connection,
+  * and queryChanged and showFilterActiveWarning are emitted when they are available.
+  * Results of queries that are replaced by a newer query are dropped.
+  * In-memory databases are always queried synchronously.
+  * Disabled by default.
+  */
+  void setAsynchronousQuery(bool asynchronous);
+  bool isAsynchronousQuery() const;
+
+  /**
+  * @brief Returns true while the UIDs of all rows are read in the background.
+  * Until then uidsForAllRows returns the UIDs of the previous query.
+  * \sa uidsForAllRowsChanged
+  */
+  bool isQueryInProgress() const;
+
 public Q_SLOTS:
   /**
    * @brief slot is called if the selection of the tableview is changed
@@ -211,6 +248,18 @@ protected Q_SLOTS:
    */
   void onFilterChanged(const QString& filterText);
 
+  /**
+   * @brief Query the rows that match the filter text.
+   * Called shortly after the user stopped typing in the ctkSearchBox.
+   */
+  void updateFilter();
+
+  /**
+   * @brief Called when the UIDs of all rows are read in the background
+   * @param generation identifies the query, results of stale queries are ignored
+   */
+  void onRowUidsQueryFinished(int generation, const QStringList& uids);
+
   /**
    * @brief Called if a new instance was added to the database
    */
@@ -249,6 +298,13 @@ Q_SIGNALS:
    */
   void queryChanged(const QStringList &uids);
 
+  /**
+   * @brief Is emitted in asynchronous mode when the UIDs of all rows are read
+   * in the background, before queryChanged.
+   * @param uids the UIDs of all rows
+   */
+  void uidsForAllRowsChanged(const QStringList &uids);
+
   void doubleClicked(const QModelIndex&);
 
 protected:
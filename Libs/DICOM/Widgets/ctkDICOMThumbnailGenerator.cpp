@@ -41,6 +41,9 @@ public:
   ctkDICOMThumbnailGeneratorPrivate(ctkDICOMThumbnailGenerator&);
   virtual ~ctkDICOMThumbnailGeneratorPrivate();
 
+  int Width;
+  int Height;
+
 protected:
   ctkDICOMThumbnailGenerator* const q_ptr;
 
@@ -51,7 +54,8 @@ private:
 //------------------------------------------------------------------------------
 ctkDICOMThumbnailGeneratorPrivate::ctkDICOMThumbnailGeneratorPrivate(ctkDICOMThumbnailGenerator& o):q_ptr(&o)
 {
-
+  this->Width = 128;
+  this->Height = 128;
 }
 
 //------------------------------------------------------------------------------
@@ -73,8 +77,15 @@ ctkDICOMThumbnailGenerator::~ctkDICOMThumbnailGenerator()
 {
 }
 
+//------------------------------------------------------------------------------
+CTK_GET_CPP(ctkDICOMThumbnailGenerator, int, width, Width);
+CTK_SET_CPP(ctkDICOMThumbnailGenerator, int, setWidth, Width);
+CTK_GET_CPP(ctkDICOMThumbnailGenerator, int, height, Height);
+CTK_SET_CPP(ctkDICOMThumbnailGenerator, int, setHeight, Height);
+
 //------------------------------------------------------------------------------
 bool ctkDICOMThumbnailGenerator::generateThumbnail(DicomImage *dcmImage, const QString &path){
+    Q_D(ctkDICOMThumbnailGenerator);
     QImage image;
     // Check whether we have a valid image
     EI_Status result = dcmImage->getStatus();
@@ -83,6 +94,23 @@ bool ctkDICOMThumbnailGenerator::generateThumbnail(DicomImage *dcmImage, const Q
       logger.error(QString("Rendering of DICOM image failed for thumbnail failed: ") + DicomImage::getString(result));
       return false;
     }
+    // Let DCMTK scale the image to the thumbnail size (keeping the pixel aspect ratio),
+    // so that only the scaled image has to be rendered.
+    QScopedPointer<DicomImage> scaledImage;
+    if (static_cast<int>(dcmImage->getWidth()) > d->Width || static_cast<int>(dcmImage->getHeight()) > d->Height)
+    {
+      const double widthRatio = static_cast<double>(dcmImage->getWidth()) / d->Width;
+      const double heightRatio = static_cast<double>(dcmImage->getHeight()) / d->Height;
+      scaledImage.reset(widthRatio > heightRatio
+        ? dcmImage->createScaledImage(static_cast<unsigned long>(d->Width), 0, 1 /* interpolate */, 1 /* aspect */)
+        : dcmImage->createScaledImage(0, static_cast<unsigned long>(d->Height), 1 /* interpolate */, 1 /* aspect */));
+      if (scaledImage.isNull() || scaledImage->getStatus() != EIS_Normal)
+      {
+        logger.error("Scaling of DICOM image failed for thumbnail");
+        return false;
+      }
+      dcmImage = scaledImage.data();
+    }
     // Select first window defined in image. If none, compute min/max window as best guess.
     // Only relevant for monochrome.
     if (dcmImage->isMonochrome())
@@ -124,14 +152,17 @@ bool ctkDICOMThumbnailGenerator::generateThumbnail(DicomImage *dcmImage, const Q
     buffer.resize(length);
 
     /* render pixel data to buffer */
-    if (dcmImage->getOutputData(static_cast<void *>(buffer.data() + offset), length - offset, 8, 0))
-    {  
-      if (!image.loadFromData( buffer ))
-        {
-            logger.error("QImage couldn't created");
-            return false;
-        }
+    if (!dcmImage->getOutputData(static_cast<void *>(buffer.data() + offset), length - offset, 8, 0))
+    {
+      logger.error("Rendering of DICOM image failed for thumbnail");
+      return false;
+    }
+    if (!image.loadFromData( buffer ))
+    {
+      logger.error("QImage couldn't created");
+      return false;
     }
-    image.scaled(128,128,Qt::KeepAspectRatio).save(path,"PNG");
-    return true;
+    // Images smaller than the thumbnail size are not scaled by DCMTK, scale them up here
+    // so that all thumbnails have the same size
+    return image.scaled(d->Width, d->Height, Qt::KeepAspectRatio).save(path,"PNG");
 }
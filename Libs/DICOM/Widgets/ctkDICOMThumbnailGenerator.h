@@ -36,14 +36,24 @@ class DicomImage;
 class CTK_DICOM_WIDGETS_EXPORT ctkDICOMThumbnailGenerator : public ctkDICOMAbstractThumbnailGenerator
 {
   Q_OBJECT
+  Q_PROPERTY(int width READ width WRITE setWidth)
+  Q_PROPERTY(int height READ height WRITE setHeight)
 public:
   ///  \brief Construct a ctkDICOMThumbnailGenerator object
   ///
   explicit ctkDICOMThumbnailGenerator(QObject* parent = 0);
   virtual ~ctkDICOMThumbnailGenerator();
 
+  /// Images are scaled down by DCMTK to fit in width x height (keeping the aspect ratio)
+  /// before they are rendered. The method may be called from multiple threads at the same time.
   virtual bool generateThumbnail(DicomImage* dcmImage, const QString& path );
 
+  /// Maximum size of the generated thumbnails. Default is 128 x 128.
+  void setWidth(int width);
+  int width()const;
+  void setHeight(int height);
+  int height()const;
+
 protected:
   QScopedPointer<ctkDICOMThumbnailGeneratorPrivate> d_ptr;
 
@@ -27,8 +27,11 @@
 #include <QMetaType>
 #include <QPersistentModelIndex>
 #include <QPixmap>
+#include <QPointer>
 #include <QPushButton>
 #include <QResizeEvent>
+#include <QScrollBar>
+#include <QTimer>
 
 // ctk includes
 #include "ctkLogger.h"
@@ -42,6 +45,7 @@
 #include "ctkDICOMDatabase.h"
 #include "ctkDICOMFilterProxyModel.h"
 #include "ctkDICOMModel.h"
+#include "ctkDICOMThumbnailService.h"
 
 // ctkDICOMWidgets includes
 #include "ctkDICOMThumbnailListWidget.h"
@@ -68,6 +72,9 @@ public:
 
   QString DatabaseDirectory;
   QModelIndex CurrentSelectedModel;
+  QPointer<ctkDICOMThumbnailService> ThumbnailService;
+  /// Thumbnail widgets waiting for the thumbnail service, indexed by SOP instance UID
+  QHash<QString, QPointer<ctkThumbnailLabel> > PendingThumbnails;
 
   void addThumbnailWidget(const QModelIndex &imageIndex, const QModelIndex& sourceIndex, const QString& text);
 
@@ -181,25 +188,52 @@ void ctkDICOMThumbnailListWidgetPrivate
   QModelIndex seriesIndex = imageIndex.parent();
   QModelIndex studyIndex = seriesIndex.parent();
 
+  QString studyInstanceUID = model->data(studyIndex ,ctkDICOMModel::UIDRole).toString();
+  QString seriesInstanceUID = model->data(seriesIndex ,ctkDICOMModel::UIDRole).toString();
+  QString sopInstanceUID = model->data(imageIndex, ctkDICOMModel::UIDRole).toString();
   QString thumbnailPath = this->DatabaseDirectory +
-                          "/thumbs/" + model->data(studyIndex ,ctkDICOMModel::UIDRole).toString() + "/" +
-                          model->data(seriesIndex ,ctkDICOMModel::UIDRole).toString() + "/" +
-                          model->data(imageIndex, ctkDICOMModel::UIDRole).toString() + ".png";
-  if(!QFileInfo(thumbnailPath).exists())
+                          "/thumbs/" + studyInstanceUID + "/" +
+                          seriesInstanceUID + "/" +
+                          sopInstanceUID + ".png";
+  bool thumbnailExists = false;
+  if(this->ThumbnailService)
     {
-    return;
+    // the service returns the thumbnail if it is up-to-date, otherwise it is generated
+    // in the background and the pixmap is set when it is ready
+    thumbnailPath = this->ThumbnailService->requestThumbnail(studyInstanceUID, seriesInstanceUID, sopInstanceUID);
+    thumbnailExists = !thumbnailPath.isEmpty();
+    if (!thumbnailExists && !this->ThumbnailService->isThumbnailPending(sopInstanceUID))
+      {
+      // request failed
+      return;
+      }
+    }
+  else
+    {
+    thumbnailExists = QFileInfo(thumbnailPath).exists();
+    if(!thumbnailExists)
+      {
+      return;
+      }
     }
   ctkThumbnailLabel* widget = new ctkThumbnailLabel(this->ScrollAreaContentWidget);
 
   QString widgetLabel = text;
   widget->setText( widgetLabel );
-  QPixmap pix(thumbnailPath);
-  logger.debug("Setting pixmap to " + thumbnailPath);
   if(this->ThumbnailSize.isValid())
     {
     widget->setFixedSize(this->ThumbnailSize);
     }
-  widget->setPixmap(pix);
+  if(thumbnailExists)
+    {
+    QPixmap pix(thumbnailPath);
+    logger.debug("Setting pixmap to " + thumbnailPath);
+    widget->setPixmap(pix);
+    }
+  else
+    {
+    this->PendingThumbnails[sopInstanceUID] = widget;
+    }
 
   QVariant var;
   var.setValue(QPersistentModelIndex(sourceIndex));
@@ -215,7 +249,11 @@ void ctkDICOMThumbnailListWidgetPrivate
 ctkDICOMThumbnailListWidget::ctkDICOMThumbnailListWidget(QWidget* _parent)
   : Superclass(new ctkDICOMThumbnailListWidgetPrivate(this), _parent)
 {
-
+  Q_D(ctkDICOMThumbnailListWidget);
+  connect(d->ScrollArea->verticalScrollBar(), SIGNAL(valueChanged(int)),
+    this, SLOT(updateThumbnailPriorities()));
+  connect(d->ScrollArea->horizontalScrollBar(), SIGNAL(valueChanged(int)),
+    this, SLOT(updateThumbnailPriorities()));
 }
 
 //----------------------------------------------------------------------------
@@ -231,6 +269,79 @@ void ctkDICOMThumbnailListWidget::setDatabaseDirectory(const QString &directory)
   d->DatabaseDirectory = directory;
 }
 
+//----------------------------------------------------------------------------
+void ctkDICOMThumbnailListWidget::setThumbnailService(ctkDICOMThumbnailService* service)
+{
+  Q_D(ctkDICOMThumbnailListWidget);
+  if (d->ThumbnailService)
+    {
+    disconnect(d->ThumbnailService, SIGNAL(thumbnailReady(QString,QString)),
+      this, SLOT(onThumbnailReady(QString,QString)));
+    disconnect(d->ThumbnailService, SIGNAL(thumbnailFailed(QString)),
+      this, SLOT(onThumbnailFailed(QString)));
+    }
+  d->ThumbnailService = service;
+  if (d->ThumbnailService)
+    {
+    connect(d->ThumbnailService, SIGNAL(thumbnailReady(QString,QString)),
+      this, SLOT(onThumbnailReady(QString,QString)));
+    connect(d->ThumbnailService, SIGNAL(thumbnailFailed(QString)),
+      this, SLOT(onThumbnailFailed(QString)));
+    }
+}
+
+//----------------------------------------------------------------------------
+ctkDICOMThumbnailService* ctkDICOMThumbnailListWidget::thumbnailService()const
+{
+  Q_D(const ctkDICOMThumbnailListWidget);
+  return d->ThumbnailService;
+}
+
+//----------------------------------------------------------------------------
+void ctkDICOMThumbnailListWidget::onThumbnailReady(const QString& sopInstanceUID, const QString& thumbnailPath)
+{
+  Q_D(ctkDICOMThumbnailListWidget);
+  QPointer<ctkThumbnailLabel> widget = d->PendingThumbnails.take(sopInstanceUID);
+  if (!widget)
+    {
+    return;
+    }
+  logger.debug("Setting pixmap to " + thumbnailPath);
+  widget->setPixmap(QPixmap(thumbnailPath));
+}
+
+//----------------------------------------------------------------------------
+void ctkDICOMThumbnailListWidget::onThumbnailFailed(const QString& sopInstanceUID)
+{
+  Q_D(ctkDICOMThumbnailListWidget);
+  // the widget keeps showing only its text
+  d->PendingThumbnails.remove(sopInstanceUID);
+}
+
+//----------------------------------------------------------------------------
+void ctkDICOMThumbnailListWidget::updateThumbnailPriorities()
+{
+  Q_D(ctkDICOMThumbnailListWidget);
+  if (!d->ThumbnailService)
+    {
+    return;
+    }
+  // thumbnails that are visible in the scroll area are generated first
+  QHash<QString, QPointer<ctkThumbnailLabel> >::iterator pendingIt = d->PendingThumbnails.begin();
+  while (pendingIt != d->PendingThumbnails.end())
+    {
+    if (!pendingIt.value())
+      {
+      // widget is already deleted, its thumbnail is no longer urgent
+      d->ThumbnailService->setThumbnailPriority(pendingIt.key(), -1);
+      pendingIt = d->PendingThumbnails.erase(pendingIt);
+      continue;
+      }
+    d->ThumbnailService->setThumbnailPriority(pendingIt.key(), pendingIt.value()->visibleRegion().isEmpty() ? 0 : 1);
+    ++pendingIt;
+    }
+}
+
 //----------------------------------------------------------------------------
 void ctkDICOMThumbnailListWidget::selectThumbnailFromIndex(const QModelIndex &index){
   Q_D(ctkDICOMThumbnailListWidget);
@@ -272,6 +383,8 @@ void ctkDICOMThumbnailListWidget::addThumbnails(const QModelIndex &index)
   Q_D(ctkDICOMThumbnailListWidget);
 
   this->clearThumbnails();
+  // thumbnails of the previous selection are still generated, but after the new ones
+  this->updateThumbnailPriorities();
 
   ctkDICOMModel* model = const_cast<ctkDICOMModel*>(qobject_cast<const ctkDICOMModel*>(index.model()));
 
@@ -296,4 +409,6 @@ void ctkDICOMThumbnailListWidget::addThumbnails(const QModelIndex &index)
     }
 
   this->setCurrentThumbnail(0);
+  // visibility of the new thumbnails is known after the layout is updated
+  QTimer::singleShot(0, this, SLOT(updateThumbnailPriorities()));
 }
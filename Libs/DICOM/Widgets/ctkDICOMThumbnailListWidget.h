@@ -26,6 +26,7 @@
 
 class QModelIndex;
 class ctkDICOMThumbnailListWidgetPrivate;
+class ctkDICOMThumbnailService;
 class ctkThumbnailWidget;
 
 /// \ingroup DICOM_Widgets
@@ -39,6 +40,12 @@ public:
 
   void setDatabaseDirectory(const QString& directory);
 
+  /// If a thumbnail service is set then missing thumbnails are generated in the
+  /// background (visible ones first) and shown when they are ready.
+  /// Otherwise only thumbnails that are already in the database directory are shown.
+  void setThumbnailService(ctkDICOMThumbnailService* service);
+  ctkDICOMThumbnailService* thumbnailService()const;
+
   void selectThumbnailFromIndex(const QModelIndex& index);
 
 private:
@@ -47,6 +54,12 @@ private:
 
 public Q_SLOTS:
   void addThumbnails(const QModelIndex& index);
+
+protected Q_SLOTS:
+  void onThumbnailReady(const QString& sopInstanceUID, const QString& thumbnailPath);
+  void onThumbnailFailed(const QString& sopInstanceUID);
+  /// Request thumbnails of visible widgets with higher priority
+  void updateThumbnailPriorities();
 };
 
 #endif
@@ -0,0 +1,580 @@
+/*=========================================================================
+
+  Library:   CTK
+
+  Copyright (c) Kitware Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0.txt
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+=========================================================================*/
+
+// Qt includes
+#include <QFileInfo>
+#include <QRunnable>
+
+// ctk includes
+#include "ctkLogger.h"
+
+// ctkDICOMCore includes
+#include "ctkDICOMModel.h"
+#include "ctkDICOMThumbnailService.h"
+
+// ctkDICOMWidgets includes
+#include "ctkDICOMThumbnailView.h"
+#include "ctkDICOMThumbnailView_p.h"
+
+static ctkLogger logger("org.commontk.DICOM.Widgets.ctkDICOMThumbnailView");
+
+static const int DEFAULT_PIXMAP_CACHE_SIZE = 1000;
+static const int DEFAULT_THUMBNAIL_SIZE = 128;
+
+//------------------------------------------------------------------------------
+// Reads a thumbnail image in a thread of the model's loader thread pool.
+// QPixmap can only be used in the main thread, therefore a QImage is passed back.
+class ctkDICOMThumbnailViewLoader : public QRunnable
+{
+public:
+  ctkDICOMThumbnailViewLoader(ctkDICOMThumbnailViewModel* model,
+    const QString& sopInstanceUID, const QString& thumbnailPath)
+    : Model(model)
+    , SOPInstanceUID(sopInstanceUID)
+    , ThumbnailPath(thumbnailPath)
+  {
+  }
+
+  virtual void run()
+  {
+    QImage image(this->ThumbnailPath);
+    QMetaObject::invokeMethod(this->Model, "onThumbnailLoaded", Qt::QueuedConnection,
+      Q_ARG(QString, this->SOPInstanceUID), Q_ARG(QImage, image));
+  }
+
+protected:
+  ctkDICOMThumbnailViewModel* Model;
+  QString SOPInstanceUID;
+  QString ThumbnailPath;
+};
+
+//------------------------------------------------------------------------------
+// ctkDICOMThumbnailViewModel methods
+
+//------------------------------------------------------------------------------
+ctkDICOMThumbnailViewModel::ctkDICOMThumbnailViewModel(QObject* parent)
+  : QAbstractListModel(parent)
+  , PixmapCache(DEFAULT_PIXMAP_CACHE_SIZE)
+  , RequestCounter(0)
+{
+  // reading small images is mostly limited by disk access
+  this->LoaderThreadPool.setMaxThreadCount(2);
+}
+
+//------------------------------------------------------------------------------
+ctkDICOMThumbnailViewModel::~ctkDICOMThumbnailViewModel()
+{
+  this->LoaderThreadPool.clear();
+  this->LoaderThreadPool.waitForDone();
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMThumbnailViewModel::rowCount(const QModelIndex& parent)const
+{
+  return parent.isValid() ? 0 : this->Items.size();
+}
+
+//------------------------------------------------------------------------------
+QVariant ctkDICOMThumbnailViewModel::data(const QModelIndex& index, int role)const
+{
+  if (!index.isValid() || index.row() >= this->Items.size())
+  {
+    return QVariant();
+  }
+  const ctkDICOMThumbnailViewItem& item = this->Items[index.row()];
+  if (role == Qt::DisplayRole || role == Qt::ToolTipRole)
+  {
+    return item.Text;
+  }
+  if (role == Qt::DecorationRole)
+  {
+    // The view only asks for the decoration of items that are painted,
+    // so only visible thumbnails are loaded.
+    QPixmap* pixmap = this->PixmapCache.object(item.SOPInstanceUID);
+    if (pixmap)
+    {
+      return *pixmap;
+    }
+    this->requestPixmap(index.row());
+  }
+  return QVariant();
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailViewModel::setItems(const QVector<ctkDICOMThumbnailViewItem>& items)
+{
+  this->beginResetModel();
+  // thumbnails of the previous items are not needed anymore
+  this->LoaderThreadPool.clear();
+  QSet<QString> pendingInstances;
+  pendingInstances.swap(this->PendingInstances);
+  foreach(const QString& sopInstanceUID, pendingInstances)
+  {
+    if (this->ThumbnailService && this->ThumbnailService->isThumbnailPending(sopInstanceUID))
+    {
+      // still generated (to fill the cache), but after the thumbnails of the new items
+      this->ThumbnailService->setThumbnailPriority(sopInstanceUID, -1);
+      this->PendingInstances.insert(sopInstanceUID);
+    }
+  }
+  this->Items = items;
+  this->RowForInstance.clear();
+  for (int row = 0; row < this->Items.size(); ++row)
+  {
+    this->RowForInstance[this->Items[row].SOPInstanceUID] = row;
+  }
+  this->endResetModel();
+}
+
+//------------------------------------------------------------------------------
+const QVector<ctkDICOMThumbnailViewItem>& ctkDICOMThumbnailViewModel::items()const
+{
+  return this->Items;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailViewModel::setThumbnailService(ctkDICOMThumbnailService* service)
+{
+  if (this->ThumbnailService)
+  {
+    disconnect(this->ThumbnailService, 0, this, 0);
+  }
+  this->ThumbnailService = service;
+  if (this->ThumbnailService)
+  {
+    connect(this->ThumbnailService, SIGNAL(thumbnailReady(QString,QString)),
+      this, SLOT(onThumbnailReady(QString,QString)));
+    connect(this->ThumbnailService, SIGNAL(thumbnailFailed(QString)),
+      this, SLOT(onThumbnailFailed(QString)));
+  }
+  this->FailedInstances.clear();
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailViewModel::requestPixmap(int row)const
+{
+  const ctkDICOMThumbnailViewItem& item = this->Items[row];
+  if (item.SOPInstanceUID.isEmpty() || this->FailedInstances.contains(item.SOPInstanceUID))
+  {
+    return;
+  }
+  if (this->PendingInstances.contains(item.SOPInstanceUID))
+  {
+    if (this->ThumbnailService)
+    {
+      // item is painted again, generate it before the ones that are scrolled out of view
+      this->ThumbnailService->setThumbnailPriority(item.SOPInstanceUID, ++this->RequestCounter);
+    }
+    return;
+  }
+  QString thumbnailPath;
+  if (this->ThumbnailService)
+  {
+    thumbnailPath = this->ThumbnailService->requestThumbnail(item.StudyInstanceUID, item.SeriesInstanceUID,
+      item.SOPInstanceUID, ++this->RequestCounter);
+    if (thumbnailPath.isEmpty())
+    {
+      if (this->ThumbnailService->isThumbnailPending(item.SOPInstanceUID))
+      {
+        this->PendingInstances.insert(item.SOPInstanceUID);
+      }
+      else
+      {
+        this->FailedInstances.insert(item.SOPInstanceUID);
+      }
+      return;
+    }
+  }
+  else
+  {
+    thumbnailPath = this->DatabaseDirectory + "/thumbs/" + item.StudyInstanceUID + "/"
+      + item.SeriesInstanceUID + "/" + item.SOPInstanceUID + ".png";
+    if (!QFileInfo(thumbnailPath).exists())
+    {
+      this->FailedInstances.insert(item.SOPInstanceUID);
+      return;
+    }
+  }
+  this->loadThumbnail(item.SOPInstanceUID, thumbnailPath);
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailViewModel::loadThumbnail(const QString& sopInstanceUID, const QString& thumbnailPath)const
+{
+  this->PendingInstances.insert(sopInstanceUID);
+  // const_cast is needed because loading is started from data()
+  this->LoaderThreadPool.start(new ctkDICOMThumbnailViewLoader(
+    const_cast<ctkDICOMThumbnailViewModel*>(this), sopInstanceUID, thumbnailPath));
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailViewModel::onThumbnailReady(const QString& sopInstanceUID, const QString& thumbnailPath)
+{
+  if (!this->RowForInstance.contains(sopInstanceUID))
+  {
+    this->PendingInstances.remove(sopInstanceUID);
+    return;
+  }
+  this->loadThumbnail(sopInstanceUID, thumbnailPath);
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailViewModel::onThumbnailFailed(const QString& sopInstanceUID)
+{
+  this->PendingInstances.remove(sopInstanceUID);
+  this->FailedInstances.insert(sopInstanceUID);
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailViewModel::onThumbnailLoaded(const QString& sopInstanceUID, const QImage& image)
+{
+  this->PendingInstances.remove(sopInstanceUID);
+  if (image.isNull())
+  {
+    logger.warn("Failed to load thumbnail of instance " + sopInstanceUID);
+    this->FailedInstances.insert(sopInstanceUID);
+    return;
+  }
+  this->PixmapCache.insert(sopInstanceUID, new QPixmap(QPixmap::fromImage(image)));
+  this->emitPixmapChanged(sopInstanceUID);
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailViewModel::emitPixmapChanged(const QString& sopInstanceUID)
+{
+  QHash<QString, int>::const_iterator rowIt = this->RowForInstance.find(sopInstanceUID);
+  if (rowIt == this->RowForInstance.end())
+  {
+    return;
+  }
+  QModelIndex changedIndex = this->index(rowIt.value());
+  emit dataChanged(changedIndex, changedIndex);
+}
+
+//------------------------------------------------------------------------------
+class ctkDICOMThumbnailViewPrivate
+{
+  Q_DECLARE_PUBLIC(ctkDICOMThumbnailView);
+
+protected:
+  ctkDICOMThumbnailView* const q_ptr;
+
+public:
+  ctkDICOMThumbnailViewPrivate(ctkDICOMThumbnailView& obj);
+
+  void init();
+  void addPatientThumbnails(const QModelIndex& patientIndex, QVector<ctkDICOMThumbnailViewItem>& items);
+  void addStudyThumbnails(const QModelIndex& studyIndex, QVector<ctkDICOMThumbnailViewItem>& items);
+  void addSeriesThumbnails(const QModelIndex& seriesIndex, QVector<ctkDICOMThumbnailViewItem>& items);
+  /// Add the item of an image, represented by sourceIndex (the image itself, or its series, study).
+  /// Nothing is added if the image index is invalid.
+  void addThumbnailItem(const QModelIndex& imageIndex, const QModelIndex& sourceIndex,
+    const QString& text, QVector<ctkDICOMThumbnailViewItem>& items);
+
+  ctkDICOMThumbnailViewModel ThumbnailModel;
+  QSize ThumbnailSize;
+};
+
+//------------------------------------------------------------------------------
+// ctkDICOMThumbnailViewPrivate methods
+
+//------------------------------------------------------------------------------
+ctkDICOMThumbnailViewPrivate::ctkDICOMThumbnailViewPrivate(ctkDICOMThumbnailView& obj)
+  : q_ptr(&obj)
+  , ThumbnailSize(DEFAULT_THUMBNAIL_SIZE, DEFAULT_THUMBNAIL_SIZE)
+{
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailViewPrivate::init()
+{
+  Q_Q(ctkDICOMThumbnailView);
+  q->setViewMode(QListView::IconMode);
+  q->setMovement(QListView::Static);
+  q->setResizeMode(QListView::Adjust);
+  q->setWrapping(true);
+  // all items have the same size, so the layout does not need to query each item
+  q->setUniformItemSizes(true);
+  q->setSelectionMode(QAbstractItemView::SingleSelection);
+  q->setEditTriggers(QAbstractItemView::NoEditTriggers);
+  q->setModel(&this->ThumbnailModel);
+  q->setThumbnailSize(this->ThumbnailSize);
+
+  QObject::connect(q, SIGNAL(clicked(QModelIndex)), q, SLOT(onClicked(QModelIndex)));
+  QObject::connect(q, SIGNAL(activated(QModelIndex)), q, SLOT(onClicked(QModelIndex)));
+  QObject::connect(q, SIGNAL(doubleClicked(QModelIndex)), q, SLOT(onDoubleClicked(QModelIndex)));
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailViewPrivate::addThumbnailItem(const QModelIndex& imageIndex,
+  const QModelIndex& sourceIndex, const QString& text, QVector<ctkDICOMThumbnailViewItem>& items)
+{
+  const QAbstractItemModel* model = imageIndex.model();
+  if (!model)
+  {
+    return;
+  }
+  QModelIndex seriesIndex = imageIndex.parent();
+  QModelIndex studyIndex = seriesIndex.parent();
+  ctkDICOMThumbnailViewItem item;
+  item.StudyInstanceUID = model->data(studyIndex, ctkDICOMModel::UIDRole).toString();
+  item.SeriesInstanceUID = model->data(seriesIndex, ctkDICOMModel::UIDRole).toString();
+  item.SOPInstanceUID = model->data(imageIndex, ctkDICOMModel::UIDRole).toString();
+  item.SourceIndex = sourceIndex;
+  item.Text = text;
+  items << item;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailViewPrivate::addPatientThumbnails(const QModelIndex& patientIndex,
+  QVector<ctkDICOMThumbnailViewItem>& items)
+{
+  ctkDICOMModel* model = const_cast<ctkDICOMModel*>(qobject_cast<const ctkDICOMModel*>(patientIndex.model()));
+  if (!model)
+  {
+    return;
+  }
+  model->fetchMore(patientIndex);
+  const int studyCount = model->rowCount(patientIndex);
+  for (int i = 0; i < studyCount; i++)
+  {
+    QModelIndex studyIndex = model->index(i, 0, patientIndex);
+    model->fetchMore(studyIndex);
+    if (model->rowCount(studyIndex) == 0)
+    {
+      continue;
+    }
+    QModelIndex seriesIndex = model->index(0, 0, studyIndex);
+    model->fetchMore(seriesIndex);
+    const int imageCount = model->rowCount(seriesIndex);
+    if (imageCount == 0)
+    {
+      continue;
+    }
+    QModelIndex imageIndex = model->index(imageCount / 2, 0, seriesIndex);
+    this->addThumbnailItem(imageIndex, studyIndex, model->data(studyIndex, Qt::DisplayRole).toString(), items);
+  }
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailViewPrivate::addStudyThumbnails(const QModelIndex& studyIndex,
+  QVector<ctkDICOMThumbnailViewItem>& items)
+{
+  ctkDICOMModel* model = const_cast<ctkDICOMModel*>(qobject_cast<const ctkDICOMModel*>(studyIndex.model()));
+  if (!model)
+  {
+    return;
+  }
+  model->fetchMore(studyIndex);
+  const int seriesCount = model->rowCount(studyIndex);
+  for (int i = 0; i < seriesCount; i++)
+  {
+    QModelIndex seriesIndex = model->index(i, 0, studyIndex);
+    model->fetchMore(seriesIndex);
+    const int imageCount = model->rowCount(seriesIndex);
+    if (imageCount == 0)
+    {
+      continue;
+    }
+    QModelIndex imageIndex = model->index(imageCount / 2, 0, seriesIndex);
+    this->addThumbnailItem(imageIndex, seriesIndex, model->data(seriesIndex, Qt::DisplayRole).toString(), items);
+  }
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailViewPrivate::addSeriesThumbnails(const QModelIndex& seriesIndex,
+  QVector<ctkDICOMThumbnailViewItem>& items)
+{
+  ctkDICOMModel* model = const_cast<ctkDICOMModel*>(qobject_cast<const ctkDICOMModel*>(seriesIndex.model()));
+  if (!model)
+  {
+    return;
+  }
+  model->fetchMore(seriesIndex);
+  const int imageCount = model->rowCount(seriesIndex);
+  logger.debug(QString("Thumbs: %1").arg(imageCount));
+  items.reserve(items.size() + imageCount);
+  for (int i = 0; i < imageCount; i++)
+  {
+    QModelIndex imageIndex = model->index(i, 0, seriesIndex);
+    this->addThumbnailItem(imageIndex, imageIndex, QString("Image %1").arg(i), items);
+  }
+}
+
+//------------------------------------------------------------------------------
+// ctkDICOMThumbnailView methods
+
+//------------------------------------------------------------------------------
+ctkDICOMThumbnailView::ctkDICOMThumbnailView(QWidget* parent)
+  : Superclass(parent)
+  , d_ptr(new ctkDICOMThumbnailViewPrivate(*this))
+{
+  Q_D(ctkDICOMThumbnailView);
+  d->init();
+}
+
+//------------------------------------------------------------------------------
+ctkDICOMThumbnailView::~ctkDICOMThumbnailView()
+{
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailView::setDatabaseDirectory(const QString& directory)
+{
+  Q_D(ctkDICOMThumbnailView);
+  d->ThumbnailModel.DatabaseDirectory = directory;
+}
+
+//------------------------------------------------------------------------------
+QString ctkDICOMThumbnailView::databaseDirectory()const
+{
+  Q_D(const ctkDICOMThumbnailView);
+  return d->ThumbnailModel.DatabaseDirectory;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailView::setThumbnailService(ctkDICOMThumbnailService* service)
+{
+  Q_D(ctkDICOMThumbnailView);
+  d->ThumbnailModel.setThumbnailService(service);
+}
+
+//------------------------------------------------------------------------------
+ctkDICOMThumbnailService* ctkDICOMThumbnailView::thumbnailService()const
+{
+  Q_D(const ctkDICOMThumbnailView);
+  return d->ThumbnailModel.ThumbnailService;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailView::setThumbnailSize(const QSize& size)
+{
+  Q_D(ctkDICOMThumbnailView);
+  d->ThumbnailSize = size;
+  this->setIconSize(size);
+  // leave room for the text below the thumbnail
+  this->setGridSize(QSize(size.width() + 8, size.height() + this->fontMetrics().height() + 8));
+}
+
+//------------------------------------------------------------------------------
+QSize ctkDICOMThumbnailView::thumbnailSize()const
+{
+  Q_D(const ctkDICOMThumbnailView);
+  return d->ThumbnailSize;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailView::setPixmapCacheSize(int count)
+{
+  Q_D(ctkDICOMThumbnailView);
+  d->ThumbnailModel.PixmapCache.setMaxCost(qMax(1, count));
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMThumbnailView::pixmapCacheSize()const
+{
+  Q_D(const ctkDICOMThumbnailView);
+  return d->ThumbnailModel.PixmapCache.maxCost();
+}
+
+//------------------------------------------------------------------------------
+int ctkDICOMThumbnailView::numberOfThumbnails()const
+{
+  Q_D(const ctkDICOMThumbnailView);
+  return d->ThumbnailModel.rowCount();
+}
+
+//------------------------------------------------------------------------------
+QModelIndex ctkDICOMThumbnailView::thumbnailSourceIndex(int row)const
+{
+  Q_D(const ctkDICOMThumbnailView);
+  if (row < 0 || row >= d->ThumbnailModel.items().size())
+  {
+    return QModelIndex();
+  }
+  return d->ThumbnailModel.items()[row].SourceIndex;
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailView::selectThumbnailFromIndex(const QModelIndex& sourceIndex)
+{
+  Q_D(ctkDICOMThumbnailView);
+  const QVector<ctkDICOMThumbnailViewItem>& items = d->ThumbnailModel.items();
+  for (int row = 0; row < items.size(); ++row)
+  {
+    if (items[row].SourceIndex == sourceIndex)
+    {
+      QModelIndex thumbnailIndex = d->ThumbnailModel.index(row);
+      this->setCurrentIndex(thumbnailIndex);
+      this->scrollTo(thumbnailIndex);
+      return;
+    }
+  }
+  this->clearSelection();
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailView::addThumbnails(const QModelIndex& index)
+{
+  Q_D(ctkDICOMThumbnailView);
+  QVector<ctkDICOMThumbnailViewItem> items;
+  const ctkDICOMModel* model = qobject_cast<const ctkDICOMModel*>(index.model());
+  if (model)
+  {
+    QModelIndex index0 = index.sibling(index.row(), 0);
+    int type = model->data(index0, ctkDICOMModel::TypeRole).toInt();
+    if (type == static_cast<int>(ctkDICOMModel::PatientType))
+    {
+      d->addPatientThumbnails(index0, items);
+    }
+    else if (type == static_cast<int>(ctkDICOMModel::StudyType))
+    {
+      d->addStudyThumbnails(index0, items);
+    }
+    else if (type == static_cast<int>(ctkDICOMModel::SeriesType))
+    {
+      d->addSeriesThumbnails(index0, items);
+    }
+  }
+  d->ThumbnailModel.setItems(items);
+  if (!items.isEmpty())
+  {
+    this->setCurrentIndex(d->ThumbnailModel.index(0));
+  }
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailView::clearThumbnails()
+{
+  Q_D(ctkDICOMThumbnailView);
+  d->ThumbnailModel.setItems(QVector<ctkDICOMThumbnailViewItem>());
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailView::onClicked(const QModelIndex& index)
+{
+  emit thumbnailSelected(this->thumbnailSourceIndex(index.row()));
+}
+
+//------------------------------------------------------------------------------
+void ctkDICOMThumbnailView::onDoubleClicked(const QModelIndex& index)
+{
+  emit thumbnailDoubleClicked(this->thumbnailSourceIndex(index.row()));
+}
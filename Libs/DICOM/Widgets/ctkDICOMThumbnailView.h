@@ -0,0 +1,103 @@
+/*=========================================================================
+
+  Library:   CTK
+
+  Copyright (c) Kitware Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0.txt
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+=========================================================================*/
+
+#ifndef __ctkDICOMThumbnailView_h
+#define __ctkDICOMThumbnailView_h
+
+// Qt includes
+#include <QListView>
+
+#include "ctkDICOMWidgetsExport.h"
+
+class ctkDICOMThumbnailService;
+class ctkDICOMThumbnailViewPrivate;
+
+/// \ingroup DICOM_Widgets
+///
+/// \brief Thumbnail list of the images of a patient, study, or series of a ctkDICOMModel
+///
+/// Unlike ctkDICOMThumbnailListWidget, which creates a widget and loads a pixmap for
+/// each thumbnail, this view only paints the thumbnails that are visible, therefore
+/// it remains responsive for series with thousands of images.
+/// Pixmaps are loaded in background threads when their item is first painted, and a
+/// limited number of them is kept in memory. Missing thumbnails are generated by the
+/// thumbnail service (if set), items that were painted most recently first.
+///
+class CTK_DICOM_WIDGETS_EXPORT ctkDICOMThumbnailView : public QListView
+{
+  Q_OBJECT
+  Q_PROPERTY(QSize thumbnailSize READ thumbnailSize WRITE setThumbnailSize)
+  Q_PROPERTY(int pixmapCacheSize READ pixmapCacheSize WRITE setPixmapCacheSize)
+
+public:
+  typedef QListView Superclass;
+  explicit ctkDICOMThumbnailView(QWidget* parent = 0);
+  virtual ~ctkDICOMThumbnailView();
+
+  /// Folder of the database, thumbnails are read from its "thumbs" subfolder.
+  /// Not used if a thumbnail service is set.
+  void setDatabaseDirectory(const QString& directory);
+  QString databaseDirectory()const;
+
+  /// Service that generates missing thumbnails in the background.
+  /// If not set then only thumbnails that are already in the database directory are shown.
+  void setThumbnailService(ctkDICOMThumbnailService* service);
+  ctkDICOMThumbnailService* thumbnailService()const;
+
+  /// Size of the thumbnails. Default is 128 x 128.
+  void setThumbnailSize(const QSize& size);
+  QSize thumbnailSize()const;
+
+  /// Maximum number of thumbnail pixmaps kept in memory. Default is 1000.
+  void setPixmapCacheSize(int count);
+  int pixmapCacheSize()const;
+
+  /// Number of thumbnails in the list
+  int numberOfThumbnails()const;
+  /// Index in the ctkDICOMModel that the thumbnail in the given row represents
+  QModelIndex thumbnailSourceIndex(int row)const;
+
+  /// Select the thumbnail that represents the index of the ctkDICOMModel
+  void selectThumbnailFromIndex(const QModelIndex& sourceIndex);
+
+public Q_SLOTS:
+  /// Show thumbnails of the studies of a patient, the series of a study,
+  /// or the images of a series.
+  void addThumbnails(const QModelIndex& index);
+  void clearThumbnails();
+
+Q_SIGNALS:
+  /// Emitted with the index of the ctkDICOMModel that the thumbnail represents
+  void thumbnailSelected(const QModelIndex& sourceIndex);
+  void thumbnailDoubleClicked(const QModelIndex& sourceIndex);
+
+protected Q_SLOTS:
+  void onClicked(const QModelIndex& index);
+  void onDoubleClicked(const QModelIndex& index);
+
+protected:
+  QScopedPointer<ctkDICOMThumbnailViewPrivate> d_ptr;
+
+private:
+  Q_DECLARE_PRIVATE(ctkDICOMThumbnailView);
+  Q_DISABLE_COPY(ctkDICOMThumbnailView);
+};
+
+#endif
@@ -0,0 +1,95 @@
+/*=========================================================================
+
+  Library:   CTK
+
+  Copyright (c) Kitware Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+      http://www.apache.org/licenses/LICENSE-2.0.txt
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+=========================================================================*/
+
+#ifndef __ctkDICOMThumbnailView_p_h
+#define __ctkDICOMThumbnailView_p_h
+
+// Qt includes
+#include <QAbstractListModel>
+#include <QCache>
+#include <QHash>
+#include <QImage>
+#include <QPersistentModelIndex>
+#include <QPixmap>
+#include <QPointer>
+#include <QSet>
+#include <QThreadPool>
+#include <QVector>
+
+class ctkDICOMThumbnailService;
+
+//------------------------------------------------------------------------------
+struct ctkDICOMThumbnailViewItem
+{
+  QString StudyInstanceUID;
+  QString SeriesInstanceUID;
+  QString SOPInstanceUID;
+  QString Text;
+  /// Index in the ctkDICOMModel that the thumbnail represents
+  QPersistentModelIndex SourceIndex;
+};
+
+//------------------------------------------------------------------------------
+/// \ingroup DICOM_Widgets
+/// Model of ctkDICOMThumbnailView. Pixmaps are loaded when the view first asks for them.
+class ctkDICOMThumbnailViewModel : public QAbstractListModel
+{
+  Q_OBJECT
+
+public:
+  explicit ctkDICOMThumbnailViewModel(QObject* parent = 0);
+  virtual ~ctkDICOMThumbnailViewModel();
+
+  virtual int rowCount(const QModelIndex& parent = QModelIndex())const;
+  virtual QVariant data(const QModelIndex& index, int role = Qt::DisplayRole)const;
+
+  void setItems(const QVector<ctkDICOMThumbnailViewItem>& items);
+  const QVector<ctkDICOMThumbnailViewItem>& items()const;
+
+  void setThumbnailService(ctkDICOMThumbnailService* service);
+
+  QString DatabaseDirectory;
+  QPointer<ctkDICOMThumbnailService> ThumbnailService;
+  mutable QCache<QString, QPixmap> PixmapCache;
+
+protected Q_SLOTS:
+  void onThumbnailReady(const QString& sopInstanceUID, const QString& thumbnailPath);
+  void onThumbnailFailed(const QString& sopInstanceUID);
+  /// Called (in the main thread) when a thumbnail image is read in a loader thread
+  void onThumbnailLoaded(const QString& sopInstanceUID, const QImage& image);
+
+protected:
+  /// Start loading (or generating) the pixmap of an item
+  void requestPixmap(int row)const;
+  void loadThumbnail(const QString& sopInstanceUID, const QString& thumbnailPath)const;
+  void emitPixmapChanged(const QString& sopInstanceUID);
+
+  QVector<ctkDICOMThumbnailViewItem> Items;
+  QHash<QString, int> RowForInstance;
+  /// Instances whose pixmap is being loaded or generated
+  mutable QSet<QString> PendingInstances;
+  /// Instances without thumbnail, they are not requested again
+  mutable QSet<QString> FailedInstances;
+  /// Most recently painted items get the highest priority in the thumbnail service
+  mutable int RequestCounter;
+  mutable QThreadPool LoaderThreadPool;
+};
+
+#endif